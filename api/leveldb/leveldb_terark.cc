@@ -31,6 +31,7 @@
 #include <stdint.h>
 #include <terark/stdtypes.hpp>
 #include <terark/num_to_str.hpp>
+#include <terark/terichdb/record_cache.hpp>
 
 //using namespace terark;
 using terark::string_appender;
@@ -282,6 +283,12 @@ DB::Open(const Options &options, const std::string &name, leveldb::DB** dbptr) {
 		fprintf(stderr, "ERROR: not exists: %s\n", metaPath.string().c_str());
 		return Status::InvalidArgument("dbmeta.json is missing", dbdir.string());
 	}
+	if (auto cache = dynamic_cast<CacheImpl*>(options.block_cache)) {
+		// decompressed records are cached by the process wide RecordCache,
+		// shared by all opened DBs, so it is just grown to the largest
+		// block_cache, opening a DB never evicts records of other DBs
+		terark::terichdb::RecordCache::instance().growCapacity(cache->capacity_);
+	}
 	try {
 		*dbptr = new DbImpl(dbdir);
 		return Status::OK();
@@ -296,11 +303,150 @@ DB::Open(const Options &options, const std::string &name, leveldb::DB** dbptr) {
 
 DbImpl::DbImpl(const fs::path& dbdir) {
 	m_tab = terark::terichdb::DbTable::open(dbdir);
+	m_snapshotNum = 0;
+	m_snapshotSeq = 0;
+	m_snapshotImageBytes = 0;
+	m_snapshotMaxImageBytes = (size_t)terark::getEnvLong(
+		"TerarkLevelDB_snapshotMaxImageBytes", 256L << 20);
+	m_spillSize = 0;
+	m_spillPath = dbdir / "snapshot-images.spill";
+	fs::remove(m_spillPath); // left by a crash
 }
 
 DbImpl::~DbImpl() {
   // m_tab destruct must after m_ctx destruct
   BOOST_STATIC_ASSERT(offsetof(DbImpl, m_tab) < offsetof(DbImpl, m_ctx));
+  for (SnapshotImpl* si : m_snapshots) {
+	fprintf(stderr, "WARN: %s: snapshot was not released\n", BOOST_CURRENT_FUNCTION);
+	delete si;
+  }
+  RemoveSpillNoLock();
+}
+
+static bool
+getValueOfKey(terark::terichdb::DbContext* ctx, const Slice& key,
+			  terark::valvec<unsigned char>* val) {
+  ctx->indexSearchExact(0, key, &ctx->exactMatchRecIdvec);
+  if (!ctx->exactMatchRecIdvec.empty()) {
+	  auto recId = ctx->exactMatchRecIdvec[0];
+	  try {
+		  ctx->selectOneColgroup(recId, 1, val);
+		  return true;
+	  }
+	  catch (const std::exception&) {
+	  }
+  }
+  return false;
+}
+
+void DbImpl::SaveBeforeImage(const Slice& key) {
+  if (0 == m_snapshotNum) {
+	  return;
+  }
+  terark::terichdb::DbContext* ctx = GetDbContext();
+  auto userBuf = ctx->bufs.get();
+  bool exists = getValueOfKey(ctx, key, userBuf.get());
+  SaveBeforeImage(key, exists, Slice((char*)userBuf->data(), userBuf->size()));
+}
+
+void DbImpl::SaveBeforeImage(const Slice& key, bool exists, const Slice& value) {
+  if (0 == m_snapshotNum) {
+	  return;
+  }
+  SnapshotImpl::BeforeImagePtr image(new SnapshotImpl::BeforeImage());
+  image->exists = exists;
+  if (exists) {
+	  image->value.assign(value.data(), value.size());
+  }
+  std::string strKey = key.ToString();
+  // approximate, the map node is in each snapshot, the value is shared
+  size_t nodeBytes = strKey.size() + 64;
+  std::lock_guard<std::mutex> lock(m_snapshotMutex);
+  size_t shared = 0;
+  for (SnapshotImpl* si : m_snapshots) {
+	  // keep the first before image
+	  if (si->images_.emplace(strKey, image).second) {
+		  si->imageBytes_ += nodeBytes;
+		  shared++;
+	  }
+  }
+  if (shared) {
+	  m_snapshotImageBytes += nodeBytes * shared;
+	  if (m_snapshotImageBytes + image->value.size() > m_snapshotMaxImageBytes
+		  && !image->value.empty()) {
+		  SpillImageNoLock(image.get());
+	  }
+	  m_snapshotImageBytes += image->value.size();
+  }
+  image.reset(); // refcount is the num of snapshots which share it
+}
+
+void DbImpl::SetSnapshotMaxImageBytes(size_t bytes) {
+  std::lock_guard<std::mutex> lock(m_snapshotMutex);
+  m_snapshotMaxImageBytes = bytes; // images in memory are not spilled
+}
+
+// move image->value to the spill file, on error it is kept in memory
+void DbImpl::SpillImageNoLock(SnapshotImpl::BeforeImage* image) {
+  try {
+	  if (!m_spill.isOpen()) {
+		  m_spill.open(m_spillPath.string(), "wb+");
+		  m_spillSize = 0;
+	  }
+	  m_spill.seek(m_spillSize);
+	  m_spill.ensureWrite(image->value.data(), image->value.size());
+  }
+  catch (const std::exception& ex) {
+	  fprintf(stderr
+		  , "WARN: %s: spill snapshot before image to %s failed: %s\n"
+		  , BOOST_CURRENT_FUNCTION, m_spillPath.string().c_str(), ex.what());
+	  return;
+  }
+  image->spillPos = m_spillSize;
+  image->spillLen = image->value.size();
+  m_spillSize += image->value.size();
+  std::string().swap(image->value);
+}
+
+Status
+DbImpl::ReadImageNoLock(const SnapshotImpl::BeforeImage& image, std::string* value) {
+  if (image.spillPos < 0) {
+	  *value = image.value;
+	  return Status::OK();
+  }
+  try {
+	  value->resize(image.spillLen);
+	  m_spill.seek(image.spillPos);
+	  m_spill.ensureRead(&(*value)[0], image.spillLen);
+  }
+  catch (const std::exception& ex) {
+	  value->clear();
+	  return Status::IOError("read snapshot spill file failed", ex.what());
+  }
+  return Status::OK();
+}
+
+// spilled values are not reclaimed until no snapshot is alive
+void DbImpl::RemoveSpillNoLock() {
+  if (m_spill.isOpen()) {
+	  m_spill.close();
+	  m_spillSize = 0;
+	  boost::system::error_code ec;
+	  fs::remove(m_spillPath, ec);
+  }
+}
+
+// values referenced only by si are freed with it
+///@returns freed bytes
+size_t DbImpl::FreeImagesNoLock(SnapshotImpl* si) {
+  size_t bytes = si->imageBytes_;
+  for (auto& kv : si->images_) {
+	  if (kv.second->get_refcount() == 1)
+		  bytes += kv.second->value.size();
+  }
+  si->imageBytes_ = 0;
+  SnapshotImpl::ImageMap().swap(si->images_);
+  return bytes;
 }
 
 static void
@@ -320,8 +466,10 @@ Status
 DbImpl::Put(const WriteOptions& options, const Slice& key, const Slice& value) {
   terark::terichdb::DbContext* ctx = GetDbContext();
   assert(NULL != ctx);
-  auto userBuf = ctx->bufs.get();
+  terark::terichdb::MyRwLock snapshotLock(m_snapshotRwMutex, false);
   try {
+	  SaveBeforeImage(key);
+	  auto userBuf = ctx->bufs.get();
 	  TRACE_KEY_VAL(key, value);
 	  encodeKeyVal(*userBuf, key, value);
 	  long long recId = ctx->upsertRow(*userBuf);
@@ -342,6 +490,8 @@ DbImpl::Delete(const WriteOptions& options, const Slice& key)
 {
   terark::terichdb::DbContext* ctx = GetDbContext();
   assert(NULL != ctx);
+  terark::terichdb::MyRwLock snapshotLock(m_snapshotRwMutex, false);
+  SaveBeforeImage(key);
   ctx->indexSearchExact(0, key, &ctx->exactMatchRecIdvec);
   if (!ctx->exactMatchRecIdvec.empty()) {
 	  auto recId = ctx->exactMatchRecIdvec[0];
@@ -355,13 +505,73 @@ DbImpl::Delete(const WriteOptions& options, const Slice& key)
   return Status::OK();
 }
 
+void OperationContext::FlushPuts() {
+	size_t rowNum = m_putRows.size();
+	if (0 == rowNum) {
+		return;
+	}
+	terark::valvec<terark::fstring> rows(rowNum, terark::valvec_no_init());
+	for (size_t i = 0; i < rowNum; ++i) {
+		rows[i] = terark::fstring(m_putRows[i]);
+	}
+	terark::valvec<long long> recIdvec(rowNum, terark::valvec_no_init());
+	size_t okNum = m_ctx->insertRows(rows.data(), rowNum, recIdvec.data());
+	if (okNum < rowNum) {
+		// key existed or duplicated in this batch, overwrite in input order
+		for (size_t i = 0; i < rowNum; ++i) {
+			if (recIdvec[i] < 0) {
+				long long recId = m_ctx->upsertRow(rows[i]);
+				TERARK_RT_assert(recId >= 0, std::logic_error);
+			}
+		}
+	}
+	m_putRows.erase_all();
+}
+
+// the snapshot set does not change during the batch, Write holds the read
+// lock of m_snapshotRwMutex, so before images of a key written again by
+// the batch have been saved by its first write
+void OperationContext::SaveUndoImage(const Slice& key) {
+	std::string strKey = key.ToString();
+	if (m_undo.count(strKey)) {
+		return;
+	}
+	auto userBuf = m_ctx->bufs.get();
+	UndoImage& image = m_undo[strKey];
+	image.exists = getValueOfKey(m_ctx, key, userBuf.get());
+	if (image.exists) {
+		image.value.assign((char*)userBuf->data(), userBuf->size());
+	}
+	m_db->SaveBeforeImage(key, image.exists, Slice(image.value));
+}
+
+void OperationContext::Rollback() {
+	m_putRows.erase_all();
+	auto userBuf = m_ctx->bufs.get();
+	for (auto& kv : m_undo) {
+		const Slice key(kv.first);
+		if (kv.second.exists) {
+			encodeKeyVal(*userBuf, key, kv.second.value);
+			long long recId = m_ctx->upsertRow(*userBuf);
+			TERARK_RT_assert(recId >= 0, std::logic_error);
+		}
+		else {
+			m_ctx->indexSearchExact(0, key, &m_ctx->exactMatchRecIdvec);
+			if (!m_ctx->exactMatchRecIdvec.empty())
+				m_ctx->removeRow(m_ctx->exactMatchRecIdvec[0]);
+		}
+	}
+	m_undo.clear();
+}
+
 void
 WriteBatchHandler::Put(const Slice& key, const Slice& value) {
 	auto opctx = context_;
-	terark::terichdb::DbContext* ctx = opctx->m_batchWriter.getCtx();
+	terark::terichdb::DbContext* ctx = opctx->m_ctx;
+	opctx->SaveUndoImage(key);
     auto userBuf = ctx->bufs.get();
 	encodeKeyVal(*userBuf, key, value);
-	opctx->m_batchWriter.upsertRow(*userBuf);
+	opctx->m_putRows.push_back(terark::fstring(*userBuf));
 }
 
 static const long g_logBatchRemoveNotFound =
@@ -369,11 +579,13 @@ static const long g_logBatchRemoveNotFound =
 
 void WriteBatchHandler::Delete(const Slice& key) {
 	auto opctx = context_;
-	terark::terichdb::DbContext* ctx = opctx->m_batchWriter.getCtx();
+	terark::terichdb::DbContext* ctx = opctx->m_ctx;
+	opctx->FlushPuts(); // keep the order of puts and deletes
+	opctx->SaveUndoImage(key);
 	ctx->indexSearchExact(0, key, &ctx->exactMatchRecIdvec);
 	if (!ctx->exactMatchRecIdvec.empty()){
 		long long recId = ctx->exactMatchRecIdvec[0];
-		opctx->m_batchWriter.removeRow(recId);
+		ctx->removeRow(recId);
 	}
 	else {
 		opctx->m_removeNotFound++;
@@ -390,28 +602,31 @@ DbImpl::Write(const WriteOptions& options, WriteBatch* updates) {
   Status status = Status::OK();
   std::unique_ptr<OperationContext> context(GetContext());
   WriteBatchHandler handler(context.get());
-#if 0
-  status = updates->Iterate(&handler);
-#else
+  terark::terichdb::MyRwLock snapshotLock(m_snapshotRwMutex, false);
   try {
     status = updates->Iterate(&handler);
-  } catch(...) {
-    context->m_batchWriter.rollback();
-    throw;
+    if (status.ok())
+      context->FlushPuts();
   }
-#endif
-  if (context->m_batchWriter.commit()) {
-    if (g_logBatchRemoveNotFound >= 1 && context->m_removeNotFound) {
-      fprintf(stderr, "ERROR: DB BatchWrite success, but removeNotFound = %zd", context->m_removeNotFound);
-	}
-	return status;
+  catch (const std::exception& ex) {
+    status = Status::IOError("DB BatchWrite failed", ex.what());
   }
-  else {
-    if (g_logBatchRemoveNotFound >= 1 && context->m_removeNotFound) {
-     fprintf(stderr, "ERROR: DB BatchWrite failed, and removeNotFound = %zd", context->m_removeNotFound);
-	}
-	return Status::InvalidArgument("Commit BatchWriter failed", context->m_batchWriter.strError());
+  if (!status.ok()) {
+    // puts and deletes before the failure have been applied, undo them
+    try {
+      context->Rollback();
+    }
+    catch (const std::exception& ex) {
+      fprintf(stderr, "ERROR: DB BatchWrite rollback failed: %s, batch error: %s\n"
+          , ex.what(), status.ToString().c_str());
+      return Status::Corruption("DB BatchWrite rollback failed", ex.what());
+    }
+    return status;
   }
+  if (g_logBatchRemoveNotFound >= 1 && context->m_removeNotFound) {
+    fprintf(stderr, "ERROR: DB BatchWrite, removeNotFound = %zd", context->m_removeNotFound);
+  }
+  return status;
 }
 
 // If the database contains an entry for "key" store the
@@ -426,24 +641,93 @@ DbImpl::Get(const ReadOptions& options, const Slice& key, std::string* value) {
   terark::terichdb::DbContext* ctx = GetDbContext();
   assert(NULL != ctx);
   auto userBuf = ctx->bufs.get();
-  ctx->indexSearchExact(0, key, &ctx->exactMatchRecIdvec);
-  if (!ctx->exactMatchRecIdvec.empty()) {
-	  auto recId = ctx->exactMatchRecIdvec[0];
-	  try {
-		  ctx->selectOneColgroup(recId, 1, userBuf.get());
-	//	  fprintf(stderr
-	//		, "DEBUG: recId=%lld, colgroup[1]={size=%zd, content=%.*s}\n"
-	//		, recId, ctx->userBuf.size(), (int)ctx->userBuf.size(), ctx->userBuf.data());
-		  value->resize(0);
-		  value->append((char*)userBuf->data(), userBuf->size());
-		  return Status::OK();
-	  }
-	  catch (const std::exception&) {
+  // read the table before checking before images: if the key has no
+  // before image now, it was not written after the snapshot when read
+  bool found = getValueOfKey(ctx, key, userBuf.get());
+  if (options.snapshot) {
+	  auto si = static_cast<const SnapshotImpl*>(options.snapshot);
+	  std::lock_guard<std::mutex> lock(m_snapshotMutex);
+	  auto iter = si->images_.find(key.ToString());
+	  if (si->images_.end() != iter) {
+		  if (!iter->second->exists) {
+			  return Status::NotFound(key);
+		  }
+		  return ReadImageNoLock(*iter->second, value);
 	  }
   }
+  if (found) {
+	  value->resize(0);
+	  value->append((char*)userBuf->data(), userBuf->size());
+	  return Status::OK();
+  }
   return Status::NotFound(key);
 }
 
+// keys are sorted and each segment's index is probed once for the batch,
+// then values are fetched grouped by segment
+std::vector<Status>
+DbImpl::MultiGet(const ReadOptions& options, const std::vector<Slice>& keys,
+				 std::vector<std::string>* values)
+{
+  const size_t n = keys.size();
+  std::vector<Status> ret(n);
+  values->resize(n);
+  terark::terichdb::DbContext* ctx = GetDbContext();
+  assert(NULL != ctx);
+  terark::valvec<terark::fstring> fkeys(n, terark::valvec_no_init());
+  for (size_t i = 0; i < n; ++i) {
+	  fkeys[i] = terark::fstring(keys[i].data(), keys[i].size());
+  }
+  terark::valvec<terark::valvec<long long> > recIdvecs(n);
+  ctx->indexSearchExactMulti(0, fkeys.data(), n, recIdvecs.data());
+  terark::valvec<long long> ids(n, terark::valvec_no_init());
+  for (size_t i = 0; i < n; ++i) {
+	  ids[i] = recIdvecs[i].empty() ? -1 : recIdvecs[i][0];
+  }
+  terark::valvec<terark::valvec<unsigned char> > vals(n);
+  try {
+	  ctx->selectOneColgroupMulti(ids.data(), n, 1, vals.data());
+  }
+  catch (const std::exception&) {
+	  // some records were removed concurrently, fetch one by one
+	  for (size_t i = 0; i < n; ++i) {
+		  if (ids[i] < 0)
+			  continue;
+		  try {
+			  ctx->selectOneColgroup(ids[i], 1, &vals[i]);
+		  }
+		  catch (const std::exception&) {
+			  ids[i] = -1;
+		  }
+	  }
+  }
+  for (size_t i = 0; i < n; ++i) {
+	  if (ids[i] >= 0) {
+		  (*values)[i].assign((char*)vals[i].data(), vals[i].size());
+		  ret[i] = Status::OK();
+	  } else {
+		  (*values)[i].clear();
+		  ret[i] = Status::NotFound(keys[i]);
+	  }
+  }
+  if (options.snapshot) {
+	  auto si = static_cast<const SnapshotImpl*>(options.snapshot);
+	  std::lock_guard<std::mutex> lock(m_snapshotMutex);
+	  for (size_t i = 0; i < n && !si->images_.empty(); ++i) {
+		  auto iter = si->images_.find(keys[i].ToString());
+		  if (si->images_.end() == iter)
+			  continue;
+		  if (iter->second->exists) {
+			  ret[i] = ReadImageNoLock(*iter->second, &(*values)[i]);
+		  } else {
+			  (*values)[i].clear();
+			  ret[i] = Status::NotFound(keys[i]);
+		  }
+	  }
+  }
+  return ret;
+}
+
 #if HAVE_BASHOLEVELDB
 // If the database contains an entry for "key" store the
 // corresponding value in *value and return OK.
@@ -484,21 +768,25 @@ err:
 // The returned iterator should be deleted before this db is deleted.
 Iterator*
 DbImpl::NewIterator(const ReadOptions& options) {
+	if (options.snapshot) {
+		auto si = static_cast<const SnapshotImpl*>(options.snapshot);
+		return new SnapshotIteratorImpl(this, si);
+	}
 	return new IteratorImpl(m_tab.get());
 }
 
-SnapshotImpl::SnapshotImpl(DbImpl *db) :
-    Snapshot(), db_(db), context_(db->NewContext()), status_(Status::OK())
-{
-}
-
 // Return a handle to the current DB state.  Iterators created with
 // this handle will all observe a stable snapshot of the current DB
 // state.  The caller must call ReleaseSnapshot(result) when the
 // snapshot is no longer needed.
 const Snapshot* DbImpl::GetSnapshot() {
-  THROW_STD(invalid_argument, "terichdb-leveldb-api doesn't support snapshot");
-  return NULL;
+  // wait for inflight writes, they don't save before images for this one
+  terark::terichdb::MyRwLock snapshotLock(m_snapshotRwMutex, true);
+  std::lock_guard<std::mutex> lock(m_snapshotMutex);
+  SnapshotImpl* si = new SnapshotImpl(this, ++m_snapshotSeq);
+  m_snapshots.insert(si);
+  m_snapshotNum++;
+  return si;
 }
 
 // Release a previously acquired snapshot.  The caller must not
@@ -506,15 +794,18 @@ const Snapshot* DbImpl::GetSnapshot() {
 void
 DbImpl::ReleaseSnapshot(const Snapshot* snapshot)
 {
-  THROW_STD(invalid_argument, "terichdb-leveldb-api doesn't support snapshot");
   SnapshotImpl *si =
     static_cast<SnapshotImpl*>(const_cast<Snapshot*>(snapshot));
   if (si != NULL) {
-    // We started a transaction: we could commit it here, but it will be rolled
-    // back automatically by closing the session, which we have to do anyway.
-    int ret = si->GetContext()->Close();
-    TERARK_RT_assert(ret == 0, std::logic_error);
+    std::lock_guard<std::mutex> lock(m_snapshotMutex);
+    size_t erased = m_snapshots.erase(si);
+    TERARK_RT_assert(1 == erased, std::invalid_argument);
+    m_snapshotNum--;
+    m_snapshotImageBytes -= FreeImagesNoLock(si);
     delete si;
+    if (m_snapshots.empty()) {
+      RemoveSpillNoLock();
+    }
   }
 }
 
@@ -550,11 +841,11 @@ DbImpl::GetProperty(const Slice& property, std::string* value)
 void
 DbImpl::GetApproximateSizes(const Range* range, int n, uint64_t* sizes)
 {
-  int i;
-
-  /* XXX Not supported */
-  for (i = 0; i < n; i++)
-    sizes[i] = 1;
+  for (int i = 0; i < n; i++) {
+    terark::fstring start(range[i].start.data(), range[i].start.size());
+    terark::fstring limit(range[i].limit.data(), range[i].limit.size());
+    sizes[i] = m_tab->approxRangeSize(0, start, limit);
+  }
 }
 
 // Compact the underlying storage for the key range [*begin,*end].
@@ -570,10 +861,15 @@ DbImpl::GetApproximateSizes(const Range* range, int n, uint64_t* sizes)
 void
 DbImpl::CompactRange(const Slice* begin, const Slice* end)
 {
-  // The compact doesn't need a cursor, but the context always opens a
-  // cursor when opening the session - so grab that, and use the session.
   fprintf(stderr, "INFO: %s\n", BOOST_CURRENT_FUNCTION);
-  m_tab->compact();
+  if (NULL == begin && NULL == end) {
+    m_tab->compact(); // also converts writable segments
+    return;
+  }
+  terark::fstring lo, hi;
+  if (begin) lo = terark::fstring(begin->data(), begin->size());
+  if (end) hi = terark::fstring(end->data(), end->size());
+  m_tab->compactRange(0, begin ? &lo : NULL, end ? &hi : NULL);
 }
 
 // Suspends the background compaction thread.  This methods
@@ -590,20 +886,12 @@ void DbImpl::ResumeCompactions()
 }
 
 OperationContext* DbImpl::GetContext() {
-	return new OperationContext(m_tab.get(), GetDbContext());
+	return new OperationContext(this, m_tab.get(), GetDbContext());
 }
 
+// snapshot reads are handled by Get and SnapshotIteratorImpl
 OperationContext* DbImpl::GetContext(const ReadOptions &options) {
-  if (options.snapshot == NULL) {
-    return GetContext();
-  }
-  THROW_STD(invalid_argument,
-    "terichdb-leveldb-api doesn't support snapshot, "
-    "ReadOptions.snapshot should alsway be NULL"
-    );
-  auto si = static_cast<const SnapshotImpl*>(options.snapshot);
-  assert(si->GetStatus().ok());
-  return si->GetContext();
+  return GetContext();
 }
 
 terark::terichdb::DbContext* DbImpl::GetDbContext() {
@@ -787,3 +1075,165 @@ IteratorImpl::Prev() {
 	}
 }
 
+
+SnapshotIteratorImpl::SnapshotIteratorImpl(DbImpl *db, const SnapshotImpl *snap)
+  : m_db(db), m_snap(snap), m_base(new IteratorImpl(db->m_tab.get())) {
+	m_valid = false;
+	m_forward = true;
+}
+
+SnapshotIteratorImpl::~SnapshotIteratorImpl() {
+}
+
+// IteratorImpl::Seek depends on its current direction, SeekTo{First,Last}
+// set the direction
+void SnapshotIteratorImpl::PositionBaseForward(const Slice& bound) {
+	m_base->SeekToFirst();
+	if (m_base->Valid() && m_base->key().compare(bound) < 0) {
+		m_base->Seek(bound);
+	}
+}
+
+void SnapshotIteratorImpl::PositionBaseBackward(const Slice& bound) {
+	m_base->SeekToLast();
+	if (m_base->Valid() && m_base->key().compare(bound) > 0) {
+		m_base->Seek(bound);
+	}
+}
+
+// a failed read of spilled value stops the iteration with m_status
+void SnapshotIteratorImpl::SetImageValue(const SnapshotImpl::BeforeImage& image) {
+	m_status = m_db->ReadImageNoLock(image, &m_val);
+	m_valid = m_status.ok();
+}
+
+void SnapshotIteratorImpl::FindForward(const std::string& bound, bool inclusive) {
+	auto& images = m_snap->images_;
+	for (;;) {
+		while (m_base->Valid()) {
+			int cmp = m_base->key().compare(bound);
+			if (cmp > 0 || (inclusive && 0 == cmp))
+				break;
+			m_base->Next();
+		}
+		std::unique_lock<std::mutex> lock(m_db->m_snapshotMutex);
+		auto iter = inclusive ? images.lower_bound(bound) : images.upper_bound(bound);
+		while (images.end() != iter && !iter->second->exists)
+			++iter;
+		if (m_base->Valid()) {
+			Slice kb = m_base->key();
+			auto ib = images.find(kb.ToString());
+			if (images.end() != ib && !ib->second->exists) {
+				lock.unlock();
+				m_base->Next(); // kb did not exist at snapshot time
+				continue;
+			}
+			if (images.end() == iter || kb.compare(iter->first) < 0) {
+				m_key = kb.ToString();
+				if (images.end() == ib) {
+					m_val = m_base->value().ToString();
+					m_valid = true;
+				} else {
+					SetImageValue(*ib->second);
+				}
+				return;
+			}
+		}
+		if (images.end() != iter) {
+			m_key = iter->first;
+			SetImageValue(*iter->second);
+		} else {
+			m_valid = false;
+		}
+		return;
+	}
+}
+
+void SnapshotIteratorImpl::FindBackward(const std::string& bound, bool inclusive, bool hasBound) {
+	auto& images = m_snap->images_;
+	for (;;) {
+		while (hasBound && m_base->Valid()) {
+			int cmp = m_base->key().compare(bound);
+			if (cmp < 0 || (inclusive && 0 == cmp))
+				break;
+			m_base->Prev();
+		}
+		std::unique_lock<std::mutex> lock(m_db->m_snapshotMutex);
+		auto iter = !hasBound ? images.end()
+				  : inclusive ? images.upper_bound(bound) : images.lower_bound(bound);
+		bool hasImage = false;
+		while (images.begin() != iter) {
+			--iter;
+			if (iter->second->exists) {
+				hasImage = true;
+				break;
+			}
+		}
+		if (m_base->Valid()) {
+			Slice kb = m_base->key();
+			auto ib = images.find(kb.ToString());
+			if (images.end() != ib && !ib->second->exists) {
+				lock.unlock();
+				m_base->Prev(); // kb did not exist at snapshot time
+				continue;
+			}
+			if (!hasImage || kb.compare(iter->first) > 0) {
+				m_key = kb.ToString();
+				if (images.end() == ib) {
+					m_val = m_base->value().ToString();
+					m_valid = true;
+				} else {
+					SetImageValue(*ib->second);
+				}
+				return;
+			}
+		}
+		if (hasImage) {
+			m_key = iter->first;
+			SetImageValue(*iter->second);
+		} else {
+			m_valid = false;
+		}
+		return;
+	}
+}
+
+void SnapshotIteratorImpl::SeekToFirst() {
+	m_forward = true;
+	m_base->SeekToFirst();
+	FindForward(std::string(), true);
+}
+
+void SnapshotIteratorImpl::SeekToLast() {
+	m_forward = false;
+	m_base->SeekToLast();
+	FindBackward(std::string(), true, false);
+}
+
+void SnapshotIteratorImpl::Seek(const Slice& target) {
+	m_forward = true;
+	PositionBaseForward(target);
+	FindForward(target.ToString(), true);
+}
+
+void SnapshotIteratorImpl::Next() {
+	assert(m_valid);
+	std::string bound;
+	bound.swap(m_key);
+	if (!m_forward) {
+		m_forward = true;
+		PositionBaseForward(bound);
+	}
+	FindForward(bound, false);
+}
+
+void SnapshotIteratorImpl::Prev() {
+	assert(m_valid);
+	std::string bound;
+	bound.swap(m_key);
+	if (m_forward) {
+		m_forward = false;
+		PositionBaseBackward(bound);
+	}
+	FindBackward(bound, false, true);
+}
@@ -31,6 +31,9 @@
 #include <leveldb/leveldb_terark_config.h>
 
 #include <thread>
+#include <map>
+#include <mutex>
+#include <set>
 #include "leveldb/cache.h"
 #include "leveldb/comparator.h"
 #include "leveldb/db.h"
@@ -45,6 +48,8 @@
 #endif
 
 #include <terark/terichdb/db_table.hpp>
+#include <terark/util/fstrvec.hpp>
+#include <terark/io/FileStream.hpp>
 #include <boost/filesystem.hpp>
 #include <tbb/enumerable_thread_specific.h>
 #undef min
@@ -104,8 +109,8 @@ class DbImpl;
 /* Context for operations (including snapshots, write batches, transactions) */
 class OperationContext {
 public:
-  OperationContext(terark::terichdb::DbTable* tab, terark::terichdb::DbContext* ctx)
-   : m_batchWriter(tab, ctx), m_removeNotFound(0) {}
+  OperationContext(DbImpl* db, terark::terichdb::DbTable* tab, terark::terichdb::DbContext* ctx)
+   : m_db(db), m_tab(tab), m_ctx(ctx), m_removeNotFound(0) {}
 
   ~OperationContext() {
 #ifdef WANT_SHUTDOWN_RACES
@@ -132,7 +137,29 @@ public:
 #endif
   WT_SESSION *GetSession() { return session_; }
 */
-  terark::terichdb::BatchWriter m_batchWriter;
+  // insert pending puts by one DbTable::insertRows, existing keys are upserted
+  void FlushPuts();
+
+  // must be called before each put or delete of a WriteBatch, the first
+  // value of each key is kept for Rollback and saved as before image
+  void SaveUndoImage(const Slice& key);
+
+  // restores the keys written by the batch to their undo images, so a
+  // failed Write is all or nothing. Concurrent readers may still see a
+  // partially applied batch, and a concurrent write of the same key may be
+  // overwritten by the rollback, there is no isolation between batches
+  void Rollback();
+
+  struct UndoImage {
+    bool        exists; // false if the key did not exist before the batch
+    std::string value;
+  };
+
+  DbImpl* m_db;
+  terark::terichdb::DbTable* m_tab;
+  terark::terichdb::DbContext* m_ctx;
+  terark::fstrvec m_putRows; // encoded rows of consecutive puts
+  std::map<std::string, UndoImage> m_undo;
   size_t m_removeNotFound;
 //  terark::valvec<unsigned char> m_rowBuf;
 //  terark::valvec<long long> m_exactRecIdvec;
@@ -232,25 +259,82 @@ private:
   void operator=(const IteratorImpl&);
 };
 
+// Keys written after the snapshot was taken have their before images saved
+// in the snapshot, other keys are not changed since then and are read from
+// the table. A before image is shared by all snapshots alive when the key
+// is written.
+// Before images are in memory, when they exceed DbImpl's limit, values of
+// new before images are spilled to a file in the db dir, the map nodes
+// (key and about 64 bytes per snapshot) are always kept in memory.
+// Snapshots never expire, a spilled value costs a file read when it is
+// read by Get, MultiGet or iterators, a failed read returns IOError.
+// The spill file is removed when the last snapshot is released.
 class SnapshotImpl : public Snapshot {
 friend class DbImpl;
-friend class IteratorImpl;
+friend class SnapshotIteratorImpl;
 public:
-  SnapshotImpl(DbImpl *db);
-  virtual ~SnapshotImpl() { delete context_; }
-protected:
-  OperationContext *GetContext() const { return context_; }
-  Status GetStatus() const { return status_; }
-  Status SetupTransaction();
+  struct BeforeImage : public terark::RefCounter {
+    bool        exists; // false if the key did not exist at snapshot time
+    std::string value;  // empty if spilled
+    long long   spillPos; // -1 if value is in memory
+    size_t      spillLen;
+    BeforeImage() : exists(false), spillPos(-1), spillLen(0) {}
+  };
+  typedef boost::intrusive_ptr<BeforeImage> BeforeImagePtr;
+  typedef std::map<std::string, BeforeImagePtr> ImageMap;
+
+  SnapshotImpl(DbImpl *db, unsigned long long seq)
+    : db_(db), seq_(seq), imageBytes_(0) {}
 private:
-  DbImpl *db_;
-  OperationContext *context_;
-  Status status_;
+  DbImpl  *db_;
+  unsigned long long seq_;
+  // below are protected by DbImpl::m_snapshotMutex
+  ImageMap images_;
+  size_t   imageBytes_; // map nodes, shared values are not included
+};
+
+// Merges the table and the before images of a snapshot, a before image
+// overrides the table entry of the same key.
+class SnapshotIteratorImpl : public Iterator {
+public:
+  SnapshotIteratorImpl(DbImpl *db, const SnapshotImpl *snap);
+  virtual ~SnapshotIteratorImpl();
+
+  virtual bool Valid() const { return m_valid; }
+  virtual void SeekToFirst();
+  virtual void SeekToLast();
+  virtual void Seek(const Slice& target);
+  virtual void Next();
+  virtual void Prev();
+  virtual Slice key() const { return Slice(m_key); }
+  virtual Slice value() const { return Slice(m_val); }
+  virtual Status status() const {
+    return m_status.ok() ? m_base->status() : m_status;
+  }
+
+private:
+  void PositionBaseForward(const Slice& bound);
+  void PositionBaseBackward(const Slice& bound);
+  void FindForward(const std::string& bound, bool inclusive);
+  void FindBackward(const std::string& bound, bool inclusive, bool hasBound);
+  void SetImageValue(const SnapshotImpl::BeforeImage&); // in m_snapshotMutex
+  DbImpl*  m_db;
+  const SnapshotImpl* m_snap;
+  std::unique_ptr<IteratorImpl> m_base;
+  std::string m_key, m_val;
+  Status m_status;
+  bool m_valid;
+  bool m_forward;
+
+  // No copying allowed
+  SnapshotIteratorImpl(const SnapshotIteratorImpl&);
+  void operator=(const SnapshotIteratorImpl&);
 };
 
 class DbImpl : public leveldb::DB {
 friend class IteratorImpl;
 friend class SnapshotImpl;
+friend class SnapshotIteratorImpl;
 public:
   DbImpl(const fs::path& dbRoot);
   ~DbImpl();
@@ -259,6 +343,12 @@ public:
   Status Write(const WriteOptions& options, WriteBatch* updates) override;
   Status Get(const ReadOptions& options, const Slice& key, std::string* value) override;
 
+  // Same as Get on each key, but all keys are searched in one batch.
+  // (*values) is resized to keys.size()
+  std::vector<Status> MultiGet(const ReadOptions& options,
+                               const std::vector<Slice>& keys,
+                               std::vector<std::string>* values);
+
 #if HAVE_BASHOLEVELDB
   virtual Status Get(const ReadOptions& options, const Slice& key, Value* value);
 #endif
@@ -345,7 +435,6 @@ public:
 #endif
 
   Iterator* NewIterator(const ReadOptions& options) override;
-  OperationContext* NewContext() { return NULL; }
 
   const Snapshot* GetSnapshot() override;
 
@@ -358,9 +447,41 @@ public:
 
   terark::terichdb::DbContext* GetDbContext();
 
+  // must be called in read lock of m_snapshotRwMutex, before key is written.
+  // While any snapshot is alive, every Put, Delete and batch write pays an
+  // extra index lookup and value read here, plus a spill file write when
+  // the in memory images are over the limit, which is done in
+  // m_snapshotMutex and so serializes writers
+  void SaveBeforeImage(const Slice& key);
+  // same as above, exists and value are the current value of key
+  void SaveBeforeImage(const Slice& key, bool exists, const Slice& value);
+
+  // max bytes of in memory before images of all snapshots, the default is
+  // env TerarkLevelDB_snapshotMaxImageBytes or 256MB, values of new before
+  // images are spilled to disk when it is exceeded
+  void SetSnapshotMaxImageBytes(size_t bytes);
+
   terark::terichdb::DbTablePtr m_tab;
+  // writers hold read lock during SaveBeforeImage and the write,
+  // GetSnapshot holds write lock, so a write is either fully visible
+  // to a snapshot or has saved its before image in the snapshot
+  terark::terichdb::MyRwMutex m_snapshotRwMutex;
 private:
   tbb::enumerable_thread_specific<DbContextPtr> m_ctx;
+  std::mutex m_snapshotMutex; // for m_snapshots and their images_
+  std::set<SnapshotImpl*> m_snapshots;
+  std::atomic<size_t> m_snapshotNum;
+  unsigned long long m_snapshotSeq;
+  size_t m_snapshotImageBytes; // map nodes and in memory shared values
+  size_t m_snapshotMaxImageBytes;
+  terark::FileStream m_spill; // spilled before image values, append only
+  long long m_spillSize;
+  fs::path m_spillPath;
+
+  size_t FreeImagesNoLock(SnapshotImpl*);
+  void SpillImageNoLock(SnapshotImpl::BeforeImage*);
+  Status ReadImageNoLock(const SnapshotImpl::BeforeImage&, std::string* value);
+  void RemoveSpillNoLock();
 
 #ifdef HAVE_ROCKSDB
   std::vector<ColumnFamilyHandle*> columns_;
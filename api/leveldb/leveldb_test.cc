@@ -26,11 +26,264 @@
  */
 
 #include <assert.h>
+#include <stdlib.h>
 #include <iostream>
+#include <vector>
 #include "leveldb_terark.h"
+#include "db/write_batch_internal.h"
 
 using namespace std;
 
+static std::string GetString(leveldb::DB* db, const leveldb::Snapshot* snap,
+                             const std::string& key) {
+  leveldb::ReadOptions read_options;
+  read_options.snapshot = snap;
+  std::string value;
+  leveldb::Status s = db->Get(read_options, key, &value);
+  if (s.IsNotFound())
+    return "NOT_FOUND";
+  if (!s.ok())
+    return "ERROR";
+  return value;
+}
+
+// Reads through a snapshot see the values at snapshot time
+static void TestSnapshot(leveldb::DB* db) {
+  leveldb::WriteOptions wo;
+  leveldb::Status s;
+  db->Delete(wo, "snap_new");
+  db->Put(wo, "snap_ow", "v1");
+  db->Put(wo, "snap_del", "v1");
+  const leveldb::Snapshot* snap = db->GetSnapshot();
+
+  // overwrite
+  s = db->Put(wo, "snap_ow", "v2");
+  assert(s.ok());
+  s = db->Put(wo, "snap_ow", "v3");
+  assert(s.ok());
+  assert(GetString(db, snap, "snap_ow") == "v1");
+  assert(GetString(db, NULL, "snap_ow") == "v3");
+
+  // delete
+  s = db->Delete(wo, "snap_del");
+  assert(s.ok());
+  assert(GetString(db, snap, "snap_del") == "v1");
+  assert(GetString(db, NULL, "snap_del") == "NOT_FOUND");
+
+  // insert after snapshot
+  s = db->Put(wo, "snap_new", "v1");
+  assert(s.ok());
+  assert(GetString(db, snap, "snap_new") == "NOT_FOUND");
+  assert(GetString(db, NULL, "snap_new") == "v1");
+
+  // delete then put back in one batch
+  leveldb::WriteBatch batch;
+  batch.Delete("snap_ow");
+  batch.Put("snap_ow", "v4");
+  s = db->Write(wo, &batch);
+  assert(s.ok());
+  assert(GetString(db, snap, "snap_ow") == "v1");
+  assert(GetString(db, NULL, "snap_ow") == "v4");
+
+  leveldb::ReadOptions read_options;
+  read_options.snapshot = snap;
+  leveldb::Iterator* iter = db->NewIterator(read_options);
+  std::string keys;
+  for (iter->Seek("snap_"); iter->Valid() && iter->key().starts_with("snap_"); iter->Next()) {
+    keys += iter->key().ToString() + "=" + iter->value().ToString() + ";";
+  }
+  assert(iter->status().ok());
+  assert(keys == "snap_del=v1;snap_ow=v1;");
+  keys.clear();
+  for (iter->SeekToLast(); iter->Valid() && iter->key().starts_with("snap_"); iter->Prev()) {
+    keys += iter->key().ToString() + "=" + iter->value().ToString() + ";";
+  }
+  assert(keys == "snap_ow=v1;snap_del=v1;");
+  delete iter;
+  db->ReleaseSnapshot(snap);
+  db->Delete(wo, "snap_new");
+  db->Delete(wo, "snap_ow");
+}
+
+static void PutKeys(leveldb::DB* db, int beg, int end, const std::string& val) {
+  char key[32];
+  for (int i = beg; i < end; ++i) {
+    snprintf(key, sizeof(key), "snap_big_%03d", i);
+    leveldb::Status s = db->Put(leveldb::WriteOptions(), key, val);
+    assert(s.ok());
+  }
+}
+
+// Before images over the limit are spilled to disk, snapshots still read
+// their old values through Get, MultiGet and iterators
+static void TestSnapshotSpill(leveldb::DB* db) {
+  DbImpl* dbi = static_cast<DbImpl*>(db);
+  leveldb::WriteOptions wo;
+  const std::string big(4096, 'x');
+  char key[32];
+  // about 4KB per before image, 80 images are 320KB, most are spilled
+  PutKeys(db, 0, 100, big);
+  dbi->SetSnapshotMaxImageBytes(64 << 10);
+  const leveldb::Snapshot* older = db->GetSnapshot();
+  PutKeys(db, 0, 40, "small");
+  const leveldb::Snapshot* newer = db->GetSnapshot();
+  PutKeys(db, 40, 80, "small");
+  assert(GetString(db, older, "snap_big_000") == big);
+  assert(GetString(db, older, "snap_big_079") == big);
+  assert(GetString(db, newer, "snap_big_000") == "small");
+  assert(GetString(db, newer, "snap_big_079") == big);
+  assert(GetString(db, NULL, "snap_big_079") == "small");
+  leveldb::ReadOptions read_options;
+  read_options.snapshot = older;
+  std::vector<leveldb::Slice> keys;
+  keys.push_back("snap_big_039");
+  keys.push_back("snap_big_099");
+  std::vector<std::string> values;
+  std::vector<leveldb::Status> ss = dbi->MultiGet(read_options, keys, &values);
+  assert(ss[0].ok() && values[0] == big);
+  assert(ss[1].ok() && values[1] == big);
+  leveldb::Iterator* iter = db->NewIterator(read_options);
+  int num = 0;
+  for (iter->Seek("snap_big_"); iter->Valid(); iter->Next()) {
+    if (!iter->key().starts_with("snap_big_"))
+      break;
+    assert(iter->value() == big);
+    num++;
+  }
+  assert(iter->status().ok());
+  assert(100 == num);
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+    if (iter->key().starts_with("snap_big_")) {
+      assert(iter->value() == big);
+      num--;
+    }
+  }
+  assert(iter->status().ok());
+  assert(0 == num);
+  delete iter;
+  db->ReleaseSnapshot(older);
+  db->ReleaseSnapshot(newer);
+  dbi->SetSnapshotMaxImageBytes(256 << 20);
+  for (int i = 0; i < 100; ++i) {
+    snprintf(key, sizeof(key), "snap_big_%03d", i);
+    db->Delete(wo, key);
+  }
+}
+
+// A WriteBatch which fails in the middle is rolled back: puts and deletes
+// applied before the failure are undone, also for snapshots
+static void TestWriteBatchRollback(leveldb::DB* db) {
+  leveldb::WriteOptions wo;
+  db->Put(wo, "wb_ow", "v1");
+  db->Put(wo, "wb_del", "v1");
+  db->Delete(wo, "wb_new");
+  const leveldb::Snapshot* snap = db->GetSnapshot();
+  leveldb::WriteBatch batch;
+  batch.Put("wb_ow", "v2");
+  batch.Put("wb_new", "v2");
+  batch.Delete("wb_del");   // flushes the puts before it
+  batch.Put("wb_ow", "v3");
+  batch.Delete("wb_new");
+  batch.Put("wb_new", "v3");
+  // a bad tag at the end, Iterate fails after applying all above
+  std::string rep = leveldb::WriteBatchInternal::Contents(&batch).ToString();
+  rep.push_back('\x7f');
+  leveldb::WriteBatchInternal::SetContents(&batch, rep);
+  leveldb::Status s = db->Write(wo, &batch);
+  assert(!s.ok());
+  assert(GetString(db, NULL, "wb_ow") == "v1");
+  assert(GetString(db, NULL, "wb_del") == "v1");
+  assert(GetString(db, NULL, "wb_new") == "NOT_FOUND");
+  assert(GetString(db, snap, "wb_ow") == "v1");
+  assert(GetString(db, snap, "wb_del") == "v1");
+  assert(GetString(db, snap, "wb_new") == "NOT_FOUND");
+  db->ReleaseSnapshot(snap);
+
+  // a good batch is fully applied
+  batch.Clear();
+  batch.Put("wb_ow", "v2");
+  batch.Delete("wb_del");
+  batch.Put("wb_new", "v2");
+  s = db->Write(wo, &batch);
+  assert(s.ok());
+  assert(GetString(db, NULL, "wb_ow") == "v2");
+  assert(GetString(db, NULL, "wb_del") == "NOT_FOUND");
+  assert(GetString(db, NULL, "wb_new") == "v2");
+  db->Delete(wo, "wb_ow");
+  db->Delete(wo, "wb_new");
+}
+
+// MultiGet returns the same as Get for each key, in the order of keys
+static void TestMultiGet(leveldb::DB* db) {
+  DbImpl* dbi = static_cast<DbImpl*>(db);
+  leveldb::WriteOptions wo;
+  leveldb::ReadOptions ro;
+  std::vector<leveldb::Slice> keys;
+  std::vector<std::string> values;
+  std::vector<leveldb::Status> st = dbi->MultiGet(ro, keys, &values);
+  assert(st.empty() && values.empty());
+
+  char key[32], val[32];
+  for (int i = 0; i < 500; i += 2) { // only even keys exist
+    snprintf(key, sizeof(key), "mget_%04d", i);
+    snprintf(val, sizeof(val), "val_%d", i);
+    db->Put(wo, key, val);
+  }
+  for (int i = 1; i < 500; i += 2) {
+    snprintf(key, sizeof(key), "mget_%04d", i);
+    db->Delete(wo, key);
+  }
+  // unsorted, with duplicates and missing keys
+  std::vector<std::string> strKeys;
+  for (int i = 0; i < 700; ++i) {
+    snprintf(key, sizeof(key), "mget_%04d", (i * 7919) % 520);
+    strKeys.push_back(key);
+  }
+  strKeys.push_back(strKeys[0]);
+  strKeys.push_back("");
+  for (const std::string& k : strKeys)
+    keys.push_back(k);
+  values.assign(3, "garbage");
+  st = dbi->MultiGet(ro, keys, &values);
+  assert(st.size() == keys.size());
+  assert(values.size() == keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    std::string expected = GetString(db, NULL, strKeys[i]);
+    if (expected == "NOT_FOUND") {
+      assert(st[i].IsNotFound());
+    } else {
+      assert(st[i].ok());
+      assert(values[i] == expected);
+    }
+  }
+
+  // through a snapshot
+  const leveldb::Snapshot* snap = db->GetSnapshot();
+  db->Put(wo, "mget_0000", "changed");
+  db->Delete(wo, "mget_0002");
+  db->Put(wo, "mget_0001", "inserted");
+  keys.clear();
+  keys.push_back("mget_0002");
+  keys.push_back("mget_0001");
+  keys.push_back("mget_0000");
+  ro.snapshot = snap;
+  st = dbi->MultiGet(ro, keys, &values);
+  assert(st[0].ok() && values[0] == "val_2");
+  assert(st[1].IsNotFound());
+  assert(st[2].ok() && values[2] == "val_0");
+  ro.snapshot = NULL;
+  st = dbi->MultiGet(ro, keys, &values);
+  assert(st[0].IsNotFound());
+  assert(st[1].ok() && values[1] == "inserted");
+  assert(st[2].ok() && values[2] == "changed");
+  db->ReleaseSnapshot(snap);
+
+  for (int i = 0; i < 500; ++i) {
+    snprintf(key, sizeof(key), "mget_%04d", i);
+    db->Delete(wo, key);
+  }
+}
+
 extern "C" int main() {
   leveldb::DB* db;
   leveldb::Options options;
@@ -38,6 +291,11 @@ extern "C" int main() {
   leveldb::Status s = leveldb::DB::Open(options, "WTLDB_HOME", &db);
   assert(s.ok());
 
+  TestSnapshot(db);
+  TestSnapshotSpill(db);
+  TestMultiGet(db);
+  TestWriteBatchRollback(db);
+
   s = db->Put(leveldb::WriteOptions(), "key", "value");
   s = db->Put(leveldb::WriteOptions(), "key2", "value2");
   s = db->Put(leveldb::WriteOptions(), "key3", "value3");
@@ -18,6 +18,7 @@
 #include <boost/filesystem.hpp>
 #include <thread>
 #include <tbb/enumerable_thread_specific.h>
+#include <tbb/concurrent_queue.h>
 #include <terark/terichdb/db_table.hpp>
 #include "record_codec.h"
 
@@ -52,6 +53,7 @@ public:
     terark::valvec<unsigned char> m_buf;
     mongo::terichdb::SchemaRecordCoder m_coder;
 	llong     m_lastUseTime;
+	bool      m_noDamagesOnce; // next updateWithDamagesSupported is false
 };
 typedef boost::intrusive_ptr<TableThreadData> TableThreadDataPtr;
 
@@ -126,6 +128,10 @@ public:
 	IndexIterDataPtr allocIndexIter(size_t indexId, bool forward);
 	void releaseIndexIter(size_t indexId, bool forward, IndexIterDataPtr);
 
+	// called by the background sweeper, free cached cursors which are
+	// not used for m_cacheExpireMillisec
+	void sweepCursorCache(llong now);
+
 	// for RecoveryUnit:
 	RecoveryUnitData* getRecoveryUnitData(RecoveryUnit*);
 	RecoveryUnitDataPtr tryRecoveryUnitData(RecoveryUnit*);
@@ -140,6 +146,10 @@ public:
 	void commitDelete(RecoveryUnit*, RecordId id);
 	void rollbackDelete(RecoveryUnit*, RecordId id);
 
+	// full row update which kept the record id, oldRow is restored on rollback
+	void registerUpdate(RecoveryUnit*, RecordId id, fstring oldRow);
+	void rollbackUpdate(RecordId id, fstring oldRow);
+
 	RuStoreIteratorBase* createStoreIter(RecoveryUnit*, bool forward);
 
 	void registerCleanOnOwnerDead(ICleanOnOwnerDead*);
@@ -147,12 +157,20 @@ public:
 
 protected:
 	tbb::enumerable_thread_specific<TableThreadDataPtr> m_ttd;
-	std::mutex m_cursorCacheMutex;
-	valvec<TableThreadDataPtr> m_cursorCache; // for RecordStore Iterator
-	valvec<valvec<IndexIterDataPtr> > m_indexForwardIterCache;
-	valvec<valvec<IndexIterDataPtr> > m_indexBackwardIterCache;
-	llong m_cacheExpireMillisec;
-	void expiringCacheItems(valvec<valvec<IndexIterDataPtr> >& vv, llong now);
+
+	// Cursor cache: each thread has a small free list, which is only
+	// contended by the background sweeper, overflows go to the lock free
+	// global queues. Index iter slot is indexId*2 + forward.
+	struct LocalCursorCache;
+	LocalCursorCache& getLocalCursorCache();
+	tbb::enumerable_thread_specific<LocalCursorCache*> m_localCursorCache;
+	std::mutex m_localCursorCacheListMutex;
+	valvec<LocalCursorCache*> m_localCursorCacheList; // for sweeper
+	tbb::concurrent_queue<TableThreadDataPtr> m_globalTtdCache; // for RecordStore Iterator
+	std::unique_ptr<tbb::concurrent_queue<IndexIterDataPtr>[]> m_globalIndexIterCache;
+	size_t m_indexIterSlotNum;
+	size_t m_localCursorCacheSize;
+	llong  m_cacheExpireMillisec;
 
 	std::mutex m_ruMapMutex;
 	gold_hash_map<RecoveryUnit*, RecoveryUnitDataPtr> m_ruMap;
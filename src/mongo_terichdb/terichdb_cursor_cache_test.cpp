@@ -0,0 +1,289 @@
+// terichdb_cursor_cache_test.cpp
+
+/**
+ *    Copyright (C) 2014 MongoDB Inc.
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *    As a special exception, the copyright holders give permission to link the
+ *    code of portions of this program with the OpenSSL library under certain
+ *    conditions as described in each individual source file and distribute
+ *    linked combinations including the program with the OpenSSL library. You
+ *    must comply with the GNU Affero General Public License in all respects for
+ *    all of the code used other than as permitted herein. If you modify file(s)
+ *    with this exception, you may extend this exception to your version of the
+ *    file(s), but you are not obligated to do so. If you do not wish to do so,
+ *    delete this exception statement from your version. If you delete this
+ *    exception statement from all source files in the program, then also delete
+ *    it in the license file.
+ */
+
+#include "mongo/platform/basic.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mongo_terichdb_common.hpp"
+#include "mongo/unittest/temp_dir.h"
+#include "mongo/unittest/unittest.h"
+#include <terark/io/DataIO.hpp>
+#include <terark/io/MemStream.hpp>
+#include <terark/util/profiling.hpp>
+
+namespace mongo { namespace db {
+
+namespace {
+
+const size_t kLocalCacheSize = 2;
+const long kExpireMillisec = 300;
+const terark::ullong kRows = 100;
+
+// rows are (id uint64, str strzero), with an ordered index on id
+class CursorCacheHarness {
+public:
+    CursorCacheHarness() : _dbpath("terichdb-cursor-cache") {
+        // read by the ThreadSafeTable constructor
+        setenv("ThreadSafeTable_localCursorCacheSize", std::to_string(kLocalCacheSize).c_str(), 1);
+        setenv("ThreadSafeTable_cacheExpireMillisec", std::to_string(kExpireMillisec).c_str(), 1);
+        fs::path dir = fs::path(_dbpath.path()) / "tab";
+        fs::create_directories(dir);
+        FILE* fp = fopen((dir / "dbmeta.json").string().c_str(), "w");
+        ASSERT(fp != NULL);
+        fprintf(fp, R"({
+  "WritableSegmentClass": "MockWritable",
+  "ReadonlySegmentClass": "MockReadonly",
+  "RowSchema": {
+    "columns": {
+      "id" : { "type": "uint64" },
+      "str": { "type": "strzero" }
+    }
+  },
+  "TableIndex": [ { "fields": "id", "ordered": true } ]
+})");
+        fclose(fp);
+        _tst = new ThreadSafeTable(dir);
+        terark::terichdb::DbContextPtr ctx(_tst->m_tab->createDbContext());
+        terark::NativeDataOutput<terark::AutoGrownMemIO> rb;
+        for (terark::ullong id = 0; id < kRows; ++id) {
+            std::string str = "str-" + std::to_string(id);
+            rb.rewind();
+            rb << id;
+            rb.write(str.c_str(), str.size() + 1);
+            ASSERT_GREATER_THAN_OR_EQUALS(ctx->insertRow(fstring(rb.begin(), rb.tell())), 0);
+        }
+    }
+    ~CursorCacheHarness() {
+        _tst = nullptr;
+    }
+    ThreadSafeTable* tst() const {
+        return _tst.get();
+    }
+
+private:
+    unittest::TempDir _dbpath;
+    ThreadSafeTablePtr _tst;
+};
+
+terark::ullong firstKey(IndexIterData* iter) {
+    llong recId = -1;
+    ASSERT_TRUE(iter->increment(&recId));
+    ASSERT_EQUALS(iter->m_curKey.size(), sizeof(terark::ullong));
+    return terark::unaligned_load<terark::ullong>(iter->m_curKey.data());
+}
+
+void sleepMillisec(long ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+}  // namespace
+
+// a released cursor is reused by the next alloc of the same thread
+TEST(TerichDbCursorCache, LocalReuse) {
+    CursorCacheHarness harness;
+    ThreadSafeTable* tst = harness.tst();
+    TableThreadDataPtr ttd = tst->allocTableThreadData();
+    TableThreadData* p = ttd.get();
+    tst->releaseTableThreadData(std::move(ttd));
+    ttd = tst->allocTableThreadData();
+    ASSERT_EQUALS(ttd.get(), p);
+    tst->releaseTableThreadData(std::move(ttd));
+}
+
+// forward and backward index iters are cached in separate slots, a reused
+// iter is reset and keeps its direction
+TEST(TerichDbCursorCache, IndexIterDirection) {
+    CursorCacheHarness harness;
+    ThreadSafeTable* tst = harness.tst();
+    IndexIterDataPtr fwd = tst->allocIndexIter(0, true);
+    IndexIterDataPtr bwd = tst->allocIndexIter(0, false);
+    ASSERT_NOT_EQUALS(fwd.get(), bwd.get());
+    ASSERT_EQUALS(firstKey(fwd.get()), 0ULL);
+    ASSERT_EQUALS(firstKey(bwd.get()), kRows - 1);
+    IndexIterData* fp = fwd.get();
+    IndexIterData* bp = bwd.get();
+    tst->releaseIndexIter(0, true, std::move(fwd));
+    tst->releaseIndexIter(0, false, std::move(bwd));
+    bwd = tst->allocIndexIter(0, false);
+    fwd = tst->allocIndexIter(0, true);
+    ASSERT_EQUALS(bwd.get(), bp);
+    ASSERT_EQUALS(fwd.get(), fp);
+    ASSERT_EQUALS(firstKey(fwd.get()), 0ULL);
+    ASSERT_EQUALS(firstKey(bwd.get()), kRows - 1);
+    tst->releaseIndexIter(0, true, std::move(fwd));
+    tst->releaseIndexIter(0, false, std::move(bwd));
+}
+
+// releases beyond the local cache size go to the global queue, where
+// other threads take them
+TEST(TerichDbCursorCache, OverflowToOtherThreads) {
+    CursorCacheHarness harness;
+    ThreadSafeTable* tst = harness.tst();
+    const size_t num = kLocalCacheSize + 3;
+    std::vector<TableThreadDataPtr> held;
+    for (size_t i = 0; i < num; ++i)
+        held.push_back(tst->allocTableThreadData());
+    std::set<TableThreadData*> overflow;
+    for (size_t i = 0; i < num; ++i) {
+        if (i >= kLocalCacheSize)
+            overflow.insert(held[i].get());
+        tst->releaseTableThreadData(held[i]);
+    }
+    std::set<TableThreadData*> taken;
+    TableThreadData* fresh = NULL;
+    std::thread thr([&]() {
+        std::vector<TableThreadDataPtr> v;
+        for (size_t i = 0; i < overflow.size() + 1; ++i)
+            v.push_back(tst->allocTableThreadData());
+        for (size_t i = 0; i < overflow.size(); ++i)
+            taken.insert(v[i].get());
+        fresh = v.back().get();
+        for (auto& ttd : v)
+            tst->releaseTableThreadData(std::move(ttd));
+    });
+    thr.join();
+    ASSERT_TRUE(taken == overflow);
+    ASSERT_EQUALS(overflow.count(fresh), 0U);
+    for (auto& ttd : held)
+        ASSERT_NOT_EQUALS(ttd.get(), fresh);
+    // the local cache of this thread still has the first ones
+    TableThreadDataPtr ttd = tst->allocTableThreadData();
+    ASSERT_EQUALS(ttd.get(), held[kLocalCacheSize - 1].get());
+    tst->releaseTableThreadData(std::move(ttd));
+}
+
+// the sweeper frees cursors not used for cacheExpireMillisec, in the
+// local caches and in the global queues
+TEST(TerichDbCursorCache, Expire) {
+    CursorCacheHarness harness;
+    ThreadSafeTable* tst = harness.tst();
+    const size_t num = kLocalCacheSize + 2;
+    std::vector<TableThreadDataPtr> ttds;
+    std::vector<IndexIterDataPtr> iters;
+    for (size_t i = 0; i < num; ++i) {
+        ttds.push_back(tst->allocTableThreadData());
+        iters.push_back(tst->allocIndexIter(0, true));
+    }
+    for (size_t i = 0; i < num; ++i) {
+        tst->releaseTableThreadData(ttds[i]);
+        tst->releaseIndexIter(0, true, iters[i]);
+    }
+    terark::profiling pf;
+    tst->sweepCursorCache(pf.now());
+    for (size_t i = 0; i < num; ++i) {
+        ASSERT_EQUALS(ttds[i]->get_refcount(), 2); // not expired
+        ASSERT_EQUALS(iters[i]->get_refcount(), 2);
+    }
+    sleepMillisec(kExpireMillisec + 100);
+    tst->sweepCursorCache(pf.now());
+    for (size_t i = 0; i < num; ++i) {
+        ASSERT_EQUALS(ttds[i]->get_refcount(), 1);
+        ASSERT_EQUALS(iters[i]->get_refcount(), 1);
+    }
+    TableThreadDataPtr ttd = tst->allocTableThreadData();
+    for (auto& x : ttds)
+        ASSERT_NOT_EQUALS(ttd.get(), x.get());
+    tst->releaseTableThreadData(std::move(ttd));
+}
+
+// a cached cursor is never handed to two threads at the same time,
+// while sweeps run concurrently
+TEST(TerichDbCursorCache, Concurrent) {
+    CursorCacheHarness harness;
+    ThreadSafeTable* tst = harness.tst();
+    std::mutex mutex;
+    std::set<void*> inUse;
+    size_t conflicts = 0;
+    std::atomic_size_t badIters(0);
+    auto acquire = [&](void* p) {
+        std::lock_guard<std::mutex> lock(mutex);
+        conflicts += !inUse.insert(p).second;
+    };
+    auto release = [&](void* p) {
+        std::lock_guard<std::mutex> lock(mutex);
+        inUse.erase(p);
+    };
+    volatile bool stop = false;
+    std::thread sweeper([&]() {
+        terark::profiling pf;
+        while (!stop) {
+            tst->sweepCursorCache(pf.now());
+            sleepMillisec(1);
+        }
+    });
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 8; ++t) {
+        workers.emplace_back([&, t]() {
+            for (int loop = 0; loop < 2000; ++loop) {
+                const size_t n = 1 + (loop + t) % 5;
+                const bool forward = (loop + t) % 2 == 0;
+                std::vector<TableThreadDataPtr> ttds;
+                std::vector<IndexIterDataPtr> iters;
+                for (size_t i = 0; i < n; ++i) {
+                    ttds.push_back(tst->allocTableThreadData());
+                    acquire(ttds.back().get());
+                    iters.push_back(tst->allocIndexIter(0, forward));
+                    acquire(iters.back().get());
+                }
+                for (size_t i = 0; i < n; ++i) {
+                    // no ASSERT in worker threads, count the bad iters
+                    llong recId = -1;
+                    IndexIterData* iter = iters[i].get();
+                    if (!iter->increment(&recId) || iter->m_curKey.size() != 8 ||
+                            terark::unaligned_load<terark::ullong>(iter->m_curKey.data())
+                                != (forward ? 0 : kRows - 1))
+                        badIters++;
+                    release(ttds[i].get());
+                    tst->releaseTableThreadData(std::move(ttds[i]));
+                    release(iters[i].get());
+                    tst->releaseIndexIter(0, forward, std::move(iters[i]));
+                }
+            }
+        });
+    }
+    for (auto& thr : workers)
+        thr.join();
+    stop = true;
+    sweeper.join();
+    ASSERT_EQUALS(conflicts, 0U);
+    ASSERT_EQUALS(badIters.load(), 0U);
+}
+
+} }  // namespace mongo::db
@@ -73,6 +73,10 @@
 #include "mongo/db/storage/kv/kv_catalog.h"
 #include <terark/io/FileStream.hpp>
 #include <terark/util/profiling.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <set>
 
 #if !defined(__has_feature)
 #define __has_feature(x) 0
@@ -97,6 +101,8 @@ ICleanOnOwnerDead::~ICleanOnOwnerDead() {
 TableThreadData::TableThreadData(DbTable* tab) {
 	m_dbCtx.reset(tab->createDbContext());
 	m_dbCtx->syncIndex = false;
+	m_lastUseTime = g_profiling.now();
+	m_noDamagesOnce = false;
 }
 
 IndexIterData::IndexIterData(DbTable* tab, size_t indexId, bool forward) {
@@ -119,11 +125,76 @@ void IndexIterData::reset(llong now) {
 	m_ctx->trySyncSegCtxSpeculativeLock(m_ctx->m_tab);
 }
 
+struct ThreadSafeTable::LocalCursorCache {
+	std::atomic_flag spin = ATOMIC_FLAG_INIT;
+	valvec<TableThreadDataPtr> ttds;
+	valvec<valvec<IndexIterDataPtr> > iters; // [indexId*2 + forward]
+
+	// owner thread vs sweeper, almost never contended
+	void lock() {
+		while (spin.test_and_set(std::memory_order_acquire))
+			std::this_thread::yield();
+	}
+	void unlock() { spin.clear(std::memory_order_release); }
+};
+
+// Periodically expires cached cursors of all ThreadSafeTable, so that
+// alloc/release of cursors never scan the caches
+class CursorCacheSweeper {
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::set<ThreadSafeTable*> m_tables;
+	std::thread m_thread;
+	bool m_stop = false;
+
+	void run() {
+		llong sweepMillisec = terark::getEnvLong("ThreadSafeTable_cacheSweepMillisec", 1000);
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (!m_stop) {
+			m_cond.wait_for(lock, std::chrono::milliseconds(sweepMillisec));
+			if (m_stop)
+				break;
+			llong now = g_profiling.now();
+			for (ThreadSafeTable* tst : m_tables) {
+				tst->sweepCursorCache(now);
+			}
+		}
+	}
+public:
+	static CursorCacheSweeper& instance() {
+		static CursorCacheSweeper sweeper;
+		return sweeper;
+	}
+	~CursorCacheSweeper() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cond.notify_all();
+		if (m_thread.joinable())
+			m_thread.join();
+	}
+	void add(ThreadSafeTable* tst) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_tables.insert(tst);
+		if (!m_thread.joinable())
+			m_thread = std::thread(&CursorCacheSweeper::run, this);
+	}
+	// after return, tst is not being swept
+	void remove(ThreadSafeTable* tst) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_tables.erase(tst);
+	}
+};
+
 ThreadSafeTable::ThreadSafeTable(const fs::path& dbPath) {
 	m_tab = DbTable::open(dbPath);
-	m_indexForwardIterCache.resize(m_tab->getIndexNum());
-	m_indexBackwardIterCache.resize(m_tab->getIndexNum());
+	m_indexIterSlotNum = 2 * m_tab->getIndexNum();
+	m_globalIndexIterCache.reset(
+		new tbb::concurrent_queue<IndexIterDataPtr>[m_indexIterSlotNum]);
+	m_localCursorCacheSize = terark::getEnvLong("ThreadSafeTable_localCursorCacheSize", 4);
 	m_cacheExpireMillisec = terark::getEnvLong("ThreadSafeTable_cacheExpireMillisec", 5 * 1000);
+	CursorCacheSweeper::instance().add(this);
 }
 
 ThreadSafeTable::~ThreadSafeTable() {
@@ -132,92 +203,115 @@ ThreadSafeTable::~ThreadSafeTable() {
 	destroy();
 }
 
+ThreadSafeTable::LocalCursorCache& ThreadSafeTable::getLocalCursorCache() {
+	LocalCursorCache*& lc = m_localCursorCache.local();
+	if (terark_unlikely(!lc)) {
+		lc = new LocalCursorCache();
+		lc->iters.resize(m_indexIterSlotNum);
+		std::lock_guard<std::mutex> lock(m_localCursorCacheListMutex);
+		m_localCursorCacheList.push_back(lc);
+	}
+	return *lc;
+}
+
 TableThreadDataPtr ThreadSafeTable::allocTableThreadData() {
 	TableThreadDataPtr ret;
-	std::unique_lock<std::mutex> lock(this->m_cursorCacheMutex);
-	if (m_cursorCache.empty()) {
-		lock.unlock();
-		ret = new TableThreadData(this->m_tab.get());
+	{
+		LocalCursorCache& lc = getLocalCursorCache();
+		std::lock_guard<LocalCursorCache> lock(lc);
+		if (!lc.ttds.empty())
+			ret = lc.ttds.pop_val();
 	}
-	else {
-		auto tab = m_tab.get();
-		for (auto& p : m_cursorCache) {
-			p->m_dbCtx->trySyncSegCtxSpeculativeLock(tab);
-		}
-		ret = m_cursorCache.pop_val();
+	if (!ret && !m_globalTtdCache.try_pop(ret)) {
+		return new TableThreadData(this->m_tab.get());
 	}
+	ret->m_dbCtx->trySyncSegCtxSpeculativeLock(m_tab.get());
 	return ret;
 }
 
 void ThreadSafeTable::releaseTableThreadData(TableThreadDataPtr ttd) {
-	std::unique_lock<std::mutex> lock(this->m_cursorCacheMutex);
-	m_cursorCache.push_back(std::move(ttd));
-}
-
-void
-ThreadSafeTable::expiringCacheItems(valvec<valvec<IndexIterDataPtr> >& vv, llong now) {
-	llong expireMillisec = m_cacheExpireMillisec;
-	for (auto& v : vv) {
-		size_t pos = 0;
-		for (; pos < v.size(); ++pos) {
-			if (g_profiling.ms(v[pos]->m_lastUseTime, now) < expireMillisec)
-				break;
+	ttd->m_lastUseTime = g_profiling.now();
+	{
+		LocalCursorCache& lc = getLocalCursorCache();
+		std::lock_guard<LocalCursorCache> lock(lc);
+		if (lc.ttds.size() < m_localCursorCacheSize) {
+			lc.ttds.push_back(std::move(ttd));
+			return;
 		}
-		v.erase_i(pos, v.size() - pos);
 	}
+	m_globalTtdCache.push(std::move(ttd));
 }
 
 IndexIterDataPtr ThreadSafeTable::allocIndexIter(size_t indexId, bool forward) {
 	auto tab = m_tab.get();
-	IndexIterDataPtr iter;
 	assert(indexId < tab->getIndexNum());
-	assert(m_indexForwardIterCache.size() == tab->getIndexNum());
-	assert(m_indexBackwardIterCache.size() == tab->getIndexNum());
-	llong now = g_profiling.now();
+	assert(m_indexIterSlotNum == 2 * tab->getIndexNum());
+	const size_t slot = 2 * indexId + (forward ? 1 : 0);
+	IndexIterDataPtr iter;
 	{
-		std::unique_lock<std::mutex> lock(m_cursorCacheMutex);
-		if (forward) {
-			if (m_indexForwardIterCache[indexId].empty()) {
-				expiringCacheItems(m_indexForwardIterCache, now);
-				expiringCacheItems(m_indexBackwardIterCache, now);
-				lock.unlock();
-				iter = new IndexIterData(tab, indexId, forward);
-			} else {
-				iter = m_indexForwardIterCache[indexId].pop_val();
-				expiringCacheItems(m_indexForwardIterCache, now);
-				expiringCacheItems(m_indexBackwardIterCache, now);
-			}
-		}
-		else {
-			if (m_indexBackwardIterCache[indexId].empty()) {
-				expiringCacheItems(m_indexForwardIterCache, now);
-				expiringCacheItems(m_indexBackwardIterCache, now);
-				lock.unlock();
-				iter = new IndexIterData(tab, indexId, forward);
-				iter->m_cursor = tab->createIndexIterBackward(indexId, nullptr);
-			} else {
-				iter = m_indexBackwardIterCache[indexId].pop_val();
-				expiringCacheItems(m_indexForwardIterCache, now);
-				expiringCacheItems(m_indexBackwardIterCache, now);
-			}
-		}
+		LocalCursorCache& lc = getLocalCursorCache();
+		std::lock_guard<LocalCursorCache> lock(lc);
+		if (!lc.iters[slot].empty())
+			iter = lc.iters[slot].pop_val();
 	}
-	iter->reset(now);
+	if (!iter && !m_globalIndexIterCache[slot].try_pop(iter)) {
+		iter = new IndexIterData(tab, indexId, forward);
+	}
+	iter->reset();
 	return iter;
 }
 
 void ThreadSafeTable::releaseIndexIter(size_t indexId, bool forward, IndexIterDataPtr iter) {
-	assert(indexId < m_indexForwardIterCache.size());
-	assert(m_indexForwardIterCache.size() == m_indexBackwardIterCache.size());
-	llong now = g_profiling.now();
-	iter->reset(now);
-	std::unique_lock<std::mutex> lock(m_cursorCacheMutex);
-	expiringCacheItems(m_indexForwardIterCache, now);
-	expiringCacheItems(m_indexBackwardIterCache, now);
-	if (forward) {
-		m_indexForwardIterCache[indexId].push_back(std::move(iter));
-	} else {
-		m_indexBackwardIterCache[indexId].push_back(std::move(iter));
+	assert(2 * indexId < m_indexIterSlotNum);
+	const size_t slot = 2 * indexId + (forward ? 1 : 0);
+	iter->reset();
+	{
+		LocalCursorCache& lc = getLocalCursorCache();
+		std::lock_guard<LocalCursorCache> lock(lc);
+		if (lc.iters[slot].size() < m_localCursorCacheSize) {
+			lc.iters[slot].push_back(std::move(iter));
+			return;
+		}
+	}
+	m_globalIndexIterCache[slot].push(std::move(iter));
+}
+
+// items are pushed back in time order, so expired items are a prefix
+template<class Vec>
+static void expireCacheItems(Vec& v, llong now, llong expireMillisec) {
+	size_t n = 0;
+	while (n < v.size() && g_profiling.ms(v[n]->m_lastUseTime, now) >= expireMillisec)
+		n++;
+	if (n)
+		v.erase_i(0, n);
+}
+
+// pop each item once, push back the unexpired ones
+template<class Queue, class Ptr>
+static void expireCacheItems(Queue& q, llong now, llong expireMillisec, Ptr*) {
+	for (size_t n = q.unsafe_size(); n > 0; --n) {
+		Ptr p;
+		if (!q.try_pop(p))
+			break;
+		if (g_profiling.ms(p->m_lastUseTime, now) < expireMillisec)
+			q.push(std::move(p));
+	}
+}
+
+void ThreadSafeTable::sweepCursorCache(llong now) {
+	const llong expireMillisec = m_cacheExpireMillisec;
+	{
+		std::lock_guard<std::mutex> listLock(m_localCursorCacheListMutex);
+		for (LocalCursorCache* lc : m_localCursorCacheList) {
+			std::lock_guard<LocalCursorCache> lock(*lc);
+			expireCacheItems(lc->ttds, now, expireMillisec);
+			for (auto& v : lc->iters)
+				expireCacheItems(v, now, expireMillisec);
+		}
+	}
+	expireCacheItems(m_globalTtdCache, now, expireMillisec, (TableThreadDataPtr*)NULL);
+	for (size_t i = 0; i < m_indexIterSlotNum; ++i) {
+		expireCacheItems(m_globalIndexIterCache[i], now, expireMillisec, (IndexIterDataPtr*)NULL);
 	}
 }
 
@@ -234,10 +328,19 @@ void ThreadSafeTable::destroy() {
 		});
 		m_dangerSubObjects.clear();
 	}
+	CursorCacheSweeper::instance().remove(this);
 	m_ruMap.clear();
-	m_indexForwardIterCache.clear();
-	m_indexBackwardIterCache.clear();
-	m_cursorCache.clear();
+	{
+		std::lock_guard<std::mutex> lock(m_localCursorCacheListMutex);
+		for (LocalCursorCache* lc : m_localCursorCacheList) {
+			delete lc;
+		}
+		m_localCursorCacheList.clear();
+	}
+	m_localCursorCache.clear();
+	m_globalTtdCache.clear();
+	m_globalIndexIterCache.reset();
+	m_indexIterSlotNum = 0;
 	m_ttd.clear();
 	log() << "ThreadSafeTable::destroy(): m_tab->refcnt = " << m_tab->get_refcount()
 		<< ", thread local m_ttd.size = " << m_ttd.size();
@@ -344,6 +447,26 @@ struct ChangeForDelete : public RecoveryUnit::Change {
 	RecordId m_id;
 };
 
+// m_inprogressWritingCount is held until commit or rollback, so the
+// writable segment of the record can not be frozen in between and the
+// rollback can always restore the old row in place
+struct ChangeForUpdate : public RecoveryUnit::Change {
+    void commit() override {
+		m_tst->m_tab->m_inprogressWritingCount--;
+	}
+    void rollback() override {
+		m_tst->rollbackUpdate(m_id, m_oldRow);
+		m_tst->m_tab->m_inprogressWritingCount--;
+	}
+	ChangeForUpdate(ThreadSafeTable* tst, RecordId id, fstring oldRow)
+		: m_tst(tst), m_id(id), m_oldRow(oldRow.str()) {
+		m_tst->m_tab->m_inprogressWritingCount++;
+	}
+	ThreadSafeTable* m_tst;
+	RecordId m_id;
+	std::string m_oldRow;
+};
+
 void ThreadSafeTable::registerInsert(RecoveryUnit* ru, RecordId id) {
 	m_tab->delmarkSet1(id.repr()-1);
 	auto  x = this->getRecoveryUnitData(ru);
@@ -408,6 +531,23 @@ void ThreadSafeTable::registerDelete(RecoveryUnit* ru, RecordId id) {
 	ru->registerChange(new ChangeForDelete(this, ru, id));
 }
 
+void ThreadSafeTable::registerUpdate(RecoveryUnit* ru, RecordId id, fstring oldRow) {
+	LOG(2) << "ThreadSafeTable::registerUpdate(): id = " << id
+		<< ", ru = " << (void*)ru
+		<< ", dir: " << m_tab->getDir().string();
+	ru->registerChange(new ChangeForUpdate(this, id, oldRow));
+}
+
+void ThreadSafeTable::rollbackUpdate(RecordId id, fstring oldRow) {
+	llong recIdx = id.repr()-1;
+	auto& td = getMyThreadData();
+	// ChangeForUpdate prevents the segment from being frozen
+	llong newRecIdx = m_tab->updateRow(recIdx, oldRow, td.m_dbCtx.get());
+	invariant(newRecIdx == recIdx);
+	LOG(2) << "ThreadSafeTable::rollbackUpdate(): id = " << id
+		<< ", dir: " << m_tab->getDir().string();
+}
+
 void ThreadSafeTable::commitDelete(RecoveryUnit* ru, RecordId id) {
 	llong recIdx = id.repr()-1;
 	auto rud = this->getRecoveryUnitData(ru);
@@ -520,6 +660,7 @@ public:
 	}
 	bool increment(llong* id, valvec<unsigned char>* val) override {
 		auto tab = static_cast<DbTable*>(m_store.get());
+		m_id = std::max(m_id, tab->oldestRowId()); // skip dropped segments
 		while (m_id < tab->inlineGetRowNum()) {
 			if (getVal(*id = m_id++, val))
 				return true;
@@ -537,7 +678,7 @@ public:
 	void reset() override {
 		auto tab = static_cast<DbTable*>(m_store.get());
 		m_rud->m_ttd->m_dbCtx->trySyncSegCtxSpeculativeLock(tab);
-		m_id = 0;
+		m_id = tab->oldestRowId();
 	}
 };
 
@@ -553,7 +694,8 @@ public:
 		traceFunc("RuStoreIterBackward::~RuStoreIterBackward()");
 	}
 	bool increment(llong* id, valvec<unsigned char>* val) override {
-		while (m_id > 0) {
+		auto tab = static_cast<DbTable*>(m_store.get());
+		while (m_id > tab->oldestRowId()) {
 			if (getVal(*id = --m_id, val))
 				return true;
 		}
@@ -802,14 +944,16 @@ TerichDbKVEngine::createRecordStore(OperationContext* opCtx,
 	if (ident == "_mdb_catalog") {
 		return m_wtEngine->createRecordStore(opCtx, ns, ident, options);
 	}
-	if (NamespaceString(ns).isOnInternalDb()) {
-		return m_wtEngine->createRecordStore(opCtx, ns, ident, options);
-	}
     if (options.capped) {
-		// now don't use TerichDbRecordStoreCapped
-		// use TerichDbRecordStoreCapped when we need hook some virtual functions
-		return m_wtEngine->createRecordStore(opCtx, ns, ident, options);
+		// capped collections, including the oplog, use TerichDbRecordStoreCapped
+		// only if MongoTerichDB_NativeCapped=1
+		if (!terark::getEnvBool("MongoTerichDB_NativeCapped", false)) {
+			return m_wtEngine->createRecordStore(opCtx, ns, ident, options);
+		}
     }
+	else if (NamespaceString(ns).isOnInternalDb()) {
+		return m_wtEngine->createRecordStore(opCtx, ns, ident, options);
+	}
     LOG(2) << "TerichDbKVEngine::createRecordStore: ns:" << ns << ", ident: " << ident
 		<< "\noptions.storageEngine: " << options.storageEngine.jsonString(Strict, true)
 		<< "\noptions.indexOptionDefaults: " << options.indexOptionDefaults.jsonString(Strict, true)
@@ -827,9 +971,11 @@ TerichDbKVEngine::createRecordStore(OperationContext* opCtx,
 		BSONElement dbmetaElem = options.storageEngine[kTerichDbEngineName];
 		std::string dbmetaData;
 		if (!dbmetaElem || !dbmetaElem.Obj().getField("RowSchema")) {
-			if (terark::getEnvBool("MongoTerichDB_DynamicCreateCollection")) {
+			if (options.capped ||
+				terark::getEnvBool("MongoTerichDB_DynamicCreateCollection")) {
 				LOG(1) << "TerichDbKVEngine::createRecordStore: ns:" << ns
-					<< ", tabDir=" << tabDir.string() << ", DynamicCreateCollection";
+					<< ", tabDir=" << tabDir.string() << ", DynamicCreateCollection"
+					<< ", capped = " << options.capped;
 				dbmetaData =
 //      "_id": { "type": "fixed", "length": 12 },
 //  "TableIndex": [
@@ -845,6 +991,13 @@ R"({
   },
   "LastField": "for stupid json comma"
 })";
+				if (options.capped) {
+					// segments are dropped as a whole, the default writing
+					// segment size(3GB) is far larger than most caps
+					llong maxWrSegSize = std::max<llong>(options.cappedSize / 4, 1 << 20);
+					dbmetaData.insert(2, "  \"MaxWrSegSize\": " +
+										 std::to_string(maxWrSegSize) + ",\n");
+				}
 			}
 			else {
 				// damn! mongodb does not allowing createRecordStore fails
@@ -899,15 +1052,21 @@ TerichDbKVEngine::getRecordStore(OperationContext* opCtx,
 	if (ident == "_mdb_catalog") {
 		return m_wtEngine->getRecordStore(opCtx, ns, ident, options);
 	}
+    if (options.capped) {
+		// capped collections created before native capped store or with
+		// without MongoTerichDB_NativeCapped=1 are still in wiredtiger
+		ThreadSafeTable* tab = openTable(ns, ident);
+		if (NULL == tab) {
+			return m_wtEngine->getRecordStore(opCtx, ns, ident, options);
+		}
+		int64_t cappedMaxSize = options.cappedSize ? options.cappedSize : 4096;
+		int64_t cappedMaxDocs = options.cappedMaxDocs ? options.cappedMaxDocs : -1;
+		return new TerichDbRecordStoreCapped(opCtx, ns, ident, tab,
+							cappedMaxSize, cappedMaxDocs, NULL);
+    }
 	if (NamespaceString(ns).isOnInternalDb()) {
 		return m_wtEngine->getRecordStore(opCtx, ns, ident, options);
 	}
-    if (options.capped) {
-		// now don't use TerichDbRecordStoreCapped
-		// use TerichDbRecordStoreCapped when we need hook some virtual functions
-		// const bool ephemeral = false;
-		return m_wtEngine->getRecordStore(opCtx, ns, ident, options);
-    }
 
 	ThreadSafeTable* tab = openTable(ns, ident);
 	if (NULL == tab) {
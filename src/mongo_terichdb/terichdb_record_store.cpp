@@ -62,6 +62,10 @@
 #include "mongo/util/scopeguard.h"
 #include "mongo/util/time_support.h"
 #include <boost/none.hpp>
+#include <terark/util/fstrvec.hpp>
+#include <terark/terichdb/db_segment.hpp>
+#include <random>
+#include <limits.h>
 
 //#define RS_ITERATOR_TRACE(x) log() << "TerichDbRS::Iterator " << x
 #define RS_ITERATOR_TRACE(x)
@@ -70,6 +74,8 @@ namespace mongo { namespace db {
 
 using std::unique_ptr;
 using std::string;
+using terark::terichdb::DbContext;
+using terark::terichdb::ReadableSegment;
 
 namespace {
 
@@ -87,9 +93,13 @@ static_assert(kCurrentRecordStoreVersion <= kMaximumRecordStoreVersion,
 
 class TerichDbRecordStore::Cursor final : public SeekableRecordCursor, public ICleanOnOwnerDead {
 public:
-    Cursor(OperationContext* txn, const TerichDbRecordStore& rs, bool forward)
+    // [begIdx, endIdx) limits a forward cursor to a record id range,
+    // used by getManyCursors
+    Cursor(OperationContext* txn, const TerichDbRecordStore& rs, bool forward,
+           llong begIdx = 0, llong endIdx = LLONG_MAX)
         : _rs(rs),
-          _txn(txn), _forward(forward) {
+          _txn(txn), _forward(forward), _begIdx(begIdx), _endIdx(endIdx) {
+		invariant(forward || (0 == begIdx && LLONG_MAX == endIdx));
 		LOG(1) << "TerichDbRecordStore::Cursor::Cursor(): forward = " << forward;
 		init(txn);
 		rs.m_table->registerCleanOnOwnerDead(this);
@@ -146,7 +156,14 @@ public:
 
         llong recIdx = _lastReturnedId.repr() - 1;
         if (!_skipNextAdvance) {
-            if (!_cursor->increment(&recIdx, &m_ttd->m_buf)) {
+            if (_lastReturnedId.isNull() && _begIdx > 0) {
+                recIdx = _cursor->seekLowerBound(_begIdx, &m_ttd->m_buf);
+                if (recIdx < 0) {
+                    _eof = true;
+                    return {};
+                }
+            }
+            else if (!_cursor->increment(&recIdx, &m_ttd->m_buf)) {
                 _eof = true;
                 return {};
             }
@@ -164,6 +181,11 @@ public:
 		else {
 			assert(!m_ttd->m_buf.empty());
 		}
+		if (recIdx >= _endIdx) {
+			_skipNextAdvance = false;
+			_eof = true;
+			return {};
+		}
 		DbTable* tab = _rs.m_table->m_tab.get();
         SharedBuffer sbuf = m_ttd->m_coder.decode(&tab->rowSchema(), m_ttd->m_buf);
         const RecordId id(recIdx + 1);
@@ -301,11 +323,179 @@ private:
 	bool m_hasRecoveryUnit = false;
 	bool m_isOwnerAlive = true;
 	const bool _forward;
+	const llong _begIdx;
+	const llong _endIdx;
 	TableThreadDataPtr m_ttd;
     terark::terichdb::StoreIteratorPtr _cursor;
     RecordId _lastReturnedId;  // If null, need to seek to first/last record.
 };
 
+// Each next() returns an independent random live record, for $sample.
+// A segment is picked weighted by its live rows, then a sub id in it is
+// picked by random probes on m_isDel, if all probes hit deleted records
+// (very sparse segment), the first live record after last probe is used.
+// If all retries failed, records are linearly scanned from a position
+// picked uniformly in all records, wrapping around at the end.
+class TerichDbRecordStore::RandomCursor final : public RecordCursor, public ICleanOnOwnerDead {
+public:
+    RandomCursor(OperationContext* txn, const TerichDbRecordStore& rs)
+        : _rs(rs), _txn(txn), m_rng(std::random_device()()) {
+		LOG(1) << "TerichDbRecordStore::RandomCursor::RandomCursor()";
+		m_ttd = rs.m_table->allocTableThreadData();
+		rs.m_table->registerCleanOnOwnerDead(this);
+    }
+
+	~RandomCursor() {
+		if (!m_isOwnerAlive) {
+			return;
+		}
+		ThreadSafeTable* tst = _rs.m_table.get();
+		if (m_ttd) {
+			tst->releaseTableThreadData(m_ttd);
+		}
+		m_ttd = nullptr;
+		tst->unregisterCleanOnOwnerDead(this);
+	}
+
+	void onOwnerPrematureDeath() override final {
+		if (m_ttd) {
+			_rs.m_table->releaseTableThreadData(m_ttd);
+		}
+		m_ttd = nullptr;
+		m_isOwnerAlive = false;
+	}
+
+    boost::optional<Record> next() final {
+		DbTable* tab = _rs.m_table->m_tab.get();
+		DbContext* ctx = m_ttd->m_dbCtx.get();
+		const int maxRetry = 32; // sampled record may be deleted concurrently
+		for (int retry = 0; retry < 2 * maxRetry; ++retry) {
+			llong recIdx = retry < maxRetry ? sampleRecIdx(tab, ctx)
+											: scanRecIdx(tab, ctx);
+			if (recIdx == -1) {
+				return {}; // table has no live record
+			}
+			if (recIdx < 0) {
+				continue;
+			}
+			try {
+				tab->getValue(recIdx, &m_ttd->m_buf, ctx);
+			}
+			catch (const terark::terichdb::ReadDeletedRecordException&) {
+				continue;
+			}
+			SharedBuffer sbuf = m_ttd->m_coder.decode(&tab->rowSchema(), m_ttd->m_buf);
+			int len = ConstDataView(sbuf.get()).read<LittleEndian<int>>();
+			return {{RecordId(recIdx + 1), {sbuf, len}}};
+		}
+		return {};
+    }
+
+    void save() final {}
+    bool restore() final { return true; }
+
+    void detachFromOperationContext() final {
+		if (m_ttd) {
+			_rs.m_table->releaseTableThreadData(m_ttd);
+		}
+		m_ttd = nullptr;
+        _txn = nullptr;
+    }
+
+    void reattachToOperationContext(OperationContext* txn) final {
+        _txn = txn;
+		m_ttd = _rs.m_table->allocTableThreadData();
+    }
+
+private:
+	///@returns -1 if no live record, -2 if should retry
+	llong sampleRecIdx(DbTable* tab, DbContext* ctx) {
+		ctx->trySyncSegCtxSpeculativeLock(tab);
+		const llong* rowNumVec = ctx->m_rowNumVec.data();
+		const size_t segNum = ctx->m_segCtx.size();
+		m_liveRowsPrefix.resize_no_init(segNum + 1);
+		m_liveRowsPrefix[0] = 0;
+		for (size_t i = 0; i < segNum; ++i) {
+			const ReadableSegment* seg = ctx->m_segCtx[i]->seg;
+			llong rows = rowNumVec[i+1] - rowNumVec[i];
+			llong live = std::max<llong>(rows - llong(seg->m_delcnt), 0);
+			m_liveRowsPrefix[i+1] = m_liveRowsPrefix[i] + live;
+		}
+		llong totalLive = m_liveRowsPrefix[segNum];
+		if (totalLive <= 0) {
+			return -1;
+		}
+		llong r = llong(m_rng() % ullong(totalLive));
+		size_t segIdx = std::upper_bound(m_liveRowsPrefix.begin(),
+				m_liveRowsPrefix.end(), r) - m_liveRowsPrefix.begin() - 1;
+		const ReadableSegment* seg = ctx->m_segCtx[segIdx]->seg;
+		const llong baseId = rowNumVec[segIdx];
+		const size_t rows = size_t(rowNumVec[segIdx+1] - baseId);
+		assert(rows > 0);
+		size_t subId = 0;
+		for (int probe = 0; probe < 16; ++probe) {
+			subId = size_t(m_rng() % rows);
+			if (!seg->testIsDel(subId)) {
+				return baseId + subId;
+			}
+		}
+		if (!seg->m_isFreezed) {
+			return -2; // m_isDel may be resized by writers
+		}
+		size_t next = subId + seg->m_isDel.one_seq_len(subId);
+		if (next >= rows) {
+			next = seg->m_isDel.one_seq_len(0);
+			if (next >= rows)
+				return -2; // all deleted, m_delcnt was stale
+		}
+		return baseId + next;
+	}
+
+	///@returns -1 if no live record
+	llong scanRecIdx(DbTable* tab, DbContext* ctx) {
+		ctx->trySyncSegCtxSpeculativeLock(tab);
+		const llong* rowNumVec = ctx->m_rowNumVec.data();
+		const size_t segNum = ctx->m_segCtx.size();
+		const llong totalRows = rowNumVec[segNum];
+		if (totalRows <= 0) {
+			return -1;
+		}
+		const llong start = llong(m_rng() % ullong(totalRows));
+		const size_t startSeg = std::upper_bound(rowNumVec,
+				rowNumVec + segNum + 1, start) - rowNumVec - 1;
+		// the start segment is visited twice: from start, and up to start
+		for (size_t k = 0; k <= segNum; ++k) {
+			const size_t segIdx = (startSeg + k) % segNum;
+			const ReadableSegment* seg = ctx->m_segCtx[segIdx]->seg;
+			const llong baseId = rowNumVec[segIdx];
+			const size_t rows = size_t(rowNumVec[segIdx+1] - baseId);
+			const size_t beg = 0 == k ? size_t(start - baseId) : 0;
+			const size_t end = segNum == k ? size_t(start - baseId) : rows;
+			if (seg->m_isFreezed) {
+				for (size_t subId = beg; subId < end; ) {
+					if (!seg->testIsDel(subId))
+						return baseId + subId;
+					subId += seg->m_isDel.one_seq_len(subId);
+				}
+			}
+			else {
+				for (size_t subId = beg; subId < end; ++subId) {
+					if (!seg->testIsDel(subId))
+						return baseId + subId;
+				}
+			}
+		}
+		return -1;
+	}
+
+    const TerichDbRecordStore& _rs;
+    OperationContext* _txn;
+	bool m_isOwnerAlive = true;
+	TableThreadDataPtr m_ttd;
+	std::mt19937_64 m_rng;
+	valvec<llong> m_liveRowsPrefix;
+};
+
 StatusWith<std::string> parseOptionsField(const BSONObj options) {
     StringBuilder ss;
     BSONForEach(elem, options) {
@@ -335,6 +525,14 @@ TerichDbRecordStore::TerichDbRecordStore(OperationContext* ctx,
 		  _ident(ident.toString()),
 		  _shuttingDown(false)
 {
+	const terark::terichdb::SchemaConfig& sconf = tab->m_tab->getSchemaConfig();
+	m_hasInplaceColumns = false;
+	for (size_t i = 0; i < sconf.m_rowSchema->columnNum(); ++i) {
+		if (sconf.isInplaceUpdatableColumn(i)) {
+			m_hasInplaceColumns = true;
+			break;
+		}
+	}
 }
 
 TerichDbRecordStore::~TerichDbRecordStore() {
@@ -436,27 +634,49 @@ Status TerichDbRecordStore::insertRecords(OperationContext* txn,
     auto& td = m_table->getMyThreadData();
 	if (0 == records->size()) {
 	    LOG(1) << "TerichDbRecordStore::insertRecords(): records->size() = 0";
+	    return Status::OK();
 	}
+	// encode all records first, then insert them by one batch
+	terark::fstrvec rowsData;
     for (size_t i = 0; i < records->size(); ++i) {
-		Record& rec = (*records)[i];
-    	BSONObj bson(rec.data.data());
+    	BSONObj bson((*records)[i].data.data());
 		try {
 			td.m_coder.encode(&tab->rowSchema(), nullptr, bson, &td.m_buf);
 		} catch (const std::exception& ex) {
 			return Status(ErrorCodes::InvalidBSON, ex.what());
 		}
-		try {
-			rec.id = RecordId(1 + tab->insertRow(td.m_buf, &*td.m_dbCtx));
-		} catch (const std::exception& ex) {
-			return Status(ErrorCodes::InternalError, ex.what());
+		rowsData.push_back(fstring(td.m_buf));
+	}
+	terark::valvec<fstring> rows(records->size(), terark::valvec_no_init());
+	for (size_t i = 0; i < rows.size(); ++i) {
+		rows[i] = fstring(rowsData[i]);
+	}
+	terark::valvec<llong> recIdvec(records->size(), terark::valvec_no_init());
+	Status status = Status::OK();
+	try {
+		size_t okNum = tab->insertRows(rows.data(), rows.size(), recIdvec.data(), &*td.m_dbCtx);
+		if (okNum != rows.size()) {
+			status = Status(ErrorCodes::DuplicateKey, td.m_dbCtx->errMsg);
+		}
+	} catch (const std::exception& ex) {
+		status = Status(ErrorCodes::InternalError, ex.what());
+	}
+	// rows inserted before a failure are registered too, so that they are
+	// removed when the unit of work is rolled back
+    for (size_t i = 0; i < records->size(); ++i) {
+		Record& rec = (*records)[i];
+		if (recIdvec[i] < 0) {
+			rec.id = RecordId();
+			continue;
 		}
+		rec.id = RecordId(1 + recIdvec[i]);
 		if (txn && txn->recoveryUnit()) {
 			m_table->registerInsert(txn->recoveryUnit(), rec.id);
 		}
 	    LOG(2) << "TerichDbRecordStore::insertRecords(): i = " << i
-			<< ", bson = " << bson.toString() << ", id = " << rec.id;
+			<< ", id = " << rec.id;
     }
-    return Status::OK();
+    return status;
 }
 
 StatusWith<RecordId> TerichDbRecordStore::insertRecord(OperationContext* txn,
@@ -600,9 +820,81 @@ TerichDbRecordStore::updateRecord(OperationContext* txn,
 }
 
 bool TerichDbRecordStore::updateWithDamagesSupported() const {
-    return false;
+	if (!m_hasInplaceColumns) {
+		return false;
+	}
+	auto& td = m_table->getMyThreadData();
+	if (td.m_noDamagesOnce) {
+		// retry of an update which updateWithDamages can not apply
+		td.m_noDamagesOnce = false;
+		return false;
+	}
+    return true;
+}
+
+namespace {
+
+// restore old column data of an inplace damage update on rollback
+struct ChangeForUpdateColumn : public RecoveryUnit::Change {
+    void commit() override {}
+    void rollback() override {
+		m_tab->updateColumn(m_recIdx, m_columnId, m_oldData);
+	}
+	ChangeForUpdateColumn(DbTable* tab, llong recIdx, size_t columnId, fstring oldData)
+	  : m_tab(tab), m_recIdx(recIdx), m_columnId(columnId), m_oldData(oldData.str()) {}
+	DbTablePtr  m_tab;
+	llong       m_recIdx;
+	size_t      m_columnId;
+	std::string m_oldData;
+};
+
+// @returns row column id if elem value is stored verbatim in an inplace
+//          updatable fixed length column, else size_t(-1)
+size_t inplaceColumnOfElem(const terark::terichdb::SchemaConfig& sconf,
+						   const BSONElement& elem) {
+	using terark::terichdb::ColumnType;
+	const Schema& rowSchema = *sconf.m_rowSchema;
+	size_t columnId = rowSchema.getColumnId(elem.fieldName());
+	if (columnId >= rowSchema.columnNum()) {
+		return size_t(-1); // in schema-less column
+	}
+	if (!sconf.isInplaceUpdatableColumn(columnId)) {
+		return size_t(-1);
+	}
+	const auto& colmeta = rowSchema.getColumnMeta(columnId);
+	bool verbatim = false;
+	switch (elem.type()) {
+	default:
+		break;
+	case mongo::Bool:
+		verbatim = colmeta.type == ColumnType::Uint08;
+		break;
+	case NumberInt:
+		verbatim = colmeta.type == ColumnType::Sint32 ||
+				   colmeta.type == ColumnType::Uint32;
+		break;
+	case NumberLong:
+	case bsonTimestamp:
+	case mongo::Date:
+		verbatim = colmeta.type == ColumnType::Sint64 ||
+				   colmeta.type == ColumnType::Uint64;
+		break;
+	case NumberDouble:
+		verbatim = colmeta.type == ColumnType::Float64;
+		break;
+	}
+	if (!verbatim || colmeta.fixedLen != size_t(elem.valuesize())) {
+		return size_t(-1);
+	}
+	return columnId;
 }
 
+} // namespace
+
+// Damages which are all inside values of inplace updatable fixed length
+// columns are written by DbTable::updateColumn, other damages are merged
+// and written by updateMergedRow, the record id is never changed, if it
+// would be, the update is retried by mongo as a normal full row update.
 StatusWith<RecordData> TerichDbRecordStore::updateWithDamages(
 							OperationContext* txn,
 							const RecordId& id,
@@ -610,23 +902,197 @@ StatusWith<RecordData> TerichDbRecordStore::updateWithDamages(
 							const char* damageSource,
 							const mutablebson::DamageVector& damages)
 {
-    MONGO_UNREACHABLE;
+	DbTable* tab = m_table->m_tab.get();
+	invariant(id.repr() != 0);
+	llong recIdx = id.repr() - 1;
+	const char* oldData = oldRec.data();
+	const int size = oldRec.size();
+	SharedBuffer newBuf = SharedBuffer::allocate(size);
+	memcpy(newBuf.get(), oldData, size);
+	for (const auto& d : damages) {
+		memcpy(newBuf.get() + d.targetOffset, damageSource + d.sourceOffset, d.size);
+	}
+	struct DamagedColumn {
+		size_t columnId;
+		size_t offset; // of value in bson
+		size_t len;
+	};
+	const terark::terichdb::SchemaConfig& sconf = tab->getSchemaConfig();
+	valvec<DamagedColumn> columns;
+	size_t coveredNum = 0;
+	bool isInplace = true;
+	BSONObj oldObj(oldData);
+	for (auto it = oldObj.begin(); isInplace && it.more(); ) {
+		BSONElement elem = it.next();
+		size_t elemBeg = elem.rawdata() - oldData;
+		size_t valBeg = elem.value() - oldData;
+		size_t valEnd = valBeg + elem.valuesize();
+		for (const auto& d : damages) {
+			size_t dBeg = d.targetOffset, dEnd = d.targetOffset + d.size;
+			if (dEnd <= elemBeg || dBeg >= valEnd)
+				continue;
+			size_t columnId = size_t(-1);
+			if (dBeg >= valBeg && dEnd <= valEnd)
+				columnId = inplaceColumnOfElem(sconf, elem);
+			if (size_t(-1) == columnId) {
+				isInplace = false; // type byte, field name or variable length
+				break;
+			}
+			if (columns.empty() || columns.back().columnId != columnId) {
+				columns.push_back({columnId, valBeg, valEnd - valBeg});
+			}
+			coveredNum++;
+		}
+	}
+	if (!isInplace || coveredNum != damages.size()) {
+		LOG(2) << "TerichDbRecordStore::updateWithDamages(): id = " << id
+			<< ", fallback to updateMergedRow";
+		return updateMergedRow(txn, id, oldData, newBuf, size);
+	}
+	terark::terichdb::IncrementGuard_size_t incrGuard(tab->m_inprogressWritingCount);
+	auto& td = m_table->getMyThreadData();
+	RecoveryUnit* ru = txn ? txn->recoveryUnit() : nullptr;
+	try {
+		for (const auto& c : columns) {
+			fstring newVal(newBuf.get() + c.offset, c.len);
+			tab->updateColumn(recIdx, c.columnId, newVal, &*td.m_dbCtx);
+			if (ru) {
+				fstring oldVal(oldData + c.offset, c.len);
+				ru->registerChange(new ChangeForUpdateColumn(tab, recIdx, c.columnId, oldVal));
+			}
+		}
+	} catch (const std::exception& ex) {
+		return Status(ErrorCodes::InternalError, ex.what());
+	}
+	LOG(2) << "TerichDbRecordStore::updateWithDamages(): id = " << id
+		<< ", inplace updated columns: " << columns.size();
+	return RecordData(newBuf, size);
+}
+
+// Damages are only requested when mongo indices are not affected, so the
+// record id must be kept: changed columns are written by updateColumn if
+// all of them are inplace updatable, which works in any segment, else the
+// row is rewritten by updateRow, which keeps the id in the writable segment.
+// A row in a frozen segment can only be rewritten by moving it, which must
+// be done by mongo for its indices: WriteConflictException makes mongo retry
+// the update, the retry sees updateWithDamagesSupported() == false and goes
+// through updateRecord, whose NeedsDocumentMove moves the document.
+StatusWith<RecordData>
+TerichDbRecordStore::updateMergedRow(OperationContext* txn,
+									 const RecordId& id,
+									 const char* oldData,
+									 SharedBuffer newBuf,
+									 int size) {
+	using terark::terichdb::ColumnVec;
+	DbTable* tab = m_table->m_tab.get();
+	terark::terichdb::IncrementGuard_size_t incrGuard(tab->m_inprogressWritingCount);
+	llong recIdx = id.repr() - 1;
+	auto& td = m_table->getMyThreadData();
+	const Schema& rowSchema = tab->rowSchema();
+	valvec<unsigned char> oldRow, newRow;
+	try {
+		td.m_coder.encode(&rowSchema, nullptr, BSONObj(oldData), &oldRow);
+		td.m_coder.encode(&rowSchema, nullptr, BSONObj(newBuf.get()), &newRow);
+	} catch (const std::exception& ex) {
+		return Status(ErrorCodes::InvalidBSON, ex.what());
+	}
+	ColumnVec oldCols, newCols;
+	rowSchema.parseRow(oldRow, &oldCols);
+	rowSchema.parseRow(newRow, &newCols);
+	const terark::terichdb::SchemaConfig& sconf = tab->getSchemaConfig();
+	valvec<size_t> changed;
+	bool allInplace = true;
+	for (size_t columnId = 0; columnId < rowSchema.columnNum(); ++columnId) {
+		if (oldCols[columnId] != newCols[columnId]) {
+			changed.push_back(columnId);
+			if (!sconf.isInplaceUpdatableColumn(columnId))
+				allInplace = false;
+		}
+	}
+	RecoveryUnit* ru = txn ? txn->recoveryUnit() : nullptr;
+	try {
+		if (allInplace) {
+			for (size_t columnId : changed) {
+				tab->updateColumn(recIdx, columnId, newCols[columnId], &*td.m_dbCtx);
+				if (ru) {
+					ru->registerChange(new ChangeForUpdateColumn(
+						tab, recIdx, columnId, oldCols[columnId]));
+				}
+			}
+			LOG(2) << "TerichDbRecordStore::updateMergedRow(): id = " << id
+				<< ", inplace updated columns: " << changed.size();
+			return RecordData(newBuf, size);
+		}
+		{
+			terark::terichdb::MyRwLock lock(tab->m_rwMutex, false);
+			size_t segIdx = tab->getSegmentIndexOfRecordIdNoLock(recIdx);
+			if (segIdx >= tab->getSegNum()) {
+				return Status(ErrorCodes::InvalidIdField, "record id is out of range");
+			}
+			if (tab->getSegmentPtr(segIdx)->m_isFreezed) {
+				LOG(2) << "TerichDbRecordStore::updateMergedRow(): id = " << id
+					<< ", segment is frozen, retry as full row update";
+				td.m_noDamagesOnce = true;
+				throw WriteConflictException();
+			}
+		}
+		// incrGuard prevents the writable segment from being frozen
+		llong newRecIdx = tab->updateRow(recIdx, newRow, &*td.m_dbCtx);
+		if (newRecIdx < 0) {
+			return Status(ErrorCodes::DuplicateKey, td.m_dbCtx->errMsg);
+		}
+		invariant(newRecIdx == recIdx);
+		if (ru) {
+			m_table->registerUpdate(ru, id, oldRow);
+		}
+	} catch (const WriteConflictException&) {
+		throw;
+	} catch (const std::exception& ex) {
+		return Status(ErrorCodes::InternalError, ex.what());
+	}
+	LOG(2) << "TerichDbRecordStore::updateMergedRow(): id = " << id
+		<< ", updated row in writable segment";
+	return RecordData(newBuf, size);
 }
 
 std::unique_ptr<SeekableRecordCursor>
 TerichDbRecordStore::getCursor(OperationContext* txn, bool forward) const {
+	if (forward) {
+		return stdx::make_unique<Cursor>(txn, *this, forward, 0, visibleEndIdx(txn));
+	}
     return stdx::make_unique<Cursor>(txn, *this, forward);
 }
 
 std::unique_ptr<RecordCursor>
 TerichDbRecordStore::getRandomCursor(OperationContext* txn) const {
-    return nullptr;
+    return stdx::make_unique<RandomCursor>(txn, *this);
 }
 
+// one cursor per segment, they can be scanned in parallel,
+// the last cursor also covers records inserted after this call
 std::vector<std::unique_ptr<RecordCursor>>
 TerichDbRecordStore::getManyCursors(OperationContext* txn) const {
-    std::vector<std::unique_ptr<RecordCursor>> cursors(1);
-    cursors[0] = stdx::make_unique<Cursor>(txn, *this, /*forward=*/true);
+	DbTable* tab = m_table->m_tab.get();
+	valvec<llong> rowNumVec;
+	{
+		auto& td = m_table->getMyThreadData();
+		DbContext* ctx = td.m_dbCtx.get();
+		ctx->trySyncSegCtxSpeculativeLock(tab);
+		rowNumVec.assign(ctx->m_rowNumVec);
+	}
+    std::vector<std::unique_ptr<RecordCursor>> cursors;
+	const size_t segNum = rowNumVec.size() - 1;
+	for (size_t i = 0; i < segNum; ++i) {
+		llong begIdx = rowNumVec[i];
+		llong endIdx = i+1 < segNum ? rowNumVec[i+1] : LLONG_MAX;
+		if (begIdx < endIdx) {
+			cursors.push_back(stdx::make_unique<Cursor>(txn, *this,
+							  /*forward=*/true, begIdx, endIdx));
+		}
+	}
+	if (cursors.empty()) {
+		cursors.push_back(stdx::make_unique<Cursor>(txn, *this, /*forward=*/true));
+	}
     return cursors;
 }
 
@@ -33,6 +33,7 @@
 #pragma once
 
 #include <boost/thread/mutex.hpp>
+#include <limits.h>
 #include <set>
 #include <string>
 
@@ -158,10 +159,22 @@ public:
 
     ThreadSafeTablePtr m_table;
 
+protected:
+    // forward cursors don't return records at or after this record index,
+    // capped oplog hides records after the first uncommitted one
+    virtual llong visibleEndIdx(OperationContext* txn) const { return LLONG_MAX; }
+
 private:
+    StatusWith<RecordData> updateMergedRow(OperationContext* txn,
+                                           const RecordId& id,
+                                           const char* oldData,
+                                           SharedBuffer newBuf,
+                                           int size);
     class Cursor;
+    class RandomCursor;
     const std::string _ident;
     bool _shuttingDown;
+    bool m_hasInplaceColumns; // updateWithDamagesSupported
 };
 
 // TerichDb failpoint to throw write conflict exceptions randomly
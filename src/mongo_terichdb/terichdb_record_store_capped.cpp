@@ -41,92 +41,69 @@
 
 #include "mongo_terichdb_common.hpp"
 
-#include "mongo/base/checked_cast.h"
-#include "mongo/bson/util/builder.h"
-#include "mongo/db/concurrency/locker.h"
-#include "mongo/db/concurrency/write_conflict_exception.h"
+#include "mongo/base/data_view.h"
+#include "mongo/bson/timestamp.h"
 #include "mongo/db/namespace_string.h"
 #include "mongo/db/operation_context.h"
-#include "mongo/db/service_context.h"
 #include "mongo/db/storage/oplog_hack.h"
-#include "terichdb_customization_hooks.h"
-#include "terichdb_global_options.h"
-//#include "terichdb_kv_engine.h"
-//#include "terichdb_record_store_oplog_stones.h"
-//#include "terichdb_recovery_unit.h"
-//#include "terichdb_session_cache.h"
-#include "terichdb_size_storer.h"
-//#include "terichdb_util.h"
+#include "terichdb_recovery_unit.h"
+#include "mongo/stdx/chrono.h"
 #include "mongo/stdx/memory.h"
 #include "mongo/util/assert_util.h"
-#include "mongo/util/fail_point.h"
 #include "mongo/util/log.h"
 #include "mongo/util/mongoutils/str.h"
-#include "mongo/util/scopeguard.h"
-#include "mongo/util/time_support.h"
-
-#include "mongo/db/storage/wiredtiger/wiredtiger_record_store.h"
+#include <terark/terichdb/db_segment.hpp>
 
 namespace mongo { namespace db {
 
 using std::unique_ptr;
 using std::string;
+using terark::terichdb::DbContext;
+using terark::terichdb::ReadableSegment;
 
-class TerichDbRecordStoreCapped::Cursor final : public SeekableRecordCursor {
+// remove the record from uncommitted set on commit or rollback,
+// the record itself is removed on rollback by ThreadSafeTable::rollbackInsert
+class TerichDbRecordStoreCapped::InsertChange : public RecoveryUnit::Change {
 public:
-    Cursor(OperationContext* txn, const TerichDbRecordStoreCapped& rs, bool forward)
-        : m_rs(rs)
-		, m_wtCursor(rs.m_wiredtigerCappedStore->getCursor(txn, forward))
-	{}
-
-    boost::optional<Record> next() final {
-		return m_wtCursor->next();
-    }
-
-    boost::optional<Record> seekExact(const RecordId& id) final {
-		return m_wtCursor->seekExact(id);
-    }
-
-    void save() final {
-		return m_wtCursor->save();
-    }
-
-    void saveUnpositioned() final {
-		return m_wtCursor->saveUnpositioned();
-    }
-
-    bool restore() final {
-		return m_wtCursor->restore();
-    }
-
-    void detachFromOperationContext() final {
-		m_wtCursor->detachFromOperationContext();
-    }
-
-    void reattachToOperationContext(OperationContext* txn) final {
-        m_wtCursor->reattachToOperationContext(txn);
-    }
+	InsertChange(TerichDbRecordStoreCapped* rs, llong recIdx)
+		: m_rs(rs), m_recIdx(recIdx) {}
+	void commit() override { m_rs->removeUncommitted(m_recIdx); }
+	void rollback() override { m_rs->removeUncommitted(m_recIdx); }
+private:
+	TerichDbRecordStoreCapped* m_rs;
+	llong m_recIdx;
+};
 
+// a registered optime which is never inserted, such as by an aborted
+// operation, must not block later oplog inserts
+class TerichDbRecordStoreCapped::OpTimeChange : public RecoveryUnit::Change {
+public:
+	OpTimeChange(TerichDbRecordStoreCapped* rs, const Timestamp& ts)
+		: m_rs(rs), m_ts(ts) {}
+	void commit() override { m_rs->removePendingOpTime(m_ts); }
+	void rollback() override { m_rs->removePendingOpTime(m_ts); }
 private:
-    const TerichDbRecordStoreCapped& m_rs;
-	std::unique_ptr<SeekableRecordCursor> m_wtCursor;
+	TerichDbRecordStoreCapped* m_rs;
+	Timestamp m_ts;
 };
 
-TerichDbRecordStoreCapped::TerichDbRecordStoreCapped(OperationContext* ctx,
+TerichDbRecordStoreCapped::TerichDbRecordStoreCapped(OperationContext* txn,
 												 StringData ns,
-												 StringData uri,
+												 StringData ident,
+												 ThreadSafeTable* tab,
 												 int64_t cappedMaxSize,
 												 int64_t cappedMaxDocs,
-												 CappedCallback* cappedCallback,
-												 WiredTigerSizeStorer* sizeStorer)
-	: RecordStore(ns)
+												 CappedCallback* cappedCallback)
+	: TerichDbRecordStore(txn, ns, ident, tab, NULL)
+	, m_isOplog(NamespaceString::oplog(ns))
+	, m_cappedMaxSize(cappedMaxSize)
+	, m_cappedMaxDocs(cappedMaxDocs)
+	, m_cappedCallback(cappedCallback)
 {
-	const bool ephemeral = false;
-	const bool isCapped = true;
-	m_wiredtigerCappedStore.reset(
-		new WiredTigerRecordStore(ctx, ns, uri,
-				kWiredTigerEngineName, isCapped, ephemeral,
-                cappedMaxSize, cappedMaxDocs, cappedCallback, sizeStorer));
+	invariant(cappedMaxSize > 0);
+	invariant(cappedMaxDocs == -1 || cappedMaxDocs > 0);
+	LOG(1) << "TerichDbRecordStoreCapped: ns = " << ns << ", isOplog = " << m_isOplog
+		<< ", cappedMaxSize = " << cappedMaxSize << ", cappedMaxDocs = " << cappedMaxDocs;
 }
 
 TerichDbRecordStoreCapped::~TerichDbRecordStoreCapped() {
@@ -134,162 +111,377 @@ TerichDbRecordStoreCapped::~TerichDbRecordStoreCapped() {
 }
 
 const char* TerichDbRecordStoreCapped::name() const {
-    return m_wiredtigerCappedStore->name();
+    return kTerichDbEngineName.c_str();
 }
 
-long long TerichDbRecordStoreCapped::dataSize(OperationContext* txn) const {
-    return m_wiredtigerCappedStore->dataSize(txn);
+bool TerichDbRecordStoreCapped::isCapped() const {
+    return true;
 }
 
-long long TerichDbRecordStoreCapped::numRecords(OperationContext* txn) const {
-    return m_wiredtigerCappedStore->numRecords(txn);
+void TerichDbRecordStoreCapped::setCappedCallback(CappedCallback* cb) {
+	stdx::lock_guard<stdx::mutex> lock(m_cappedCallbackMutex);
+	m_cappedCallback = cb;
 }
 
-bool TerichDbRecordStoreCapped::isCapped() const {
-	invariant(m_wiredtigerCappedStore->isCapped());
-    return true;
+void
+TerichDbRecordStoreCapped::addUncommittedNoLock(OperationContext* txn, const RecordId& id) {
+	if (txn && txn->recoveryUnit()) {
+		llong recIdx = id.repr() - 1;
+		m_uncommitted.insert(recIdx);
+		txn->recoveryUnit()->registerChange(new InsertChange(this, recIdx));
+	}
 }
 
-int64_t TerichDbRecordStoreCapped::storageSize(OperationContext* txn,
-									   BSONObjBuilder* extraInfo,
-									   int infoLevel) const {
-	return m_wiredtigerCappedStore->storageSize(txn, extraInfo, infoLevel);
+void TerichDbRecordStoreCapped::removeUncommitted(llong recIdx) {
+	stdx::lock_guard<stdx::mutex> lock(m_uncommittedMutex);
+	m_uncommitted.erase(recIdx);
 }
 
-RecordData
-TerichDbRecordStoreCapped::dataFor(OperationContext* txn, const RecordId& id)
-const {
-	return m_wiredtigerCappedStore->dataFor(txn, id);
+void TerichDbRecordStoreCapped::removePendingOpTime(const Timestamp& ts) {
+	stdx::lock_guard<stdx::mutex> lock(m_uncommittedMutex);
+	if (m_pendingOpTimes.erase(ts)) {
+		m_pendingCond.notify_all();
+	}
 }
 
-bool TerichDbRecordStoreCapped::findRecord(OperationContext* txn,
-								   const RecordId& id,
-								   RecordData* out) const {
-	return m_wiredtigerCappedStore->findRecord(txn, id, out);
+// Inserts wait for smaller registered optimes, the wait is bounded in case
+// a registered optime is neither inserted nor its unit of work finished.
+// On timeout *outOfOrder is set, the caller must not trim the oplog then,
+// the missing optime may be in the segments to be dropped.
+Status TerichDbRecordStoreCapped::insertOplogRecords(OperationContext* txn,
+											std::vector<Record>* records,
+											bool* outOfOrder) {
+	*outOfOrder = false;
+	Timestamp minTs;
+	bool hasTs = false;
+	valvec<Timestamp> opTimes;
+	for (const Record& rec : *records) {
+		BSONElement elem = BSONObj(rec.data.data())["ts"];
+		if (elem.type() == bsonTimestamp) {
+			Timestamp ts = elem.timestamp();
+			if (!hasTs || ts < minTs)
+				minTs = ts;
+			hasTs = true;
+			opTimes.push_back(ts);
+		}
+	}
+	static const long waitMillis = terark::getEnvLong("MongoTerichDB_oplogOrderWaitMillis", 10000);
+	stdx::unique_lock<stdx::mutex> lock(m_uncommittedMutex);
+	if (hasTs) {
+		auto noSmallerPending = [&]() {
+			return m_pendingOpTimes.empty() || !(*m_pendingOpTimes.begin() < minTs);
+		};
+		if (!m_pendingCond.wait_for(lock, stdx::chrono::milliseconds(waitMillis), noSmallerPending)) {
+			severe() << "TerichDbRecordStoreCapped::insertOplogRecords(): ns = " << ns()
+				<< ", waited " << waitMillis << " ms for optime "
+				<< m_pendingOpTimes.begin()->toStringPretty()
+				<< " before " << minTs.toStringPretty() << ", insert out of order";
+			*outOfOrder = true;
+		}
+	}
+	Status status = TerichDbRecordStore::insertRecords(txn, records, false);
+	for (const Timestamp& ts : opTimes) {
+		m_pendingOpTimes.erase(ts);
+	}
+	m_pendingCond.notify_all();
+	// rows inserted before a failure stay uncommitted until the unit of
+	// work is rolled back, so readers never see past them
+	for (const Record& rec : *records) {
+		if (!rec.id.isNull())
+			addUncommittedNoLock(txn, rec.id);
+	}
+	return status;
 }
 
-void TerichDbRecordStoreCapped::deleteRecord(OperationContext* txn, const RecordId& id) {
-	m_wiredtigerCappedStore->deleteRecord(txn, id);
+llong TerichDbRecordStoreCapped::visibleEndIdx(OperationContext* txn) const {
+	if (!m_isOplog) {
+		return LLONG_MAX;
+	}
+	// keep the same view in an active transaction, as setOplogReadTill expects
+	auto ru = txn ? dynamic_cast<TerichDbRecoveryUnit*>(txn->recoveryUnit()) : NULL;
+	if (ru && ru->inActiveTxn() && !ru->getOplogReadTill().isNull()) {
+		return ru->getOplogReadTill().repr() - 1;
+	}
+	llong endIdx;
+	{
+		stdx::lock_guard<stdx::mutex> lock(m_uncommittedMutex);
+		if (m_uncommitted.empty())
+			endIdx = m_table->m_tab->inlineGetRowNum();
+		else
+			endIdx = *m_uncommitted.begin();
+	}
+	if (ru) {
+		ru->setOplogReadTill(RecordId(endIdx + 1));
+	}
+	return endIdx;
 }
 
 Status TerichDbRecordStoreCapped::insertRecords(OperationContext* txn,
 										std::vector<Record>* records,
 										bool enforceQuota) {
-	return m_wiredtigerCappedStore->insertRecords(txn, records, enforceQuota);
+	if (m_isOplog) {
+		bool outOfOrder;
+		Status status = insertOplogRecords(txn, records, &outOfOrder);
+		if (!status.isOK()) {
+			return status;
+		}
+		if (outOfOrder) {
+			return Status::OK(); // skip trim
+		}
+	}
+	else {
+		Status status = TerichDbRecordStore::insertRecords(txn, records, enforceQuota);
+		if (!status.isOK()) {
+			return status;
+		}
+	}
+	cappedDropAsNeeded(txn);
+	return Status::OK();
 }
 
 StatusWith<RecordId> TerichDbRecordStoreCapped::insertRecord(OperationContext* txn,
 													 const char* data,
 													 int len,
 													 bool enforceQuota) {
-	return m_wiredtigerCappedStore->insertRecord(txn, data, len, enforceQuota);
+	std::vector<Record> records(1);
+	records[0].data = RecordData(data, len);
+	Status status = insertRecords(txn, &records, enforceQuota);
+	if (!status.isOK()) {
+		return status;
+	}
+	return records[0].id;
 }
 
 Status
-TerichDbRecordStoreCapped::updateRecord(OperationContext* txn,
-									  const RecordId& id,
-									  const char* data,
-									  int len,
-									  bool enforceQuota,
-									  UpdateNotifier* notifier) {
-	return m_wiredtigerCappedStore->
-		updateRecord(txn, id, data, len, enforceQuota, notifier);
-}
-
-bool TerichDbRecordStoreCapped::updateWithDamagesSupported() const {
-    return false;
-}
-
-StatusWith<RecordData> TerichDbRecordStoreCapped::updateWithDamages(
-							OperationContext* txn,
-							const RecordId& id,
-							const RecordData& oldRec,
-							const char* damageSource,
-							const mutablebson::DamageVector& damages)
-{
-    MONGO_UNREACHABLE;
-}
-
-std::unique_ptr<SeekableRecordCursor>
-TerichDbRecordStoreCapped::getCursor(OperationContext* txn, bool forward) const {
-    return stdx::make_unique<Cursor>(txn, *this, forward);
-}
-
-std::unique_ptr<RecordCursor>
-TerichDbRecordStoreCapped::getRandomCursor(OperationContext* txn) const {
-    return m_wiredtigerCappedStore->getRandomCursor(txn);
-}
-
-std::vector<std::unique_ptr<RecordCursor>>
-TerichDbRecordStoreCapped::getManyCursors(OperationContext* txn) const {
-	return m_wiredtigerCappedStore->getManyCursors(txn);
-}
-
-Status TerichDbRecordStoreCapped::truncate(OperationContext* txn) {
-	return m_wiredtigerCappedStore->truncate(txn);
-}
-
-bool TerichDbRecordStoreCapped::compactSupported() const {
-	return m_wiredtigerCappedStore->compactSupported();
-}
-
-bool TerichDbRecordStoreCapped::compactsInPlace() const {
-	return m_wiredtigerCappedStore->compactsInPlace();
+TerichDbRecordStoreCapped::insertRecordsWithDocWriter(OperationContext* txn,
+                                            const DocWriter* const* docs,
+                                            size_t nDocs,
+                                            RecordId* idsOut) {
+	std::unique_ptr<RecordId[]> ids;
+	if (!idsOut) {
+		ids.reset(new RecordId[nDocs]);
+		idsOut = ids.get();
+	}
+	if (m_isOplog) {
+		// the optimes are needed before insert, so write the documents
+		size_t totalSize = 0;
+		for (size_t i = 0; i < nDocs; ++i) {
+			totalSize += docs[i]->documentSize();
+		}
+		std::unique_ptr<char[]> buffer(new char[totalSize]);
+		std::vector<Record> records(nDocs);
+		char* pos = buffer.get();
+		for (size_t i = 0; i < nDocs; ++i) {
+			const size_t size = docs[i]->documentSize();
+			docs[i]->writeDocument(pos);
+			records[i].data = RecordData(pos, size);
+			pos += size;
+		}
+		bool outOfOrder;
+		Status status = insertOplogRecords(txn, &records, &outOfOrder);
+		if (!status.isOK()) {
+			return status;
+		}
+		for (size_t i = 0; i < nDocs; ++i) {
+			idsOut[i] = records[i].id;
+		}
+		if (outOfOrder) {
+			return Status::OK(); // skip trim
+		}
+	}
+	else {
+		Status status = TerichDbRecordStore::
+			insertRecordsWithDocWriter(txn, docs, nDocs, idsOut);
+		if (!status.isOK()) {
+			return status;
+		}
+	}
+	cappedDropAsNeeded(txn);
+	return Status::OK();
 }
 
-Status TerichDbRecordStoreCapped::compact(OperationContext* txn,
-										RecordStoreCompactAdaptor* adaptor,
-										const CompactOptions* options,
-										CompactStats* stats) {
-	return m_wiredtigerCappedStore->compact(txn, adaptor, options, stats);
-}
-
-Status TerichDbRecordStoreCapped::validate(OperationContext* txn,
-										 ValidateCmdLevel level,
-										 ValidateAdaptor* adaptor,
-										 ValidateResults* results,
-										 BSONObjBuilder* output) {
-	return m_wiredtigerCappedStore->
-		validate(txn, level, adaptor, results, output);
+// Segments which are fully deleted have been dropped, all others are
+// counted, then frozen segments are dropped from the oldest one until the
+// collection is in its cap, the writing segment is never dropped.
+void TerichDbRecordStoreCapped::cappedDropAsNeeded(OperationContext* txn) {
+	DbTable* tab = m_table->m_tab.get();
+	auto sav = tab->getSegArrayVersion();
+	const size_t segNum = sav->m_segs.size();
+	const llong* rowNumVec = sav->m_rowNumVec.data();
+	llong bytes = 0, docs = 0;
+	for (size_t i = 0; i < segNum; ++i) {
+		const ReadableSegment* seg = sav->m_segs[i].get();
+		llong live = llong(seg->m_isDel.size()) - llong(seg->m_delcnt);
+		if (live > 0) {
+			bytes += seg->dataInflateSize();
+			docs += live;
+		}
+	}
+	auto inCap = [&]() {
+		return bytes <= m_cappedMaxSize &&
+			  (m_cappedMaxDocs <= 0 || docs <= m_cappedMaxDocs);
+	};
+	if (inCap()) {
+		return;
+	}
+	stdx::unique_lock<stdx::mutex> dropLock(m_cappedDropMutex, stdx::try_to_lock);
+	if (!dropLock.owns_lock()) {
+		return; // another thread is dropping
+	}
+	llong endIdx = 0;
+	for (size_t i = 0; i + 1 < segNum && !inCap(); ++i) {
+		const ReadableSegment* seg = sav->m_segs[i].get();
+		if (!seg->m_isFreezed) {
+			break;
+		}
+		llong live = llong(seg->m_isDel.size()) - llong(seg->m_delcnt);
+		if (live > 0) {
+			bytes -= seg->dataInflateSize();
+			docs -= live;
+		}
+		endIdx = rowNumVec[i+1];
+	}
+	if (0 == endIdx) {
+		return;
+	}
+	{
+		// oplog has no index, other capped collections have indices in
+		// mongo layer, which are cleaned by the callback
+		stdx::lock_guard<stdx::mutex> lock(m_cappedCallbackMutex);
+		if (m_cappedCallback && !m_isOplog) {
+			auto& td = m_table->getMyThreadData();
+			terark::terichdb::StoreIteratorPtr iter =
+				tab->createStoreIterForward(td.m_dbCtx.get());
+			llong recIdx = -1;
+			while (iter->increment(&recIdx, &td.m_buf) && recIdx < endIdx) {
+				SharedBuffer sbuf = td.m_coder.decode(&tab->rowSchema(), td.m_buf);
+				int len = ConstDataView(sbuf.get()).read<LittleEndian<int>>();
+				uassertStatusOK(m_cappedCallback->aboutToDeleteCapped(
+					txn, RecordId(recIdx + 1), RecordData(sbuf, len)));
+			}
+		}
+	}
+	llong dropped = tab->dropOldSegments(endIdx);
+	LOG(1) << "TerichDbRecordStoreCapped::cappedDropAsNeeded(): ns = " << ns()
+		<< ", endIdx = " << endIdx << ", dropped = " << dropped;
 }
 
 void TerichDbRecordStoreCapped::appendCustomStats(OperationContext* txn,
 												BSONObjBuilder* result,
 												double scale) const {
-    return m_wiredtigerCappedStore->appendCustomStats(txn, result, scale);
-}
-
-Status
-TerichDbRecordStoreCapped::touch(OperationContext* txn, BSONObjBuilder* output)
-const {
-	return m_wiredtigerCappedStore->touch(txn, output);
-}
-
-void TerichDbRecordStoreCapped::updateStatsAfterRepair(OperationContext* txn,
-											   long long numRecords,
-											   long long dataSize) {
-	return m_wiredtigerCappedStore->
-		updateStatsAfterRepair(txn, numRecords, dataSize);
+	result->appendBool("capped", true);
+	result->appendIntOrLL("max", m_cappedMaxDocs);
+	result->appendIntOrLL("maxSize", (long long)(m_cappedMaxSize / scale));
 }
 
+// used by rollback, records after end are few, so they are deleted one by one
 void TerichDbRecordStoreCapped::temp_cappedTruncateAfter(OperationContext* txn,
 												 RecordId end,
 												 bool inclusive) {
-	return m_wiredtigerCappedStore->
-		temp_cappedTruncateAfter(txn, end, inclusive);
+	DbTable* tab = m_table->m_tab.get();
+	auto& td = m_table->getMyThreadData();
+	DbContext* ctx = td.m_dbCtx.get();
+	const llong begIdx = end.repr() - (inclusive ? 1 : 0);
+	valvec<llong> ids;
+	{
+		terark::terichdb::StoreIteratorPtr iter = tab->createStoreIterBackward(ctx);
+		llong recIdx = -1;
+		while (iter->increment(&recIdx, &td.m_buf) && recIdx >= begIdx) {
+			ids.push_back(recIdx);
+		}
+	}
+	stdx::lock_guard<stdx::mutex> lock(m_cappedCallbackMutex);
+	for (llong recIdx : ids) {
+		if (m_cappedCallback && !m_isOplog) {
+			tab->getValue(recIdx, &td.m_buf, ctx);
+			SharedBuffer sbuf = td.m_coder.decode(&tab->rowSchema(), td.m_buf);
+			int len = ConstDataView(sbuf.get()).read<LittleEndian<int>>();
+			uassertStatusOK(m_cappedCallback->aboutToDeleteCapped(
+				txn, RecordId(recIdx + 1), RecordData(sbuf, len)));
+		}
+		tab->removeRow(recIdx, ctx);
+	}
+	LOG(1) << "TerichDbRecordStoreCapped::temp_cappedTruncateAfter(): ns = " << ns()
+		<< ", end = " << end << ", inclusive = " << inclusive
+		<< ", removed = " << ids.size();
 }
 
+bool TerichDbRecordStoreCapped::readOpTime(llong recIdx, Timestamp* ts) const {
+	DbTable* tab = m_table->m_tab.get();
+	auto& td = m_table->getMyThreadData();
+	try {
+		tab->getValue(recIdx, &td.m_buf, td.m_dbCtx.get());
+	}
+	catch (const terark::terichdb::ReadDeletedRecordException&) {
+		return false;
+	}
+	SharedBuffer sbuf = td.m_coder.decode(&tab->rowSchema(), td.m_buf);
+	BSONElement elem = BSONObj(sbuf.get())["ts"];
+	if (elem.type() != bsonTimestamp) {
+		return false;
+	}
+	*ts = elem.timestamp();
+	return true;
+}
+
+// RecordId of the native oplog is the record index, not the optime, but
+// inserts are ordered by the optimes registered in oplogDiskLocRegister,
+// so "ts" is ascending by record index and is binary searched
 boost::optional<RecordId>
 TerichDbRecordStoreCapped::oplogStartHack(OperationContext* txn,
 										const RecordId& startingPosition) const {
-	return m_wiredtigerCappedStore->oplogStartHack(txn, startingPosition);
+	if (!m_isOplog) {
+		return boost::none;
+	}
+	DbTable* tab = m_table->m_tab.get();
+	auto& td = m_table->getMyThreadData();
+	const Timestamp target(static_cast<unsigned long long>(startingPosition.repr()));
+	llong lo = -1;
+	{
+		terark::terichdb::StoreIteratorPtr iter =
+			tab->createStoreIterForward(td.m_dbCtx.get());
+		if (!iter->increment(&lo, &td.m_buf)) {
+			return RecordId(); // empty
+		}
+	}
+	llong hi = std::min(visibleEndIdx(txn), tab->inlineGetRowNum()) - 1;
+	Timestamp ts;
+	if (lo > hi || !readOpTime(lo, &ts) || target < ts) {
+		return RecordId(); // before the oldest record
+	}
+	llong found = lo++;
+	while (lo <= hi) {
+		llong mid = lo + (hi - lo) / 2;
+		if (readOpTime(mid, &ts) && !(target < ts)) {
+			found = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1; // deleted records are just at the tail
+		}
+	}
+	return RecordId(found + 1);
 }
 
+// Called in optime order when mongo allocates the optime, before the
+// insert. The optime is an ordering ticket: inserts with larger optimes
+// wait for it, so no record after a registered but not inserted optime
+// can exist, and visibility by m_uncommitted hides all after it.
 Status
 TerichDbRecordStoreCapped::oplogDiskLocRegister(OperationContext* txn,
 											  const Timestamp& opTime) {
-	return m_wiredtigerCappedStore->oplogDiskLocRegister(txn, opTime);
+	if (!m_isOplog) {
+		return Status::OK();
+	}
+	{
+		stdx::lock_guard<stdx::mutex> lock(m_uncommittedMutex);
+		m_pendingOpTimes.insert(opTime);
+	}
+	if (txn && txn->recoveryUnit()) {
+		txn->recoveryUnit()->registerChange(new OpTimeChange(this, opTime));
+	}
+	LOG(2) << "TerichDbRecordStoreCapped::oplogDiskLocRegister(): opTime = "
+		<< opTime.toStringPretty();
+	return Status::OK();
 }
 
-
 } } // namespace mongo::terichdb
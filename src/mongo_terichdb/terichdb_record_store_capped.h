@@ -32,60 +32,36 @@
 
 #pragma once
 
-#include <boost/thread/mutex.hpp>
 #include <set>
 #include <string>
 
-#include "mongo_terichdb_common.hpp"
-#include "mongo/db/catalog/collection_options.h"
-#include "mongo/db/storage/capped_callback.h"
-#include "mongo/db/storage/record_store.h"
-#include "mongo/platform/atomic_word.h"
-#include "mongo/stdx/mutex.h"
-#include "mongo/util/fail_point_service.h"
-#include "terichdb_size_storer.h"
-
-namespace mongo {
-	class WiredTigerSizeStorer;
-}
+#include "mongo/bson/timestamp.h"
+#include "mongo/stdx/condition_variable.h"
+#include "terichdb_record_store.h"
 
 namespace mongo { namespace db {
 
-class TerichDbKVEngine;
-
-class TerichDbRecordStoreCapped : public RecordStore {
+// Capped collection and oplog stored natively in a TerichDB table.
+// Records are only appended, when the collection exceeds its cap, whole old
+// segments are dropped by DbTable::dropOldSegments, there are no per record
+// deletes. Each frozen segment acts as an oplog stone, so the cap is kept
+// with the granularity of segments.
+class TerichDbRecordStoreCapped : public TerichDbRecordStore {
 public:
-    TerichDbRecordStoreCapped(OperationContext* ctx,
+    TerichDbRecordStoreCapped(OperationContext* txn,
 							StringData ns,
-							StringData uri,
+							StringData ident,
+							ThreadSafeTable* tab,
 							int64_t cappedMaxSize,
 							int64_t cappedMaxDocs,
-							CappedCallback* cappedCallback,
-							WiredTigerSizeStorer* sizeStorer);
+							CappedCallback* cappedCallback);
 
     virtual ~TerichDbRecordStoreCapped();
 
-    // name of the RecordStore implementation
     virtual const char* name() const override;
 
-    virtual long long dataSize(OperationContext* txn) const override;
-
-    virtual long long numRecords(OperationContext* txn) const override;
-
     virtual bool isCapped() const override;
 
-    virtual int64_t storageSize(OperationContext* txn,
-                                BSONObjBuilder* extraInfo,
-                                int infoLevel) const override;
-
-    // CRUD related
-
-    virtual RecordData dataFor(OperationContext* txn, const RecordId& id) const override;
-
-    virtual bool findRecord(OperationContext* txn, const RecordId& id, RecordData* out) const override;
-
-    virtual void deleteRecord(OperationContext* txn, const RecordId& id) override;
-
     virtual Status insertRecords(OperationContext* txn,
                                  std::vector<Record>* records,
                                  bool enforceQuota) override;
@@ -95,52 +71,15 @@ public:
                                               int len,
                                               bool enforceQuota) override;
 
-    virtual Status updateRecord(OperationContext* txn,
-                                              const RecordId& oldLocation,
-                                              const char* data,
-                                              int len,
-                                              bool enforceQuota,
-                                              UpdateNotifier* notifier) override;
-
-    virtual bool updateWithDamagesSupported() const override;
-
-    StatusWith<RecordData>
-	updateWithDamages(OperationContext* txn,
-                      const RecordId& id,
-                      const RecordData& oldRec,
-                      const char* damageSource,
-                      const mutablebson::DamageVector& damages) override;
-
-    std::unique_ptr<SeekableRecordCursor>
-	getCursor(OperationContext* txn, bool forward) const override final;
-
-    std::unique_ptr<RecordCursor> getRandomCursor(OperationContext*) const override final;
-
-    std::vector<std::unique_ptr<RecordCursor>>
-	getManyCursors(OperationContext* txn) const override final;
-
-    virtual Status truncate(OperationContext* txn);
-
-    virtual bool compactSupported() const override;
-    virtual bool compactsInPlace() const override;
-
-    virtual Status compact(OperationContext* txn,
-                           RecordStoreCompactAdaptor* adaptor,
-                           const CompactOptions* options,
-                           CompactStats* stats);
-
-    virtual Status validate(OperationContext* txn,
-                            ValidateCmdLevel level,
-                            ValidateAdaptor* adaptor,
-                            ValidateResults* results,
-                            BSONObjBuilder* output) override;
+	virtual Status insertRecordsWithDocWriter(OperationContext* txn,
+                                              const DocWriter* const* docs,
+                                              size_t nDocs,
+                                              RecordId* idsOut) override;
 
     virtual void appendCustomStats(OperationContext* txn,
                                    BSONObjBuilder* result,
                                    double scale) const override;
 
-    virtual Status touch(OperationContext* txn, BSONObjBuilder* output) const override;
-
     virtual void temp_cappedTruncateAfter(OperationContext* txn, RecordId end, bool inclusive) override;
 
     boost::optional<RecordId> oplogStartHack(OperationContext* txn,
@@ -148,17 +87,45 @@ public:
 
     Status oplogDiskLocRegister(OperationContext* txn, const Timestamp& opTime) override;
 
-    void updateStatsAfterRepair(OperationContext* txn,
-                                long long numRecords,
-                                long long dataSize) override;
+    void setCappedCallback(CappedCallback* cb) override;
 
-	std::unique_ptr<RecordStore> m_wiredtigerCappedStore;
+    bool isOplog() const { return m_isOplog; }
+    int64_t cappedMaxSize() const { return m_cappedMaxSize; }
+    int64_t cappedMaxDocs() const { return m_cappedMaxDocs; }
+
+    // drop old segments if the collection exceeds its cap
+    void cappedDropAsNeeded(OperationContext* txn);
+
+protected:
+    llong visibleEndIdx(OperationContext* txn) const override;
 
 private:
-    class Cursor;
+    class InsertChange;
+    class OpTimeChange;
+    void addUncommittedNoLock(OperationContext* txn, const RecordId& id);
+    void removeUncommitted(llong recIdx);
+    void removePendingOpTime(const Timestamp& ts);
+    Status insertOplogRecords(OperationContext* txn, std::vector<Record>* records,
+                              bool* outOfOrder);
+    bool readOpTime(llong recIdx, Timestamp* ts) const;
+
+    const bool    m_isOplog;
+    const int64_t m_cappedMaxSize;
+    const int64_t m_cappedMaxDocs;
+
+    stdx::mutex     m_cappedCallbackMutex;
+    CappedCallback* m_cappedCallback;
+    stdx::mutex     m_cappedDropMutex; // just one dropper at a time
+
+    // Optimes are registered by oplogDiskLocRegister in optime order, an
+    // oplog insert waits until no smaller registered optime is pending,
+    // then inserts under m_uncommittedMutex, so record index order is
+    // optime order, and all records after the first uncommitted one are
+    // invisible to readers.
+    mutable stdx::mutex m_uncommittedMutex;
+    stdx::condition_variable m_pendingCond;
+    std::set<llong>     m_uncommitted; // recIdx
+    std::set<Timestamp> m_pendingOpTimes; // registered, not yet inserted
 };
 
-// TerichDb failpoint to throw write conflict exceptions randomly
-MONGO_FP_FORWARD_DECLARE(TerichDbWriteConflictException);
-} }  // namespace mongo::terark
-
+} }  // namespace mongo::terichdb
@@ -30,15 +30,21 @@
 
 #include "mongo/platform/basic.h"
 
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "mongo/base/string_data.h"
 #include "mongo/bson/bsonobjbuilder.h"
 #include "mongo/base/checked_cast.h"
+#include "mongo/base/data_view.h"
+#include "mongo/bson/mutable/damage_vector.h"
 #include "mongo/db/concurrency/write_conflict_exception.h"
 #include "mongo/db/json.h"
 #include "mongo/db/operation_context_noop.h"
+#include "mongo/db/storage/recovery_unit_noop.h"
 #include "mongo/db/storage/record_store_test_harness.h"
 #include "terichdb_recovery_unit.h"
 #include "terichdb_record_store.h"
@@ -1442,4 +1448,216 @@ TEST(TerichDbRecordStoreTest, OplogStones_AscendingOrder) {
     }
 }
 
+namespace {
+
+// a TerichDbRecordStore on a mock table, rows are (n sint64, $$), n is an
+// inplace updatable column, other fields are saved in the schema-less $$
+class MockTableHarness {
+public:
+    explicit MockTableHarness(long maxWrSegSize) : _dbpath("terichdb-record-store") {
+        fs::path dir = fs::path(_dbpath.path()) / "tab";
+        fs::create_directories(dir);
+        FILE* fp = fopen((dir / "dbmeta.json").string().c_str(), "w");
+        ASSERT(fp != NULL);
+        fprintf(fp, R"({
+  "CheckMongoType": true,
+  "WritableSegmentClass": "MockWritable",
+  "ReadonlySegmentClass": "MockReadonly",
+  "MaxWrSegSize": %ld,
+  "RowSchema": {
+    "columns": {
+      "n" : { "type": "sint64", "colstore": { "inplaceUpdatable": true } },
+      "$$": { "type": "carbin" }
+    }
+  }
+})", maxWrSegSize);
+        fclose(fp);
+        _tst = new ThreadSafeTable(dir);
+        _rs.reset(new TerichDbRecordStore(nullptr, "a.b", "a.b", _tst.get(), nullptr));
+    }
+    ~MockTableHarness() {
+        _rs.reset();
+        _tst = nullptr;
+    }
+    TerichDbRecordStore* rs() const {
+        return _rs.get();
+    }
+    DbTable* tab() const {
+        return _tst->m_tab.get();
+    }
+    RecordId insert(long long n, const std::string& s) {
+        BSONObj obj = BSON("n" << n << "s" << s);
+        StatusWith<RecordId> res = _rs->insertRecord(nullptr, obj.objdata(), obj.objsize(), false);
+        ASSERT_OK(res.getStatus());
+        return res.getValue();
+    }
+
+private:
+    unittest::TempDir _dbpath;
+    ThreadSafeTablePtr _tst;
+    std::unique_ptr<TerichDbRecordStore> _rs;
+};
+
+// one damage which overwrites size bytes at offset of field's value
+mutablebson::DamageVector damageOfField(const BSONObj& obj, StringData field,
+                                        size_t offset, size_t size) {
+    mutablebson::DamageEvent d;
+    d.sourceOffset = 0;
+    d.targetOffset = obj[field].value() - obj.objdata() + offset;
+    d.size = size;
+    return mutablebson::DamageVector(1, d);
+}
+
+}  // namespace
+
+// every record returned by the random cursor is live and has its own data,
+// also in segments where most records are deleted
+TEST(TerichDbRecordStoreTest, RandomCursorReturnsLiveRecords) {
+    MockTableHarness harness(4096);
+    TerichDbRecordStore* rs = harness.rs();
+    ASSERT_FALSE(rs->getRandomCursor(nullptr)->next());
+
+    const long long num = 300;
+    std::vector<RecordId> ids;
+    for (long long i = 0; i < num; ++i)
+        ids.push_back(harness.insert(i, "rand-" + std::to_string(i)));
+    ASSERT_GREATER_THAN(harness.tab()->getSegNum(), 1U);
+    std::set<RecordId> live;
+    for (long long i = 0; i < num; ++i) {
+        if (i % 10 == 0)
+            live.insert(ids[i]);
+        else
+            rs->deleteRecord(nullptr, ids[i]);
+    }
+    auto cursor = rs->getRandomCursor(nullptr);
+    std::set<RecordId> seen;
+    for (int i = 0; i < 200; ++i) {
+        auto rec = cursor->next();
+        ASSERT_TRUE(rec);
+        ASSERT_EQUALS(live.count(rec->id), 1U);
+        BSONObj obj = rec->data.toBson();
+        long long n = obj["n"].numberLong();
+        ASSERT_TRUE(ids[n] == rec->id);
+        ASSERT_EQUALS(obj["s"].str(), "rand-" + std::to_string(n));
+        seen.insert(rec->id);
+    }
+    ASSERT_GREATER_THAN(seen.size(), 1U);
+
+    for (const RecordId& id : live)
+        rs->deleteRecord(nullptr, id);
+    ASSERT_FALSE(cursor->next());
+}
+
+// the cursors of getManyCursors are scanned in parallel, each live record
+// is returned by exactly one of them
+TEST(TerichDbRecordStoreTest, ManyCursorsParallelScan) {
+    MockTableHarness harness(4096);
+    TerichDbRecordStore* rs = harness.rs();
+    const long long num = 300;
+    std::set<RecordId> live;
+    for (long long i = 0; i < num; ++i) {
+        RecordId id = harness.insert(i, "many-" + std::to_string(i));
+        if (i % 3 == 0)
+            rs->deleteRecord(nullptr, id);
+        else
+            live.insert(id);
+    }
+    auto cursors = rs->getManyCursors(nullptr);
+    ASSERT_GREATER_THAN(cursors.size(), 1U);
+    std::vector<std::vector<RecordId>> scanned(cursors.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < cursors.size(); ++i) {
+        threads.emplace_back([&cursors, &scanned, i]() {
+            while (auto rec = cursors[i]->next())
+                scanned[i].push_back(rec->id);
+        });
+    }
+    for (auto& thr : threads)
+        thr.join();
+    std::set<RecordId> all;
+    for (size_t i = 0; i < scanned.size(); ++i) {
+        for (size_t j = 1; j < scanned[i].size(); ++j)
+            ASSERT_LESS_THAN(scanned[i][j-1], scanned[i][j]);
+        for (const RecordId& id : scanned[i])
+            ASSERT_TRUE(all.insert(id).second);
+    }
+    ASSERT_TRUE(all == live);
+}
+
+// damages inside the value of an inplace updatable column are written by
+// updateColumn, and restored when the unit of work is rolled back
+TEST(TerichDbRecordStoreTest, UpdateWithDamagesInplaceColumn) {
+    MockTableHarness harness(64 << 20);
+    TerichDbRecordStore* rs = harness.rs();
+    ASSERT_TRUE(rs->updateWithDamagesSupported());
+    RecordId id = harness.insert(1, "abc");
+    char src[8];
+    {
+        RecordData oldRec = rs->dataFor(nullptr, id);
+        BSONObj oldObj = oldRec.toBson();
+        DataView(src).write<LittleEndian<long long>>(42);
+        auto res = rs->updateWithDamages(nullptr, id, oldRec, src,
+                                         damageOfField(oldObj, "n", 0, 8));
+        ASSERT_OK(res.getStatus());
+        ASSERT_EQUALS(res.getValue().toBson()["n"].numberLong(), 42);
+    }
+    {
+        RecordData rec = rs->dataFor(nullptr, id);
+        ASSERT_EQUALS(rec.toBson()["n"].numberLong(), 42);
+        ASSERT_EQUALS(rec.toBson()["s"].str(), "abc");
+    }
+    {
+        OperationContextNoop txn(new RecoveryUnitNoop());
+        WriteUnitOfWork uow(&txn);
+        RecordData oldRec = rs->dataFor(&txn, id);
+        DataView(src).write<LittleEndian<long long>>(7);
+        auto res = rs->updateWithDamages(&txn, id, oldRec, src,
+                                         damageOfField(oldRec.toBson(), "n", 0, 8));
+        ASSERT_OK(res.getStatus());
+        ASSERT_EQUALS(rs->dataFor(nullptr, id).releaseToBson()["n"].numberLong(), 7);
+        // not committed
+    }
+    ASSERT_EQUALS(rs->dataFor(nullptr, id).releaseToBson()["n"].numberLong(), 42);
+}
+
+// damages in other fields are merged into the row, which is rewritten in
+// the writable segment and keeps its record id
+TEST(TerichDbRecordStoreTest, UpdateWithDamagesMergedRow) {
+    MockTableHarness harness(64 << 20);
+    TerichDbRecordStore* rs = harness.rs();
+    RecordId id = harness.insert(1, "abc");
+    RecordData oldRec = rs->dataFor(nullptr, id);
+    auto res = rs->updateWithDamages(nullptr, id, oldRec, "xyz",
+                                     damageOfField(oldRec.toBson(), "s", 4, 3));
+    ASSERT_OK(res.getStatus());
+    RecordData rec = rs->dataFor(nullptr, id);
+    ASSERT_EQUALS(rec.toBson()["n"].numberLong(), 1);
+    ASSERT_EQUALS(rec.toBson()["s"].str(), "xyz");
+}
+
+// a row in a frozen segment can not be rewritten in place: the update is
+// retried once without damages, inplace columns are still updated
+TEST(TerichDbRecordStoreTest, UpdateWithDamagesFrozenSegment) {
+    MockTableHarness harness(64 << 20);
+    TerichDbRecordStore* rs = harness.rs();
+    RecordId id = harness.insert(1, "abc");
+    harness.tab()->syncFinishWriting();
+    RecordData oldRec = rs->dataFor(nullptr, id);
+    ASSERT_THROWS(rs->updateWithDamages(nullptr, id, oldRec, "xyz",
+                                        damageOfField(oldRec.toBson(), "s", 4, 3)),
+                  WriteConflictException);
+    ASSERT_FALSE(rs->updateWithDamagesSupported());
+    ASSERT_TRUE(rs->updateWithDamagesSupported());
+    ASSERT_EQUALS(rs->dataFor(nullptr, id).releaseToBson()["s"].str(), "abc");
+
+    char src[8];
+    DataView(src).write<LittleEndian<long long>>(42);
+    auto res = rs->updateWithDamages(nullptr, id, oldRec, src,
+                                     damageOfField(oldRec.toBson(), "n", 0, 8));
+    ASSERT_OK(res.getStatus());
+    RecordData rec = rs->dataFor(nullptr, id);
+    ASSERT_EQUALS(rec.toBson()["n"].numberLong(), 42);
+    ASSERT_EQUALS(rec.toBson()["s"].str(), "abc");
+}
+
 } } // namespace mongo::terichdb
@@ -209,6 +209,7 @@ Schema::Schema() {
 	m_isInplaceUpdatable = false;
 	m_enableLinearScan = false;
 	m_mmapPopulate = false;
+	m_warmUpHot = false;
 	m_keepCols.fill(true);
 	m_minFragLen = 0;
 	m_maxFragLen = 0;
@@ -218,6 +219,8 @@ Schema::Schema() {
 	m_nltNestLevel = DEFAULT_nltNestLevel;
 	m_lastVarLenCol = 0;
 	m_restFixLenSum = 0;
+	m_fixedPlanLen = 0;
+	m_comparePlan = ComparePlan_Interpret;
 }
 Schema::~Schema() {
 }
@@ -308,6 +311,7 @@ void Schema::compile(const Schema* parent) {
 	if (m_name.empty()) {
 		m_name = joinColumnNames();
 	}
+	compilePlan();
 }
 
 void Schema::parseRow(fstring row, ColumnVec* columns) const {
@@ -339,7 +343,15 @@ void Schema::parseRowAppend(fstring row, size_t start, ColumnVec* columns) const
 
 #define CHECK_CURR_LAST(len) CHECK_CURR_LAST3(curr, last, len)
 	size_t colnum = m_columnsMeta.end_i();
-	for (size_t i = 0; i < colnum; ++i) {
+	size_t i = 0;
+	if (m_fixedPlanLen && m_fixedPlanLen <= size_t(last - curr)) {
+		for (const FixedColumnPlan& cp : m_fixedPlan) {
+			columns->push_back(start + cp.offset, cp.len);
+		}
+		curr += m_fixedPlanLen;
+		i = m_fixedPlan.size();
+	}
+	for (; i < colnum; ++i) {
 		const fstring colname = m_columnsMeta.key(i);
 		const ColumnMeta& colmeta = m_columnsMeta.val(i);
 		size_t collen = 0;
@@ -825,6 +837,105 @@ void Schema::byteLexDecode(byte* data, size_t size) const {
 	byteLexConvert<DecodeOffsetCoding>(data, size);
 }
 
+template<class Number>
+static int PlanCompareNumber(const byte* x, const byte* y, size_t) {
+	Number xv = unaligned_load<Number>(x);
+	Number yv = unaligned_load<Number>(y);
+	if (xv < yv) return -1;
+	if (xv > yv) return +1;
+	return 0;
+}
+static int PlanCompareBytes(const byte* x, const byte* y, size_t len) {
+	return memcmp(x, y, len);
+}
+static void PlanLexSint08(byte* p) {
+	p[0] ^= 1 << 7;
+}
+template<class Int>
+static void PlanLexSwap(byte* p) {
+	Int x = unaligned_load<Int>(p);
+	BYTE_SWAP_IF_LITTLE_ENDIAN(x);
+	unaligned_save(p, x);
+}
+template<class Int, class Converter>
+static void PlanLexConvert(byte* p) {
+	Int x = unaligned_load<Int>(p);
+	x = Converter::convert(x);
+	unaligned_save(p, x);
+}
+
+void Schema::clearPlan() {
+	m_fixedPlan.erase_all();
+	m_fixedPlanLen = 0;
+	m_comparePlan = ComparePlan_Interpret;
+}
+
+void Schema::compilePlan() {
+	static const bool interpretOnly = getEnvBool("TerichDB_SchemaInterpretOnly", false);
+	clearPlan();
+	if (interpretOnly) {
+		return;
+	}
+	size_t colnum = m_columnsMeta.end_i();
+	bool allMemcmp = true;
+	for (size_t i = 0; i < colnum; ++i) {
+		const ColumnMeta& colmeta = m_columnsMeta.val(i);
+		FixedColumnPlan cp;
+		cp.offset = uint32_t(m_fixedPlanLen);
+		cp.len = colmeta.fixedLen;
+		cp.compare = &PlanCompareBytes;
+		cp.lexEncode = cp.lexDecode = nullptr;
+		switch (colmeta.type) {
+		default: // var length, or not supported by compareData/byteLexConvert
+			goto Done;
+		case ColumnType::Uint08:
+			break;
+		case ColumnType::Sint08:
+			cp.compare = &PlanCompareNumber<sbyte>;
+			cp.lexEncode = cp.lexDecode = &PlanLexSint08;
+			break;
+#define PLAN_UNSIGNED(Type) \
+			cp.compare = &PlanCompareNumber<Type>; \
+			cp.lexEncode = cp.lexDecode = &PlanLexSwap<Type>; \
+			break
+#define PLAN_SIGNED(Type, Uint) \
+			cp.compare = &PlanCompareNumber<Type>; \
+			cp.lexEncode = &PlanLexConvert<Uint, EncodeOffsetCoding>; \
+			cp.lexDecode = &PlanLexConvert<Uint, DecodeOffsetCoding>; \
+			break
+		case ColumnType::Uint16:  PLAN_UNSIGNED(uint16_t);
+		case ColumnType::Sint16:  PLAN_SIGNED( int16_t, uint16_t);
+		case ColumnType::Uint32:  PLAN_UNSIGNED(uint32_t);
+		case ColumnType::Sint32:  PLAN_SIGNED( int32_t, uint32_t);
+		case ColumnType::Float32: PLAN_SIGNED(float    , uint32_t);
+		case ColumnType::Uint64:  PLAN_UNSIGNED(uint64_t);
+		case ColumnType::Sint64:  PLAN_SIGNED( int64_t, uint64_t);
+		case ColumnType::Float64: PLAN_SIGNED(double   , uint64_t);
+#undef PLAN_UNSIGNED
+#undef PLAN_SIGNED
+		case ColumnType::Uuid:
+		case ColumnType::Fixed:
+			break;
+		}
+		assert(cp.len > 0);
+		if (&PlanCompareBytes != cp.compare)
+			allMemcmp = false;
+		m_fixedPlan.push_back(cp);
+		m_fixedPlanLen += cp.len;
+	}
+Done:
+	if (m_fixedPlan.size() == colnum) {
+		assert(m_fixedPlanLen == m_fixedLen);
+		if (allMemcmp)
+			m_comparePlan = ComparePlan_FixedMemcmp;
+	}
+	else if (1 == colnum) {
+		ColumnType type = m_columnsMeta.val(0).type;
+		if (ColumnType::Binary == type || ColumnType::CarBin == type)
+			m_comparePlan = ComparePlan_OneBinary;
+	}
+}
+
 template<class Converter>
 void Schema::byteLexConvert(byte* data, size_t size) const {
 	assert(size_t(-1) != m_fixedLen);
@@ -832,7 +943,18 @@ void Schema::byteLexConvert(byte* data, size_t size) const {
 	byte* curr = data;
 	byte* last = data + size;
 	size_t colnum = m_columnsMeta.end_i();
-	for (size_t i = 0; i < colnum; ++i) {
+	size_t i = 0;
+	if (m_fixedPlanLen && m_fixedPlanLen <= size) {
+		const bool isEncode = std::is_same<Converter, EncodeOffsetCoding>::value;
+		for (const FixedColumnPlan& cp : m_fixedPlan) {
+			auto conv = isEncode ? cp.lexEncode : cp.lexDecode;
+			if (conv)
+				conv(curr + cp.offset);
+		}
+		curr += m_fixedPlanLen;
+		i = m_fixedPlan.size();
+	}
+	for (; i < colnum; ++i) {
 		const fstring     colname = m_columnsMeta.key(i);
 		const ColumnMeta& colmeta = m_columnsMeta.val(i);
 		switch (colmeta.type) {
@@ -1612,6 +1734,16 @@ Schema::OneColumnComparator Schema::getOneColumnComparator(bool ascending) const
 
 int Schema::compareData(fstring x, fstring y) const {
 	assert(size_t(-1) != m_fixedLen);
+	switch (m_comparePlan) {
+	case ComparePlan_Interpret:
+		break;
+	case ComparePlan_FixedMemcmp:
+		if (x.size() >= m_fixedLen && y.size() >= m_fixedLen)
+			return memcmp(x.p, y.p, m_fixedLen);
+		break; // let the interpreter report the error
+	case ComparePlan_OneBinary:
+		return fstring_func::compare3()(x, y);
+	}
 	const byte *xcurr = x.udata(), *xlast = xcurr + x.size();
 	const byte *ycurr = y.udata(), *ylast = ycurr + y.size();
 
@@ -1629,7 +1761,18 @@ int Schema::compareData(fstring x, fstring y) const {
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
 	size_t colnum = m_columnsMeta.end_i();
-	for (size_t i = 0; i < colnum; ++i) {
+	size_t i = 0;
+	if (m_fixedPlanLen && m_fixedPlanLen <= x.size() && m_fixedPlanLen <= y.size()) {
+		for (const FixedColumnPlan& cp : m_fixedPlan) {
+			int ret = cp.compare(xcurr + cp.offset, ycurr + cp.offset, cp.len);
+			if (ret)
+				return ret;
+		}
+		xcurr += m_fixedPlanLen;
+		ycurr += m_fixedPlanLen;
+		i = m_fixedPlan.size();
+	}
+	for (; i < colnum; ++i) {
 		const fstring     colname = m_columnsMeta.key(i);
 		const ColumnMeta& colmeta = m_columnsMeta.val(i);
 		switch (colmeta.type) {
@@ -2004,6 +2147,12 @@ const llong  DEFAULT_maxWritingSegmentSize  = 3LL * 1024 * 1024 * 1024;
 const size_t DEFAULT_minMergeSegNum         = 5;
 const size_t DEFAULT_suggestWritableSegNum  = 4;
 const double DEFAULT_purgeDeleteThreshold   = 0.10;
+const size_t DEFAULT_compressingParallelism = 1; // 1 means sequential
+const size_t DEFAULT_indexFilterBitsPerKey  = 10; // about 1% false positive
+const size_t DEFAULT_writeStallSoftSegNum   = 64;
+const size_t DEFAULT_writeStallHardSegNum   = 256;
+const size_t DEFAULT_writeStallMaxDelayUsec = 10000;
+const size_t DEFAULT_warmUpBytesPerSecond   = 256 * 1024 * 1024;
 
 SchemaConfig::SchemaConfig() {
 	m_compressingWorkMemSize = DEFAULT_compressingWorkMemSize;
@@ -2011,6 +2160,15 @@ SchemaConfig::SchemaConfig() {
 	m_minMergeSegNum = DEFAULT_minMergeSegNum;
 	m_suggestWritableSegNum = DEFAULT_suggestWritableSegNum;
 	m_writeThrottleBytesPerSecond = 0; // no limit
+	m_writeStallSoftPendingBytes = 2 * DEFAULT_maxWritingSegmentSize;
+	m_writeStallHardPendingBytes = 4 * DEFAULT_maxWritingSegmentSize;
+	m_writeStallSoftSegNum = DEFAULT_writeStallSoftSegNum;
+	m_writeStallHardSegNum = DEFAULT_writeStallHardSegNum;
+	m_writeStallMaxDelayUsec = DEFAULT_writeStallMaxDelayUsec;
+	m_warmUpBytesPerSecond = DEFAULT_warmUpBytesPerSecond;
+	m_warmUpOnOpen = false;
+	m_compressingParallelism = DEFAULT_compressingParallelism;
+	m_indexFilterBitsPerKey = DEFAULT_indexFilterBitsPerKey;
 	m_purgeDeleteThreshold = DEFAULT_purgeDeleteThreshold;
 	m_usePermanentRecordId = false;
 	m_enableSnapshot = false;
@@ -2236,6 +2394,7 @@ parseJsonColgroup(Schema& schema, const terark::json& js, int sufarrMinFreq) {
 	schema.m_minFragLen = getJsonValue(js, "minFragLen", 0);
 	schema.m_sufarrMinFreq = getJsonValue(js, "sufarrMinFreq", sufarrMinFreq);
 	schema.m_mmapPopulate = getJsonValue(js, "mmapPopulate", false);
+	schema.m_warmUpHot = getJsonValue(js, "warmUpHot", false);
 	//  512: rank_select_se_512
 	//  256: rank_select_se_256
 	// -256: rank_select_il_256
@@ -2738,8 +2897,25 @@ if (colgroupsIter != meta.end()) {
 		meta, "SuggestWritableSegNum", DEFAULT_suggestWritableSegNum);
 	m_writeThrottleBytesPerSecond = getJsonSizeValue(
 		meta, "WriteThrottleBytesPerSecond", 0);
+	m_writeStallSoftPendingBytes = getJsonSizeValue(
+		meta, "WriteStallSoftPendingBytes", 2 * m_maxWritingSegmentSize);
+	m_writeStallHardPendingBytes = getJsonSizeValue(
+		meta, "WriteStallHardPendingBytes", 4 * m_maxWritingSegmentSize);
+	m_writeStallSoftSegNum = getJsonValue(
+		meta, "WriteStallSoftSegNum", DEFAULT_writeStallSoftSegNum);
+	m_writeStallHardSegNum = getJsonValue(
+		meta, "WriteStallHardSegNum", DEFAULT_writeStallHardSegNum);
+	m_writeStallMaxDelayUsec = getJsonValue(
+		meta, "WriteStallMaxDelayUsec", DEFAULT_writeStallMaxDelayUsec);
+	m_warmUpBytesPerSecond = getJsonSizeValue(
+		meta, "WarmUpBytesPerSecond", DEFAULT_warmUpBytesPerSecond);
+	m_warmUpOnOpen = getJsonValue(meta, "WarmUpOnOpen", false);
 	m_purgeDeleteThreshold = getJsonValue(
 		meta, "PurgeDeleteThreshold", DEFAULT_purgeDeleteThreshold);
+	m_compressingParallelism = std::max<size_t>(1, getJsonValue(
+		meta, "CompressingParallelism", DEFAULT_compressingParallelism));
+	m_indexFilterBitsPerKey = getJsonValue(
+		meta, "IndexFilterBitsPerKey", DEFAULT_indexFilterBitsPerKey);
 
 	m_enableSnapshot = getJsonValue(meta, "EnableSnapshot", false);
 {
@@ -2814,8 +2990,9 @@ if (tableIndex != meta.end()) {
 		indexSchema->m_nltNestLevel = (byte)limitInBound(
 			getJsonValue(index, "nltNestLevel", DEFAULT_nltNestLevel), 1u, 20u);
 
-		// default mmapPopulate for index is true
-		indexSchema->m_mmapPopulate = getJsonValue(index, "mmapPopulate", true);
+		// default mmapPopulate for index is true, unless it is warmed up
+		// asynchronously after open
+		indexSchema->m_mmapPopulate = getJsonValue(index, "mmapPopulate", !m_warmUpOnOpen);
 
 /*
 		if (indexSchema->m_isPrimary) {
@@ -2893,6 +3070,8 @@ void SchemaConfig::loadMetaDFA(fstring metaFile) {
 	} else {
 		m_maxWritingSegmentSize = DEFAULT_maxWritingSegmentSize;
 	}
+	m_writeStallSoftPendingBytes = 2 * m_maxWritingSegmentSize;
+	m_writeStallHardPendingBytes = 4 * m_maxWritingSegmentSize;
 	if (metaConf->find_key_uniq_val("CompressingWorkMemSize", &val)) {
 		m_compressingWorkMemSize = lcast(val);
 	} else {
@@ -189,6 +189,9 @@ namespace terark { namespace terichdb {
 		static
 		bool isEquivalentSchema(const Schema&, const Schema&, bool checkColname = false);
 		void compile(const Schema* parent = nullptr);
+		// drop the execution plan built by compile(), rows are interpreted,
+		// used for comparing the plan with the interpreter
+		void clearPlan();
 
 		void parseRow(fstring row, ColumnVec* columns) const;
 		void parseRowAppend(fstring row, size_t start, ColumnVec* columns) const;
@@ -291,6 +294,7 @@ namespace terark { namespace terichdb {
 		bool   m_isInplaceUpdatable: 1;
 		bool   m_enableLinearScan  : 1;
 		bool   m_mmapPopulate : 1;
+		bool   m_warmUpHot : 1; // colgroup is warmed up right after indices
 		static_bitmap<MaxProjColumns> m_keepCols;
 
 		// used for ordered index, m_indexOrder.is1(i) means i'th column
@@ -302,9 +306,29 @@ namespace terark { namespace terichdb {
 		size_t computeFixedRowLen() const; // return 0 if RowLen is not fixed
 		template<class Converter>
 		void byteLexConvert(byte* data, size_t size) const;
+		void compilePlan();
 
 	protected:
 		size_t m_fixedLen;
+
+		// execution plan built by compile(): the leading fixed length
+		// columns are parsed, compared and lex converted by precomputed
+		// offsets and per type kernels, the rest columns are interpreted
+		struct FixedColumnPlan {
+			uint32_t offset;
+			uint32_t len;
+			int  (*compare)(const byte* x, const byte* y, size_t len);
+			void (*lexEncode)(byte*);
+			void (*lexDecode)(byte*);
+		};
+		valvec<FixedColumnPlan> m_fixedPlan;
+		size_t m_fixedPlanLen; // sum of len in m_fixedPlan
+		enum ComparePlan : byte {
+			ComparePlan_Interpret,
+			ComparePlan_FixedMemcmp, // all columns are fixed and memcmp-able
+			ComparePlan_OneBinary,   // just one Binary or CarBin column
+		};
+		ComparePlan m_comparePlan;
 	/*
 	// Backlog: select from multiple tables
 		struct ColumnLink {
@@ -543,6 +567,17 @@ namespace terark { namespace terichdb {
 		size_t   m_suggestWritableSegNum;
 		size_t   m_bestUniqueIndexId;
 		size_t   m_writeThrottleBytesPerSecond;
+		///@{ write stall on background backlog, 0 to disable a limit
+		llong    m_writeStallSoftPendingBytes; // of writable segments to be converted
+		llong    m_writeStallHardPendingBytes;
+		size_t   m_writeStallSoftSegNum;
+		size_t   m_writeStallHardSegNum;
+		size_t   m_writeStallMaxDelayUsec; // delay per write near hard limit
+		///@}
+		size_t   m_warmUpBytesPerSecond; // I/O budget of warm up, 0 for no limit
+		bool     m_warmUpOnOpen; // async warm up readonly segments after open
+		size_t   m_compressingParallelism; // max threads for building one segment
+		size_t   m_indexFilterBitsPerKey; // bloom filter of readonly index, 0 to disable
 		double   m_purgeDeleteThreshold;
 		std::string m_writableSegmentClass;
 		std::string m_readonlySegmentClass;
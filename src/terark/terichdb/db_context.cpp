@@ -71,6 +71,7 @@ static std::atomic<size_t> g_dbCtxCreatedCnt;
 
 DbContext::DbContext(const DbTable* tab)
     : m_tab(const_cast<DbTable*>(tab))
+    , m_wrSegPtr(NULL)
     , syncOnCommit(false)
 {
 // must calling the constructor in lock tab->m_rwMutex
@@ -90,8 +91,9 @@ DbContext::DbContext(const DbTable* tab)
 	m_mySnapshotVersion = tab->m_rowNum - 1;
 	m_isUserDefineSnapshot = false;
 
-	segArrayUpdateSeq = tab->m_segArrayUpdateSeq;
+	segArrayUpdateSeq = tab->getSegArrayUpdateSeq();
 	syncIndex = true;
+	noRecordCacheFill = 0;
 	isUpsertOverwritten = 0;
 	TERARK_RT_assert(tab->getSegArrayUpdateSeq() == oldtab_segArrayUpdateSeq,
 					 std::logic_error);
@@ -115,29 +117,38 @@ DbContext::~DbContext() {
 	g_dbCtxLiveCnt--;
 }
 
+// does not need tab->m_rwMutex: syncs from the published SegArrayVersion,
+// which may be newer than tab->m_segments if the caller does not hold lock
 void DbContext::doSyncSegCtxNoLock(const DbTable* tab) {
 	assert(tab == m_tab);
-	assert(this->segArrayUpdateSeq < tab->getSegArrayUpdateSeq());
-	if (!m_isUserDefineSnapshot) {
-		m_mySnapshotVersion = tab->m_rowNum - 1;
+	SegArrayVersionPtr ver = tab->getSegArrayVersion();
+	assert(NULL != ver);
+	if (ver->m_updateSeq == this->segArrayUpdateSeq) {
+		// publishSegArrayVersionNoLock swaps in the new version before it
+		// stores m_segArrayUpdateSeq, so a caller who saw a newer seq
+		// always loads a version at least that new. Equal seq means this
+		// ctx was already synced to the latest published version (caller
+		// did not compare seq first), nothing changed
+		return;
 	}
+	assert(this->segArrayUpdateSeq < ver->m_updateSeq);
+	const ReadableSegmentPtr* segs = ver->m_segs.data();
 	size_t indexNum = tab->getIndexNum();
-	size_t oldtab_segArrayUpdateSeq = tab->getSegArrayUpdateSeq();
 	size_t oldSegNum = m_segCtx.size();
-	size_t segNum = tab->getSegNum();
+	size_t segNum = ver->m_segs.size();
 	if (m_segCtx.size() < segNum) {
 		m_segCtx.resize(segNum, NULL);
 		for (size_t i = oldSegNum; i < segNum; ++i)
-			m_segCtx[i] = SegCtx::create(tab->getSegmentPtr(i), indexNum);
+			m_segCtx[i] = SegCtx::create(segs[i].get(), indexNum);
 	}
-	if (m_transaction && tab->m_wrSeg.get() != m_wrSegPtr) {
+	if (m_transaction && ver->m_wrSeg != m_wrSegPtr) {
 		// m_transaction is useless, reset it!
 		m_transaction.reset();
 		m_wrSegPtr = NULL;
 	}
 	SegCtx** sctx = m_segCtx.data();
 	for (size_t i = 0; i < segNum; ++i) {
-		ReadableSegment* seg = tab->getSegmentPtr(i);
+		ReadableSegment* seg = segs[i].get();
 		if (NULL == sctx[i]) {
 			sctx[i] = SegCtx::create(seg, indexNum);
 			continue;
@@ -172,14 +183,21 @@ void DbContext::doSyncSegCtxNoLock(const DbTable* tab) {
 	for (size_t i = 0; i < segNum; ++i) {
 		TERARK_RT_assert(NULL != sctx[i], std::logic_error);
 		TERARK_RT_assert(NULL != sctx[i]->seg, std::logic_error);
-		TERARK_RT_assert(tab->getSegmentPtr(i) == sctx[i]->seg, std::logic_error);
+		TERARK_RT_assert(segs[i].get() == sctx[i]->seg, std::logic_error);
 	}
 	m_segCtx.risk_set_size(segNum);
-	m_rowNumVec.assign(tab->m_rowNumVec);
+	m_rowNumVec.assign(ver->m_rowNumVec);
 	TERARK_RT_assert(m_rowNumVec.size() == segNum + 1, std::logic_error);
-	TERARK_RT_assert(tab->getSegArrayUpdateSeq() == oldtab_segArrayUpdateSeq,
-					 std::logic_error);
-	segArrayUpdateSeq = tab->getSegArrayUpdateSeq();
+	segArrayUpdateSeq = ver->m_updateSeq;
+	llong rowNum = m_rowNumVec.back();
+	if (tab->getSegArrayUpdateSeq() == ver->m_updateSeq) {
+		// rows may be appended to wrseg after ver was published
+		rowNum = tab->m_rowNum;
+		m_rowNumVec.back() = rowNum;
+	}
+	if (!m_isUserDefineSnapshot) {
+		m_mySnapshotVersion = rowNum - 1;
+	}
 }
 
 StoreIterator* DbContext::getWrtStoreIterNoLock(size_t segIdx) {
@@ -210,7 +228,7 @@ IndexIterator* DbContext::getIndexIterNoLock(size_t segIdx, size_t indexId) {
 }
 
 void DbContext::debugCheckUnique(fstring row, size_t uniqueIndexId) {
-	assert(this->segArrayUpdateSeq == m_tab->m_segArrayUpdateSeq);
+	assert(this->segArrayUpdateSeq == m_tab->getSegArrayUpdateSeq());
 	const Schema& indexSchema = m_tab->getIndexSchema(uniqueIndexId);
     auto cols1 = cols.get();
     auto key1 = bufs.get();
@@ -101,6 +101,7 @@ public:
 
 	llong insertRow(fstring row);
 	llong upsertRow(fstring row);
+	size_t insertRows(const fstring* rows, size_t rowNum, llong* recIdvec);
 	llong updateRow(llong id, fstring row);
 	void  removeRow(llong id);
 
@@ -113,6 +114,8 @@ public:
 
 	void indexSearchExactNoLock(size_t indexId, fstring key, valvec<llong>* recIdvec);
 	bool indexKeyExistsNoLock(size_t indexId, fstring key);
+	void indexSearchExactMulti(size_t indexId, const fstring* keys, size_t keyNum,
+							   valvec<llong>* recIdvecs);
 
 	bool indexMatchRegex(size_t indexId, class RegexForIndex*, valvec<llong>* recIdvec);
 
@@ -124,6 +127,8 @@ public:
 	void selectColgroups(llong id, const size_t* cgIdvec, size_t cgIdvecSize, valvec<byte>* cgDataVec);
 
 	void selectOneColgroup(llong id, size_t cgId, valvec<byte>* cgData);
+	void selectOneColgroupMulti(const llong* ids, size_t idNum, size_t cgId,
+								valvec<byte>* cgDataVec);
 
 	void selectColumnsNoLock(llong id, const valvec<size_t>& cols, valvec<byte>* colsData);
 	void selectColumnsNoLock(llong id, const size_t* colsId, size_t colsNum, valvec<byte>* colsData);
@@ -170,6 +175,7 @@ public:
 	size_t regexMatchMemLimit;
 	size_t segArrayUpdateSeq;
 	int  upsertMaxRetry;
+	int  noRecordCacheFill; // > 0 while scanning, RecordCache is not filled
 	bool syncIndex;
 	bool m_isUserDefineSnapshot;
     bool syncOnCommit;
@@ -113,6 +113,10 @@ void ReadableIndex::decodeIndexKey(const Schema& schema, byte* key, size_t keyLe
 	}
 }
 
+llong ReadableIndex::searchLowerBoundRank(fstring key) const {
+	return -1;
+}
+
 ReadableStore* ReadableIndex::getReadableStore() {
 	return nullptr;
 }
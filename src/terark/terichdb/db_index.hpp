@@ -97,6 +97,10 @@ public:
 
 	virtual IndexIterator* createIndexIterForward(DbContext*) const = 0;
 	virtual IndexIterator* createIndexIterBackward(DbContext*) const = 0;
+
+	///@returns num of keys less than key, -1 if not supported,
+	///         used for estimating size of key ranges
+	virtual llong searchLowerBoundRank(fstring key) const;
 	///@}
 
 	/// ReadableIndex can be a ReadableStore
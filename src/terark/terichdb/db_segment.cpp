@@ -5,6 +5,7 @@
 #include "fixed_len_key_index.hpp"
 #include "fixed_len_store.hpp"
 #include "appendonly.hpp"
+#include "record_cache.hpp"
 #include <terark/util/autoclose.hpp>
 #include <terark/io/FileStream.hpp>
 #include <terark/io/StreamBuffer.hpp>
@@ -30,6 +31,9 @@
 #endif
 #include <fcntl.h>
 #include <float.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "json.hpp"
 
@@ -381,6 +385,7 @@ ColgroupSegment::ColgroupSegment() {
 	m_dataMemSize = 0;
 	m_totalStorageSize = 0;
 	m_dataInflateSize = 0;
+	m_recordCacheId = 0;
 }
 ColgroupSegment::~ColgroupSegment() {
 	assert(nullptr == m_isPurgedMmap);
@@ -393,6 +398,7 @@ ColgroupSegment* ColgroupSegment::getColgroupSegment() const {
 
 ReadonlySegment::ReadonlySegment() {
 	m_isFreezed = true;
+	m_recordCacheId = RecordCache::newSegmentId();
 }
 ReadonlySegment::~ReadonlySegment() {
 	if (m_isPurgedMmap) {
@@ -454,7 +460,7 @@ const {
 		const Schema& iSchema = m_schema->getColgroupSchema(i);
 		if (iSchema.m_keepCols.has_any1()) {
 			size_t oldsize = buf1->size();
-			m_colgroups[i]->getValueAppend(id, buf1.get(), ctx);
+			colgroupValueAppend(i, id, buf1.get(), ctx);
 			iSchema.parseRowAppend(*buf1, oldsize, cols1.get());
 		}
 		else {
@@ -488,6 +494,32 @@ const {
 	m_schema->m_rowSchema->combineRow(*cols2, val);
 }
 
+// only compressed colgroups are cached, fixed len colgroups are read
+// from mmap directly and inplace updatable colgroups may be changed,
+// scans read through the cache but don't fill it
+void
+ColgroupSegment::colgroupValueAppend(size_t cgId, size_t physicId,
+									 valvec<byte>* val, DbContext* ctx)
+const {
+	const ReadableStore* store = m_colgroups[cgId].get();
+	if (m_recordCacheId) {
+		const Schema& schema = m_schema->getColgroupSchema(cgId);
+		RecordCache& cache = RecordCache::instance();
+		if (cache.enabled() && !schema.m_isInplaceUpdatable &&
+				schema.getFixedRowLen() == 0) {
+			if (cache.getAppend(m_recordCacheId, cgId, physicId, val))
+				return;
+			size_t oldsize = val->size();
+			store->getValueAppend(physicId, val, ctx);
+			if (!ctx || !ctx->noRecordCacheFill)
+				cache.put(m_recordCacheId, cgId, physicId,
+						  fstring(val->data() + oldsize, val->size() - oldsize));
+			return;
+		}
+	}
+	store->getValueAppend(physicId, val, ctx);
+}
+
 void
 ColgroupWritableSegment::indexSearchExactAppend(size_t mySegIdx, size_t indexId,
 										fstring key, valvec<llong>* recIdvec,
@@ -530,6 +562,17 @@ void
 ReadonlySegment::indexSearchExactAppend(size_t mySegIdx, size_t indexId,
 										fstring key, valvec<llong>* recIdvec,
 										DbContext* ctx) const {
+	auto filter = getIndexFilter(indexId);
+	if (filter && !filter->mayContain(IndexFilter::hashKey(key))) {
+		return;
+	}
+	indexSearchExactAppendNoFilter(mySegIdx, indexId, key, recIdvec, ctx);
+}
+
+void
+ReadonlySegment::indexSearchExactAppendNoFilter(size_t mySegIdx, size_t indexId,
+										fstring key, valvec<llong>* recIdvec,
+										DbContext* ctx) const {
 	size_t oldsize = recIdvec->size();
 	auto index = m_indices[indexId].get();
 	index->searchExactAppend(key, recIdvec, ctx);
@@ -628,7 +671,7 @@ const {
 		const Schema& schema = m_schema->getColgroupSchema(colgroupId);
 		if (offsets[colgroupId] == UINT32_MAX) {
 			offsets[colgroupId] = cols->size();
-			m_colgroups[colgroupId]->getValueAppend(physicId, buf.get(), ctx);
+			colgroupValueAppend(colgroupId, physicId, buf.get(), ctx);
 			schema.parseRowAppend(*buf, oldsize, cols.get());
 		}
 		fstring d = (*cols)[offsets[colgroupId] + cp.subColumnId];
@@ -674,12 +717,14 @@ const {
 //	printf("colprojects = %zd, colgroupId = %zd, schema.cols = %zd\n"
 //		, m_schema->m_colproject.size(), colgroupId, schema.columnNum());
 	if (schema.columnNum() == 1) {
-		m_colgroups[colgroupId]->getValue(physicId, colsData, ctx);
+		colsData->erase_all();
+		colgroupValueAppend(colgroupId, physicId, colsData, ctx);
 	}
 	else {
         auto cols = ctx->cols.get();
         auto buf = ctx->bufs.get();
-		m_colgroups[colgroupId]->getValue(physicId, buf.get(), ctx);
+		buf->erase_all();
+		colgroupValueAppend(colgroupId, physicId, buf.get(), ctx);
 		schema.parseRow(*buf, cols.get());
 		colsData->erase_all();
 		colsData->append((*cols)[cp.subColumnId]);
@@ -716,10 +761,24 @@ void ColgroupSegment::selectColgroupsByPhysicId(llong physicId,
 			THROW_STD(out_of_range, "cgId = %zd, cgNum = %zd"
 				, cgId, m_schema->getColgroupNum());
 		}
-		m_colgroups[cgId]->getValue(physicId, &cgDataVec[i], ctx);
+		cgDataVec[i].erase_all();
+		colgroupValueAppend(cgId, physicId, &cgDataVec[i], ctx);
 	}
 }
 
+namespace {
+// records read by scans should not evict the working set from RecordCache
+struct ScanNoCacheFill {
+	DbContext* m_ctx;
+	explicit ScanNoCacheFill(DbContext* ctx) : m_ctx(ctx) {
+		if (ctx) ctx->noRecordCacheFill++;
+	}
+	~ScanNoCacheFill() {
+		if (m_ctx) m_ctx->noRecordCacheFill--;
+	}
+};
+} // namespace
+
 class ColgroupSegment::MyStoreIterForward : public StoreIterator {
 	llong  m_id = 0;
 	DbContextPtr m_ctx;
@@ -735,6 +794,7 @@ public:
 			m_id++;
 		if (terark_likely(size_t(m_id) < rows)) {
 			*id = m_id++;
+			ScanNoCacheFill noFill(m_ctx.get());
 			owner->getValue(*id, val, m_ctx.get());
 			return true;
 		}
@@ -773,6 +833,7 @@ public:
 			 --m_id;
 		if (terark_likely(m_id > 0)) {
 			*id = --m_id;
+			ScanNoCacheFill noFill(m_ctx.get());
 			owner->getValue(*id, val, m_ctx.get());
 			return true;
 		}
@@ -979,29 +1040,36 @@ ReadonlySegment::compressMultipleColgroups(ReadableSegment* input, DbContext* ct
 }
 	// build index from temporary index files
 	colgroupTempFiles.completeWrite();
-	for (size_t i = 0; i < indexNum; ++i) {
-		SortableStrVec strVec;
+	auto buildOneIndex = [&](size_t i) {
 		const Schema& schema = m_schema->getIndexSchema(i);
 		auto tmpStore = colgroupTempFiles.getStore(i);
+		if (schema.getFixedRowLen() && tmpStore->dataInflateSize() >
+				m_schema->m_compressingWorkMemSize) {
+			// keys are in mmap of temp file, sort them in bounded memory
+			m_indices[i] = this->buildIndexByExtSort(schema, tmpStore, tmpDir);
+		}
 		StoreIteratorPtr iter = tmpStore->ensureStoreIterForward(NULL);
-		colgroupTempFiles.collectData(i, iter.get(), strVec);
-		m_indices[i] = this->buildIndex(schema, strVec);
+		if (!m_indices[i]) {
+			SortableStrVec strVec;
+			colgroupTempFiles.collectData(i, iter.get(), strVec);
+			m_indices[i] = this->buildIndex(schema, strVec); // memory heavy
+		}
 		m_colgroups[i] = m_indices[i]->getReadableStore();
 		if (!schema.m_enableLinearScan) {
 			iter.reset();
 			tmpStore->deleteFiles();
 		}
-	}
-	for (size_t i = indexNum; i < colgroupTempFiles.size(); ++i) {
+	};
+	auto buildOneColgroup = [&](size_t i) {
 		if (0 == newRowNum) {
 			m_colgroups[i] = new EmptyIndexStore();
-			continue;
+			return;
 		}
 		const Schema& schema = m_schema->getColgroupSchema(i);
 		auto tmpStore = colgroupTempFiles.getStore(i);
 		if (schema.should_use_FixedLenStore()) {
 			m_colgroups[i] = tmpStore;
-			continue;
+			return;
 		}
 		// dictZipSampleRatio < 0 indicate don't use dictZip
 		if (schema.m_dictZipSampleRatio >= 0.0) {
@@ -1012,7 +1080,7 @@ ReadonlySegment::compressMultipleColgroups(ReadableSegment* input, DbContext* ct
 				m_colgroups[i] = buildDictZipStore(schema, tmpDir, *iter, NULL, NULL);
 				iter.reset();
 				tmpStore->deleteFiles();
-				continue;
+				return;
 			}
 		}
 		size_t maxMem = m_schema->m_compressingWorkMemSize;
@@ -1027,9 +1095,120 @@ ReadonlySegment::compressMultipleColgroups(ReadableSegment* input, DbContext* ct
 		m_colgroups[i] = parts->finishParts();
 		iter.reset();
 		tmpStore->deleteFiles();
+	};
+	size_t colgroupNum = colgroupTempFiles.size();
+	size_t parallel = std::min(m_schema->m_compressingParallelism, colgroupNum);
+	if (parallel <= 1) {
+		for (size_t i = 0; i < indexNum; ++i) {
+			buildOneIndex(i);
+		}
+		for (size_t i = indexNum; i < colgroupNum; ++i) {
+			buildOneColgroup(i);
+		}
+		return;
+	}
+	// indices and colgroups are independent, build them concurrently,
+	// sum of estimated working memory is bounded by m_compressingWorkMemSize.
+	// The builders share nothing mutable of this segment: buildIndex,
+	// buildStore, buildDictZipStore and buildIndexByExtSort are const and
+	// return a new object built from the data of their own colgroup, each
+	// job writes only its own m_indices[i] and m_colgroups[i], which were
+	// sized before, and temp files in tmpDir are named by the colgroup
+	// name, which is unique in the schema. The NestLoudsTrie and DictZip
+	// builders of dfadb already run concurrently for different segments,
+	// and the memory heavy phase of DictZip is serialized process wide by
+	// DictZip_reduceMemMutex, so they are also safe for one segment
+	const size_t maxMem = size_t(m_schema->m_compressingWorkMemSize);
+	valvec<std::pair<size_t, size_t> > jobs(colgroupNum, valvec_reserve());
+	for (size_t i = 0; i < colgroupNum; ++i) {
+		const Schema& schema = m_schema->getColgroupSchema(i);
+		size_t memSize = estimateBuildMemSize(schema, i < indexNum,
+							*colgroupTempFiles.getStore(i), maxMem);
+		jobs.unchecked_push_back(std::make_pair(memSize, i));
+	}
+	// largest job first, to reduce the total time
+	std::sort(jobs.begin(), jobs.end(),
+		[](const std::pair<size_t, size_t>& x, const std::pair<size_t, size_t>& y) {
+			return x.first > y.first;
+		});
+	std::mutex  mutex;
+	std::condition_variable cond;
+	size_t usedMem = 0;
+	size_t nextJob = 0;
+	std::exception_ptr firstError;
+	auto worker = [&]() {
+		for (;;) {
+			std::pair<size_t, size_t> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				if (nextJob >= jobs.size() || firstError) {
+					return;
+				}
+				job = jobs[nextJob++];
+				// a job larger than maxMem runs only when nothing else runs
+				while (usedMem > 0 && usedMem + job.first > maxMem) {
+					cond.wait(lock);
+				}
+				usedMem += job.first;
+			}
+			try {
+				if (job.second < indexNum)
+					buildOneIndex(job.second);
+				else
+					buildOneColgroup(job.second);
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!firstError)
+					firstError = std::current_exception();
+			}
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				usedMem -= job.first;
+			}
+			cond.notify_all();
+		}
+	};
+	std::vector<std::thread> threads;
+	threads.reserve(parallel - 1);
+	for (size_t i = 0; i < parallel - 1; ++i) {
+		threads.emplace_back(worker);
+	}
+	worker(); // current thread is also a worker
+	for (auto& t : threads) {
+		t.join();
+	}
+	if (firstError) {
+		std::rethrow_exception(firstError);
 	}
 }
 
+// the data is collected into a SortableStrVec, as buildOneIndex and
+// buildOneColgroup do: fixed len data is just the strpool, var len data
+// also has an SEntry for each row
+size_t
+ReadonlySegment::estimateBuildMemSize(const Schema& schema, bool isIndex,
+									  const ReadableStore& tmpStore,
+									  size_t maxMem) {
+	const size_t fixlen = schema.getFixedRowLen();
+	const size_t bytes = size_t(tmpStore.dataInflateSize());
+	const size_t rows = size_t(tmpStore.numDataRows());
+	if (fixlen) {
+		if (!isIndex) {
+			// FixedLenStore is the temp store itself
+			return schema.should_use_FixedLenStore() ? 0 : bytes;
+		}
+		// buildIndexByExtSort sorts keys of fixlen <= 16 in the mmap of
+		// the temp file with maxMem, other keys are fully loaded
+		return fixlen <= 16 ? std::min(bytes, maxMem) : bytes;
+	}
+	size_t memSize = bytes + sizeof(SortableStrVec::SEntry) * rows;
+	if (isIndex) {
+		return memSize; // index data is fully loaded
+	}
+	return std::min(memSize, maxMem); // colgroup data is split by maxMem
+}
+
 void
 ReadonlySegment::compressSingleKeyIndex(ReadableSegment* input, DbContext* ctx) {
 	llong logicRowNum = input->m_isDel.size();
@@ -1042,12 +1221,20 @@ ReadonlySegment::compressSingleKeyIndex(ReadableSegment* input, DbContext* ctx)
 	llong prevId = -1, id = -1;
 	SortableStrVec keyVec;
 	const Schema& keySchema = m_schema->getIndexSchema(0);
+	const size_t fixlen = keySchema.getFixedRowLen();
+	FixedLenStorePtr keyStore; // for external sort
+	if (fixlen && llong(fixlen * logicRowNum) > m_schema->m_compressingWorkMemSize) {
+		keyStore = new FixedLenStore(tmpDir, keySchema);
+		keyStore->unneedsLock();
+	}
 	while (iter->increment(&id, &key) && id < logicRowNum) {
 		assert(id >= 0);
 		assert(id < logicRowNum);
 		assert(prevId < id);
 		if (!m_isDel[id]) {
-			if (keySchema.getFixedRowLen() > 0) {
+			if (keyStore) {
+				keyStore->append(key, NULL);
+			} else if (fixlen > 0) {
 				keyVec.m_strpool.append(key);
 			} else {
 				keyVec.push_back(key);
@@ -1072,7 +1259,18 @@ ReadonlySegment::compressSingleKeyIndex(ReadableSegment* input, DbContext* ctx)
 		this->m_isDel.beg_end_set1(inputRowNum, logicRowNum);
 	}
 	m_delcnt = m_isDel.popcnt(); // recompute delcnt
-	m_indices[0] = buildIndex(keySchema, keyVec); // memory heavy
+	if (keyStore) {
+		keyStore->shrinkToFit();
+		m_indices[0] = buildIndexByExtSort(keySchema, keyStore.get(), tmpDir);
+		if (!m_indices[0]) {
+			keyVec.m_strpool.assign(keyStore->getRecordsBasePtr(),
+									fixlen * keyStore->numDataRows());
+		}
+		keyStore->deleteFiles();
+	}
+	if (!m_indices[0]) {
+		m_indices[0] = buildIndex(keySchema, keyVec); // memory heavy
+	}
 	m_colgroups[0] = m_indices[0]->getReadableStore();
 }
 
@@ -1162,6 +1360,7 @@ ReadonlySegment::completeAndReload(DbTable* tab, size_t segIdx,
 	m_isDel.clear();
 	m_isPurged.clear();
 	m_indices.erase_all();
+	m_indexFilters.erase_all();
 	m_colgroups.erase_all();
 	this->load(tmpDir);
 	assert(this->m_isDel.size() == input->m_isDel.size());
@@ -1263,7 +1462,7 @@ ReadonlySegment::completeAndReload(DbTable* tab, size_t segIdx,
 #endif
 	assert(tab->m_segments[segIdx].get() == input);
 	tab->m_segments[segIdx] = this;
-	tab->m_segArrayUpdateSeq++;
+	tab->publishSegArrayVersionNoLock();
 }
 
 // dstBaseId is for merge update
@@ -1568,6 +1767,7 @@ ReadonlySegment::purgeColgroup_s(size_t colgroupId,
 void ReadonlySegment::load(PathRef segDir) {
 	ColgroupSegment::load(segDir);
 	removePurgeBitsForCompactIdspace(segDir);
+	loadIndexFilters(segDir);
 
 	size_t physicRows = this->getPhysicRows();
 	for (size_t i = 0; i < m_colgroups.size(); ++i) {
@@ -1671,6 +1871,56 @@ void ReadonlySegment::save(PathRef segDir) const {
 	}
 	savePurgeBits(segDir);
 	ColgroupSegment::save(segDir);
+	saveIndexFilters(segDir);
+}
+
+void ReadonlySegment::saveIndexFilters(PathRef segDir) const {
+	const size_t bitsPerKey = m_schema->m_indexFilterBitsPerKey;
+	const size_t physicRows = this->getPhysicRows();
+	valvec<byte> key;
+	for (size_t i = 0; i < m_indices.size(); ++i) {
+		const Schema& schema = m_schema->getIndexSchema(i);
+		fs::path fpath = segDir / ("index-" + schema.m_name + ".bloom");
+		if (auto filter = getIndexFilter(i)) {
+			if (segDir != m_segDir)
+				filter->save(fpath);
+			continue;
+		}
+		if (0 == bitsPerKey || 0 == physicRows) {
+			continue;
+		}
+		IndexIteratorPtr iter = m_indices[i]->createIndexIterForward(NULL);
+		if (!iter) {
+			continue; // unordered index may have no iterator
+		}
+		IndexFilterPtr filter = new IndexFilter();
+		filter->init(physicRows, bitsPerKey);
+		llong id;
+		while (iter->increment(&id, &key)) {
+			filter->add(IndexFilter::hashKey(key));
+		}
+		filter->save(fpath);
+	}
+}
+
+void ReadonlySegment::loadIndexFilters(PathRef segDir) {
+	m_indexFilters.erase_all();
+	m_indexFilters.resize(m_indices.size());
+	for (size_t i = 0; i < m_indices.size(); ++i) {
+		const Schema& schema = m_schema->getIndexSchema(i);
+		fs::path fpath = segDir / ("index-" + schema.m_name + ".bloom");
+		if (!fs::exists(fpath)) {
+			continue; // segment built before index filter
+		}
+		IndexFilterPtr filter = new IndexFilter();
+		try {
+			filter->load(fpath);
+			m_indexFilters[i] = filter;
+		}
+		catch (const std::exception& ex) {
+			fprintf(stderr, "WARN: ignore index filter: %s\n", ex.what());
+		}
+	}
 }
 
 void ColgroupSegment::saveRecordStore(PathRef segDir) const {
@@ -1689,6 +1939,8 @@ void ReadonlySegment::loadRecordStore(PathRef segDir) {
 	}
 	// indices must be loaded first
 	assert(m_indices.size() == m_schema->getIndexNum());
+	// records cached before closeFiles may be stale, they age out
+	m_recordCacheId = RecordCache::newSegmentId();
 
 	size_t indexNum = m_schema->getIndexNum();
 	size_t colgroupNum = m_schema->getColgroupNum();
@@ -1794,6 +2046,72 @@ const {
 	return nullptr; // derived class should override
 }
 
+ReadableIndex*
+ReadonlySegment::buildIndexByExtSort(const Schema& schema, ReadableStore* keyStore,
+									 PathRef tmpDir)
+const {
+	const size_t fixlen = schema.getFixedRowLen();
+	const size_t rows = size_t(keyStore->numDataRows());
+	const byte*  keys = keyStore->getRecordsBasePtr();
+	const size_t maxMem = size_t(m_schema->m_compressingWorkMemSize);
+	if (0 == fixlen || 0 == rows || NULL == keys) {
+		return NULL;
+	}
+	if (schema.columnNum() == 1 && schema.getColumnMeta(0).isInteger()) {
+		try {
+			std::unique_ptr<ZipIntKeyIndex> index(new ZipIntKeyIndex(schema));
+			index->build(schema.getColumnMeta(0).type, keys, rows, maxMem, tmpDir);
+			return index.release();
+		}
+		catch (const std::exception&) {
+			// ignore and fall through
+		}
+	}
+	if (fixlen <= 16) {
+		std::unique_ptr<FixedLenKeyIndex> index(new FixedLenKeyIndex(schema));
+		index->build(schema, keys, rows, maxMem, tmpDir);
+		return index.release();
+	}
+	return NULL; // such as NestLoudsTrieIndex, needs all keys in memory
+}
+
+ReadableIndex*
+ReadonlySegment::buildIndexSorted(const Schema& schema, SortableStrVec& keys,
+								  const valvec<uint32_t>& sortedIds)
+const {
+	const size_t fixlen = schema.getFixedRowLen();
+	if (!canBuildIndexSorted(schema) || sortedIds.empty()) {
+		return NULL;
+	}
+	if (schema.columnNum() == 1 && schema.getColumnMeta(0).isInteger()) {
+		try {
+			std::unique_ptr<ZipIntKeyIndex> index(new ZipIntKeyIndex(schema));
+			index->buildSorted(schema.getColumnMeta(0).type, keys, sortedIds);
+			return index.release();
+		}
+		catch (const std::exception&) {
+			// ignore and fall through
+		}
+	}
+	if (fixlen <= 16) {
+		std::unique_ptr<FixedLenKeyIndex> index(new FixedLenKeyIndex(schema));
+		index->buildSorted(schema, keys, sortedIds);
+		return index.release();
+	}
+	return NULL; // such as NestLoudsTrieIndex
+}
+
+bool ReadonlySegment::canBuildIndexSorted(const Schema& schema) const {
+	const size_t fixlen = schema.getFixedRowLen();
+	if (0 == fixlen) {
+		return false; // NestLoudsTrieIndex builder sorts the keys itself
+	}
+	if (schema.columnNum() == 1 && schema.getColumnMeta(0).isInteger()) {
+		return true; // ZipIntKeyIndex, or FixedLenKeyIndex, fixlen <= 8
+	}
+	return fixlen <= 16;
+}
+
 ReadableStore*
 ReadonlySegment::buildStore(const Schema& schema, SortableStrVec& storeData)
 const {
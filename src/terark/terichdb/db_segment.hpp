@@ -3,6 +3,7 @@
 
 #include "db_index.hpp"
 #include "db_store.hpp"
+#include "index_filter.hpp"
 #include <terark/bitmap.hpp>
 #include <terark/rank_select.hpp>
 #include <tbb/spin_rw_mutex.h>
@@ -140,6 +141,8 @@ public:
 
 protected:
 	void getValueByPhysicId(size_t id, valvec<byte>* val, DbContext*) const;
+	void colgroupValueAppend(size_t cgId, size_t physicId,
+							 valvec<byte>* val, DbContext*) const;
 
 	void selectColumnsByPhysicId(llong recId, const size_t* colsId,
 				size_t colsNum, valvec<byte>* colsData, DbContext*) const;
@@ -160,6 +163,7 @@ public:
 	llong  m_dataInflateSize;
 	llong  m_dataMemSize;
 	llong  m_totalStorageSize;
+	ullong m_recordCacheId; // for RecordCache, 0 if not cached
 };
 typedef boost::intrusive_ptr<ColgroupSegment> ColgroupSegmentPtr;
 
@@ -189,6 +193,14 @@ public:
 	void indexSearchExactAppend(size_t mySegIdx, size_t indexId,
 								fstring key, valvec<llong>* recIdvec,
 								DbContext*) const override;
+	///@{ for callers which have checked getIndexFilter
+	void indexSearchExactAppendNoFilter(size_t mySegIdx, size_t indexId,
+								fstring key, valvec<llong>* recIdvec,
+								DbContext*) const;
+	const IndexFilter* getIndexFilter(size_t indexId) const {
+		return indexId < m_indexFilters.size() ? m_indexFilters[indexId].get() : NULL;
+	}
+	///@}
 
 	void selectColumns(llong recId, const size_t* colsId, size_t colsNum,
 					   valvec<byte>* colsData, DbContext*) const override;
@@ -207,6 +219,28 @@ public:
 			buildIndex(const Schema&, SortableStrVec& indexData)
 			const = 0;
 
+	///@param keyStore fixed len keys in a temporary file
+	///@returns NULL if the index can not be built with bounded memory,
+	///         caller should then fallback to buildIndex
+	virtual ReadableIndex*
+			buildIndexByExtSort(const Schema&, ReadableStore* keyStore,
+								PathRef tmpDir)
+			const;
+
+	///@param keys fixed len keys in recId order
+	///@param sortedIds recIds in (key, recId) order, such as merged from
+	///       sorted indices of input segments
+	///@returns NULL if the index can not be built from sorted keys,
+	///         caller should then fallback to buildIndex
+	virtual ReadableIndex*
+			buildIndexSorted(const Schema&, SortableStrVec& keys,
+							 const valvec<uint32_t>& sortedIds)
+			const;
+	/// checked before merging, buildIndexSorted never returns NULL
+	/// for non-empty keys if this returns true, var len keys are never
+	/// merged sorted, they are resorted
+	virtual bool canBuildIndexSorted(const Schema&) const;
+
 	virtual ReadableStore*
 			buildStore(const Schema&, SortableStrVec& storeData)
 			const = 0;
@@ -217,6 +251,11 @@ public:
 			const;
 
 	void compressMultipleColgroups(ReadableSegment* input, DbContext* ctx);
+	///@returns working memory of building an index or a colgroup from its
+	///         temporary store, by the bytes of its data in the store
+	static size_t estimateBuildMemSize(const Schema&, bool isIndex,
+									   const ReadableStore& tmpStore,
+									   size_t maxMem);
 	void compressSingleKeyIndex(ReadableSegment* input, DbContext* ctx);
 	virtual
 	void compressSingleColgroup(ReadableSegment* input, DbContext* ctx);
@@ -238,6 +277,11 @@ public:
 
 	void removePurgeBitsForCompactIdspace(PathRef segDir);
 	void savePurgeBits(PathRef segDir) const;
+
+	void saveIndexFilters(PathRef segDir) const;
+	void loadIndexFilters(PathRef segDir);
+
+	valvec<IndexFilterPtr> m_indexFilters; // parallel with m_indices, may be null
 };
 typedef boost::intrusive_ptr<ReadonlySegment> ReadonlySegmentPtr;
 
@@ -101,6 +101,11 @@ UpdatableStore* ReadableStore::getUpdatableStore() {
 	return nullptr;
 }
 
+bool ReadableStore::filterRange(const fstring*, const fstring*, febitvec*)
+const {
+	return false;
+}
+
 void ReadableStore::deleteFiles() {
 	THROW_STD(invalid_argument, "Unsupportted Method");
 }
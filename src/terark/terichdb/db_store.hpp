@@ -86,6 +86,14 @@ public:
 	virtual AppendableStore* getAppendableStore();
 	virtual UpdatableStore* getUpdatableStore();
 
+	///@{ predicate pushdown: set bitmap[id] iff lo <= value(id) <= hi,
+	/// compared by the store's schema, NULL lo/hi is unbounded.
+	/// bitmap is resized to numDataRows(), ids are physic ids
+	///@returns false if not supported, caller should fetch the values
+	virtual bool filterRange(const fstring* lo, const fstring* hi,
+							 febitvec* bitmap) const;
+	///@}
+
 	void getValue(llong id, valvec<byte>* val, DbContext* ctx) const {
 		val->risk_set_size(0);
 		getValueAppend(id, val, ctx);
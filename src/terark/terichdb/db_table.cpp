@@ -14,10 +14,20 @@
 #include <terark/util/sortable_strvec.hpp>
 #include <boost/scope_exit.hpp>
 #include <thread> // for std::this_thread::sleep_for
+#include <mutex>
+#include <condition_variable>
 #include <tbb/tbb_thread.h>
-#include <terark/util/concurrent_queue.hpp>
 #include <float.h>
 #include <terark/util/profiling.hpp>
+#include <chrono>
+
+#if defined(_MSC_VER)
+	#include <io.h>
+#else
+	#include <unistd.h>
+	#include <sys/mman.h>
+#endif
+#include <fcntl.h>
 
 #undef min
 #undef max
@@ -80,12 +90,29 @@ DbTable::DbTable()
 	m_bgTaskNum = 0;
 	m_rowNum = 0;
 	m_oldestSnapshotVersion = 0;
-	m_segArrayUpdateSeq = 1;
+	m_segArrayUpdateSeq.store(1, std::memory_order_relaxed);
+	m_segArrayVersion = NULL;
+	m_segArrayVerReaders[0] = 0;
+	m_segArrayVerReaders[1] = 0;
+	m_segArrayVerEpoch = 0;
 	m_throwOnThrottle = false; // if true, auto delay/sleep on throttle
+	m_pendingConvertBytes = 0;
+	m_publishedSegNum = 0;
+	m_oldestRowId = 0;
+	m_writeStallReason = WriteStallNone;
+	m_writeStallDelayUsec = 0;
+	m_writeStallDelayedNum = 0;
+	m_writeStallStoppedNum = 0;
+	m_writeStallTotalUsec = 0;
+	m_warmUp = NULL;
 //	m_ctxListHead = new DbContextLink();
 }
 
 DbTable::~DbTable() {
+	stopWarmUp();
+	if (SegArrayVersion* ver = m_segArrayVersion.exchange(NULL)) {
+		ver->release(); // no readers now
+	}
 	m_wrSeg = nullptr;
 //	fprintf(stderr, "INFO: DbTable::~DbTable(): m_dir = %s\n", m_dir.string().c_str());
 //	fprintf(stderr, "INFO: DbTable::~DbTable(): m_segments.size = %zd\n", m_segments.size());
@@ -279,6 +306,9 @@ static SortableStrVec getWorkingSegDirList(PathRef mergeDir) {
 		if (fstr.startsWith("wr-") || fstr.startsWith("rd-")) {
 			segDirList.push_back(fname);
 		}
+		else if (fstr == "OldestRowId") {
+			// saved by saveOldestRowId
+		}
 		else {
 			fprintf(stderr, "WARN: Skip unknown dir: %s\n", segDir.c_str());
 		}
@@ -393,13 +423,307 @@ void DbTable::doLoad(PathRef dir) {
 	}
 	m_rowNumVec.resize_no_init(m_segments.size() + 1);
 	llong baseId = 0;
+	if (fs::exists(mergeDir / "OldestRowId")) {
+		// head segments have been removed by dropOldSegments
+		LineBuf line;
+		line.read_all((mergeDir / "OldestRowId").string());
+		baseId = strtoll(line.p, NULL, 10);
+	}
 	for (size_t i = 0; i < m_segments.size(); ++i) {
 		m_rowNumVec[i] = baseId;
 		baseId += m_segments[i]->numDataRows();
 	}
 	m_rowNumVec.back() = baseId; // the end guard
 	m_rowNum = baseId;
+	publishSegArrayVersionNoLock();
 	runLockFile.close(); // notify DO NOT delete in BOOST_SCOPE_EXIT
+	if (m_schema->m_warmUpOnOpen) {
+		startWarmUp();
+	}
+}
+
+struct DbTable::WarmUp {
+	std::thread thr;
+	std::atomic<bool>  stop;
+	std::atomic<bool>  running;
+	std::atomic<llong> totalBytes;
+	std::atomic<llong> doneBytes;
+	std::atomic<llong> cachedBytes;
+	std::atomic_size_t totalFiles;
+	std::atomic_size_t doneFiles;
+	WarmUp() : stop(false), running(true), totalBytes(0), doneBytes(0)
+			 , cachedBytes(0), totalFiles(0), doneFiles(0) {}
+};
+
+namespace {
+struct WarmUpFile {
+	std::string fpath;
+	llong fsize;
+};
+}
+
+#if !defined(_MSC_VER)
+// bytes of [pos, pos+len) in page cache, base is the mmap of the file
+static llong
+residentBytes(const byte* base, llong pos, llong len, valvec<byte>& vec) {
+	const llong pageSize = sysconf(_SC_PAGESIZE);
+	const llong pages = (len + pageSize - 1) / pageSize;
+	vec.resize_no_init(size_t(pages));
+#if defined(__linux__)
+	typedef unsigned char* MincoreVec;
+#else
+	typedef char* MincoreVec;
+#endif
+	if (mincore((void*)(base + pos), size_t(len), (MincoreVec)vec.data()) != 0) {
+		return 0;
+	}
+	llong bytes = 0;
+	for (llong i = 0; i < pages; ++i) {
+		if (vec[i] & 1)
+			bytes += std::min(pageSize, len - i * pageSize);
+	}
+	return bytes;
+}
+#endif
+
+// pages in one file by chunks, sleeps to keep in the I/O budget,
+// a chunk is done when it has been read, chunks found in page cache by
+// mincore are not read and cost no I/O budget
+static void
+warmUpOneFile(const WarmUpFile& file, const std::atomic<bool>& stop,
+			  std::atomic<llong>& doneBytes, std::atomic<llong>& cachedBytes,
+			  double bytesPerSecond,
+			  std::chrono::steady_clock::time_point startTime, llong& issuedBytes) {
+	const llong chunkSize = 4 << 20;
+	valvec<byte> buf(chunkSize, valvec_no_init());
+#if defined(_MSC_VER)
+	FILE* fp = fopen(file.fpath.c_str(), "rb");
+	if (NULL == fp) {
+		return; // the segment may have been merged or purged
+	}
+#else
+	int fd = ::open(file.fpath.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return; // the segment may have been merged or purged
+	}
+	// just for mincore, NULL if failed, then all chunks are read
+	byte* base = (byte*)::mmap(NULL, size_t(file.fsize), PROT_READ, MAP_SHARED, fd, 0);
+	if (MAP_FAILED == (void*)base) {
+		base = NULL;
+	}
+	valvec<byte> incore;
+#endif
+	for (llong pos = 0; pos < file.fsize && !stop; ) {
+		llong len = std::min(chunkSize, file.fsize - pos);
+#if defined(_MSC_VER)
+		len = fread(buf.data(), 1, size_t(len), fp);
+		if (len <= 0) break;
+#else
+		if (base && residentBytes(base, pos, len, incore) == len) {
+			pos += len;
+			doneBytes += len;
+			cachedBytes += len;
+			continue;
+		}
+		len = ::pread(fd, buf.data(), size_t(len), off_t(pos));
+		if (len <= 0) break; // the file may have been truncated
+#endif
+		pos += len;
+		issuedBytes += len;
+		doneBytes += len;
+		if (bytesPerSecond > 0) {
+			double expect = issuedBytes / bytesPerSecond;
+			for (;;) {
+				std::chrono::duration<double> elapsed =
+					std::chrono::steady_clock::now() - startTime;
+				if (stop || elapsed.count() >= expect)
+					break;
+				double sec = std::min(expect - elapsed.count(), 0.1);
+				std::this_thread::sleep_for(std::chrono::duration<double>(sec));
+			}
+		}
+	}
+#if defined(_MSC_VER)
+	fclose(fp);
+#else
+	if (base) {
+		::munmap(base, size_t(file.fsize));
+	}
+	::close(fd);
+#endif
+}
+
+void DbTable::getWarmUpFiles(valvec<std::string>* fpaths) const {
+	// files of a colgroup are "colgroup-name", "colgroup-name.ext",
+	// "colgroup-name.0000.ext" for multi parts, and "colgroup-name-dict"
+	valvec<std::string> hotPrefixes;
+	for (size_t i = m_schema->getIndexNum(); i < m_schema->getColgroupNum(); ++i) {
+		const Schema& schema = m_schema->getColgroupSchema(i);
+		if (schema.m_warmUpHot)
+			hotPrefixes.push_back("colgroup-" + schema.m_name);
+	}
+	auto isHot = [&](fstring fname) {
+		for (const std::string& prefix : hotPrefixes) {
+			if (fname.startsWith(prefix)) {
+				fstring rest = fname.substr(prefix.size());
+				if (rest.empty() || '.' == rest[0] || rest == "-dict")
+					return true;
+			}
+		}
+		return false;
+	};
+	valvec<std::string> files[3]; // index files, hot colgroups, colgroups
+	SegArrayVersionPtr ver = getSegArrayVersion();
+	for (size_t i = ver->m_segs.size(); i > 0; --i) {
+		ReadableSegment* seg = ver->m_segs[i-1].get();
+		if (!seg->getReadonlySegment())
+			continue;
+		boost::system::error_code ec;
+		fs::directory_iterator iter(seg->m_segDir, ec), end;
+		for (; !ec && iter != end; iter.increment(ec)) {
+			const fs::path& fpath = iter->path();
+			std::string fname = fpath.filename().string();
+			int kind;
+			if (fstring(fname).startsWith("index-"))
+				kind = 0;
+			else if (fstring(fname).startsWith("colgroup-"))
+				kind = isHot(fname) ? 1 : 2;
+			else
+				continue;
+			files[kind].push_back(fpath.string());
+		}
+	}
+	fpaths->erase_all();
+	for (auto& vec : files) {
+		for (auto& f : vec)
+			fpaths->push_back(std::move(f));
+	}
+}
+
+void DbTable::startWarmUp(size_t bytesPerSecond) {
+	stopWarmUp();
+	if (0 == bytesPerSecond)
+		bytesPerSecond = m_schema->m_warmUpBytesPerSecond;
+	valvec<std::string> fpaths;
+	getWarmUpFiles(&fpaths);
+	valvec<WarmUpFile> files;
+	for (auto& fpath : fpaths) {
+		boost::system::error_code ec;
+		llong fsize = fs::file_size(fpath, ec);
+		if (!ec && fsize > 0)
+			files.push_back({std::move(fpath), fsize});
+	}
+	WarmUp* w = new WarmUp();
+	for (auto& f : files) {
+		w->totalBytes += f.fsize;
+		w->totalFiles++;
+	}
+	fprintf(stderr, "INFO: DbTable::startWarmUp(%s): files = %zd, bytes = %lld, bytesPerSecond = %zd\n"
+		, m_dir.string().c_str(), size_t(w->totalFiles), llong(w->totalBytes), bytesPerSecond);
+	std::string dir = m_dir.string();
+	w->thr = std::thread([w, dir, bytesPerSecond](valvec<WarmUpFile> files) {
+		auto startTime = std::chrono::steady_clock::now();
+		llong issuedBytes = 0;
+		for (size_t i = 0; i < files.size() && !w->stop; ++i) {
+			warmUpOneFile(files[i], w->stop, w->doneBytes, w->cachedBytes,
+						  double(bytesPerSecond), startTime, issuedBytes);
+			w->doneFiles++;
+		}
+		std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - startTime;
+		fprintf(stderr, "INFO: DbTable warm up(%s) %s: files = %zd/%zd, bytes = %lld/%lld, cached = %lld, time = %.3f sec\n"
+			, dir.c_str(), w->stop ? "stopped" : "done"
+			, size_t(w->doneFiles), size_t(w->totalFiles)
+			, llong(w->doneBytes), llong(w->totalBytes)
+			, llong(w->cachedBytes), elapsed.count());
+		w->running = false;
+	}, std::move(files));
+	WarmUp* old;
+	{
+		MyRwLock lock(m_rwMutex, true);
+		old = m_warmUp; // started concurrently by another thread
+		m_warmUp = w;
+	}
+	if (old) {
+		old->stop = true;
+		old->thr.join();
+		delete old;
+	}
+}
+
+void DbTable::stopWarmUp() {
+	WarmUp* w;
+	{
+		MyRwLock lock(m_rwMutex, true);
+		w = m_warmUp;
+		m_warmUp = NULL;
+	}
+	if (w) {
+		w->stop = true;
+		w->thr.join();
+		delete w;
+	}
+}
+
+void DbTable::getWarmUpProgress(WarmUpProgress* p) const {
+	MyRwLock lock(m_rwMutex, false);
+	if (m_warmUp) {
+		p->totalBytes = m_warmUp->totalBytes;
+		p->doneBytes  = m_warmUp->doneBytes;
+		p->cachedBytes= m_warmUp->cachedBytes;
+		p->totalFiles = m_warmUp->totalFiles;
+		p->doneFiles  = m_warmUp->doneFiles;
+		p->running    = m_warmUp->running;
+	} else {
+		memset(p, 0, sizeof(*p));
+	}
+}
+
+SegArrayVersionPtr DbTable::getSegArrayVersion() const {
+	for (;;) {
+		size_t epoch = m_segArrayVerEpoch.load();
+		auto& readers = m_segArrayVerReaders[epoch & 1];
+		readers++;
+		if (m_segArrayVerEpoch.load() == epoch) {
+			// publisher will not release the version we load until
+			// readers in this epoch slot are drained
+			SegArrayVersionPtr ver(m_segArrayVersion.load());
+			readers--;
+			return ver;
+		}
+		readers--; // epoch flipped, retry in the new slot
+	}
+}
+
+void DbTable::publishSegArrayVersionNoLock() {
+	assert(m_rowNumVec.size() == m_segments.size() + 1);
+	SegArrayVersion* ver = new SegArrayVersion();
+	ver->m_segs.assign(m_segments);
+	ver->m_rowNumVec.assign(m_rowNumVec);
+	ver->m_wrSeg = m_wrSeg.get();
+	ver->m_updateSeq = getSegArrayUpdateSeq() + 1;
+	ver->add_ref(); // owned by m_segArrayVersion
+	// backlog for write stall, writable segments except m_wrSeg are
+	// frozen and waiting for flush or convert
+	llong pendingBytes = 0;
+	for (size_t i = 0; i < m_segments.size(); ++i) {
+		ReadableSegment* seg = m_segments[i].get();
+		if (seg != m_wrSeg.get() && seg->getWritableSegment())
+			pendingBytes += seg->dataStorageSize();
+	}
+	m_pendingConvertBytes.store(pendingBytes, std::memory_order_relaxed);
+	m_publishedSegNum.store(m_segments.size(), std::memory_order_relaxed);
+	m_oldestRowId.store(m_rowNumVec[0], std::memory_order_relaxed);
+	SegArrayVersion* old = m_segArrayVersion.exchange(ver);
+	// DbContext checks m_segArrayUpdateSeq first, ver must be visible
+	m_segArrayUpdateSeq.store(ver->m_updateSeq, std::memory_order_release);
+	if (old) {
+		size_t epoch = m_segArrayVerEpoch.fetch_add(1);
+		while (m_segArrayVerReaders[epoch & 1].load() != 0) {
+			std::this_thread::yield(); // readers are very short
+		}
+		old->release();
+	}
 }
 
 size_t DbTable::findSegIdx(size_t segIdxBeg, ReadableSegment* seg) const {
@@ -458,7 +782,7 @@ protected:
 		this->m_ctx.reset(ctx);
 	// MyStoreIterator creation is rarely used, lock it by m_rwMutex
 		MyRwLock lock(tab->m_rwMutex, false);
-		m_segArrayUpdateSeq = tab->m_segArrayUpdateSeq;
+		m_segArrayUpdateSeq = tab->getSegArrayUpdateSeq();
 		m_segs.resize_fill(tab->m_segments.size());
 		for (size_t i = 0; i < m_segs.size(); ++i) {
 			ReadableSegment* seg = tab->m_segments[i].get();
@@ -480,7 +804,7 @@ protected:
 
 	bool syncTabSegs() {
 		auto tab = static_cast<const DbTable*>(m_store.get());
-		if (m_segArrayUpdateSeq == tab->m_segArrayUpdateSeq) {
+		if (m_segArrayUpdateSeq == tab->getSegArrayUpdateSeq()) {
 			// there is no new segments
 			llong oldmaxId = m_rowNumVec.back();
 			if (tab->m_rowNum == oldmaxId)
@@ -490,6 +814,11 @@ protected:
 			return tab->m_rowNum > oldmaxId;
 		}
 		valvec<OneSeg> tmp(tab->m_segments.size()+2); // with 2 extra
+		// segments before current one may be merged or dropped
+		assert(m_segIdx >= 1);
+		ReadableSegmentPtr curSeg = m_segs[m_segIdx-1].seg;
+		llong  curBaseId = m_rowNumVec[m_segIdx-1];
+		size_t curSegIdx = size_t(-1);
 		OneSeg* segA = m_segs.data();
 		size_t  segN = m_segs.size();
 		sort_0(segA, segN, By_seg_get());
@@ -502,11 +831,23 @@ protected:
 			if (lo < segN && segA[lo].seg.get() == seg) {
 				tmp[i].iter = std::move(segA[lo].iter);
 			}
+			if (seg == curSeg.get())
+				curSegIdx = i;
 		}
 		m_segs.swap(tmp);
 		m_rowNumVec = tab->m_rowNumVec;
-		m_segArrayUpdateSeq = tab->m_segArrayUpdateSeq;
+		m_segArrayUpdateSeq = tab->getSegArrayUpdateSeq();
 		assert(m_rowNumVec.size() == m_segs.size()+1);
+		if (size_t(-1) != curSegIdx) {
+			m_segIdx = curSegIdx + 1;
+		}
+		else if (curBaseId < m_rowNumVec[0]) {
+			// curSeg was dropped, so were all segments before it
+			onCurSegDropped();
+		}
+		else { // curSeg was merged, goto the segment which holds its rows
+			m_segIdx = upper_bound_0(m_rowNumVec.data(), m_segs.size(), curBaseId);
+		}
 		return true;
 	}
 
@@ -542,7 +883,7 @@ protected:
 		assert(m_segIdx <= m_segs.size());
 		auto cur = &m_segs[m_segIdx-1];
 		if (terark_unlikely(!cur->iter)) {
-			 cur->iter = cur->seg->createStoreIterForward(m_ctx.get());
+			 cur->iter = createSegStoreIter(cur->seg.get());
 		}
 		if (!cur->iter->increment(subId, val)) {
 			syncTabSegs();
@@ -561,6 +902,7 @@ protected:
 		return true;
 	}
 	virtual bool incrementSegIndex() = 0;
+	virtual void onCurSegDropped() = 0;
 
 	///! on success, position must point to next record
 	///! on fail, position is unspecified
@@ -570,6 +912,9 @@ protected:
 		assert(m_segIdx <= m_segs.size());
 		do {
 			syncTabSegs();
+			if (id < m_rowNumVec[0]) {
+				return false; // dropped
+			}
 			size_t upp = upper_bound_0(m_rowNumVec.data(), m_rowNumVec.size()-1, id);
 			llong subId = id - m_rowNumVec[upp-1];
 			auto cur = &m_segs[upp-1];
@@ -623,6 +968,9 @@ public:
 		}
 		return false;
 	}
+	void onCurSegDropped() override {
+		m_segIdx = 0; // next is the first segment
+	}
 	void reset() override {
 		resetIterBase();
 		m_segIdx = 1;
@@ -645,12 +993,83 @@ public:
 		}
 		return false;
 	}
+	void onCurSegDropped() override {
+		m_segIdx = 1; // there is no older segment
+	}
 	void reset() override {
 		resetIterBase();
 		m_segIdx = m_segs.size();
 	}
 };
 
+// selectColumns of rows in a segment, deleted rows are skipped
+class SegProjectIter : public StoreIterator {
+	const ReadableSegment* m_seg;
+	const valvec<size_t>&  m_cols;
+	DbContext* m_ctx;
+	llong m_id;
+	bool  m_forward;
+public:
+	SegProjectIter(const ReadableSegment* seg, const valvec<size_t>& cols,
+				   DbContext* ctx, bool forward)
+	  : m_seg(seg), m_cols(cols), m_ctx(ctx), m_forward(forward) {
+		m_store.reset(const_cast<ReadableSegment*>(seg));
+		reset();
+	}
+	bool increment(llong* id, valvec<byte>* val) override {
+		if (m_forward) {
+			llong rows = m_seg->m_isDel.size();
+			while (m_id < rows && m_seg->testIsDel(m_id))
+				m_id++;
+			if (m_id >= rows)
+				return false;
+			*id = m_id++;
+		}
+		else {
+			while (m_id > 0 && m_seg->testIsDel(m_id-1))
+				m_id--;
+			if (0 == m_id)
+				return false;
+			*id = --m_id;
+		}
+		m_seg->selectColumns(*id, m_cols.data(), m_cols.size(), val, m_ctx);
+		return true;
+	}
+	bool seekExact(llong id, valvec<byte>* val) override {
+		assert(id >= 0);
+		if (id >= llong(m_seg->m_isDel.size()))
+			return false;
+		m_id = m_forward ? id + 1 : id;
+		m_seg->selectColumns(id, m_cols.data(), m_cols.size(), val, m_ctx);
+		return true;
+	}
+	void reset() override {
+		m_id = m_forward ? 0 : m_seg->m_isDel.size();
+	}
+};
+
+class DbTable::MyProjectIterForward : public MyStoreIterForward {
+	valvec<size_t> m_cols;
+	StoreIterator* createSegStoreIter(ReadableSegment* seg) override {
+		return new SegProjectIter(seg, m_cols, m_ctx.get(), true);
+	}
+public:
+	MyProjectIterForward(const DbTable* tab, const size_t* colsId,
+						 size_t colsNum, DbContext* ctx)
+	  : MyStoreIterForward(tab, ctx), m_cols(colsId, colsNum) {}
+};
+
+class DbTable::MyProjectIterBackward : public MyStoreIterBackward {
+	valvec<size_t> m_cols;
+	StoreIterator* createSegStoreIter(ReadableSegment* seg) override {
+		return new SegProjectIter(seg, m_cols, m_ctx.get(), false);
+	}
+public:
+	MyProjectIterBackward(const DbTable* tab, const size_t* colsId,
+						  size_t colsNum, DbContext* ctx)
+	  : MyStoreIterBackward(tab, ctx), m_cols(colsId, colsNum) {}
+};
+
 const std::string& BatchWriter::strError() const {
 	return m_ctx->m_transaction->strError();
 }
@@ -817,7 +1236,7 @@ llong BatchWriter::upsertRow(fstring row) {
 //			llong recId = baseId + subId;
 //			assert(ctx->exactMatchRecIdvec.size() == 1);
 //			MyRwLock lock(tab->m_rwMutex, false);
-//			if (ctx->segArrayUpdateSeq != tab->m_segArrayUpdateSeq) {
+//			if (ctx->segArrayUpdateSeq != tab->getSegArrayUpdateSeq()) {
 //				ctx->doSyncSegCtxNoLock(tab);
 //				size_t upp = upper_bound_a(ctx->m_rowNumVec, recId);
 //#if !defined(NDEBUG)
@@ -986,6 +1405,212 @@ StoreIterator* DbTable::createStoreIterBackward(DbContext* ctx) const {
 	return new MyStoreIterBackward(this, ctx);
 }
 
+namespace {
+struct ScanPartition {
+	ReadableSegment* seg;
+	llong baseId;
+	llong subBeg;
+	llong subEnd;
+};
+// rows of a partition, for ordered parallelScan
+struct ScanResult {
+	valvec<llong>  ids;
+	valvec<size_t> offsets; // offsets.size() == ids.size() + 1
+	valvec<byte>   data;
+	bool done = false;
+};
+// same as indexSearchExact: with m_deletionTime, rows deleted after the
+// snapshot are still visible to the snapshot
+bool isVisibleToSnapshot(const ReadableSegment* seg, llong subId,
+						 llong snapshotVersion) {
+	if (!seg->m_isPurged.empty() && seg->m_isPurged[subId])
+		return false;
+	if (seg->m_deletionTime) {
+		auto deltime = (const llong*)seg->m_deletionTime->getRecordsBasePtr();
+		return deltime[seg->getPhysicId(subId)] > snapshotVersion;
+	}
+	return !seg->testIsDel(subId);
+}
+}
+
+llong DbTable::parallelScan(const ParallelScanOptions& opt,
+							const ScanRowCallback& onRow, DbContext* ctx)
+const {
+	ctx->trySyncSegCtxSpeculativeLock(this);
+	valvec<ReadableSegmentPtr> segs(ctx->m_segCtx.size(), valvec_reserve());
+	for (size_t i = 0; i < ctx->m_segCtx.size(); ++i) {
+		segs.push_back(ctx->m_segCtx[i]->seg);
+	}
+	const valvec<llong> rowNumVec = ctx->m_rowNumVec; // the snapshot
+	const llong snapshotVersion = ctx->m_mySnapshotVersion;
+	assert(rowNumVec.size() == segs.size() + 1);
+	{
+		MyRwLock lock(m_rwMutex, true);
+		m_tableScanningRefCount++;
+	}
+	BOOST_SCOPE_EXIT(&m_rwMutex, &m_tableScanningRefCount){
+		MyRwLock lock(m_rwMutex, true);
+		m_tableScanningRefCount--;
+	}BOOST_SCOPE_EXIT_END;
+
+	const llong partRows = std::max<llong>(opt.partitionRows, 1);
+	valvec<ScanPartition> parts;
+	for (size_t i = 0; i < segs.size(); ++i) {
+		ReadableSegment* seg = segs[i].get();
+		llong rows = std::min<llong>(rowNumVec[i+1] - rowNumVec[i], seg->m_isDel.size());
+		ScanPartition p = { seg, rowNumVec[i], 0, rows };
+		if (seg->getReadonlySegment()) {
+			for (; p.subBeg + partRows < rows; p.subBeg += partRows) {
+				p.subEnd = p.subBeg + partRows;
+				parts.push_back(p);
+			}
+			p.subEnd = rows;
+		}
+		if (p.subBeg < p.subEnd)
+			parts.push_back(p);
+	}
+	if (parts.empty()) {
+		return 0;
+	}
+	size_t threadNum = opt.threadNum;
+	if (0 == threadNum)
+		threadNum = std::thread::hardware_concurrency();
+	threadNum = std::max<size_t>(std::min(threadNum, parts.size()), 1);
+
+	const size_t maxInflight = 2 * threadNum; // bound memory of ordered scan
+	std::atomic<size_t> nextPart(0);
+	std::atomic<bool>   stop(false);
+	std::atomic<llong>  rowCount(0);
+	std::mutex mtx; // for results, consumed and err
+	std::condition_variable cond;
+	size_t consumed = 0;
+	std::exception_ptr err;
+	valvec<ScanResult> results(opt.ordered ? parts.size() : 0);
+
+	auto worker = [&]() {
+		valvec<byte> row;
+		llong rowNum = 0;
+		try {
+			DbContextPtr wctx(this->createDbContext());
+			wctx->noRecordCacheFill = 1; // scan, don't fill RecordCache
+			wctx->m_mySnapshotVersion = snapshotVersion;
+			for (;;) {
+				size_t k = nextPart++;
+				if (k >= parts.size() || stop)
+					break;
+				const ScanPartition& p = parts[k];
+				ScanResult* res = NULL;
+				if (opt.ordered) {
+					std::unique_lock<std::mutex> lock(mtx);
+					cond.wait(lock, [&]{ return k < consumed + maxInflight || stop; });
+					if (stop)
+						break;
+					res = &results[k];
+					res->offsets.push_back(0);
+				}
+				// the first visible row is positioned by seekExact, which
+				// fails if the row of a writable segment is being removed.
+				// the iterator of a readonly segment skips m_isDel'ed rows,
+				// the iterator of a writable segment yields all rows
+				StoreIteratorPtr iter(p.seg->createStoreIterForward(wctx.get()));
+				llong subId = p.subBeg;
+				bool hasRow = false;
+				while (subId < p.subEnd) {
+					if (isVisibleToSnapshot(p.seg, subId, snapshotVersion) &&
+							iter->seekExact(subId, &row)) {
+						hasRow = true;
+						break;
+					}
+					subId++;
+				}
+				for (; hasRow && subId < p.subEnd && !stop;
+					   hasRow = iter->increment(&subId, &row)) {
+					if (!isVisibleToSnapshot(p.seg, subId, snapshotVersion))
+						continue;
+					if (res) {
+						res->ids.push_back(p.baseId + subId);
+						res->data.append(row.data(), row.size());
+						res->offsets.push_back(res->data.size());
+					}
+					else {
+						rowNum++;
+						if (!onRow(p.baseId + subId, row))
+							stop = true;
+					}
+				}
+				if (res) {
+					std::lock_guard<std::mutex> lock(mtx);
+					res->done = true;
+					cond.notify_all();
+				}
+			}
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(mtx);
+			if (!err)
+				err = std::current_exception();
+			stop = true;
+			cond.notify_all();
+		}
+		rowCount += rowNum;
+	};
+	std::vector<std::thread> threads;
+	threads.reserve(threadNum);
+	// onRow of ordered scan runs in this thread, if it or creating a thread
+	// throws, workers must be stopped and joined before rethrow
+	try {
+		for (size_t i = 0; i < threadNum; ++i) {
+			threads.emplace_back(worker);
+		}
+		if (opt.ordered) {
+			llong rowNum = 0;
+			for (size_t k = 0; k < parts.size() && !stop; ++k) {
+				ScanResult& res = results[k];
+				{
+					std::unique_lock<std::mutex> lock(mtx);
+					cond.wait(lock, [&]{ return res.done || stop; });
+					if (!res.done)
+						break;
+				}
+				for (size_t j = 0; j < res.ids.size(); ++j) {
+					size_t off = res.offsets[j];
+					fstring row(res.data.data() + off, res.offsets[j+1] - off);
+					rowNum++;
+					if (!onRow(res.ids[j], row)) {
+						stop = true;
+						break;
+					}
+				}
+				res.ids.clear(); // free memory
+				res.offsets.clear();
+				res.data.clear();
+				std::lock_guard<std::mutex> lock(mtx);
+				consumed = k + 1;
+				cond.notify_all();
+			}
+			rowCount += rowNum;
+			std::lock_guard<std::mutex> lock(mtx);
+			if (consumed < parts.size())
+				stop = true; // wake up waiting workers
+			cond.notify_all();
+		}
+	}
+	catch (...) {
+		std::lock_guard<std::mutex> lock(mtx);
+		if (!err)
+			err = std::current_exception();
+		stop = true;
+		cond.notify_all();
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+	if (err) {
+		std::rethrow_exception(err);
+	}
+	return rowCount;
+}
+
 DbContext* DbTable::createDbContext() const {
 	MyRwLock lock(m_rwMutex, false);
 	return this->createDbContextNoLock();
@@ -1057,6 +1682,9 @@ const {
 	auto rowNumPtr = ctx->m_rowNumVec.data();
 	size_t upp = upper_bound_0(rowNumPtr, ctx->m_rowNumVec.size(), id);
 	assert(upp < ctx->m_rowNumVec.size());
+	if (terark_unlikely(0 == upp)) { // dropped by dropOldSegments
+		throw ReadDeletedRecordException(m_dir.string(), 0, id);
+	}
 	llong baseId = rowNumPtr[upp-1];
 	llong subId = id - baseId;
 	auto seg = ctx->m_segCtx[upp-1]->seg;
@@ -1144,7 +1772,7 @@ void DbTable::doCreateNewSegmentInLock() {
 	llong newMaxRowNum = m_rowNumVec.back();
 	m_rowNumVec.push_back(newMaxRowNum);
 	m_newWrSegNum++;
-	m_segArrayUpdateSeq++;
+	publishSegArrayVersionNoLock();
 	oldwrseg->m_deletedWrIdSet.clear(); // free memory
 	// freeze oldwrseg, this may be too slow
 	// auto& oldwrseg = m_segments.ende(2);
@@ -1205,6 +1833,9 @@ bool DbTable::exists(llong id) const {
 	MyRwLock lock(m_rwMutex, false);
 	size_t upp = upper_bound_a(m_rowNumVec, id);
 	assert(upp < m_rowNumVec.size());
+	if (terark_unlikely(0 == upp)) {
+		return false; // dropped by dropOldSegments
+	}
 	llong baseId = m_rowNumVec[upp-1];
 	size_t subId = size_t(id - baseId);
 	auto seg = m_segments[upp-1].get();
@@ -1253,6 +1884,14 @@ llong DbTable::insertRowImpl(fstring row, ColumnVec *cols, DbContext* ctx, MyRwL
 	if (!ctx->syncIndex) {
 		return insertRowDoInsert(row, cols, ctx);
 	}
+	if (insertCheckFrozenUniqueDupNoLock(cols, ctx)) {
+		return -1;
+	}
+	return insertRowDoInsert(row, cols, ctx);
+}
+
+// return true if any unique key of cols exists in frozen segments
+bool DbTable::insertCheckFrozenUniqueDupNoLock(ColumnVec *cols, DbContext* ctx) {
 	const SchemaConfig& sconf = *m_schema;
     auto key = ctx->bufs.get();
 	for (size_t segIdx = 0; segIdx < m_segments.size()-1; ++segIdx) {
@@ -1271,16 +1910,146 @@ llong DbTable::insertRowImpl(fstring row, ColumnVec *cols, DbContext* ctx, MyRwL
 								+ ", in frozen seg: " + seg->m_segDir.string();
 				//	txn->errMsg += ", rowData=";
 				//	txn->errMsg += sconf.m_rowSchema->toJsonStr(row);
-					return -1;
+					return true;
 				}
 			}
 		}
 	}
-	return insertRowDoInsert(row, cols, ctx);
+	return false;
+}
+
+///@param recIdvec recIdvec[i] is the result of rows[i], -1 on dup key
+///@return num of inserted rows
+///@note rows are inserted in chunks, a chunk is inserted in one lock,
+///      ctx->errMsg is the error of the last failed row
+///@note if an exception is thrown, rows inserted before it have been
+///      committed and have recIdvec[i] >= 0, all other recIdvec[i] are -1
+///@note subIds of a chunk are allocated in input order, but rows are
+///      written in key order, so writable stores get ids out of order,
+///      an id may be larger than the current rows of the store, stores of
+///      writable segments must grow for it: FixedLenStore and trbdb's
+///      MemoryFixedLenStore resize, TrbWritableStore and its log are
+///      keyed by id, see testInsertRowsOutOfOrder in TestDbTable
+size_t
+DbTable::insertRows(const fstring* rows, size_t rowNum, llong* recIdvec,
+					DbContext* ctx) {
+	const size_t ChunkRows = 256; // don't hold the lock too long
+	size_t okNum = 0;
+	std::fill_n(recIdvec, rowNum, llong(-1));
+	for (size_t beg = 0; beg < rowNum; beg += ChunkRows) {
+		size_t num = min(rowNum - beg, ChunkRows);
+		okNum += insertRowsChunk(rows + beg, num, recIdvec + beg, ctx);
+	}
+	return okNum;
+}
+
+size_t
+DbTable::insertRowsChunk(const fstring* rows, size_t rowNum, llong* recIdvec,
+						 DbContext* ctx) {
+	this->throttleWrite();
+	const SchemaConfig& sconf = *m_schema;
+	const Schema& rowSchema = *sconf.m_rowSchema;
+	auto cols = ctx->cols.get();
+	size_t okNum = 0;
+	// rows are parsed once without lock, columns of row i are
+	// parsedCols[i*colnum, (i+1)*colnum), relative to rows[i]
+	const size_t colnum = rowSchema.columnNum();
+	valvec<ColumnVec::Elem> parsedCols;
+	if (ctx->syncIndex) {
+		parsedCols.reserve(colnum * rowNum);
+		for (size_t i = 0; i < rowNum; ++i) {
+			rowSchema.parseRow(rows[i], cols.get());
+			assert(cols->size() == colnum);
+			parsedCols.append(cols->m_cols.data(), colnum);
+		}
+	}
+	auto getCols = [&](size_t i) {
+		cols->m_base = rows[i].udata();
+		cols->m_cols.assign(parsedCols.data() + colnum * i, colnum);
+	};
+	// rows are inserted to all indices in one transaction per row, so a
+	// chunk has only one order: sort rows by key of the first ordered
+	// index, unique index first, then its writable index is inserted
+	// sequentially, key equal rows remain in input order
+	valvec<size_t> order(rowNum, valvec_no_init());
+	for (size_t i = 0; i < rowNum; ++i) {
+		order[i] = i;
+	}
+	size_t sortIndexId = size_t(-1);
+	for (auto indices : { &sconf.m_uniqIndices, &sconf.m_multIndices }) {
+		for (size_t indexId : *indices) {
+			if (size_t(-1) == sortIndexId && sconf.getIndexSchema(indexId).m_isOrdered)
+				sortIndexId = indexId;
+		}
+	}
+	if (ctx->syncIndex && size_t(-1) != sortIndexId && rowNum > 1) {
+		const Schema& iSchema = sconf.getIndexSchema(sortIndexId);
+		auto key = ctx->bufs.get();
+		auto keyPool = ctx->bufs.get();
+		valvec<size_t> keyOffset(rowNum + 1, valvec_reserve());
+		keyPool->erase_all();
+		for (size_t i = 0; i < rowNum; ++i) {
+			getCols(i);
+			iSchema.selectParent(*cols, key.get());
+			keyOffset.unchecked_push_back(keyPool->size());
+			keyPool->append(*key);
+		}
+		keyOffset.unchecked_push_back(keyPool->size());
+		const byte* base = keyPool->data();
+		const size_t* offsets = keyOffset.data();
+		std::stable_sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+			fstring xkey(base + offsets[x], offsets[x+1] - offsets[x]);
+			fstring ykey(base + offsets[y], offsets[y+1] - offsets[y]);
+			return iSchema.compareData(xkey, ykey) < 0;
+		});
+	}
+	IncrementGuard_size_t guard(m_inprogressWritingCount);
+	MyRwLock lock(m_rwMutex, false);
+	assert(m_rowNumVec.size() == m_segments.size()+1);
+	DebugCheckRowNumVecNoLock(this);
+	maybeCreateNewSegment(lock);
+	ctx->trySyncSegCtxNoLock(this);
+	ctx->ensureTransactionNoLock();
+	// alloc subId in input order, so recId order is same as input order
+	valvec<llong> subIdvec(rowNum, valvec_no_init());
+	for (size_t i = 0; i < rowNum; ++i) {
+		subIdvec[i] = allocInvisibleWrSubId_NoTabLock();
+	}
+	size_t k = 0;
+	try {
+		for (; k < rowNum; ++k) {
+			size_t i = order[k];
+			llong  subId = subIdvec[i];
+			if (ctx->syncIndex) {
+				getCols(i);
+				if (insertCheckFrozenUniqueDupNoLock(cols.get(), ctx)) {
+					freeInvisibleWrSubId_NoTabLock(subId);
+					recIdvec[i] = -1;
+					continue;
+				}
+			}
+			recIdvec[i] = insertRowDoInsertSubId(subId, rows[i], cols.get(), ctx);
+			if (recIdvec[i] >= 0)
+				okNum++;
+		}
+	}
+	catch (...) {
+		// the failed row is handled same as insertRow, subIds of rows
+		// after it have not been used
+		for (size_t j = k + 1; j < rowNum; ++j) {
+			freeInvisibleWrSubId_NoTabLock(subIdvec[order[j]]);
+		}
+		throw;
+	}
+	return okNum;
 }
 
 llong DbTable::insertRowDoInsert(fstring row, ColumnVec *cols, DbContext* ctx) {
     llong subId = allocInvisibleWrSubId_NoTabLock();
+	return insertRowDoInsertSubId(subId, row, cols, ctx);
+}
+
+llong DbTable::insertRowDoInsertSubId(llong subId, fstring row, ColumnVec *cols, DbContext* ctx) {
 	TransactionGuard txn(ctx->m_transaction.get(), subId);
 	llong recId = insertRowDoInsertNoCommit(subId, row, cols, ctx);
 	if (recId >= 0) {
@@ -1466,7 +2235,7 @@ llong DbTable::doUpsertRow(fstring row, DbContext* ctx) {
 			llong baseId = ctx->m_rowNumVec[segIdx];
 			assert(ctx->exactMatchRecIdvec.size() == 1);
 			MyRwLock lock(m_rwMutex, false);
-			if (ctx->segArrayUpdateSeq != m_segArrayUpdateSeq) {
+			if (ctx->segArrayUpdateSeq != getSegArrayUpdateSeq()) {
 				ctx->doSyncSegCtxNoLock(this);
 				llong recId = baseId + subId;
 				size_t upp = upper_bound_a(ctx->m_rowNumVec, recId);
@@ -1576,6 +2345,11 @@ DbTable::updateRow(llong id, fstring row, DbContext* ctx) {
 			, id, m_rowNumVec.back());
 	}
 	ctx->trySyncSegCtxNoLock(this);
+	if (id < m_rowNumVec[0]) {
+		THROW_STD(invalid_argument
+			, "id=%lld has been dropped, oldest id=%lld"
+			, id, m_rowNumVec[0]);
+	}
 	size_t j = upper_bound_0(m_rowNumVec.data(), m_rowNumVec.size(), id);
 	assert(j > 0);
 	assert(j < m_rowNumVec.size());
@@ -1769,10 +2543,117 @@ DbTable::updateSyncMultIndex(llong subId, ColumnVec *cols1, ColumnVec *cols2, Db
 
 static profiling g_pf;
 
+const char* DbTable::writeStallReasonStr(WriteStallReason reason) {
+	switch (reason) {
+	default: return "Unknown";
+	case WriteStallNone:              return "None";
+	case WriteStallDelayPendingBytes: return "DelayPendingBytes";
+	case WriteStallDelaySegNum:       return "DelaySegNum";
+	case WriteStallStopPendingBytes:  return "StopPendingBytes";
+	case WriteStallStopSegNum:        return "StopSegNum";
+	}
+}
+
+void DbTable::getWriteStallStat(WriteStallStat* st) const {
+	st->reason = WriteStallReason(m_writeStallReason.load(std::memory_order_relaxed));
+	st->delayUsec = m_writeStallDelayUsec.load(std::memory_order_relaxed);
+	st->pendingConvertBytes = m_pendingConvertBytes.load(std::memory_order_relaxed);
+	st->segNum = m_publishedSegNum.load(std::memory_order_relaxed);
+	st->delayedWrites = m_writeStallDelayedNum.load(std::memory_order_relaxed);
+	st->stoppedWrites = m_writeStallStoppedNum.load(std::memory_order_relaxed);
+	st->totalStallUsec = m_writeStallTotalUsec.load(std::memory_order_relaxed);
+}
+
+namespace anonymousForDebugMSVC {
+	extern volatile bool g_stopCompress; // defined with compress threads
+}
+
+/// @returns number of sleeps for write stall
+size_t DbTable::stallWrite() {
+	const SchemaConfig& sconf = *m_schema;
+	size_t retry = 0;
+	for (; ; retry++) {
+		if (anonymousForDebugMSVC::g_stopCompress || !m_autoTask) {
+			// background conversion won't reduce pending bytes/segments
+			if (m_writeStallReason.load(std::memory_order_relaxed) != WriteStallNone) {
+				m_writeStallReason.store(WriteStallNone, std::memory_order_relaxed);
+				m_writeStallDelayUsec.store(0, std::memory_order_relaxed);
+			}
+			return retry;
+		}
+		double pendingBytes = double(m_pendingConvertBytes.load(std::memory_order_relaxed));
+		double segNum = double(m_publishedSegNum.load(std::memory_order_relaxed));
+		WriteStallReason reason = WriteStallNone;
+		double ratio = 0; // position in the range [soft, hard]
+		auto check = [&](double x, double soft, double hard,
+						 WriteStallReason delay, WriteStallReason stop) {
+			if (hard > 0 && x >= hard) {
+				if (reason < WriteStallStopPendingBytes)
+					reason = stop, ratio = 1;
+			}
+			else if (soft > 0 && x > soft && reason < WriteStallStopPendingBytes) {
+				double range = hard > soft ? hard - soft : soft;
+				double r = std::min((x - soft) / range, 1.0);
+				if (r >= ratio)
+					reason = delay, ratio = r;
+			}
+		};
+		check(pendingBytes,
+			  double(sconf.m_writeStallSoftPendingBytes),
+			  double(sconf.m_writeStallHardPendingBytes),
+			  WriteStallDelayPendingBytes, WriteStallStopPendingBytes);
+		check(segNum,
+			  double(sconf.m_writeStallSoftSegNum),
+			  double(sconf.m_writeStallHardSegNum),
+			  WriteStallDelaySegNum, WriteStallStopSegNum);
+		int oldReason = m_writeStallReason.load(std::memory_order_relaxed);
+		if (terark_likely(WriteStallNone == reason && WriteStallNone == oldReason)) {
+			return retry;
+		}
+		if (oldReason != reason) {
+			m_writeStallReason.store(reason, std::memory_order_relaxed);
+			if (reason >= WriteStallStopPendingBytes || oldReason >= WriteStallStopPendingBytes) {
+				fprintf(stderr
+					, "INFO: DbTable write stall: %s -> %s, pendingConvertBytes = %.0f, segNum = %.0f, dir = %s\n"
+					, writeStallReasonStr(WriteStallReason(oldReason))
+					, writeStallReasonStr(reason)
+					, pendingBytes, segNum, m_dir.string().c_str());
+			}
+		}
+		if (WriteStallNone == reason) {
+			m_writeStallDelayUsec.store(0, std::memory_order_relaxed);
+			return retry;
+		}
+		if (m_throwOnThrottle) {
+			std::string msg = "WriteThrottleException: write stall ";
+			msg += writeStallReasonStr(reason);
+			msg += ", dbdir = " + m_dir.string();
+			throw WriteThrottleException(msg);
+		}
+		if (reason >= WriteStallStopPendingBytes) {
+			// wait for background tasks, check again after sleep
+			const size_t stopSleepUsec = 10000;
+			if (0 == retry)
+				m_writeStallStoppedNum++;
+			m_writeStallDelayUsec.store(stopSleepUsec, std::memory_order_relaxed);
+			m_writeStallTotalUsec += stopSleepUsec;
+			tbb::this_tbb_thread::sleep(tbb::tick_count::interval_t(stopSleepUsec*1e-6));
+			continue;
+		}
+		// delay grows quadratically from soft limit to hard limit
+		size_t delayUsec = size_t(ratio * ratio * sconf.m_writeStallMaxDelayUsec) + 1;
+		m_writeStallDelayUsec.store(delayUsec, std::memory_order_relaxed);
+		m_writeStallDelayedNum++;
+		m_writeStallTotalUsec += delayUsec;
+		tbb::this_tbb_thread::sleep(tbb::tick_count::interval_t(delayUsec*1e-6));
+		return retry + 1;
+	}
+}
+
 /// @returns number of sleep and retries for throttle
 size_t DbTable::throttleWrite() {
 	const SchemaConfig& sconf = *m_schema;
-	size_t retry = 0, sleepMicrosec = 500;
+	size_t retry = stallWrite(), sleepMicrosec = 500;
 	for (; ; retry++) {
 		size_t throttleRate = sconf.m_writeThrottleBytesPerSecond;
 		if (0 == throttleRate)
@@ -1827,6 +2708,9 @@ bool DbTable::removeRow(llong id, DbContext* ctx) {
 	DebugCheckRowNumVecNoLock(this);
 	assert(m_rowNumVec.size() == m_segments.size()+1);
 	assert(id < m_rowNum);
+	if (id < m_rowNumVec[0]) {
+		return false; // dropped by dropOldSegments
+	}
 	size_t j = upper_bound_0(m_rowNumVec.data(), m_rowNumVec.size(), id);
 	assert(j < m_rowNumVec.size());
 	llong baseId = m_rowNumVec[j-1];
@@ -1938,6 +2822,10 @@ void DbTable::delmarkSet0(llong id) {
 	}
 	MyRwLock lock(m_rwMutex, false);
 	size_t upp = upper_bound_a(m_rowNumVec, id);
+	if (0 == upp) {
+		THROW_STD(invalid_argument,
+			"id = %lld has been dropped, oldest id = %lld\n", id, m_rowNumVec[0]);
+	}
 	auto seg = m_segments[upp-1].get();
 	llong baseId = m_rowNumVec[upp-1];
 	size_t subId = size_t(id - baseId);
@@ -1956,6 +2844,9 @@ void DbTable::delmarkSet1(llong id) {
 	}
 	MyRwLock lock(m_rwMutex, false);
 	size_t upp = upper_bound_a(m_rowNumVec, id);
+	if (0 == upp) {
+		return; // dropped by dropOldSegments, it is deleted
+	}
 	auto seg = m_segments[upp-1].get();
 	llong baseId = m_rowNumVec[upp-1];
 	size_t subId = size_t(id - baseId);
@@ -1987,6 +2878,9 @@ void DbTable::putToFreeList(llong id) {
 	}
 	MyRwLock lock(m_rwMutex, false);
 	size_t upp = upper_bound_a(m_rowNumVec, id);
+	if (0 == upp) {
+		return; // dropped by dropOldSegments
+	}
 	llong baseId = m_rowNumVec[upp-1];
 	size_t subId = size_t(id - baseId);
 	auto seg = m_segments[upp-1].get();
@@ -2293,6 +3187,87 @@ const {
 #endif
 }
 
+void
+DbTable::indexSearchExactMulti(size_t indexId, const fstring* keys, size_t keyNum,
+							   valvec<llong>* recIdvecs, DbContext* ctx)
+const {
+	ctx->trySyncSegCtxSpeculativeLock(this);
+	indexSearchExactMultiNoLock(indexId, keys, keyNum, recIdvecs, ctx);
+}
+
+/// each recIdvecs[i] is in the same order as indexSearchExactNoLock
+void
+DbTable::indexSearchExactMultiNoLock(size_t indexId, const fstring* keys, size_t keyNum,
+									 valvec<llong>* recIdvecs, DbContext* ctx)
+const {
+	if (indexId >= m_schema->getIndexNum()) {
+		THROW_STD(invalid_argument, "invalid indexId = %zd, indexNum = %zd"
+			, indexId, m_schema->getIndexNum());
+	}
+	const bool isUnique = m_schema->getIndexSchema(indexId).m_isUnique;
+	const size_t PrefetchDistance = 8;
+	valvec<uint64_t> hashes(keyNum, valvec_no_init());
+	valvec<size_t> pending(keyNum, valvec_no_init()); // keys to be probed
+	for (size_t k = 0; k < keyNum; ++k) {
+		recIdvecs[k].erase_all();
+		hashes[k] = IndexFilter::hashKey(keys[k]);
+		pending[k] = k;
+	}
+	// probe in key order, adjacent keys share index pages in a segment
+	std::sort(pending.begin(), pending.end(), [keys](size_t x, size_t y) {
+		return keys[x] < keys[y];
+	});
+	size_t segNum = ctx->m_segCtx.size();
+	// search newer segments first
+	for (size_t i = segNum; i > 0 && !pending.empty(); ) {
+		auto seg = ctx->m_segCtx[--i]->seg;
+		if (seg->m_isDel.size() == seg->m_delcnt)
+			continue;
+		auto rdseg = seg->getReadonlySegment();
+		auto filter = rdseg ? rdseg->getIndexFilter(indexId) : NULL;
+		const llong baseId = ctx->m_rowNumVec[i];
+		const size_t pendingNum = pending.size();
+		if (filter) {
+			for (size_t j = 0; j < std::min(PrefetchDistance, pendingNum); ++j)
+				filter->prefetch(hashes[pending[j]]);
+		}
+		size_t newPendingNum = 0;
+		for (size_t j = 0; j < pendingNum; ++j) {
+			size_t k = pending[j];
+			if (filter) {
+				if (j + PrefetchDistance < pendingNum)
+					filter->prefetch(hashes[pending[j + PrefetchDistance]]);
+				if (!filter->mayContain(hashes[k])) {
+					pending[newPendingNum++] = k;
+					continue;
+				}
+			}
+			valvec<llong>* recIdvec = &recIdvecs[k];
+			size_t oldsize = recIdvec->size();
+			if (rdseg)
+				rdseg->indexSearchExactAppendNoFilter(i, indexId, keys[k], recIdvec, ctx);
+			else
+				seg->indexSearchExactAppend(i, indexId, keys[k], recIdvec, ctx);
+			size_t len = recIdvec->size() - oldsize;
+			if (len) {
+				llong* p = recIdvec->data() + oldsize;
+				for (size_t l = 0; l < len; ++l) {
+					p[l] += baseId;
+				}
+				if (isUnique) {
+					TERARK_IF_DEBUG(;,continue); // found, needn't probe older segments
+				}
+				if (len >= 2) {
+					std::sort(p, p + len); // don't use std::greater
+					std::reverse(p, p + len); // in descending order
+				}
+			}
+			pending[newPendingNum++] = k;
+		}
+		pending.risk_set_size(newPendingNum);
+	}
+}
+
 // implemented in DfaDbTable
 ///@params recIdvec result of matched record id list
 bool
@@ -2416,6 +3391,10 @@ DbTable::indexInsert(size_t indexId, fstring indexKey, llong id,
 	MyRwLock lock(m_rwMutex, true);
 	size_t upp = upper_bound_0(m_rowNumVec.data(), m_rowNumVec.size(), id);
 	assert(upp <= m_segments.size());
+	if (0 == upp) {
+		THROW_STD(invalid_argument,
+			"id = %lld has been dropped, oldest id = %lld", id, m_rowNumVec[0]);
+	}
 	auto seg = m_segments[upp-1].get();
 	auto wrIndex = seg->m_indices[indexId]->getWritableIndex();
 	if (!wrIndex) {
@@ -2444,6 +3423,10 @@ DbTable::indexRemove(size_t indexId, fstring indexKey, llong id,
 	MyRwLock lock(m_rwMutex, true);
 	size_t upp = upper_bound_0(m_rowNumVec.data(), m_rowNumVec.size(), id);
 	assert(upp <= m_segments.size());
+	if (0 == upp) {
+		THROW_STD(invalid_argument,
+			"id = %lld has been dropped, oldest id = %lld", id, m_rowNumVec[0]);
+	}
 	auto seg = m_segments[upp-1].get();
 	auto wrIndex = seg->m_indices[indexId]->getWritableIndex();
 	if (!wrIndex) {
@@ -2479,7 +3462,12 @@ DbTable::indexUpdate(size_t indexId, fstring indexKey,
 	size_t newupp = upper_bound_0(m_rowNumVec.data(), m_rowNumVec.size(), newId);
 	assert(oldupp <= m_segments.size());
 	assert(newupp <= m_segments.size());
-	llong oldBaseId = m_rowNumVec[oldupp-1];
+	if (0 == oldupp || 0 == newupp) {
+		THROW_STD(invalid_argument,
+			"oldId = %lld or newId = %lld has been dropped, oldest id = %lld",
+			oldId, newId, m_rowNumVec[0]);
+	}
+	llong oldBaseId = m_rowNumVec[oldupp-1];
 	llong newBaseId = m_rowNumVec[newupp-1];
 	llong oldSubId = oldId - oldBaseId;
 	llong newSubId = newId - newBaseId;
@@ -2537,114 +3525,195 @@ class TableIndexIter : public IndexIterator {
 		valvec<byte>       data;
 		llong              subId = -1;
 		llong              baseId = -1;
-		llong              padding = 0;
+		uint64_t           prefix = 0; // order preserving prefix of data
+		bool               eof = true;
 	};
 	valvec<OneSeg> m_segs;
-	static bool
-	lessThanImp(const Schema* schema, const OneSeg* segs, size_t x, size_t y) {
-		const auto& xkey = segs[x].data;
-		const auto& ykey = segs[y].data;
-		if (xkey.empty()) {
-			if (ykey.empty())
-				return false; // equal
-			else
-				return true; // xkey < ykey
-		}
-		if (ykey.empty())
-			return false; // xkey > ykey
-		int r = schema->compareData(xkey, ykey);
-		if (r) return r < 0;
-		else   return x < y;
-	}
-	template<bool Forward> class HeapKeyCompareMultiColumns {
-		const Schema* schema;
-		const OneSeg* segs;
-	public:
-		bool operator()(size_t x, size_t y) const {
-			// min heap's compare is 'greater'
-			if (Forward)
-				return lessThanImp(schema, segs, y, x);
-			else
-				return lessThanImp(schema, segs, x, y);
-		}
-		HeapKeyCompareMultiColumns(const Schema& schema1, const OneSeg* segs1)
-		: schema(&schema1), segs(segs1) {}
+
+	// how to get an order preserving uint64 prefix of an index key,
+	// so most of comparisons in loser tree are a single integer compare
+	enum KeyPrefixKind {
+		KeyPrefixNone,     // such as float, always compare full key
+		KeyPrefixUint,     // first column is unsigned integer
+		KeyPrefixSint,     // first column is signed integer
+		KeyPrefixBytes,    // first m_prefixLen bytes is byte lex ordered
+		KeyPrefixStrZero,  // first column is zero ended string
 	};
-	template<bool Forward> class HeapKeyCompareOneColumn {
-		const Schema::OneColumnComparator comp;
-		const OneSeg* segs;
-	public:
-		bool operator()(size_t x, size_t y) const {
-			// min heap's compare is 'greater'
-			const auto& xkey = segs[x].data;
-			const auto& ykey = segs[y].data;
-			if (Forward)
-				return comp(ykey, xkey) < 0;
+	KeyPrefixKind m_prefixKind;
+	size_t        m_prefixLen;
+	Schema::OneColumnComparator m_oneColumnComp;
+
+	void initKeyPrefix() {
+		const Schema& schema = m_ischema;
+		m_prefixKind = KeyPrefixNone;
+		m_prefixLen = 0;
+		m_oneColumnComp = NULL;
+		const ColumnMeta& colmeta = schema.getColumnMeta(0);
+		switch (colmeta.type) {
+		default: break;
+		case ColumnType::Uint08:
+		case ColumnType::Uint16:
+		case ColumnType::Uint32:
+		case ColumnType::Uint64:
+			m_prefixKind = KeyPrefixUint;
+			m_prefixLen = colmeta.fixedLen;
+			break;
+		case ColumnType::Sint08:
+		case ColumnType::Sint16:
+		case ColumnType::Sint32:
+		case ColumnType::Sint64:
+			m_prefixKind = KeyPrefixSint;
+			m_prefixLen = colmeta.fixedLen;
+			break;
+		case ColumnType::Uuid:
+		case ColumnType::Fixed:
+			m_prefixKind = KeyPrefixBytes;
+			m_prefixLen = std::min<size_t>(colmeta.fixedLen, 8);
+			break;
+		case ColumnType::StrZero:
+			m_prefixKind = KeyPrefixStrZero;
+			m_prefixLen = 8;
+			break;
+		case ColumnType::Binary:
+		case ColumnType::CarBin:
+			// length prefixed if not the last column
+			if (schema.columnNum() == 1) {
+				m_prefixKind = KeyPrefixBytes;
+				m_prefixLen = 8;
+			}
+			break;
+		}
+		if (schema.columnNum() == 1 && colmeta.type != ColumnType::Any) {
+			m_oneColumnComp = schema.getOneColumnComparator();
+		}
+	}
+
+	void updateKeyPrefix(OneSeg& cur) const {
+		const byte* p = cur.data.data();
+		const size_t n = cur.data.size();
+		uint64_t x = 0;
+		switch (m_prefixKind) {
+		case KeyPrefixNone:
+			break;
+		case KeyPrefixUint:
+			if (n >= m_prefixLen) {
+				switch (m_prefixLen) {
+				case 1: x = p[0]; break;
+				case 2: x = unaligned_load<uint16_t>(p); break;
+				case 4: x = unaligned_load<uint32_t>(p); break;
+				case 8: x = unaligned_load<uint64_t>(p); break;
+				}
+			}
+			break;
+		case KeyPrefixSint:
+			if (n >= m_prefixLen) {
+				switch (m_prefixLen) {
+				case 1: x = uint64_t(int64_t(sbyte(p[0]))); break;
+				case 2: x = uint64_t(int64_t(unaligned_load<int16_t>(p))); break;
+				case 4: x = uint64_t(int64_t(unaligned_load<int32_t>(p))); break;
+				case 8: x = uint64_t(unaligned_load<int64_t>(p)); break;
+				}
+				x ^= uint64_t(1) << 63; // make signed order as unsigned order
+			}
+			break;
+		case KeyPrefixBytes:
+		case KeyPrefixStrZero: {
+			size_t len = std::min(m_prefixLen, n);
+			for (size_t i = 0; i < len; ++i) {
+				if (KeyPrefixStrZero == m_prefixKind && 0 == p[i])
+					{ len = i; break; }
+				x = x << 8 | p[i];
+			}
+			if (len < 8)
+				x <<= 8 * (8 - len); // big endian, pad with zeros
+			break; }
+		}
+		cur.prefix = x;
+	}
+
+	int compareKey(const valvec<byte>& x, const valvec<byte>& y) const {
+		if (x.empty())
+			return y.empty() ? 0 : -1;
+		if (y.empty())
+			return 1;
+		if (m_oneColumnComp)
+			return m_oneColumnComp(x, y);
+		return m_ischema.compareData(x, y);
+	}
+
+	///@returns true if m_segs[x] should be output before m_segs[y]
+	/// forward: smaller key first, older segment first on equal keys
+	/// backward: larger key first, newer segment first on equal keys
+	bool beats(size_t x, size_t y) const {
+		const OneSeg& xs = m_segs[x];
+		const OneSeg& ys = m_segs[y];
+		if (xs.eof)
+			return ys.eof && x < y;
+		if (ys.eof)
+			return true;
+		if (xs.prefix != ys.prefix) {
+			if (m_forward)
+				return xs.prefix < ys.prefix;
 			else
-				return comp(xkey, ykey) < 0;
+				return xs.prefix > ys.prefix;
 		}
-		HeapKeyCompareOneColumn(const Schema& schema1, const OneSeg* segs1)
-		: comp(schema1.getOneColumnComparator()), segs(segs1) {}
-	};
+		int r = compareKey(xs.data, ys.data);
+		if (r) return m_forward ? r < 0 : r > 0;
+		return m_forward ? x < y : x > y;
+	}
+
 	valvec<byte> m_keyBuf;
 	ColumnVec    m_keyColvec;
-	terark::valvec<size_t> m_heap;
+	// loser tree: m_tree[0] is the winner, m_tree[j] for 0 < j < n is the
+	// loser of inner node j, leaf of m_segs[i] is n+i, parent of k is k/2
+	valvec<size_t> m_tree;
+	valvec<size_t> m_winner; // temporary for buildTree
+	size_t m_liveNum; // num of segs which are not eof
 	size_t m_oldsegArrayUpdateSeq;
 	const bool m_forward;
-	bool m_isHeapBuilt;
-
-	void makeHeap() {
-		size_t* beg = m_heap.begin();
-		size_t* end = m_heap.end();
-		const OneSeg* segs = m_segs.data();
-		if (m_ischema.columnNum() == 1) {
-			if (m_forward)
-				std::make_heap(beg, end, HeapKeyCompareOneColumn<1>(m_ischema, segs));
-			else
-				std::make_heap(beg, end, HeapKeyCompareOneColumn<0>(m_ischema, segs));
+	bool m_isTreeBuilt;
+
+	void buildTree() {
+		const size_t n = m_segs.size();
+		m_liveNum = 0;
+		for (size_t i = 0; i < n; ++i) {
+			if (!m_segs[i].eof) {
+				updateKeyPrefix(m_segs[i]);
+				m_liveNum++;
+			}
 		}
-		else {
-			if (m_forward)
-				std::make_heap(beg, end, HeapKeyCompareMultiColumns<1>(m_ischema, segs));
-			else
-				std::make_heap(beg, end, HeapKeyCompareMultiColumns<0>(m_ischema, segs));
+		m_tree.resize_no_init(std::max<size_t>(n, 1));
+		if (n <= 1) {
+			m_tree[0] = 0;
+			return;
 		}
-	}
-
-	void pushHeap() {
-		size_t* beg = m_heap.begin();
-		size_t* end = m_heap.end();
-		const OneSeg* segs = m_segs.data();
-		if (m_ischema.columnNum() == 1) {
-			if (m_forward)
-				std::push_heap(beg, end, HeapKeyCompareOneColumn<1>(m_ischema, segs));
-			else
-				std::push_heap(beg, end, HeapKeyCompareOneColumn<0>(m_ischema, segs));
+		m_winner.resize_no_init(2 * n);
+		for (size_t i = 0; i < n; ++i) {
+			m_winner[n + i] = i;
 		}
-		else {
-			if (m_forward)
-				std::push_heap(beg, end, HeapKeyCompareMultiColumns<1>(m_ischema, segs));
-			else
-				std::push_heap(beg, end, HeapKeyCompareMultiColumns<0>(m_ischema, segs));
+		for (size_t j = n - 1; j > 0; --j) {
+			size_t a = m_winner[2*j + 0];
+			size_t b = m_winner[2*j + 1];
+			if (beats(a, b)) {
+				m_winner[j] = a;
+				m_tree[j] = b;
+			} else {
+				m_winner[j] = b;
+				m_tree[j] = a;
+			}
 		}
+		m_tree[0] = m_winner[1];
 	}
 
-	void popHeap() {
-		size_t* beg = m_heap.begin();
-		size_t* end = m_heap.end();
-		const OneSeg* segs = m_segs.data();
-		if (m_ischema.columnNum() == 1) {
-			if (m_forward)
-				std::pop_heap(beg, end, HeapKeyCompareOneColumn<1>(m_ischema, segs));
-			else
-				std::pop_heap(beg, end, HeapKeyCompareOneColumn<0>(m_ischema, segs));
-		}
-		else {
-			if (m_forward)
-				std::pop_heap(beg, end, HeapKeyCompareMultiColumns<1>(m_ischema, segs));
-			else
-				std::pop_heap(beg, end, HeapKeyCompareMultiColumns<0>(m_ischema, segs));
+	// m_segs[segIdx] is the winner and its key has changed
+	void replayTree(size_t segIdx) {
+		const size_t n = m_segs.size();
+		size_t winner = segIdx;
+		for (size_t k = (n + segIdx) / 2; k > 0; k /= 2) {
+			if (beats(m_tree[k], winner))
+				std::swap(m_tree[k], winner);
 		}
+		m_tree[0] = winner;
 	}
 
 	IndexIterator* createIter(const ReadableSegment& seg) {
@@ -2657,14 +3726,14 @@ class TableIndexIter : public IndexIterator {
 
 	size_t syncSegPtr() {
 		m_ctx->trySyncSegCtxSpeculativeLock(m_tab.get());
-		if (m_oldsegArrayUpdateSeq == m_tab->m_segArrayUpdateSeq) {
+		if (m_oldsegArrayUpdateSeq == m_tab->getSegArrayUpdateSeq()) {
 			return 0;
 		}
 		size_t numChangedSegs = 0;
 		sort_a(m_segs, By_seg_get());
 		valvec<OneSeg> tmp(m_tab->m_segments.size()+2); // with 2 extra
 		MyRwLock lock(m_tab->m_rwMutex, false);
-		m_oldsegArrayUpdateSeq = m_tab->m_segArrayUpdateSeq;
+		m_oldsegArrayUpdateSeq = m_tab->getSegArrayUpdateSeq();
 		tmp.resize(m_tab->m_segments.size());
 		const llong* rowNumVec = m_tab->m_rowNumVec.data();
 		OneSeg* segA = m_segs.data();
@@ -2708,22 +3777,25 @@ public:
 			tab->m_tableScanningRefCount++;
 		}
 		m_oldsegArrayUpdateSeq = 0;
-		m_isHeapBuilt = false;
+		m_liveNum = 0;
+		m_isTreeBuilt = false;
+		initKeyPrefix();
 	}
 	~TableIndexIter() {
 		MyRwLock lock(m_tab->m_rwMutex);
 		m_tab->m_tableScanningRefCount--;
 	}
 	void reset() override {
-		m_heap.erase_all();
+		m_tree.erase_all();
+		m_liveNum = 0;
 		m_segs.erase_all();
 		m_keyBuf.erase_all();
 		m_oldsegArrayUpdateSeq = 0;
-		m_isHeapBuilt = false;
+		m_isTreeBuilt = false;
 		m_ctx->trySyncSegCtxSpeculativeLock(m_tab.get());
 	}
 	bool increment(llong* id, valvec<byte>* key) override {
-		if (terark_unlikely(!m_isHeapBuilt)) {
+		if (terark_unlikely(!m_isTreeBuilt)) {
 			if (syncSegPtr()) {
 				for (auto& cur : m_segs) {
 					if (cur.iter == nullptr)
@@ -2732,19 +3804,17 @@ public:
 						cur.iter->reset();
 				}
 			}
-			m_heap.erase_all();
-			m_heap.reserve(m_segs.size());
 			for (size_t i = 0; i < m_segs.size(); ++i) {
 				auto& cur = m_segs[i];
-				if (cur.iter->increment(&cur.subId, &cur.data)) {
-					m_heap.push_back(i);
+				cur.eof = !cur.iter->increment(&cur.subId, &cur.data);
+				if (!cur.eof) {
 					cur.subId = cur.seg->getLogicId(cur.subId);
 				}
 			}
-			makeHeap();
-			m_isHeapBuilt = true;
+			buildTree();
+			m_isTreeBuilt = true;
 		}
-		while (!m_heap.empty()) {
+		while (m_liveNum) {
 			llong subId;
 			size_t segIdx = incrementNoCheckDel(&subId);
 			if (!isDeleted(segIdx, subId)) {
@@ -2760,22 +3830,23 @@ public:
 		return false;
 	}
 	size_t incrementNoCheckDel(llong* subId) {
-		assert(!m_heap.empty());
-		size_t segIdx = m_heap[0];
-		popHeap();
+		assert(m_liveNum > 0);
+		size_t segIdx = m_tree[0];
 		auto& cur = m_segs[segIdx];
+		assert(!cur.eof);
 		*subId = cur.subId;
 		m_keyBuf.swap(cur.data); // should be assign, but swap is more efficient
 		if (cur.iter->increment(&cur.subId, &cur.data)) {
-			assert(m_heap.back() == segIdx);
-			pushHeap();
 			cur.subId = cur.seg->getLogicId(cur.subId);
+			updateKeyPrefix(cur);
 		}
 		else {
-			m_heap.pop_back();
 			cur.subId = -3; // eof
 			cur.data.erase_all();
+			cur.eof = true;
+			m_liveNum--;
 		}
+		replayTree(segIdx);
 		return segIdx;
 	}
 	bool isDeleted(size_t segIdx, llong subId) {
@@ -2834,16 +3905,14 @@ public:
 				if (cur.iter == nullptr)
 					cur.iter = createIter(*cur.seg);
 		}
-		m_heap.erase_all();
-		m_heap.reserve(m_segs.size());
 		for(size_t i = 0; i < m_segs.size(); ++i) {
 			auto& cur = m_segs[i];
 			int ret = inclusive
 					? cur.iter->seekLowerBound(key, &cur.subId, &cur.data)
 					: cur.iter->seekUpperBound(key, &cur.subId, &cur.data)
 					;
-			if (ret >= 0) {
-				m_heap.push_back(i);
+			cur.eof = ret < 0;
+			if (!cur.eof) {
 				cur.subId = cur.seg->getLogicId(cur.subId);
 			}
 		#if 0//!defined(NDEBUG)
@@ -2856,10 +3925,10 @@ public:
 				);
 		#endif
 		}
-		m_isHeapBuilt = true;
-		if (m_heap.size()) {
-			makeHeap();
-			while (!m_heap.empty()) {
+		buildTree();
+		m_isTreeBuilt = true;
+		if (m_liveNum) {
+			while (m_liveNum) {
 				llong subId;
 				size_t segIdx = incrementNoCheckDel(&subId);
 				if (!isDeleted(segIdx, subId)) {
@@ -2964,6 +4033,9 @@ const {
 		THROW_STD(out_of_range, "id = %lld, rows=%lld", id, rows);
 	}
 	size_t upp = upper_bound_a(ctx->m_rowNumVec, id);
+	if (terark_unlikely(0 == upp)) { // dropped by dropOldSegments
+		throw ReadDeletedRecordException(m_dir.string(), 0, id);
+	}
 	llong baseId = ctx->m_rowNumVec[upp-1];
 	auto seg = ctx->m_segCtx[upp-1]->seg;
 	llong subId = id - baseId;
@@ -2992,6 +4064,9 @@ const {
 		THROW_STD(out_of_range, "id = %lld, rows=%lld", id, rows);
 	}
 	size_t upp = upper_bound_a(ctx->m_rowNumVec, id);
+	if (terark_unlikely(0 == upp)) { // dropped by dropOldSegments
+		throw ReadDeletedRecordException(m_dir.string(), 0, id);
+	}
 	llong baseId = ctx->m_rowNumVec[upp-1];
 	auto seg = ctx->m_segCtx[upp-1]->seg;
 	llong subId = id - baseId;
@@ -3020,6 +4095,9 @@ const {
 		THROW_STD(out_of_range, "id = %lld, rows=%lld", id, rows);
 	}
 	size_t upp = upper_bound_a(ctx->m_rowNumVec, id);
+	if (terark_unlikely(0 == upp)) { // dropped by dropOldSegments
+		throw ReadDeletedRecordException(m_dir.string(), 0, id);
+	}
 	llong baseId = ctx->m_rowNumVec[upp-1];
 	auto seg = ctx->m_segCtx[upp-1]->seg;
 	llong subId = id - baseId;
@@ -3057,6 +4135,9 @@ void DbTable::selectColgroupsNoLock(llong recId,
 		THROW_STD(out_of_range, "recId = %lld, rows=%lld", recId, rows);
 	}
 	size_t upp = upper_bound_a(ctx->m_rowNumVec, recId);
+	if (terark_unlikely(0 == upp)) { // dropped by dropOldSegments
+		throw ReadDeletedRecordException(m_dir.string(), 0, recId);
+	}
 	llong baseId = ctx->m_rowNumVec[upp-1];
 	llong subId = recId - baseId;
 	assert(recId >= baseId);
@@ -3075,7 +4156,88 @@ void DbTable::selectOneColgroupNoLock(llong recId, size_t cgId,
 	selectColgroupsNoLock(recId, &cgId, 1, cgData, ctx);
 }
 
-#if 0
+void DbTable::selectOneColgroupMulti(const llong* ids, size_t idNum, size_t cgId,
+						valvec<byte>* cgDataVec, DbContext* ctx) const {
+	ctx->trySyncSegCtxSpeculativeLock(this);
+	selectOneColgroupMultiNoLock(ids, idNum, cgId, cgDataVec, ctx);
+}
+
+void DbTable::selectOneColgroupMultiNoLock(const llong* ids, size_t idNum,
+						size_t cgId, valvec<byte>* cgDataVec, DbContext* ctx) const {
+	llong rows = m_rowNum;
+	valvec<size_t> order(idNum, valvec_reserve());
+	for (size_t k = 0; k < idNum; ++k) {
+		cgDataVec[k].erase_all();
+		if (ids[k] < 0)
+			continue;
+		if (terark_unlikely(ids[k] >= rows)) {
+			THROW_STD(out_of_range, "recId = %lld, rows=%lld", ids[k], rows);
+		}
+		if (ids[k] < ctx->m_rowNumVec[0])
+			continue; // dropped by dropOldSegments
+		order.push_back(k);
+	}
+	std::sort(order.begin(), order.end(), [ids](size_t x, size_t y) {
+		return ids[x] < ids[y];
+	});
+	const llong* rowNumPtr = ctx->m_rowNumVec.data();
+	const size_t segNum = ctx->m_segCtx.size();
+	size_t segIdx = 0;
+	for (size_t k : order) {
+		llong recId = ids[k];
+		while (segIdx + 1 < segNum && rowNumPtr[segIdx + 1] <= recId)
+			segIdx++;
+		auto seg = ctx->m_segCtx[segIdx]->seg;
+		seg->selectColgroups(recId - rowNumPtr[segIdx], &cgId, 1, &cgDataVec[k], ctx);
+	}
+}
+
+size_t DbTable::filterColgroupRange(size_t cgId, const fstring* lo,
+									const fstring* hi, valvec<llong>* recIdvec,
+									DbContext* ctx) const {
+	if (cgId >= m_schema->getColgroupNum()) {
+		THROW_STD(out_of_range, "cgId = %zd, cgNum = %zd"
+			, cgId, m_schema->getColgroupNum());
+	}
+	const Schema& schema = m_schema->getColgroupSchema(cgId);
+	ctx->trySyncSegCtxSpeculativeLock(this);
+	recIdvec->erase_all();
+	const llong* rowNumPtr = ctx->m_rowNumVec.data();
+	febitvec bitmap;
+	valvec<byte> cgData;
+	for (size_t i = 0; i < ctx->m_segCtx.size(); ++i) {
+		ReadableSegment* seg = ctx->m_segCtx[i]->seg;
+		llong  baseId = rowNumPtr[i];
+		size_t segRows = std::min(size_t(rowNumPtr[i+1] - baseId), seg->m_isDel.size());
+		if (cgId < seg->m_colgroups.size() && seg->m_colgroups[cgId] &&
+				seg->m_colgroups[cgId]->filterRange(lo, hi, &bitmap)) {
+			// bitmap is indexed by physic id
+			const bool hasPurged = !seg->m_isPurged.empty();
+			const bm_uint_t* bits = bitmap.bldata();
+			for (size_t w = 0, wn = bitmap.blsize(); w < wn; ++w) {
+				for (bm_uint_t x = bits[w]; x; x &= x - 1) {
+					size_t physicId = w * WordBits + fast_ctz(x);
+					size_t subId = hasPurged ? seg->getLogicId(physicId) : physicId;
+					if (subId < segRows && !seg->testIsDel(subId))
+						recIdvec->push_back(baseId + subId);
+				}
+			}
+			continue;
+		}
+		for (size_t subId = 0; subId < segRows; ++subId) {
+			if (seg->testIsDel(subId))
+				continue;
+			seg->selectColgroups(subId, &cgId, 1, &cgData, ctx);
+			if (lo && schema.compareData(*lo, cgData) > 0)
+				continue;
+			if (hi && schema.compareData(cgData, *hi) > 0)
+				continue;
+			recIdvec->push_back(baseId + subId);
+		}
+	}
+	return recIdvec->size();
+}
+
 StoreIteratorPtr
 DbTable::createProjectIterForward(const valvec<size_t>& cols, DbContext* ctx)
 const {
@@ -3087,16 +4249,33 @@ const {
 	return createProjectIterBackward(cols.data(), cols.size(), ctx);
 }
 
+static void
+checkProjectColumns(const SchemaConfig& sconf, const size_t* colsId, size_t colsNum) {
+	if (0 == colsNum) {
+		THROW_STD(invalid_argument, "colsNum must not be 0");
+	}
+	size_t columnNum = sconf.m_rowSchema->columnNum();
+	for (size_t i = 0; i < colsNum; ++i) {
+		if (colsId[i] >= columnNum) {
+			THROW_STD(invalid_argument, "colsId[%zd] = %zd, columnNum = %zd"
+				, i, colsId[i], columnNum);
+		}
+	}
+}
+
 StoreIteratorPtr
-DbTable::createProjectIterForward(const size_t* colsId, size_t colsNum, DbContext*)
+DbTable::createProjectIterForward(const size_t* colsId, size_t colsNum, DbContext* ctx)
 const {
+	checkProjectColumns(*m_schema, colsId, colsNum);
+	return new MyProjectIterForward(this, colsId, colsNum, ctx);
 }
 
 StoreIteratorPtr
-DbTable::createProjectIterBackward(const size_t* colsId, size_t colsNum, DbContext*)
+DbTable::createProjectIterBackward(const size_t* colsId, size_t colsNum, DbContext* ctx)
 const {
+	checkProjectColumns(*m_schema, colsId, colsNum);
+	return new MyProjectIterBackward(this, colsId, colsNum, ctx);
 }
-#endif
 
 namespace {
 fstring getDotExtension(fstring fpath) {
@@ -3195,6 +4374,8 @@ public:
 
 	ReadableIndex*
 	mergeIndex(ReadonlySegment* dseg, size_t indexId, DbContext* ctx);
+	ReadableIndex*
+	mergeSortedIndex(ReadonlySegment* dseg, size_t indexId, DbContext* ctx);
 
 	bool needsPurgeBits() const;
 
@@ -3279,6 +4460,127 @@ void DbTable::MergeParam::syncPurgeBits(double purgeThresholdRatio) {
 	}
 }
 
+// k-way merge the ordered indices of input segments, the output is
+// (key, newPhysicId) in order, so the keys are neither fetched by random
+// access nor sorted again. only fixed length keys are merged here, they
+// are put to the pool at newPhysicId, all keys are gathered in memory,
+// buildIndexSorted needs them. var length keys, such as NLT indices,
+// go through the resort path in mergeIndex.
+// returns NULL before writing any file if the caller should fallback
+ReadableIndex*
+DbTable::MergeParam::
+mergeSortedIndex(ReadonlySegment* dseg, size_t indexId, DbContext* ctx) {
+	const Schema& schema = m_segs[0].seg->m_schema->getIndexSchema(indexId);
+	const size_t fixlen = schema.getFixedRowLen();
+	if (0 == fixlen || !dseg->canBuildIndexSorted(schema)) {
+		return NULL;
+	}
+	struct Input {
+		IndexIteratorPtr iter;
+		valvec<uint32_t> newId; // indexed by old physic id
+		valvec<byte>     key;
+		llong            id;
+	};
+	std::vector<Input> inputs(m_segs.size());
+	size_t newRows = 0;
+	for (size_t i = 0; i < m_segs.size(); ++i) {
+		auto& e = m_segs[i];
+		auto seg = e.seg;
+		size_t logicRows = seg->m_isDel.size();
+		const bm_uint_t* oldpurgeBits = seg->m_isPurged.bldata();
+		const bm_uint_t* newpurgeBits = e.newIsPurged.bldata();
+		valvec<uint32_t>& newId = inputs[i].newId;
+		newId.reserve(logicRows);
+		for (size_t logicId = 0; logicId < logicRows; ++logicId) {
+			if (!oldpurgeBits || !terark_bit_test(oldpurgeBits, logicId)) {
+				if (!newpurgeBits || !terark_bit_test(newpurgeBits, logicId))
+					newId.push_back(uint32_t(newRows++));
+				else
+					newId.push_back(UINT32_MAX);
+			}
+		}
+		if (newRows >= UINT32_MAX) {
+			return NULL;
+		}
+		inputs[i].iter = seg->m_indices[indexId]->createIndexIterForward(ctx);
+		if (!inputs[i].iter) {
+			return NULL;
+		}
+	}
+	if (0 == newRows) {
+		return new EmptyIndexStore();
+	}
+	// skip purged ids
+	auto next = [&](Input& in) {
+		while (in.iter->increment(&in.id, &in.key)) {
+			assert(size_t(in.id) < in.newId.size());
+			if (UINT32_MAX != in.newId[in.id])
+				return true;
+		}
+		return false;
+	};
+	// keys of different inputs are ordered by input index, which is
+	// also the order of newId
+	auto heapComp = [&](size_t x, size_t y) {
+		int r = schema.compareData(inputs[x].key, inputs[y].key);
+		return r ? r > 0 : x > y;
+	};
+	valvec<size_t> heap(inputs.size(), valvec_reserve());
+	for (size_t i = 0; i < inputs.size(); ++i) {
+		if (next(inputs[i]))
+			heap.push_back(i);
+	}
+	std::make_heap(heap.begin(), heap.end(), heapComp);
+	SortableStrVec strVec;
+	strVec.m_strpool.resize_no_init(fixlen * newRows);
+	valvec<uint32_t> sortedIds(newRows, valvec_reserve());
+	while (!heap.empty()) {
+		std::pop_heap(heap.begin(), heap.end(), heapComp);
+		Input& in = inputs[heap.back()];
+		if (in.key.size() != fixlen) {
+			fprintf(stderr, "WARN: mergeSortedIndex: index %s: key.size = %zd"
+				", fixlen = %zd, fallback to resort\n"
+				, schema.m_name.c_str(), in.key.size(), fixlen);
+			return NULL;
+		}
+		uint32_t newId = in.newId[in.id];
+		memcpy(strVec.m_strpool.data() + fixlen * newId, in.key.data(), fixlen);
+		sortedIds.push_back(newId);
+		if (next(in))
+			std::push_heap(heap.begin(), heap.end(), heapComp);
+		else
+			heap.pop_back();
+	}
+	if (sortedIds.size() != newRows) {
+		fprintf(stderr, "WARN: mergeSortedIndex: index %s: merged rows = %zd"
+			", expected = %zd, fallback to resort\n"
+			, schema.m_name.c_str(), sortedIds.size(), newRows);
+		return NULL;
+	}
+	inputs.clear(); // free memory
+	// keys in recId order are needed by linear scan, write them before
+	// buildIndexSorted, which takes the pool, instead of copying the pool.
+	// the file is removed if the index is not built, so the fallback path
+	// can create it again
+	std::string linearFile;
+	if (schema.m_enableLinearScan) {
+		std::unique_ptr<SeqReadAppendonlyStore> seqStore(
+			new SeqReadAppendonlyStore(dseg->m_segDir, schema));
+		for (size_t i = 0; i < newRows; ++i) {
+			seqStore->append(fstring(strVec.m_strpool.data() + fixlen * i, fixlen), ctx);
+		}
+		linearFile = (dseg->m_segDir / "linear-" + schema.m_name + ".seq").string();
+	}
+	std::unique_ptr<ReadableIndex> index(
+		dseg->buildIndexSorted(schema, strVec, sortedIds));
+	if (!index) {
+		if (!linearFile.empty())
+			boost::filesystem::remove(linearFile);
+		return NULL;
+	}
+	return index.release();
+}
+
 ReadableIndex*
 DbTable::MergeParam::
 mergeIndex(ReadonlySegment* dseg, size_t indexId, DbContext* ctx) {
@@ -3286,6 +4588,12 @@ mergeIndex(ReadonlySegment* dseg, size_t indexId, DbContext* ctx) {
 	SortableStrVec strVec;
 	const Schema& schema = m_segs[0].seg->m_schema->getIndexSchema(indexId);
 	const size_t fixedIndexRowLen = schema.getFixedRowLen();
+#if !defined(SLOW_DEBUG_CHECK)
+	if (!getEnvBool("TerichDB_MergeIndexByResort", false)) {
+		if (ReadableIndex* index = mergeSortedIndex(dseg, indexId, ctx))
+			return index;
+	}
+#endif
 	std::unique_ptr<SeqReadAppendonlyStore> seqStore;
 	if (schema.m_enableLinearScan) {
 		seqStore.reset(new SeqReadAppendonlyStore(dseg->m_segDir, schema));
@@ -3760,6 +5068,7 @@ try{
 
 	dseg->savePurgeBits(destSegDir);
 	dseg->saveIndices(destSegDir);
+	dseg->saveIndexFilters(destSegDir);
 	dseg->saveIsDel(destSegDir);
 
 	// load as mmap
@@ -3784,8 +5093,8 @@ try{
 	// newSegPathes don't include m_wrSeg
 	valvec<ReadableSegmentPtr> newSegs(m_segments.capacity(), valvec_reserve());
 	valvec<llong> newRowNumVec(m_rowNumVec.capacity(), valvec_reserve());
-	newRowNumVec.push_back(0);
-	size_t rows = 0;
+	newRowNumVec.push_back(m_rowNumVec[0]); // dropOldSegments may set it
+	size_t rows = size_t(m_rowNumVec[0]);
 	auto addseg = [&](const ReadableSegmentPtr& seg) {
 		rows += seg->m_isDel.size();
 		newSegs.push_back(seg);
@@ -3824,6 +5133,7 @@ try{
 	for (size_t i = toMerge.m_segs.back().idx + 1; i < m_segments.size(); ++i) {
         shareSeg(m_segments[i].get());
     };
+	saveOldestRowId(destMergeDir);
 	auto syncOneRecord = [](ReadonlySegment* dseg, ReadableSegment* sseg,
 							size_t baseLogicId, size_t subId) {
 		if (sseg->m_isDel[subId]) {
@@ -3879,12 +5189,12 @@ try{
 		for (auto& e : toMerge.m_segs) {
 			e.seg->m_bookUpdates = false;
 		}
-		assert(toMerge.m_old_segArrayUpdateSeq == m_segArrayUpdateSeq);
+		assert(toMerge.m_old_segArrayUpdateSeq == getSegArrayUpdateSeq());
 		m_segments.swap(newSegs);
 		m_rowNumVec.swap(newRowNumVec);
 		m_rowNumVec.back() = newRowNumVec.back();
 		m_mergeSeqNum++;
-		m_segArrayUpdateSeq++;
+		publishSegArrayVersionNoLock();
 #if defined(SLOW_DEBUG_CHECK)
 		valvec<byte> r1, r2;
 		size_t baseLogicId = 0;
@@ -3972,7 +5282,6 @@ void DbTable::clear() {
 	m_rowNumVec.clear();
 	m_wrSeg = nullptr;
 	m_mergeSeqNum++;
-	m_segArrayUpdateSeq++;
 
 	const size_t segIdx = 0;
 	m_wrSeg = myCreateWritableSegment(getSegPath("wr", segIdx));
@@ -3980,6 +5289,7 @@ void DbTable::clear() {
 	m_rowNumVec.push_back(0);
 	m_rowNumVec.push_back(0);
 	m_rowNum = 0;
+	publishSegArrayVersionNoLock();
 }
 
 void DbTable::flush() {
@@ -4070,6 +5380,216 @@ void DbTable::compact() {
         ;
 }
 
+static bool
+segOverlapKeyRange(const ReadableSegment* seg, size_t indexId,
+				   const Schema& schema, const fstring* lo, const fstring* hi,
+				   DbContext* ctx) {
+	IndexIteratorPtr iter(seg->m_indices[indexId]->createIndexIterForward(ctx));
+	valvec<byte> key;
+	llong id;
+	if (lo) {
+		if (iter->seekLowerBound(*lo, &id, &key) < 0)
+			return false;
+	}
+	else {
+		iter->reset();
+		if (!iter->increment(&id, &key))
+			return false;
+	}
+	return !hi || schema.compareData(fstring(key.data(), key.size()), *hi) <= 0;
+}
+
+void DbTable::compactRange(size_t indexId, const fstring* lo, const fstring* hi) {
+	assert(indexId < m_schema->getIndexNum());
+	waitForBackgroundTasks(m_rwMutex, m_bgTaskNum);
+	{
+		MyRwLock lock(m_rwMutex, true);
+		this->m_bgTaskNum++;
+	}
+	BOOST_SCOPE_EXIT(&m_rwMutex, &m_bgTaskNum){
+		MyRwLock lock(m_rwMutex, true);
+		m_bgTaskNum--;
+	}BOOST_SCOPE_EXIT_END;
+	while (compactRangeStep(indexId, lo, hi))
+		;
+}
+
+// adjacent overlapping readonly segments are merged, a single one is
+// purged if it has unpurged deletions.
+///@returns false if nothing to do
+bool DbTable::compactRangeStep(size_t indexId, const fstring* lo, const fstring* hi) {
+	const Schema& schema = m_schema->getIndexSchema(indexId);
+	DbContextPtr ctx(this->createDbContext());
+	MergeParam param;
+	size_t rngBeg = 0, rngLen = 0;
+	valvec<byte> overlap;
+	// a background merge/purge may run for long, don't wait for it forever
+	static const double maxWaitSec = (double)
+		getEnvLong("TerichDB_CompactRangeMaxWaitSeconds", 600);
+	double waitedSec = 0;
+	for (;;) {
+		// index seeks are slow, they are done on a snapshot without lock,
+		// the snapshot is rechecked in the lock
+		SegArrayVersionPtr ver = getSegArrayVersion();
+		overlap.resize_fill(ver->m_segs.size(), false);
+		for (size_t i = 0; i < ver->m_segs.size(); ++i) {
+			auto seg = ver->m_segs[i]->getMergableSegment();
+			overlap[i] = seg && seg->getReadonlySegment() &&
+				segOverlapKeyRange(seg, indexId, schema, lo, hi, ctx.get());
+		}
+		MyRwLock lock(m_rwMutex, true);
+		if (m_isMerging || m_isPurging) {
+			lock.release();
+			if (waitedSec >= maxWaitSec) {
+				fprintf(stderr
+					, "WARN: compactRange: background merge/purge is still"
+					  " running after %.1f seconds, give up\n", waitedSec);
+				return false;
+			}
+			tbb::this_tbb_thread::sleep(tbb::tick_count::interval_t(0.1));
+			waitedSec += 0.1;
+			continue;
+		}
+		if (m_segments.size() != ver->m_segs.size() ||
+			!std::equal(m_segments.begin(), m_segments.end(),
+				ver->m_segs.begin())) {
+			continue; // segment array was changed after the snapshot
+		}
+		auto isCandidate = [&](size_t i) {
+			auto seg = m_segments[i]->getMergableSegment();
+			return seg && overlap[i] && !seg->m_onProcess;
+		};
+		for (size_t i = 0; i < m_segments.size(); ) {
+			if (!m_segments[i]->getMergableSegment())
+				break;
+			size_t j = i;
+			while (j < m_segments.size() && isCandidate(j))
+				j++;
+			if (j - i >= 2 || (j - i == 1 &&
+				m_segments[i]->m_delcnt > m_segments[i]->m_isPurged.max_rank1()))
+			{
+				rngBeg = i;
+				rngLen = j - i;
+				break;
+			}
+			if (j < m_segments.size() && !m_segments[j]->getMergableSegment())
+				break;
+			i = j + 1;
+		}
+		if (0 == rngLen) {
+			return false;
+		}
+		if (1 == rngLen) {
+			m_segments[rngBeg]->m_onProcess = true;
+			m_isPurging = true;
+			break;
+		}
+		for (size_t i = rngBeg; i < rngBeg + rngLen; ++i) {
+			param.m_segs.emplace_back(m_segments[i]->getMergableSegment(), i);
+			param.m_newSegRows += m_segments[i]->m_isDel.size();
+		}
+		param.m_forcePurgeAndMerge = true;
+		param.m_tabSegNum = m_segments.size();
+		param.m_old_segArrayUpdateSeq = getSegArrayUpdateSeq();
+		m_isMerging = true;
+		break;
+	}
+	if (rngLen >= 2) {
+		BOOST_SCOPE_EXIT(&m_isMerging){
+			m_isMerging = false;
+		}BOOST_SCOPE_EXIT_END;
+		merge(param);
+		return true;
+	}
+	ReadableSegmentPtr seg;
+	{
+		MyRwLock lock(m_rwMutex, false);
+		seg = m_segments[rngBeg];
+	}
+	BOOST_SCOPE_EXIT(&m_rwMutex, &m_isPurging, &seg){
+		MyRwLock lock(m_rwMutex, true);
+		seg->m_onProcess = false;
+		m_isPurging = false;
+	}BOOST_SCOPE_EXIT_END;
+	fprintf(stderr, "INFO: compactRange: purge %s, rows = %zd, delcnt = %zd\n"
+		, seg->m_segDir.string().c_str(), seg->m_isDel.size(), seg->m_delcnt);
+	ReadonlySegmentPtr newSeg = myCreateReadonlySegment(getSegPath("rd", rngBeg));
+	newSeg->purgeDeletedRecords(this, rngBeg);
+	return true;
+}
+
+// position of key in (first, last) as a fraction, by 8 bytes after the
+// common prefix of first and last
+static double interpolateKeyPos(fstring first, fstring last, fstring key) {
+	size_t cp = 0, n = std::min(first.size(), last.size());
+	while (cp < n && first[cp] == last[cp])
+		cp++;
+	auto num = [cp](fstring s) {
+		double x = 0;
+		for (size_t i = cp; i < cp + 8; ++i)
+			x = x * 256 + (i < s.size() ? byte(s[i]) : 0);
+		return x;
+	};
+	double f = num(first), l = num(last), k = num(key);
+	if (l <= f)
+		return 0.5;
+	return std::min(std::max((k - f) / (l - f), 0.0), 1.0);
+}
+
+// for indices without rank, keys are assumed evenly distributed between
+// the first and the last key
+static double
+approxKeyRangeFraction(const ReadableIndex* index, const Schema& schema,
+					   fstring lo, fstring hi, DbContext* ctx) {
+	valvec<byte> first, last;
+	llong id;
+	IndexIteratorPtr fwd(index->createIndexIterForward(ctx));
+	IndexIteratorPtr bwd(index->createIndexIterBackward(ctx));
+	fwd->reset();
+	bwd->reset();
+	if (!fwd->increment(&id, &first) || !bwd->increment(&id, &last))
+		return 0;
+	fstring f(first.data(), first.size());
+	fstring l(last.data(), last.size());
+	auto pos = [&](fstring key) -> double {
+		if (schema.compareData(key, f) <= 0) return 0;
+		if (schema.compareData(key, l) >  0) return 1;
+		return interpolateKeyPos(f, l, key);
+	};
+	return pos(hi) - pos(lo);
+}
+
+llong DbTable::approxRangeSize(size_t indexId, fstring lo, fstring hi) const {
+	assert(indexId < m_schema->getIndexNum());
+	const Schema& schema = m_schema->getIndexSchema(indexId);
+	if (schema.compareData(lo, hi) >= 0) {
+		return 0;
+	}
+	SegArrayVersionPtr ver = getSegArrayVersion();
+	DbContextPtr ctx;
+	double size = 0;
+	for (const auto& seg : ver->m_segs) {
+		size_t rows = seg->getPhysicRows();
+		if (0 == rows || seg->m_indices.size() <= indexId) {
+			continue;
+		}
+		const ReadableIndex* index = seg->m_indices[indexId].get();
+		llong rankLo = index->searchLowerBoundRank(lo);
+		llong rankHi = index->searchLowerBoundRank(hi);
+		double frac;
+		if (rankLo >= 0 && rankHi >= 0) {
+			frac = double(rankHi - rankLo) / rows;
+		}
+		else {
+			if (!ctx)
+				ctx.reset(this->createDbContext());
+			frac = approxKeyRangeFraction(index, schema, lo, hi, ctx.get());
+		}
+		size += std::min(std::max(frac, 0.0), 1.0) * seg->totalStorageSize();
+	}
+	return llong(size);
+}
+
 void DbTable::syncFinishWriting() {
     m_autoTask = false;
 	m_wrSeg = nullptr; // can't write anymore
@@ -4094,6 +5614,149 @@ void DbTable::asyncPurgeDelete() {
 	inLockPutPurgeDeleteTaskToQueue();
 }
 
+llong DbTable::dropOldSegments(llong endId) {
+	llong dropped = 0;
+	{
+		MyRwLock lock(m_rwMutex, false);
+		for (size_t i = 0; i + 1 < m_segments.size(); ++i) {
+			if (m_rowNumVec[i+1] > endId) {
+				break;
+			}
+			ReadableSegment* seg = m_segments[i].get();
+			if (!seg->m_isFreezed || seg->m_deletionTime) {
+				break; // writing segment, or snapshot needs per row deltime
+			}
+			SpinRwLock segLock(seg->m_segMutex, true);
+			const size_t rows = seg->m_isDel.size();
+			if (seg->m_delcnt == rows) {
+				continue;
+			}
+			if (seg->m_bookUpdates) {
+				// being converted or purged, all rows are updated,
+				// the extra guard bit is also set
+				seg->m_updateBits.resize(rows + 1);
+				seg->m_updateBits.set1(0, rows + 1);
+			}
+			seg->m_isDel.set1(0, rows);
+			dropped += llong(rows - seg->m_delcnt);
+			seg->m_delcnt = rows;
+			seg->m_isDirty = true;
+		}
+	}
+	if (dropped) {
+		fprintf(stderr, "INFO: %s: dropOldSegments(endId = %lld): dropped rows = %lld\n"
+			, m_dir.string().c_str(), endId, dropped);
+	}
+	if (0 == removeDroppedSegments()) {
+		// busy by merging or purging, retry by autoConvMergePurge
+		MyRwLock lock(m_rwMutex, false);
+		if (m_segments.size() > 1 && m_segments[0]->m_isFreezed &&
+				m_segments[0]->m_delcnt == m_segments[0]->m_isDel.size()) {
+			lock.upgrade_to_writer();
+			putAutoTask();
+		}
+	}
+	else {
+		// tasks run during the removal were declined by m_isMerging, the
+		// conversions they should do would be left without any task
+		MyRwLock lock(m_rwMutex, true);
+		putAutoTask(BgTaskConvert);
+	}
+	return dropped;
+}
+
+// fully deleted readonly segments at the head are removed by a new
+// merge dir which just has symlinks to the remaining segments
+///@returns number of removed segments
+size_t DbTable::removeDroppedSegments() {
+	valvec<ReadableSegmentPtr> newSegs;
+	valvec<ReadableSegmentPtr> tobeDel;
+	fs::path destMergeDir;
+	{
+		MyRwLock lock(m_rwMutex, true);
+		if (m_isMerging || m_isPurging) {
+			return 0;
+		}
+		for (auto& seg : m_segments) {
+			if (seg->m_onProcess)
+				return 0; // segIdx is used by the processing
+		}
+		size_t k = 0;
+		while (k + 1 < m_segments.size()) {
+			ReadableSegment* seg = m_segments[k].get();
+			if (!seg->getReadonlySegment() || !seg->m_isFreezed ||
+					seg->m_deletionTime || seg->m_bookUpdates ||
+					seg->m_delcnt != seg->m_isDel.size())
+				break;
+			k++;
+		}
+		if (0 == k) {
+			return 0;
+		}
+		m_isMerging = true;
+		tobeDel.assign(m_segments.begin(), m_segments.begin() + k);
+		newSegs.reserve(m_segments.capacity());
+		newSegs.assign(m_segments.begin() + k, m_segments.end());
+		destMergeDir = getMergePath(m_dir, m_mergeSeqNum+1);
+	}
+	BOOST_SCOPE_EXIT(&m_isMerging){
+		m_isMerging = false;
+	}BOOST_SCOPE_EXIT_END;
+	if (fs::exists(destMergeDir)) {
+		THROW_STD(logic_error, "dir: '%s' should not existed"
+			, destMergeDir.string().c_str());
+	}
+	fs::create_directories(destMergeDir);
+	fs::path   mergingLockFile = destMergeDir / "merging.lock";
+	FileStream mergingLockFp(mergingLockFile.string().c_str(), "wb");
+	for (size_t i = 0; i < newSegs.size(); ++i) {
+		ReadableSegment* seg = newSegs[i].get();
+		fs::path Old = seg->m_segDir;
+		if (fs::is_symlink(Old)) {
+			Old = fs::read_symlink(Old);
+		}
+		fs::path New = getSegPath2(m_dir, m_mergeSeqNum + 1,
+			seg->getWritableStore() ? "wr" : "rd", i);
+		fs::path Rela = ".." / Old.parent_path().filename() / Old.filename();
+		fs::create_directory_symlink(Rela, New);
+	}
+	{
+		MyRwLock lock(m_rwMutex, true);
+		// m_isMerging prevents new segments, but m_wrSeg may grow
+		if (m_segments.size() != tobeDel.size() + newSegs.size()) {
+			// empty m_wrSeg was removed by syncFinishWriting
+			lock.release();
+			mergingLockFp.close();
+			fs::remove_all(destMergeDir);
+			return 0;
+		}
+		valvec<llong> newRowNumVec(m_rowNumVec.capacity(), valvec_reserve());
+		newRowNumVec.assign(m_rowNumVec.data() + tobeDel.size(),
+							m_rowNumVec.size() - tobeDel.size());
+		m_segments.swap(newSegs);
+		m_rowNumVec.swap(newRowNumVec);
+		saveOldestRowId(destMergeDir);
+		m_mergeSeqNum++;
+		publishSegArrayVersionNoLock();
+	}
+	mergingLockFp.close();
+	fs::remove(mergingLockFile);
+	for (auto& seg : tobeDel) {
+		seg->deleteSegment();
+	}
+	fprintf(stderr, "INFO: %s: removed %zd dropped segments, oldest id = %lld\n"
+		, m_dir.string().c_str(), tobeDel.size(), m_oldestRowId.load());
+	return tobeDel.size();
+}
+
+void DbTable::saveOldestRowId(PathRef mergeDir) const {
+	if (m_rowNumVec[0]) {
+		fs::path fpath = mergeDir / "OldestRowId";
+		FileStream fp(fpath.string().c_str(), "w");
+		fprintf(fp, "%lld\n", m_rowNumVec[0]);
+	}
+}
+
 void DbTable::dropTable() {
 	assert(!m_dir.empty());
 	for (auto& seg : m_segments) {
@@ -4172,18 +5835,20 @@ void DbTable::save(PathRef dir) const {
 		assert(seg->getWritableStore());
 		seg->save(getSegPath2(dir, 0, "wr", segIdx));
 	}
+	saveOldestRowId(getMergePath(dir, 0));
 	lock.upgrade_to_writer();
 	fs::path jsonFile = dir / "dbmeta.json";
 	m_schema->saveJsonFile(jsonFile.string());
 }
 
-bool DbTable::autoConvMergePurge(bool forcePurgeAndMerge) {
+bool DbTable::autoConvMergePurge(bool forcePurgeAndMerge, BgTaskPriority kind) {
     BOOST_SCOPE_EXIT(&m_rwMutex, &m_bgTaskNum){
 		MyRwLock lock(m_rwMutex, true);
 		--m_bgTaskNum;
 	}BOOST_SCOPE_EXIT_END;
 	if (m_isMerging || m_bgTaskNum > 2)
 		return false;
+	removeDroppedSegments();
 
     MergeParam param;
 
@@ -4253,12 +5918,12 @@ bool DbTable::autoConvMergePurge(bool forcePurgeAndMerge) {
         }
 		if (m_segs.size() <= 1)
 			break;
-	    param.m_old_segArrayUpdateSeq = m_segArrayUpdateSeq;
+	    param.m_old_segArrayUpdateSeq = getSegArrayUpdateSeq();
 		if (!lock.upgrade_to_writer()) {
 			if (m_isMerging) // check again
 				return false;
-			if (param.m_old_segArrayUpdateSeq != m_segArrayUpdateSeq) {
-				assert(param.m_old_segArrayUpdateSeq < m_segArrayUpdateSeq);
+			if (param.m_old_segArrayUpdateSeq != getSegArrayUpdateSeq()) {
+				assert(param.m_old_segArrayUpdateSeq < getSegArrayUpdateSeq());
 				return true;
 			}
         }
@@ -4268,7 +5933,7 @@ bool DbTable::autoConvMergePurge(bool forcePurgeAndMerge) {
 		// used for violation check
 		param.m_tabSegNum = m_segments.size();
 		DebugCheckRowNumVecNoLock(tab);
-	    param.m_old_segArrayUpdateSeq = m_segArrayUpdateSeq;
+	    param.m_old_segArrayUpdateSeq = getSegArrayUpdateSeq();
     } while(false);
 
     size_t findSegmentId = size_t(-1);
@@ -4284,8 +5949,11 @@ bool DbTable::autoConvMergePurge(bool forcePurgeAndMerge) {
                 break;
             }
         }
+        // all are being converted, or just m_wrSeg is plain writable
+        convPlainWritableSegment = findSegmentId != size_t(-1);
     }
-    if (findSegmentId == size_t(-1)) {
+    // m_segs may be empty if the head segment is being converted
+    if (findSegmentId == size_t(-1) && !m_segs.empty()) {
 	    size_t sumSegRows = 0;
 	    for (size_t i = 0; i < m_segs.size(); ++i) {
             if ((m_segs[i].purgePriority = getPurge(i)) > 0)
@@ -4382,6 +6050,13 @@ bool DbTable::autoConvMergePurge(bool forcePurgeAndMerge) {
 		    MyRwLock lock(m_rwMutex, true);
             if (seg->m_onProcess)
                 return false;
+            // removeDroppedSegments is changing segIdx, or has removed
+            // seg, return true to retry by a new AutoTask
+            if (m_isMerging)
+                return true;
+            i = findSegIdx(0, seg);
+            if (i == m_segments.size())
+                return true;
             seg->m_onProcess = true;
         }
         BOOST_SCOPE_EXIT(&m_rwMutex, &seg){
@@ -4424,6 +6099,34 @@ bool DbTable::autoConvMergePurge(bool forcePurgeAndMerge) {
         return true;
     };
 
+    if (BgTaskPriorityNum != kind) {
+        bool hasConv = convPlainWritableSegment || convLargeWritableSegment
+                    || convWritableSegment;
+        bool hasMerge = mergeColgroupSegment || mergeReadonlySegment;
+        BgTaskPriority found = hasConv ? BgTaskConvert
+                             : hasMerge ? BgTaskMerge
+                             : purgeReadonlySegment ? BgTaskPurge
+                             : BgTaskPriorityNum;
+        bool mine = BgTaskConvert == kind ? hasConv
+                  : BgTaskMerge == kind ? hasMerge
+                  : purgeReadonlySegment;
+        if (!mine) {
+            // let the work wait in the queue of its own priority, so a
+            // merge or purge is never run in the place of a convert
+            MyRwLock lock(m_rwMutex, true);
+            m_isMerging = false;
+            if (BgTaskPriorityNum != found)
+                putAutoTask(found);
+            return false;
+        }
+        if (BgTaskConvert != kind)
+            convPlainWritableSegment = convLargeWritableSegment
+                                     = convWritableSegment = false;
+        if (BgTaskMerge != kind)
+            mergeColgroupSegment = mergeReadonlySegment = false;
+        if (BgTaskPurge != kind)
+            purgeReadonlySegment = false;
+    }
     if (convPlainWritableSegment) {
         if (m_bgTaskNum > 2) {
 		    m_isMerging = false;
@@ -4531,12 +6234,7 @@ bool DbTable::autoConvMergePurge(bool forcePurgeAndMerge) {
     return false;
 }
 
-void DbTable::freezeFlushWritableSegment(size_t segIdx) {
-	ReadableSegmentPtr seg;
-	{
-		MyRwLock lock(m_rwMutex, false);
-		seg = m_segments[segIdx];
-	}
+void DbTable::freezeFlushWritableSegment(ReadableSegment* seg) {
 	if (seg->m_isDelMmap) {
 		return;
 	}
@@ -4553,94 +6251,351 @@ namespace anonymousForDebugMSVC {
 
 class MyTask : public RefCounter {
 public:
+	const DbTable* m_tab; // key for per table fairness
+	DbTable::BgTaskPriority m_priority;
+	ullong m_enqueueTime;
+	MyTask(const DbTable* tab, DbTable::BgTaskPriority prio)
+		: m_tab(tab), m_priority(prio), m_enqueueTime(0) {}
 	virtual void execute() = 0;
 };
 typedef boost::intrusive_ptr<MyTask> MyTaskPtr;
 std::mutex g_mutexForStop;
-terark::util::concurrent_queue<std::deque<MyTaskPtr> > g_flushQueue;
-terark::util::concurrent_queue<std::deque<MyTaskPtr> > g_compressQueue;
 
 volatile bool g_stopPutToFlushQueue = false;
 volatile bool g_stopCompress = false;
 volatile bool g_flushStopped = false;
 
-void FlushThreadFunc() {
-	while (true) {
+// Tasks of a table are always put into the same shard, each worker has
+// its own home shard, an idle worker steals tasks from other shards.
+// In a shard, tables with pending tasks of the same priority are served
+// round robin, so a busy table can not starve other tables.
+class BgTaskShard {
+	struct TableQueue {
+		const DbTable* tab;
+		std::deque<MyTaskPtr> tasks;
+	};
+	std::mutex m_mutex;
+	std::deque<TableQueue> m_tables[DbTable::BgTaskPriorityNum];
+public:
+	std::atomic_size_t m_size[DbTable::BgTaskPriorityNum];
+
+	BgTaskShard() {
+		for (auto& x : m_size) x = 0;
+	}
+	void push(MyTask* t) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto& ring = m_tables[t->m_priority];
+		auto iter = ring.begin();
+		while (iter != ring.end() && iter->tab != t->m_tab)
+			++iter;
+		if (ring.end() == iter) {
+			ring.emplace_back();
+			iter = ring.end() - 1;
+			iter->tab = t->m_tab;
+		}
+		iter->tasks.push_back(t);
+		m_size[t->m_priority]++;
+	}
+	MyTaskPtr pop(size_t prio) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto& ring = m_tables[prio];
+		if (ring.empty()) {
+			return nullptr;
+		}
 		MyTaskPtr t;
-		while (g_flushQueue.pop_front(t, 100)) {
-			if (t)
-				t->execute();
-			else // must only one flush thread
-				goto Done; // nullptr is stop notifier
+		t.swap(ring.front().tasks.front());
+		ring.front().tasks.pop_front();
+		if (ring.front().tasks.empty()) {
+			ring.pop_front();
+		}
+		else if (ring.size() > 1) { // rotate to next table
+			ring.push_back(std::move(ring.front()));
+			ring.pop_front();
 		}
+		m_size[prio]--;
+		return t;
 	}
-Done:
-	assert(g_flushQueue.empty());
-	g_flushStopped = true;
-	fprintf(stderr, "INFO: flushing thread completed!\n");
-}
+	void clear() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t prio = 0; prio < DbTable::BgTaskPriorityNum; ++prio) {
+			m_tables[prio].clear();
+			m_size[prio] = 0;
+		}
+	}
+};
 
-void CompressThreadFunc() {
-	while (!g_flushStopped && !g_stopCompress) {
-		MyTaskPtr t;
-		while (!g_stopCompress && g_compressQueue.pop_front(t, 100)) {
-			if (g_stopCompress)
-				break;
-			t->execute();
+void FlushThreadFunc();
+void CompressThreadFunc(size_t workerId);
+
+class BgTaskScheduler {
+	struct Worker {
+		tbb::tbb_thread* thread;
+		bool exited;
+	};
+	std::unique_ptr<BgTaskShard[]> m_shards;
+	size_t m_maxShardNum; // max num of workers
+	std::atomic_size_t m_shardNum; // tables are put to this num of shards
+	std::mutex m_mutex; // for m_cond and m_workers
+	std::condition_variable m_cond;
+	std::vector<Worker> m_workers;
+	size_t m_workerNum; // expected num of compression workers
+	tbb::tbb_thread* m_flushThread;
+	std::atomic_size_t m_running;
+	std::atomic<ullong> m_stolen;
+	std::atomic<ullong> m_executed[DbTable::BgTaskPriorityNum];
+	std::atomic<ullong> m_totalWaitUsec[DbTable::BgTaskPriorityNum];
+	std::atomic<ullong> m_maxWaitUsec[DbTable::BgTaskPriorityNum];
+
+	size_t shardOf(const DbTable* tab) const {
+		return std::hash<const void*>()(tab) % m_shardNum;
+	}
+	// after workers num is reduced, tasks may be left in the shards out
+	// of m_shardNum, so all shards are searched
+	bool hasTaskIn(size_t minPrio, size_t maxPrio) const {
+		for (size_t prio = minPrio; prio <= maxPrio; ++prio) {
+			for (size_t i = 0; i < m_maxShardNum; ++i) {
+				if (m_shards[i].m_size[prio])
+					return true;
+			}
 		}
+		return false;
+	}
+	void spawnWorker(size_t workerId) {
+		m_workers[workerId].exited = false;
+		m_workers[workerId].thread = new tbb::tbb_thread(&CompressThreadFunc, workerId);
 	}
-}
 
-class CompressionThreadsList : private std::vector<tbb::tbb_thread*> {
 public:
-	CompressionThreadsList() {
+	BgTaskScheduler() {
 		size_t cpu = tbb::tbb_thread::hardware_concurrency();
 		size_t cfg = getEnvLong("TerichDB_CompressionThreadsNum", 0);
 		size_t num = cfg ? min(cpu, cfg) : min<size_t>(cpu, 4);
-		this->resize(num);
+		m_maxShardNum = std::max<size_t>(cpu, 1);
+		m_shards.reset(new BgTaskShard[m_maxShardNum]);
+		m_shardNum = std::max<size_t>(num, 1);
+		m_running = 0;
+		m_stolen = 0;
+		for (size_t prio = 0; prio < DbTable::BgTaskPriorityNum; ++prio) {
+			m_executed[prio] = 0;
+			m_totalWaitUsec[prio] = 0;
+			m_maxWaitUsec[prio] = 0;
+		}
+		m_workerNum = num;
+		m_workers.resize(num);
 		for (size_t i = 0; i < num; ++i) {
-			(*this)[i] = new tbb::tbb_thread(&CompressThreadFunc);
+			spawnWorker(i);
 		}
+		m_flushThread = new tbb::tbb_thread(&FlushThreadFunc);
 	}
-	~CompressionThreadsList() {
-		if (!this->empty())
+	~BgTaskScheduler() {
+		if (m_flushThread)
 			DbTable::safeStopAndWaitForFlush();
 	}
-	void join() {
-		for (auto& th : *this) {
-			th->join();
-			delete th;
-			th = NULL;
+
+	void push(MyTask* t) {
+		t->m_enqueueTime = g_pf.now();
+		m_shards[shardOf(t->m_tab)].push(t);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
 		}
-		fprintf(stderr, "INFO: compression threads(%zd) completed!\n", this->size());
-		this->clear();
-		g_compressQueue.clearQueue();
+		m_cond.notify_all();
+	}
+
+	///@param home the shard which is searched first
+	MyTaskPtr pop(size_t home, size_t minPrio, size_t maxPrio) {
+		for (size_t prio = minPrio; prio <= maxPrio; ++prio) {
+			for (size_t k = 0; k < m_maxShardNum; ++k) {
+				BgTaskShard& shard = m_shards[(home + k) % m_maxShardNum];
+				if (shard.m_size[prio]) {
+					MyTaskPtr t = shard.pop(prio);
+					if (t) {
+						if (k) m_stolen++;
+						return t;
+					}
+				}
+			}
+		}
+		return nullptr;
+	}
+
+	void waitForTask(size_t minPrio, size_t maxPrio) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait_for(lock, std::chrono::milliseconds(100), [&]() {
+			return g_stopPutToFlushQueue || hasTaskIn(minPrio, maxPrio);
+		});
+	}
+
+	void execute(MyTask* t) {
+		ullong waitUsec = g_pf.us(t->m_enqueueTime, g_pf.now());
+		size_t prio = t->m_priority;
+		m_executed[prio]++;
+		m_totalWaitUsec[prio] += waitUsec;
+		ullong maxWait = m_maxWaitUsec[prio];
+		while (maxWait < waitUsec &&
+			   !m_maxWaitUsec[prio].compare_exchange_weak(maxWait, waitUsec)) {}
+		m_running++;
+		BOOST_SCOPE_EXIT(&m_running) {
+			m_running--;
+		} BOOST_SCOPE_EXIT_END;
+		t->execute();
+	}
+
+	bool isEmpty() const {
+		return !hasTaskIn(0, DbTable::BgTaskPriorityNum - 1);
+	}
+
+	size_t homeShardOf(size_t workerId) const {
+		return workerId % m_maxShardNum;
+	}
+
+	// worker exits when it is out of expected num, check between tasks
+	bool shouldWorkerExit(size_t workerId) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (workerId >= m_workerNum) {
+			if (workerId < m_workers.size())
+				m_workers[workerId].exited = true;
+			return true;
+		}
+		return false;
+	}
+
+	void setWorkerNum(size_t num) {
+		num = std::min(num, m_maxShardNum); // one shard per worker
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (g_stopPutToFlushQueue) {
+			return;
+		}
+		size_t oldnum = m_workers.size();
+		if (num > oldnum) {
+			m_workers.resize(num);
+		}
+		for (size_t i = 0; i < std::min(num, oldnum); ++i) {
+			if (m_workers[i].exited) {
+				// has returned, or will return without m_mutex
+				m_workers[i].thread->join();
+				delete m_workers[i].thread;
+				spawnWorker(i);
+			}
+			// else: a retiring worker which has not exited, just keep it
+		}
+		for (size_t i = oldnum; i < num; ++i) {
+			spawnWorker(i);
+		}
+		fprintf(stderr, "INFO: compression threads num: %zd -> %zd\n"
+			, m_workerNum, num);
+		m_workerNum = num;
+		m_shardNum = std::max<size_t>(num, 1);
+		m_cond.notify_all();
+	}
+
+	size_t getWorkerNum() const { return m_workerNum; }
+
+	void joinFlushThread() {
+		m_cond.notify_all();
+		m_flushThread->join();
+		delete m_flushThread;
+		m_flushThread = NULL;
+	}
+
+	void joinWorkers() {
+		m_cond.notify_all();
+		std::vector<Worker> workers;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			workers.swap(m_workers);
+		}
+		for (auto& w : workers) {
+			w.thread->join();
+			delete w.thread;
+		}
+		fprintf(stderr, "INFO: compression threads(%zd) completed!\n", workers.size());
+		for (size_t i = 0; i < m_maxShardNum; ++i) {
+			m_shards[i].clear();
+		}
+	}
+
+	void getStat(DbTable::BgTaskStat* st) const {
+		for (size_t prio = 0; prio < DbTable::BgTaskPriorityNum; ++prio) {
+			size_t depth = 0;
+			for (size_t i = 0; i < m_maxShardNum; ++i) {
+				depth += m_shards[i].m_size[prio];
+			}
+			st->queueDepth[prio] = depth;
+			st->executedNum[prio] = m_executed[prio];
+			st->totalWaitUsec[prio] = m_totalWaitUsec[prio];
+			st->maxWaitUsec[prio] = m_maxWaitUsec[prio];
+		}
+		st->stolenNum = m_stolen;
+		st->runningNum = m_running;
+		st->workerNum = m_workerNum;
 	}
 };
-tbb::tbb_thread g_flushThread(&FlushThreadFunc);
-CompressionThreadsList g_compressThreads;
+BgTaskScheduler g_bgScheduler;
+
+// flush thread runs flush tasks only, so flush is never blocked by
+// long running convert/merge/purge tasks
+void FlushThreadFunc() {
+	const size_t prio = DbTable::BgTaskFlush;
+	while (true) {
+		MyTaskPtr t = g_bgScheduler.pop(0, prio, prio);
+		if (t) {
+			g_bgScheduler.execute(t.get());
+		}
+		else if (g_stopPutToFlushQueue) {
+			break; // all flush tasks have been done
+		}
+		else {
+			g_bgScheduler.waitForTask(prio, prio);
+		}
+	}
+	g_flushStopped = true;
+	fprintf(stderr, "INFO: flushing thread completed!\n");
+}
+
+// compression workers run convert/merge/purge tasks, flush tasks are
+// run only by the flush thread, so a segment is never flushed twice
+void CompressThreadFunc(size_t workerId) {
+	const size_t home = g_bgScheduler.homeShardOf(workerId);
+	const size_t minPrio = DbTable::BgTaskConvert;
+	const size_t maxPrio = DbTable::BgTaskPriorityNum - 1;
+	while (!g_stopCompress && !g_bgScheduler.shouldWorkerExit(workerId)) {
+		MyTaskPtr t = g_bgScheduler.pop(home, minPrio, maxPrio);
+		if (t) {
+			g_bgScheduler.execute(t.get());
+		}
+		else if (g_flushStopped) {
+			break;
+		}
+		else {
+			g_bgScheduler.waitForTask(minPrio, maxPrio);
+		}
+	}
+}
 
 class AutoTask : public MyTask {
 	DbTablePtr m_tab;
 public:
 	void execute() override {
-		if (m_tab->autoConvMergePurge(false) && m_tab->isAutoTask()) {
-            m_tab->putAutoTask();
+		if (m_tab->autoConvMergePurge(false, m_priority) && m_tab->isAutoTask()) {
+            // re-queue at the same priority, the default BgTaskMerge
+            // would put a pending convert behind every queued merge
+            m_tab->putAutoTask(m_priority);
         }
 	}
-	AutoTask(DbTablePtr tab) : m_tab(tab) {}
+	AutoTask(DbTablePtr tab, DbTable::BgTaskPriority prio)
+		: MyTask(tab.get(), prio), m_tab(tab) {}
 };
 
 class WrSegFreezeFlushTask : public MyTask {
 	DbTablePtr m_tab;
-	size_t m_segIdx;
+	ReadableSegmentPtr m_seg; // segIdx may be changed by dropOldSegments
 public:
-	WrSegFreezeFlushTask(DbTablePtr tab, size_t segIdx)
-		: m_tab(tab), m_segIdx(segIdx) {}
+	WrSegFreezeFlushTask(DbTablePtr tab, ReadableSegment* seg)
+		: MyTask(tab.get(), DbTable::BgTaskFlush), m_tab(tab), m_seg(seg) {}
 
 	void execute() override {
-		m_tab->freezeFlushWritableSegment(m_segIdx);
-		g_compressQueue.push_back(new AutoTask(m_tab));
+		m_tab->freezeFlushWritableSegment(m_seg.get());
+		g_bgScheduler.push(new AutoTask(m_tab, DbTable::BgTaskConvert));
 	}
 };
 
@@ -4655,7 +6610,7 @@ void DbTable::putToFlushQueue(size_t segIdx) {
 	assert(segIdx < m_segments.size());
 	assert(m_segments[segIdx]->m_isDel.size() > 0);
 	assert(m_segments[segIdx]->getWritableStore() != nullptr);
-	g_flushQueue.push_back(new WrSegFreezeFlushTask(this, segIdx));
+	g_bgScheduler.push(new WrSegFreezeFlushTask(this, m_segments[segIdx].get()));
 	m_bgTaskNum++;
 }
 
@@ -4666,15 +6621,16 @@ void DbTable::putToCompressionQueue(size_t segIdx) {
 	if (g_stopCompress) {
 		return;
 	}
-	g_compressQueue.push_back(new AutoTask(this));
+	g_bgScheduler.push(new AutoTask(this, BgTaskConvert));
 	m_bgTaskNum++;
 }
 
-void DbTable::putAutoTask() {
+void DbTable::putAutoTask(BgTaskPriority kind) {
+	assert(BgTaskFlush != kind && kind < BgTaskPriorityNum);
 	if (g_stopCompress || !m_autoTask) {
 		return;
 	}
-	g_compressQueue.push_back(new AutoTask(this));
+	g_bgScheduler.push(new AutoTask(this, kind));
 	m_bgTaskNum++;
 }
 
@@ -4682,6 +6638,18 @@ bool DbTable::isAutoTask() const {
     return m_autoTask;
 }
 
+void DbTable::setBgThreadNum(size_t threadNum) {
+	g_bgScheduler.setWorkerNum(threadNum);
+}
+
+size_t DbTable::getBgThreadNum() {
+	return g_bgScheduler.getWorkerNum();
+}
+
+void DbTable::getBgTaskStat(BgTaskStat* st) {
+	g_bgScheduler.getStat(st);
+}
+
 inline
 bool DbTable::checkPurgeDeleteNoLock(const ReadableSegment* seg) {
 	assert(!g_stopPutToFlushQueue);
@@ -4712,7 +6680,7 @@ void DbTable::inLockPutPurgeDeleteTaskToQueue() {
 	if (g_stopPutToFlushQueue) {
 		return;
 	}
-	g_compressQueue.push_back(new AutoTask(this));
+	g_bgScheduler.push(new AutoTask(this, BgTaskPurge));
 	m_bgTaskNum++;
 }
 
@@ -4724,12 +6692,10 @@ void DbTable::safeStopAndWaitForFlush() {
 	}
 	g_stopPutToFlushQueue = true;
 	g_stopCompress = true;
-	g_flushQueue.push_back(nullptr); // notify and stop flag
-	g_flushThread.join();
+	g_bgScheduler.joinFlushThread();
 	assert(g_flushStopped);
-	g_compressThreads.join();
-	assert(g_flushQueue.empty());
-	assert(g_compressQueue.empty());
+	g_bgScheduler.joinWorkers();
+	assert(g_bgScheduler.isEmpty());
 }
 
 void DbTable::safeStopAndWaitForCompress() {
@@ -4737,12 +6703,13 @@ void DbTable::safeStopAndWaitForCompress() {
 	if (g_stopPutToFlushQueue) {
 		return;
 	}
+	if (0 == g_bgScheduler.getWorkerNum()) {
+		g_bgScheduler.setWorkerNum(1); // paused, queued tasks must be done
+	}
 	g_stopPutToFlushQueue = true;
-	g_flushQueue.push_back(nullptr); // notify and stop flag
-	g_flushThread.join();
-	g_compressThreads.join();
-	assert(g_flushQueue.empty());
-	assert(g_compressQueue.empty());
+	g_bgScheduler.joinFlushThread();
+	g_bgScheduler.joinWorkers();
+	assert(g_bgScheduler.isEmpty());
 }
 
 /*
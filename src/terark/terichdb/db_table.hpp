@@ -5,6 +5,7 @@
 #include "db_index.hpp"
 #include <tbb/queuing_rw_mutex.h>
 #include <atomic>
+#include <functional>
 
 #if defined(TBB_VERSION_MAJOR)
 	#if TBB_VERSION_MAJOR * 1000 + TBB_VERSION_MINOR < 4004
@@ -41,6 +42,17 @@ class TERICHDB_DLL WritableSegment;
 typedef boost::intrusive_ptr<ReadableSegment> ReadableSegmentPtr;
 typedef boost::intrusive_ptr<WritableSegment> WritableSegmentPtr;
 
+// Immutable copy of the segment array, published by DbTable each time the
+// segment array is changed, DbContext syncs from it without m_rwMutex.
+class TERICHDB_DLL SegArrayVersion : public RefCounter {
+public:
+	valvec<ReadableSegmentPtr> m_segs;
+	valvec<llong>    m_rowNumVec; // back() is stale, rows are appended after publish
+	WritableSegment* m_wrSeg;
+	size_t           m_updateSeq;
+};
+typedef boost::intrusive_ptr<SegArrayVersion> SegArrayVersionPtr;
+
 // Now BatchWriter is supported only when table has at most one unique index
 class TERICHDB_DLL BatchWriter {
 	DECLARE_NONE_COPYABLE_CLASS(BatchWriter);
@@ -68,6 +80,8 @@ class TERICHDB_DLL DbTable : public ReadableStore {
 	class MyStoreIterBase;	    friend class MyStoreIterBase;
 	class MyStoreIterForward;	friend class MyStoreIterForward;
 	class MyStoreIterBackward;	friend class MyStoreIterBackward;
+	class MyProjectIterForward;	friend class MyProjectIterForward;
+	class MyProjectIterBackward;	friend class MyProjectIterBackward;
 public:
 	DbTable();
 	~DbTable();
@@ -79,12 +93,50 @@ public:
 
 	StoreIterator* createStoreIterForward(DbContext*) const override;
 	StoreIterator* createStoreIterBackward(DbContext*) const override;
+
+	///@{ parallel full table scan on the segments of ctx's snapshot,
+	/// rows inserted after the scan started are not visited.
+	/// Segments are partitioned, large readonly segments by sub id ranges.
+	struct ParallelScanOptions {
+		size_t threadNum = 0; // 0 for hardware concurrency
+		size_t partitionRows = 256*1024; // max rows of a partition
+		/// true:  onRow is called in recId order in the caller's thread
+		/// false: onRow is called concurrently by worker threads
+		bool   ordered = false;
+	};
+	/// onRow returns false to stop the scan
+	typedef std::function<bool(llong recId, fstring row)> ScanRowCallback;
+	///@returns num of rows passed to onRow
+	llong parallelScan(const ParallelScanOptions&, const ScanRowCallback& onRow,
+					   DbContext*) const;
+	///@}
 	DbContext* createDbContext() const;
 	virtual DbContext* createDbContextNoLock() const;
 
+	///@{ async warm up: a background thread loads files of readonly
+	/// segments into page cache, index files first, then colgroups with
+	/// "warmUpHot", then other colgroups, newer segments first.
+	/// Reads are served while warm up is running.
+	struct WarmUpProgress {
+		llong  totalBytes;
+		llong  doneBytes;   // have been read, or found in page cache
+		llong  cachedBytes; // of doneBytes, found in page cache by mincore
+		size_t totalFiles;
+		size_t doneFiles;
+		bool   running;
+	};
+	/// bytesPerSecond = 0 uses SchemaConfig::m_warmUpBytesPerSecond
+	void startWarmUp(size_t bytesPerSecond = 0);
+	void stopWarmUp();
+	void getWarmUpProgress(WarmUpProgress*) const;
+	void getWarmUpFiles(valvec<std::string>* fpaths) const; // in warm up order
+	///@}
+
 	llong existingRows(DbContext* = NULL) const;
 
 	llong inlineGetRowNum() const { return m_rowNum; }
+	/// ids less than it have been dropped by dropOldSegments, lock free
+	llong oldestRowId() const { return m_oldestRowId.load(std::memory_order_relaxed); }
 	llong totalStorageSize() const;
 	llong numDataRows() const override;
 	llong dataStorageSize() const override;
@@ -95,6 +147,7 @@ public:
 
 	llong insertRow(fstring row, DbContext*);
 	llong upsertRow(fstring row, DbContext*);
+	size_t insertRows(const fstring* rows, size_t rowNum, llong* recIdvec, DbContext*);
 	llong updateRow(llong id, fstring row, DbContext*);
 	bool  removeRow(llong id, DbContext*);
 
@@ -117,6 +170,28 @@ public:
 	void setThrowOnThrottle(bool val) { m_throwOnThrottle = val; }
 	bool isThrowOnThrottle() const { return m_throwOnThrottle; }
 
+	///@{ adaptive write stall: writers are delayed smoothly when background
+	/// backlog exceeds soft limits of SchemaConfig, and stopped at hard limits
+	enum WriteStallReason {
+		WriteStallNone,
+		WriteStallDelayPendingBytes, // writable segments to be converted
+		WriteStallDelaySegNum,
+		WriteStallStopPendingBytes,
+		WriteStallStopSegNum,
+	};
+	struct WriteStallStat {
+		WriteStallReason reason; // current
+		ullong delayUsec; // current delay per write
+		llong  pendingConvertBytes;
+		size_t segNum;
+		ullong delayedWrites;
+		ullong stoppedWrites;
+		ullong totalStallUsec;
+	};
+	static const char* writeStallReasonStr(WriteStallReason);
+	void getWriteStallStat(WriteStallStat*) const;
+	///@}
+
 	SchemaConfig& getSchemaConfig() const { return *m_schema; }
 	size_t getColumnId(fstring colname) const {
 		return m_schema->m_rowSchema->getColumnId(colname);
@@ -157,6 +232,14 @@ public:
 	void indexSearchExactNoLock(size_t indexId, fstring key, valvec<llong>* recIdvec, DbContext*) const;
 	bool indexKeyExistsNoLock(size_t indexId, fstring key, DbContext*) const;
 
+	///@{ recIdvecs[i] is the same as indexSearchExact(indexId, keys[i], ...)
+	/// segments are probed for all keys at once to overlap memory misses
+	void indexSearchExactMulti(size_t indexId, const fstring* keys, size_t keyNum,
+							   valvec<llong>* recIdvecs, DbContext*) const;
+	void indexSearchExactMultiNoLock(size_t indexId, const fstring* keys, size_t keyNum,
+									 valvec<llong>* recIdvecs, DbContext*) const;
+	///@}
+
 	bool indexMatchRegex(size_t indexId, RegexForIndex*, valvec<llong>* recIdvec, DbContext*) const;
 
 	bool indexInsert(size_t indexId, fstring indexKey, llong id, DbContext*);
@@ -187,6 +270,24 @@ public:
 
 	void selectOneColgroup(llong id, size_t cgId, valvec<byte>* cgData, DbContext*) const;
 
+	///@{ cgDataVec[i] is the same as selectOneColgroup(ids[i], ...)
+	/// ids[i] < 0 is skipped, records are fetched grouped by segment
+	void selectOneColgroupMulti(const llong* ids, size_t idNum, size_t cgId,
+								valvec<byte>* cgDataVec, DbContext*) const;
+	void selectOneColgroupMultiNoLock(const llong* ids, size_t idNum, size_t cgId,
+									  valvec<byte>* cgDataVec, DbContext*) const;
+	///@}
+
+	///@{ predicate pushdown on colgroup cgId: lo <= colgroupData <= hi,
+	/// NULL lo/hi is unbounded. Stores supporting ReadableStore::filterRange
+	/// are filtered without fetching rows, others are filtered row by row.
+	/// recIdvec is the ascending live recIds of ctx's snapshot, matching rows
+	/// can then be fetched by selectOneColgroupMulti or selectColumns
+	///@returns recIdvec->size()
+	size_t filterColgroupRange(size_t cgId, const fstring* lo, const fstring* hi,
+							   valvec<llong>* recIdvec, DbContext*) const;
+	///@}
+
 protected:
 	void selectColumnsNoLock(llong id, const valvec<size_t>& cols,
 					   valvec<byte>* colsData, DbContext*) const;
@@ -202,7 +303,9 @@ protected:
 
 	void selectOneColgroupNoLock(llong id, size_t cgId, valvec<byte>* cgData, DbContext*) const;
 
-#if 0
+public:
+	///@{ iterate the projected columns of all rows, just the colgroups
+	/// containing the columns are read, val is same as selectColumns
 	StoreIteratorPtr
 	createProjectIterForward(const valvec<size_t>& cols, DbContext*)
 	const;
@@ -216,15 +319,32 @@ protected:
 	StoreIteratorPtr
 	createProjectIterBackward(const size_t* colsId, size_t colsNum, DbContext*)
 	const;
-#endif
+	///@}
 
 public:
 	void clear();
 	void flush();
 	void compact();
+	///@{ key range [lo, hi] of index indexId, NULL means unbounded
+	/// merge/purge just the readonly segments overlapping the key range
+	/// waits for a running background merge/purge at most
+	/// env TerichDB_CompactRangeMaxWaitSeconds (default 600), then gives up
+	void compactRange(size_t indexId, const fstring* lo, const fstring* hi);
+	///@}
+	/// estimated storage size of keys in [lo, hi) of index indexId
+	llong approxRangeSize(size_t indexId, fstring lo, fstring hi) const;
 	void syncFinishWriting();
 	void asyncPurgeDelete();
 
+	///@{ for capped tables, rows of whole frozen segments before endId are
+	/// deleted by filling m_isDel, indices are not touched. Fully deleted
+	/// readonly segments at the head are then removed from the segment
+	/// array and their dirs are deleted, m_rowNumVec[0] becomes the id of
+	/// the oldest remaining row, so recId of other rows is kept.
+	///@returns number of rows newly deleted
+	llong dropOldSegments(llong endId);
+	///@}
+
 	void dropTable();
 
 	PathRef getDir() const { return m_dir; }
@@ -238,15 +358,46 @@ public:
 	size_t findSegIdx(size_t segIdxBeg, ReadableSegment* seg) const;
 	size_t getSegNum() const { return m_segments.size(); }
 	size_t getWritableSegNum() const;
-	size_t getSegArrayUpdateSeq() const { return this->m_segArrayUpdateSeq; }
+	size_t getSegArrayUpdateSeq() const { // lock free
+		// acquire pairs with release in publishSegArrayVersionNoLock,
+		// the version of the seq is visible if the seq is seen
+		return m_segArrayUpdateSeq.load(std::memory_order_acquire);
+	}
+	SegArrayVersionPtr getSegArrayVersion() const; // lock free
 	size_t getSegmentIndexOfRecordIdNoLock(llong recId) const;
 
+	///@{ background task scheduler, shared by all tables in the process
+	enum BgTaskPriority {
+		BgTaskFlush,   // highest priority
+		BgTaskConvert,
+		BgTaskMerge,
+		BgTaskPurge,
+		BgTaskPriorityNum
+	};
+	struct BgTaskStat {
+		size_t queueDepth[BgTaskPriorityNum];
+		ullong executedNum[BgTaskPriorityNum];
+		ullong totalWaitUsec[BgTaskPriorityNum]; // time in queue
+		ullong maxWaitUsec[BgTaskPriorityNum];
+		ullong stolenNum; // num of tasks taken from other worker's shard
+		size_t runningNum;
+		size_t workerNum; // num of compression threads
+	};
+	// can be changed at runtime, 0 pauses convert/merge/purge, flush is
+	// never paused
+	static void setBgThreadNum(size_t threadNum);
+	static size_t getBgThreadNum();
+	static void getBgTaskStat(BgTaskStat*);
+	///@}
+
 	///@{ internal use only
-    bool autoConvMergePurge(bool forcePurgeAndMerge);
-	void freezeFlushWritableSegment(size_t segIdx);
+	///@param kind only runs the work of this kind, other work is put to
+	///            the queue of its kind, BgTaskPriorityNum runs any work
+    bool autoConvMergePurge(bool forcePurgeAndMerge, BgTaskPriority kind = BgTaskPriorityNum);
+	void freezeFlushWritableSegment(ReadableSegment*);
 	void putToFlushQueue(size_t segIdx);
 	void putToCompressionQueue(size_t segIdx);
-    void putAutoTask();
+    void putAutoTask(BgTaskPriority kind = BgTaskMerge);
     bool isAutoTask() const;
 	///@}
 
@@ -259,6 +410,7 @@ public:
 	static void safeStopAndWaitForFlush();
 	static void safeStopAndWaitForCompress();
 
+
 protected:
 	static void registerTableClass(fstring tableClass, std::function<DbTable*()> tableFactory);
 
@@ -266,6 +418,9 @@ protected:
 
 	class MergeParam; friend class MergeParam;
 	void merge(MergeParam&);
+	bool compactRangeStep(size_t indexId, const fstring* lo, const fstring* hi);
+	size_t removeDroppedSegments();
+	void saveOldestRowId(PathRef mergeDir) const;
 	void checkRowNumVecNoLock() const;
 
 	bool maybeCreateNewSegment(MyRwLock&);
@@ -273,6 +428,9 @@ protected:
 	void doCreateNewSegmentInLock();
 	llong insertRowImpl(fstring row, ColumnVec *cols, DbContext*, MyRwLock&);
 	llong insertRowDoInsert(fstring row, ColumnVec *cols, DbContext*);
+	llong insertRowDoInsertSubId(llong subId, fstring row, ColumnVec *cols, DbContext*);
+	bool insertCheckFrozenUniqueDupNoLock(ColumnVec *cols, DbContext*);
+	size_t insertRowsChunk(const fstring* rows, size_t rowNum, llong* recIdvec, DbContext*);
 	llong insertRowDoInsertNoCommit(llong subId, fstring row, ColumnVec *cols, DbContext*);
 	bool insertSyncIndex(llong subId, ColumnVec *cols, DbTransaction*, DbContext*);
 	bool updateCheckSegDup(size_t begSeg, size_t numSeg, ColumnVec *cols, DbContext*);
@@ -303,6 +461,10 @@ protected:
 //	void unregisterDbContext(DbContext* ctx) const;
 
 	size_t throttleWrite();
+	size_t stallWrite();
+
+	// must be called in writer lock after m_segments/m_rowNumVec changed
+	void publishSegArrayVersionNoLock();
 
 public:
 	mutable MyRwMutex m_rwMutex;
@@ -322,12 +484,28 @@ protected:
 	size_t m_mergeSeqNum;
 	size_t m_newWrSegNum;
 	size_t m_bgTaskNum;
-	size_t m_segArrayUpdateSeq;
+	std::atomic_size_t m_segArrayUpdateSeq;
+	// m_segArrayVersion holds one ref, readers are counted in the slot of
+	// m_segArrayVerEpoch parity while they load and add_ref it, a publisher
+	// flips the epoch and waits the old slot drained before release old one
+	mutable std::atomic<SegArrayVersion*> m_segArrayVersion;
+	mutable std::atomic_size_t m_segArrayVerReaders[2];
+	std::atomic_size_t m_segArrayVerEpoch;
 	llong  m_rowNum;
 	llong  m_oldestSnapshotVersion;
 	std::atomic<ullong> m_lastWriteThrottleTimePoint;
 	std::atomic<ullong> m_lastWriteThrottleBytes;
 	std::atomic<ullong> m_accumulateWrittenBytes;
+	std::atomic<llong>  m_pendingConvertBytes; // set on publishSegArrayVersion
+	std::atomic_size_t  m_publishedSegNum;
+	std::atomic<llong>  m_oldestRowId; // m_rowNumVec[0] of last publish
+	std::atomic<int>    m_writeStallReason;
+	std::atomic<ullong> m_writeStallDelayUsec;
+	std::atomic<ullong> m_writeStallDelayedNum;
+	std::atomic<ullong> m_writeStallStoppedNum;
+	std::atomic<ullong> m_writeStallTotalUsec;
+	struct WarmUp;
+	WarmUp* m_warmUp; // protected by m_rwMutex
 	bool m_throwOnThrottle;
 	bool m_tobeDrop;
 	bool m_isMerging;
@@ -381,6 +559,10 @@ llong DbContext::upsertRow(fstring row) {
 	return m_tab->upsertRow(row, this);
 }
 inline
+size_t DbContext::insertRows(const fstring* rows, size_t rowNum, llong* recIdvec) {
+	return m_tab->insertRows(rows, rowNum, recIdvec, this);
+}
+inline
 llong DbContext::updateRow(llong id, fstring row) {
 //	assert(this != nullptr);
 	return m_tab->updateRow(id, row, this);
@@ -423,6 +605,11 @@ inline bool
 DbContext::indexKeyExistsNoLock(size_t indexId, fstring key) {
 	return m_tab->indexKeyExistsNoLock(indexId, key, this);
 }
+inline void
+DbContext::indexSearchExactMulti(size_t indexId, const fstring* keys, size_t keyNum,
+								 valvec<llong>* recIdvecs) {
+	m_tab->indexSearchExactMulti(indexId, keys, keyNum, recIdvecs, this);
+}
 inline bool
 DbContext::indexMatchRegex(size_t indexId, RegexForIndex* regex, valvec<llong>* recIdvec) {
 	return m_tab->indexMatchRegex(indexId, regex, recIdvec, this);
@@ -477,17 +664,22 @@ inline void
 DbContext::selectOneColgroupNoLock(llong id, size_t cgId, valvec<byte>* cgData) {
 	m_tab->selectOneColgroupNoLock(id, cgId, cgData, this);
 }
+inline void
+DbContext::selectOneColgroupMulti(const llong* ids, size_t idNum, size_t cgId,
+								  valvec<byte>* cgDataVec) {
+	m_tab->selectOneColgroupMulti(ids, idNum, cgId, cgDataVec, this);
+}
 
 inline
 ReadableSegment* DbContext::getSegmentPtr(size_t segIdx) const {
-//	assert(this->segArrayUpdateSeq == m_tab->m_segArrayUpdateSeq);
+//	assert(this->segArrayUpdateSeq == m_tab->getSegArrayUpdateSeq());
 	return m_segCtx[segIdx]->seg;
 }
 
 inline
 void DbContext::trySyncSegCtxNoLock(const DbTable* tab) {
-	if (this->segArrayUpdateSeq != tab->m_segArrayUpdateSeq) {
-		assert(this->segArrayUpdateSeq < tab->m_segArrayUpdateSeq);
+	if (this->segArrayUpdateSeq != tab->getSegArrayUpdateSeq()) {
+		assert(this->segArrayUpdateSeq < tab->getSegArrayUpdateSeq());
 		this->doSyncSegCtxNoLock(tab);
 		assert(m_segCtx.size() == tab->m_segments.size());
 		assert(m_rowNumVec.size() == tab->m_segments.size()+1);
@@ -507,13 +699,11 @@ void DbContext::trySyncSegCtxNoLock(const DbTable* tab) {
 
 inline
 void DbContext::trySyncSegCtxSpeculativeLock(const DbTable* tab) {
-	if (this->segArrayUpdateSeq != tab->m_segArrayUpdateSeq) {
-		assert(this->segArrayUpdateSeq < tab->m_segArrayUpdateSeq);
-		MyRwLock lock(tab->m_rwMutex, false);
+	if (this->segArrayUpdateSeq != tab->getSegArrayUpdateSeq()) {
+		assert(this->segArrayUpdateSeq < tab->getSegArrayUpdateSeq());
+		// sync from the published SegArrayVersion, m_rwMutex is not needed
 		this->doSyncSegCtxNoLock(tab);
-		assert(m_segCtx.size() == tab->m_segments.size());
-		assert(m_rowNumVec.size() == tab->m_segments.size()+1);
-		assert(m_rowNumVec.size() == tab->m_rowNumVec.size());
+		assert(m_rowNumVec.size() == m_segCtx.size()+1);
 	}
 	else {
 		llong rowNum = tab->m_rowNum;
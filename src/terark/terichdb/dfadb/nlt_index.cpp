@@ -106,6 +106,36 @@ const {
 	val->append(buf);
 }
 
+void NestLoudsTrieIndex::buildWordRank() const {
+	const size_t keys = m_dfa->num_words();
+	valvec<size_t> wordRank(keys, valvec_no_init());
+	std::unique_ptr<ADFA_LexIterator> iter(m_dfa->adfa_make_iter());
+	size_t rank = 0;
+	for (bool hasNext = iter->seek_begin(); hasNext; hasNext = iter->incr()) {
+		size_t dawgIdx = m_dfa->state_to_word_id(iter->word_state());
+		wordRank[dawgIdx] = rank;
+		if (m_isUnique) {
+			rank++;
+		}
+		else {
+			size_t bitpos = m_recBits.select1(dawgIdx);
+			rank += m_recBits.zero_seq_len(bitpos + 1) + 1;
+		}
+	}
+	assert(llong(rank) == numDataRows());
+	m_wordRank.build_from(wordRank);
+}
+
+llong NestLoudsTrieIndex::searchLowerBoundRank(fstring key) const {
+	std::call_once(m_wordRankOnce, [this]() { buildWordRank(); });
+	std::unique_ptr<ADFA_LexIterator> iter(m_dfa->adfa_make_iter());
+	if (!iter->seek_lower_bound(key)) {
+		return numDataRows();
+	}
+	size_t dawgIdx = m_dfa->state_to_word_id(iter->word_state());
+	return llong(m_wordRank.get(dawgIdx));
+}
+
 StoreIterator* NestLoudsTrieIndex::createStoreIterForward(DbContext*) const {
 	return nullptr; // not needed
 }
@@ -4,6 +4,7 @@
 #include <terark/int_vector.hpp>
 #include <terark/rank_select.hpp>
 #include <terark/fsa/nest_trie_dawg.hpp>
+#include <mutex>
 
 namespace terark {
 //	class Nest
@@ -26,6 +27,8 @@ public:
 	IndexIterator* createIndexIterForward(DbContext*) const override;
 	IndexIterator* createIndexIterBackward(DbContext*) const override;
 
+	llong searchLowerBoundRank(fstring key) const override;
+
 	ReadableIndex* getReadableIndex() override;
 	ReadableStore* getReadableStore() override;
 
@@ -54,6 +57,13 @@ protected:
 	rank_select_se_512 m_recBits; // only for dupable index
 	const Schema& m_schema;
 
+	// word ids of m_dfa are not in lexical order, m_wordRank[wordId] is
+	// the num of rows whose key is less than the word, it is built on the
+	// first searchLowerBoundRank
+	mutable UintVecMin0    m_wordRank;
+	mutable std::once_flag m_wordRankOnce;
+	void buildWordRank() const;
+
 	class UniqueIndexIterForward;   friend class UniqueIndexIterForward;
 	class UniqueIndexIterBackward;	friend class UniqueIndexIterBackward;
 
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <terark/terichdb/db_store.hpp>
+#include <terark/bitmanip.hpp>
+#include <terark/fstring.hpp>
+#include <algorithm>
+
+namespace terark { namespace terichdb {
+
+// Sampled Eytzinger layout of a sorted index, it narrows the binary search
+// on the bit packed index to 1<<shift positions.
+// Every (1<<shift)-th sorted key is a sample, samples are stored in BFS
+// order of a perfect binary tree: slot 0 is unused, children of slot k
+// are 2k and 2k+1, slots past the real samples hold the max key.
+// Because the tree is perfect, the leaf reached by the branchless descent
+// is the rank of the sample bound, no rank array is needed.
+class EytzingerLayout {
+public:
+	///@returns sample shift from env TerichDB_eytzingerSampleShift,
+	/// -1 if the layer is disabled or not worthwhile for `rows`
+	static int sampleShift(size_t rows) {
+		static const long shift = getEnvLong("TerichDB_eytzingerSampleShift", 4);
+		if (shift < 0 || shift > 16 || rows < (size_t(64) << shift))
+			return -1;
+		return int(shift);
+	}
+	static size_t levels(size_t rows, int shift) {
+		assert(rows > 0 && shift >= 0);
+		size_t samples = ((rows - 1) >> shift) + 1;
+		return terark_bsr_u64(samples) + 1; // 2^levels - 1 >= samples
+	}
+	static size_t slots(size_t levels) { return size_t(1) << levels; }
+
+	///@param onSample(slot, sortedPos) for real samples
+	///@param onPad(slot) for padding slots
+	template<class OnSample, class OnPad>
+	static void build(size_t rows, int shift, size_t levels,
+					  OnSample onSample, OnPad onPad) {
+		for (size_t d = 0; d < levels; ++d) {
+			size_t beg = size_t(1) << d;
+			for (size_t k = beg; k < 2*beg; ++k) {
+				size_t rank = ((2*(k - beg) + 1) << (levels - 1 - d)) - 1;
+				size_t pos = rank << shift;
+				if (pos < rows)
+					onSample(k, pos);
+				else
+					onPad(k);
+			}
+		}
+	}
+
+	///@param less(slot) is monotone on sorted samples
+	///@returns number of samples for which less is true
+	template<class Less>
+	static size_t rank(const void* base, size_t slotLen, size_t levels, Less less) {
+		size_t k = 1;
+		for (size_t l = 0; l < levels; ++l) {
+#if defined(__GNUC__)
+			// 16 descendants 4 levels below, a few cache lines
+			__builtin_prefetch((const byte*)base + slotLen * 16 * k);
+#endif
+			k = 2*k + size_t(less(k));
+		}
+		return k - (size_t(1) << levels);
+	}
+
+	/// narrow [*lo, *hi) by the rank of the sample bound
+	static void narrowLo(size_t r, int shift, size_t rows, size_t* lo) {
+		if (r)
+			*lo = std::min(((r - 1) << shift) + 1, rows);
+	}
+	static void narrowHi(size_t r, int shift, size_t rows, size_t* hi) {
+		*hi = std::min(r << shift, rows);
+	}
+};
+
+}} // namespace terark::terichdb
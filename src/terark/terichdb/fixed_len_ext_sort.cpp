@@ -0,0 +1,151 @@
+#include "fixed_len_ext_sort.hpp"
+#include <terark/lcast.hpp>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+
+namespace terark { namespace terichdb {
+
+namespace fs = boost::filesystem;
+
+struct FixedLenExtSorter::Run {
+	std::string  fpath;
+	FileStream   fp;
+	valvec<byte> buf;
+	size_t       pos = 0; // in bytes
+	size_t       len = 0; // in bytes
+	const byte* cur() const { return buf.data() + pos; }
+};
+
+FixedLenExtSorter::FixedLenExtSorter(size_t recLen, size_t maxMem,
+									 PathRef tmpDir, fstring prefix)
+  : m_recLen(recLen) {
+	assert(recLen > 0);
+	// m_order takes 4 bytes per record
+	m_maxRecs = std::max<size_t>(maxMem / (recLen + sizeof(uint32_t)), 1024);
+	m_maxRecs = std::min<size_t>(m_maxRecs, UINT32_MAX);
+	m_filePrefix = (tmpDir / prefix.str()).string();
+	m_bufPos = 0;
+	m_completed = false;
+}
+
+FixedLenExtSorter::~FixedLenExtSorter() {
+	for (Run* run : m_runs) {
+		if (run->fp.isOpen())
+			run->fp.close();
+		boost::system::error_code ec;
+		fs::remove(run->fpath, ec);
+		delete run;
+	}
+}
+
+void FixedLenExtSorter::add(const void* rec) {
+	assert(!m_completed);
+	if (m_buf.size() == m_maxRecs * m_recLen) {
+		spillRun();
+	}
+	m_buf.append((const byte*)rec, m_recLen);
+}
+
+void FixedLenExtSorter::sortBuf() {
+	const size_t recLen = m_recLen;
+	const size_t rows = m_buf.size() / recLen;
+	const byte*  base = m_buf.data();
+	m_order.resize_no_init(rows);
+	for (size_t i = 0; i < rows; ++i) {
+		m_order[i] = uint32_t(i);
+	}
+	std::sort(m_order.begin(), m_order.end(), [=](uint32_t x, uint32_t y) {
+		return memcmp(base + recLen * x, base + recLen * y, recLen) < 0;
+	});
+}
+
+void FixedLenExtSorter::spillRun() {
+	sortBuf();
+	std::unique_ptr<Run> run(new Run());
+	run->fpath = m_filePrefix + ".run-" + lcast(m_runs.size());
+	{
+		FileStream fp(run->fpath, "wb");
+		fp.disbuf();
+		valvec<byte> wbuf(std::min<size_t>(m_buf.size(), 1 << 20), valvec_reserve());
+		for (uint32_t x : m_order) {
+			if (wbuf.size() + m_recLen > wbuf.capacity()) {
+				fp.ensureWrite(wbuf.data(), wbuf.size());
+				wbuf.erase_all();
+			}
+			wbuf.append(m_buf.data() + m_recLen * x, m_recLen);
+		}
+		fp.ensureWrite(wbuf.data(), wbuf.size());
+	}
+	m_runs.push_back(run.release());
+	m_buf.erase_all();
+	m_order.erase_all();
+}
+
+bool FixedLenExtSorter::fillRun(Run& run) {
+	assert(run.pos == run.len);
+	run.len = run.fp.read(run.buf.data(), run.buf.capacity());
+	run.len -= run.len % m_recLen; // files are always in whole records
+	run.pos = 0;
+	return run.len > 0;
+}
+
+bool FixedLenExtSorter::runLess(size_t x, size_t y) const {
+	int r = memcmp(m_runs[x]->cur(), m_runs[y]->cur(), m_recLen);
+	return r ? r < 0 : x < y;
+}
+
+void FixedLenExtSorter::complete() {
+	assert(!m_completed);
+	m_completed = true;
+	if (m_runs.empty()) {
+		sortBuf(); // all records are in memory
+		m_bufPos = 0;
+		return;
+	}
+	if (!m_buf.empty()) {
+		spillRun();
+	}
+	m_buf.clear(); // free memory
+	m_order.clear();
+	// all runs share the memory budget for read buffer
+	size_t bufRecs = std::max<size_t>(m_maxRecs / m_runs.size(), 64);
+	auto heapComp = [this](size_t x, size_t y) { return runLess(y, x); };
+	for (size_t i = 0; i < m_runs.size(); ++i) {
+		Run& run = *m_runs[i];
+		run.fp.open(run.fpath, "rb");
+		run.fp.disbuf();
+		run.buf.reserve(bufRecs * m_recLen);
+		if (fillRun(run)) {
+			m_heap.push_back(i);
+		}
+	}
+	std::make_heap(m_heap.begin(), m_heap.end(), heapComp);
+}
+
+const byte* FixedLenExtSorter::next() {
+	assert(m_completed);
+	if (m_runs.empty()) {
+		if (m_bufPos < m_order.size())
+			return m_buf.data() + m_recLen * m_order[m_bufPos++];
+		return NULL;
+	}
+	auto heapComp = [this](size_t x, size_t y) { return runLess(y, x); };
+	if (m_heap.empty()) {
+		return NULL;
+	}
+	std::pop_heap(m_heap.begin(), m_heap.end(), heapComp);
+	Run& run = *m_runs[m_heap.back()];
+	// copy out, because fillRun may overwrite run.buf
+	m_buf.assign(run.cur(), m_recLen);
+	run.pos += m_recLen;
+	if (run.pos < run.len || fillRun(run)) {
+		std::push_heap(m_heap.begin(), m_heap.end(), heapComp);
+	} else {
+		m_heap.pop_back();
+		run.fp.close();
+		run.buf.clear();
+	}
+	return m_buf.data();
+}
+
+}} // namespace terark::terichdb
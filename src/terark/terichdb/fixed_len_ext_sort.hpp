@@ -0,0 +1,46 @@
+#pragma once
+
+#include <terark/terichdb/db_store.hpp>
+#include <terark/io/FileStream.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace terark { namespace terichdb {
+
+// Sort fixed length records by memcmp with bounded memory:
+// records are sorted in runs of at most maxMem bytes, full runs are
+// spilled to temporary files in tmpDir, then all runs are merged.
+// Records which are memcmp equal are output in unspecified order.
+class TERICHDB_DLL FixedLenExtSorter : boost::noncopyable {
+public:
+	FixedLenExtSorter(size_t recLen, size_t maxMem, PathRef tmpDir, fstring prefix);
+	~FixedLenExtSorter();
+
+	void add(const void* rec);
+
+	/// must be called once after all records are added
+	void complete();
+
+	///@returns next record in sorted order, NULL on end
+	const byte* next();
+
+	size_t runNum() const { return m_runs.size(); }
+
+private:
+	struct Run;
+	void sortBuf();
+	void spillRun();
+	bool fillRun(Run&);
+	bool runLess(size_t x, size_t y) const;
+
+	const size_t m_recLen;
+	size_t       m_maxRecs; // max records per run
+	std::string  m_filePrefix;
+	valvec<byte> m_buf;
+	valvec<uint32_t> m_order; // sorted order of records in m_buf
+	size_t       m_bufPos;  // output pos in m_order, when runNum() == 0
+	valvec<Run*> m_runs;
+	valvec<size_t> m_heap;  // min heap of runs
+	bool         m_completed;
+};
+
+}} // namespace terark::terichdb
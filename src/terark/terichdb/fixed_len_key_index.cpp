@@ -1,10 +1,23 @@
 #include "fixed_len_key_index.hpp"
+#include "fixed_len_ext_sort.hpp"
+#include "eytzinger_layout.hpp"
 #include <terark/io/FileStream.hpp>
 #include <terark/io/DataIO.hpp>
 #include <terark/util/mmap.hpp>
+#include <terark/util/truncate_file.hpp>
+#include <boost/filesystem.hpp>
 
 namespace terark { namespace terichdb {
 
+namespace {
+	struct Header {
+		uint32_t rows;
+		uint32_t uniqKeys;
+		uint32_t fixlen;
+		uint32_t eytzShift; // EytzingerLayout sample shift + 1, 0 for none
+	};
+}
+
 FixedLenKeyIndex::FixedLenKeyIndex(const Schema& schema) : m_schema(schema) {
 	m_isOrdered = true;
 	m_isIndexKeyByteLex = true;
@@ -12,14 +25,21 @@ FixedLenKeyIndex::FixedLenKeyIndex(const Schema& schema) : m_schema(schema) {
 	m_mmapSize = 0;
 	m_fixedLen = 0;
 	m_uniqKeys = 0;
+	m_eytzShift = -1;
+	m_eytzLevels = 0;
 }
 
 FixedLenKeyIndex::~FixedLenKeyIndex() {
 	if (m_mmapBase) {
 		m_keys.risk_release_ownership();
 		m_index.risk_release_ownership();
+		m_eytz.risk_release_ownership();
 		mmap_close(m_mmapBase, m_mmapSize);
 	}
+	if (!m_tmpFile.empty()) {
+		boost::system::error_code ec;
+		boost::filesystem::remove(m_tmpFile, ec);
+	}
 }
 
 ReadableStore* FixedLenKeyIndex::getReadableStore() {
@@ -32,7 +52,7 @@ ReadableIndex* FixedLenKeyIndex::getReadableIndex() {
 
 ///@{ ordered and unordered index
 llong FixedLenKeyIndex::indexStorageSize() const {
-	return m_index.mem_size();
+	return m_index.mem_size() + m_eytz.used_mem_size();
 }
 
 void
@@ -56,6 +76,13 @@ const {
 	}
 }
 
+llong FixedLenKeyIndex::searchLowerBoundRank(fstring key) const {
+	if (key.size() != m_fixedLen) {
+		return -1;
+	}
+	return llong(searchLowerBound_cvt(key));
+}
+
 size_t FixedLenKeyIndex::searchLowerBound_cvt(fstring key) const {
 	if (m_schema.m_needEncodeToLexByteComparable) {
 		size_t fixlen = m_fixedLen;
@@ -82,6 +109,19 @@ size_t FixedLenKeyIndex::searchUpperBound_cvt(fstring key) const {
 	}
 }
 
+size_t FixedLenKeyIndex::eytzRank(fstring key, bool upper) const {
+	const byte* a = m_eytz.data();
+	const byte* k = key.udata();
+	size_t fixlen = m_fixedLen;
+	size_t levels = m_eytzLevels;
+	if (upper)
+		return EytzingerLayout::rank(a, fixlen, levels,
+			[=](size_t x) { return memcmp(a + fixlen*x, k, fixlen) <= 0; });
+	else
+		return EytzingerLayout::rank(a, fixlen, levels,
+			[=](size_t x) { return memcmp(a + fixlen*x, k, fixlen) < 0; });
+}
+
 size_t FixedLenKeyIndex::searchLowerBound(fstring key) const {
 	assert(key.size() == m_fixedLen);
 	auto indexData = m_index.data();
@@ -90,6 +130,11 @@ size_t FixedLenKeyIndex::searchLowerBound(fstring key) const {
 	auto keysData = m_keys.data();
 	size_t fixlen = m_fixedLen;
 	size_t i = 0, j = m_index.size();
+	if (!m_eytz.empty()) {
+		size_t r = eytzRank(key, false);
+		EytzingerLayout::narrowLo(r, m_eytzShift, m_index.size(), &i);
+		EytzingerLayout::narrowHi(r, m_eytzShift, m_index.size(), &j);
+	}
 	while (i < j) {
 		size_t mid = (i + j) / 2;
 		size_t hitPos = UintVecMin0::fast_get(indexData, indexBits, indexMask, mid);
@@ -110,6 +155,11 @@ size_t FixedLenKeyIndex::searchUpperBound(fstring key) const {
 	auto keysData = m_keys.data();
 	size_t fixlen = m_fixedLen;
 	size_t i = 0, j = m_index.size();
+	if (!m_eytz.empty()) {
+		size_t r = eytzRank(key, true);
+		EytzingerLayout::narrowLo(r, m_eytzShift, m_index.size(), &i);
+		EytzingerLayout::narrowHi(r, m_eytzShift, m_index.size(), &j);
+	}
 	while (i < j) {
 		size_t mid = (i + j) / 2;
 		size_t hitPos = UintVecMin0::fast_get(indexData, indexBits, indexMask, mid);
@@ -200,15 +250,131 @@ void FixedLenKeyIndex::build(const Schema& schema, SortableStrVec& strVec) {
 	assert(0 == minIdx);
 	m_keys.clear();
 	m_keys.swap(strVec.m_strpool);
+	buildEytzinger();
 }
 
-namespace {
-	struct Header {
-		uint32_t rows;
-		uint32_t uniqKeys;
-		uint32_t fixlen;
-		uint32_t padding;
-	};
+void FixedLenKeyIndex::buildSorted(const Schema& schema, SortableStrVec& strVec,
+								   const valvec<uint32_t>& sortedIds) {
+	size_t fixlen = schema.getFixedRowLen();
+	byte*  data = strVec.m_strpool.data();
+	size_t rows = strVec.m_strpool.size() / fixlen;
+	assert(strVec.m_index.size() == 0);
+	assert(strVec.m_strpool.size() % fixlen == 0);
+	assert(sortedIds.size() == rows);
+	if (schema.m_needEncodeToLexByteComparable) {
+		for (size_t i = 0; i < rows; ++i) {
+			schema.byteLexEncode(data + i*fixlen, fixlen);
+		}
+	}
+	m_fixedLen = fixlen;
+	m_uniqKeys = rows ? 1 : 0;
+	for (size_t i = 1; i < rows; ++i) {
+		const byte* xkey = data + fixlen * sortedIds[i-1];
+		const byte* ykey = data + fixlen * sortedIds[i-0];
+		int cmp = memcmp(xkey, ykey, fixlen);
+		assert(cmp < 0 || (0 == cmp && sortedIds[i-1] < sortedIds[i]));
+		if (cmp)
+			m_uniqKeys++;
+	}
+	m_isUnique = m_uniqKeys == rows;
+	auto minIdx = m_index.build_from(sortedIds);
+	(void)minIdx;
+	assert(0 == minIdx);
+	m_keys.clear();
+	m_keys.swap(strVec.m_strpool);
+	buildEytzinger();
+}
+
+// the index is built in the layout of its file, in the mmap of a temp file,
+// keys and ids are written through the page cache instead of the heap
+void FixedLenKeyIndex::build(const Schema& schema, const byte* keys, size_t rows,
+							 size_t maxMem, PathRef tmpDir) {
+	assert(rows > 0);
+	assert(NULL == m_mmapBase);
+	const size_t fixlen = schema.getFixedRowLen();
+	const size_t keyMemSize = fixlen * rows;
+	const size_t keyPadSize = (keyMemSize + 15) & ~size_t(15);
+	const size_t idBits = UintVecMin0::compute_uintbits(rows - 1);
+	const size_t idMemSize = UintVecMin0::compute_mem_size(idBits, rows);
+	const int    eytzShift = EytzingerLayout::sampleShift(rows);
+	const size_t eytzLevels = eytzShift < 0 ? 0 : EytzingerLayout::levels(rows, eytzShift);
+	const size_t eytzSize = eytzShift < 0 ? 0 : fixlen * EytzingerLayout::slots(eytzLevels);
+	m_tmpFile = (tmpDir / ("index-" + schema.m_name + ".fixlen")).string();
+	truncate_file(m_tmpFile, sizeof(Header) + keyPadSize + idMemSize + eytzSize);
+	m_mmapBase = (byte_t*)mmap_load(m_tmpFile, &m_mmapSize, true);
+	byte* data = (byte*)m_mmapBase + sizeof(Header);
+	memcpy(data, keys, keyMemSize);
+	m_keys .risk_set_data(data, keyMemSize);
+	m_index.risk_set_data(data + keyPadSize, rows, idBits);
+	m_eytz .risk_set_data(data + keyPadSize + idMemSize, eytzSize);
+	assert(m_index.mem_size() == idMemSize);
+	if (schema.m_needEncodeToLexByteComparable) {
+		for (size_t i = 0; i < rows; ++i) {
+			schema.byteLexEncode(data + i*fixlen, fixlen);
+		}
+	}
+	// record is (key, big endian recId), memcmp order is (key, recId) order
+	const size_t recLen = fixlen + 4;
+	FixedLenExtSorter sorter(recLen, maxMem, tmpDir, "index-" + schema.m_name);
+	valvec<byte> rec(recLen, valvec_no_init());
+	for (size_t i = 0; i < rows; ++i) {
+		memcpy(rec.data(), data + fixlen * i, fixlen);
+		for (int k = 0; k < 4; ++k) rec[fixlen+k] = byte(i >> (24 - 8*k));
+		sorter.add(rec.data());
+	}
+	sorter.complete();
+	m_fixedLen = fixlen;
+	m_uniqKeys = 0;
+	for (size_t i = 0; i < rows; ++i) {
+		const byte* r = sorter.next();
+		assert(NULL != r);
+		if (0 == i || memcmp(rec.data(), r, fixlen) != 0) {
+			m_uniqKeys++;
+			memcpy(rec.data(), r, fixlen);
+		}
+		const byte* p = r + fixlen;
+		size_t recId = size_t(p[0]) << 24 | size_t(p[1]) << 16 | size_t(p[2]) << 8 | p[3];
+		m_index.set_wire(i, recId);
+	}
+	assert(NULL == sorter.next());
+	m_isUnique = m_uniqKeys == rows;
+	m_eytzShift = eytzShift;
+	m_eytzLevels = eytzLevels;
+	if (eytzShift >= 0) {
+		fillEytzinger();
+	}
+	auto h = (Header*)m_mmapBase;
+	h->rows     = uint32_t(rows);
+	h->uniqKeys = uint32_t(m_uniqKeys);
+	h->fixlen   = uint32_t(fixlen);
+	h->eytzShift= eytzShift < 0 ? 0 : uint32_t(eytzShift + 1);
+}
+
+void FixedLenKeyIndex::buildEytzinger() {
+	size_t rows = m_index.size();
+	m_eytz.clear();
+	m_eytzLevels = 0;
+	m_eytzShift = EytzingerLayout::sampleShift(rows);
+	if (m_eytzShift < 0) {
+		return;
+	}
+	m_eytzLevels = EytzingerLayout::levels(rows, m_eytzShift);
+	m_eytz.resize_no_init(m_fixedLen * EytzingerLayout::slots(m_eytzLevels));
+	fillEytzinger();
+}
+
+// m_eytz has been sized for m_eytzLevels
+void FixedLenKeyIndex::fillEytzinger() {
+	size_t rows = m_index.size();
+	size_t fixlen = m_fixedLen;
+	byte* a = m_eytz.data();
+	const byte* keysData = m_keys.data();
+	memset(a, 0, fixlen); // unused
+	EytzingerLayout::build(rows, m_eytzShift, m_eytzLevels,
+		[&](size_t k, size_t pos) {
+			memcpy(a + fixlen*k, keysData + fixlen*m_index.get(pos), fixlen);
+		},
+		[=](size_t k) { memset(a + fixlen*k, 0xFF, fixlen); });
 }
 
 void FixedLenKeyIndex::load(PathRef path) {
@@ -223,6 +389,13 @@ void FixedLenKeyIndex::load(PathRef path) {
 	m_keys .risk_set_data((byte*)(h+1) , keyMemSize);
 	keyMemSize = (keyMemSize + 15) & ~15;
 	m_index.risk_set_data((byte*)(h+1) + keyMemSize, h->rows, rbits);
+	if (h->eytzShift) {
+		byte* eytz = (byte*)(h+1) + keyMemSize + m_index.mem_size();
+		m_eytzShift  = int(h->eytzShift - 1);
+		m_eytzLevels = EytzingerLayout::levels(h->rows, m_eytzShift);
+		m_eytz.risk_set_data(eytz, h->fixlen * EytzingerLayout::slots(m_eytzLevels));
+		assert(eytz + m_eytz.size() <= m_mmapBase + m_mmapSize);
+	}
 }
 
 void FixedLenKeyIndex::save(PathRef path) const {
@@ -233,7 +406,7 @@ void FixedLenKeyIndex::save(PathRef path) const {
 	h.rows     = uint32_t(m_index.size());
 	h.uniqKeys = m_uniqKeys;
 	h.fixlen   = m_fixedLen;
-	h.padding  = 0;
+	h.eytzShift= m_eytz.empty() ? 0 : uint32_t(m_eytzShift + 1);
 	dio.ensureWrite(&h, sizeof(h));
 	byte zero[16];
 	memset(zero, 0, sizeof(zero));
@@ -242,6 +415,7 @@ void FixedLenKeyIndex::save(PathRef path) const {
 		dio.ensureWrite(zero, 16 - m_keys.used_mem_size() % 16);
 	}
 	dio.ensureWrite(m_index.data(), m_index.mem_size());
+	dio.ensureWrite(m_eytz .data(), m_eytz .size());
 }
 
 class FixedLenKeyIndex::MyIndexIterForward : public IndexIterator {
@@ -20,6 +20,7 @@ public:
 
 	IndexIterator* createIndexIterForward(DbContext*) const override;
 	IndexIterator* createIndexIterBackward(DbContext*) const override;
+	llong searchLowerBoundRank(fstring key) const override;
 
 	ReadableStore* getReadableStore() override;
 	ReadableIndex* getReadableIndex() override;
@@ -32,6 +33,15 @@ public:
 	StoreIterator* createStoreIterBackward(DbContext*) const override;
 
 	void build(const Schema& schema, SortableStrVec& strVec);
+	///@param keys fixed len keys in recId order, such as mmap of a temp file
+	/// the index is sorted by FixedLenExtSorter with at most maxMem memory,
+	/// and is written to the mmap of a temp file in tmpDir
+	void build(const Schema& schema, const byte* keys, size_t rows,
+			   size_t maxMem, PathRef tmpDir);
+	///@param sortedIds recIds in (key, recId) order, such as merged from
+	/// sorted indices, keys are not sorted again
+	void buildSorted(const Schema& schema, SortableStrVec& strVec,
+					 const valvec<uint32_t>& sortedIds);
 	void load(PathRef path) override;
 	void save(PathRef path) const override;
 
@@ -43,7 +53,14 @@ protected:
 	size_t       m_mmapSize;
 	size_t       m_fixedLen;
 	size_t       m_uniqKeys;
+	int          m_eytzShift;  // -1 if no Eytzinger layer
+	size_t       m_eytzLevels;
+	valvec<byte> m_eytz;       // sampled keys, see EytzingerLayout
+	std::string  m_tmpFile;    // mmap of ext sort build, deleted by dtor
 
+	void buildEytzinger();
+	void fillEytzinger();
+	size_t eytzRank(fstring binkey, bool upper) const;
 	size_t searchLowerBound(fstring binkey) const;
 	size_t searchUpperBound(fstring binkey) const;
 
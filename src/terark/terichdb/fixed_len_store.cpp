@@ -5,6 +5,7 @@
 #include <terark/util/autoclose.hpp>
 #include <terark/util/truncate_file.hpp>
 #include <functional>
+#include <limits>
 #include <terark/num_to_str.hpp>
 
 #if defined(_MSC_VER)
@@ -82,6 +83,81 @@ void FixedLenStore::getValueAppend(llong id, valvec<byte>* val, DbContext*) cons
 	val->append(dataPtr, m_mmapBase->fixlen);
 }
 
+// branch free, each word of bitmap is built from WordBits values,
+// the inner loop is vectorized by the compiler
+template<class T>
+static void
+filterFixedNumber(const T* vals, size_t rows, T lo, T hi, bm_uint_t* bits) {
+	size_t i = 0;
+	for (; i + WordBits <= rows; i += WordBits) {
+		const T* p = vals + i;
+		bm_uint_t w = 0;
+		for (size_t j = 0; j < WordBits; ++j) {
+			w |= bm_uint_t((lo <= p[j]) & (p[j] <= hi)) << j;
+		}
+		bits[i / WordBits] = w;
+	}
+	if (i < rows) {
+		bm_uint_t w = 0;
+		for (size_t j = 0; i + j < rows; ++j) {
+			w |= bm_uint_t((lo <= vals[i+j]) & (vals[i+j] <= hi)) << j;
+		}
+		bits[i / WordBits] = w;
+	}
+}
+
+template<class T>
+static void
+filterFixedNumber(const byte* vals, size_t rows,
+				  const fstring* lo, const fstring* hi, febitvec* bitmap) {
+	T ilo = lo ? unaligned_load<T>(lo->udata()) : std::numeric_limits<T>::lowest();
+	T ihi = hi ? unaligned_load<T>(hi->udata()) : std::numeric_limits<T>::max();
+	filterFixedNumber<T>((const T*)vals, rows, ilo, ihi, bitmap->bldata());
+}
+
+bool FixedLenStore::filterRange(const fstring* lo, const fstring* hi,
+								febitvec* bitmap) const {
+	if ((lo && lo->size() != m_fixlen) || (hi && hi->size() != m_fixlen)) {
+		THROW_STD(invalid_argument
+			, "fixlen = %zd, lo.size = %zd, hi.size = %zd, schema = %s"
+			, m_fixlen, lo ? lo->size() : 0, hi ? hi->size() : 0
+			, m_schema.m_name.c_str());
+	}
+	ScopeLock(false);
+	size_t rows = NULL == m_mmapBase ? 0 : size_t(m_mmapBase->rows);
+	bitmap->erase_all();
+	bitmap->resize(rows, false);
+	if (0 == rows) {
+		return true;
+	}
+	const byte* data = m_mmapBase->get_data(0);
+	if (m_schema.columnNum() == 1) {
+		switch (m_schema.getColumnMeta(0).type) {
+		default: break;
+		case ColumnType::Sint08 : filterFixedNumber< int8_t >(data, rows, lo, hi, bitmap); return true;
+		case ColumnType::Uint08 : filterFixedNumber<uint8_t >(data, rows, lo, hi, bitmap); return true;
+		case ColumnType::Sint16 : filterFixedNumber< int16_t>(data, rows, lo, hi, bitmap); return true;
+		case ColumnType::Uint16 : filterFixedNumber<uint16_t>(data, rows, lo, hi, bitmap); return true;
+		case ColumnType::Sint32 : filterFixedNumber< int32_t>(data, rows, lo, hi, bitmap); return true;
+		case ColumnType::Uint32 : filterFixedNumber<uint32_t>(data, rows, lo, hi, bitmap); return true;
+		case ColumnType::Sint64 : filterFixedNumber< int64_t>(data, rows, lo, hi, bitmap); return true;
+		case ColumnType::Uint64 : filterFixedNumber<uint64_t>(data, rows, lo, hi, bitmap); return true;
+		case ColumnType::Float32: filterFixedNumber<float   >(data, rows, lo, hi, bitmap); return true;
+		case ColumnType::Float64: filterFixedNumber<double  >(data, rows, lo, hi, bitmap); return true;
+		}
+	}
+	// general fixed len rows, compared by schema on the mmap, no copy
+	const size_t fixlen = m_fixlen;
+	bm_uint_t* bits = bitmap->bldata();
+	for (size_t i = 0; i < rows; ++i) {
+		fstring row(data + fixlen * i, fixlen);
+		bool match = (!lo || m_schema.compareData(*lo, row) <= 0)
+				  && (!hi || m_schema.compareData(row, *hi) <= 0);
+		bits[i / WordBits] |= bm_uint_t(match) << (i % WordBits);
+	}
+	return true;
+}
+
 StoreIterator* FixedLenStore::createStoreIterForward(DbContext*) const {
 	return nullptr; // not needed
 }
@@ -167,10 +243,11 @@ void FixedLenStore::update(llong id, fstring row, DbContext* ctx) {
 	if (nullptr == h) {
 		h = allocFileSize(llong(std::max(m_mmapSize, sizeof(Header)) * 1.618));
 	}
-	// id may greater than h->rows in concurrent insertions
+	// id may greater than h->rows in concurrent insertions, or in
+	// DbTable::insertRows, which writes rows of a chunk in key order while
+	// their ids are allocated in input order, so no assert(id <= oldRows)
 	uint64_t oldRows = h->rows;
 	uint64_t newRows = std::max<uint64_t>(oldRows, id+1);
-	assert(uint64_t(id) <= oldRows); // assert in single thread tests
 	if (newRows >= h->capacity) {
 		assert(m_mmapSize % ChunkBytes == 0);
 		size_t required_bytes = m_mmapSize + m_fixlen * (newRows - h->capacity);
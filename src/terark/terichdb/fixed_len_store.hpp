@@ -20,6 +20,7 @@ public:
 	llong dataInflateSize() const override;
 	llong numDataRows() const override;
 	void getValueAppend(llong id, valvec<byte>* val, DbContext*) const override;
+	bool filterRange(const fstring* lo, const fstring* hi, febitvec*) const override;
 
 	StoreIterator* createStoreIterForward(DbContext*) const override;
 	StoreIterator* createStoreIterBackward(DbContext*) const override;
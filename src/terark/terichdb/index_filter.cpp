@@ -0,0 +1,118 @@
+#include "index_filter.hpp"
+#include <terark/io/FileStream.hpp>
+#include <terark/util/mmap.hpp>
+#include <string.h>
+
+namespace terark { namespace terichdb {
+
+struct IndexFilter::Header {
+	char     magic[8];
+	uint32_t numProbes;
+	uint32_t padding;
+	uint64_t numBlocks;
+	uint64_t numKeys;
+	uint64_t reserved[4];
+};
+static const char g_indexFilterMagic[8] = {'T','r','k','B','l','o','o','m'};
+
+// MurmurHash64A, keys are short, the hash quality is good enough
+uint64_t IndexFilter::hashKey(fstring key) {
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+	const byte_t* p = key.udata();
+	size_t len = key.size();
+	uint64_t h = 0x9E3779B97F4A7C15ULL ^ (len * m);
+	for (; len >= 8; len -= 8, p += 8) {
+		uint64_t k;
+		memcpy(&k, p, 8);
+		k *= m; k ^= k >> r; k *= m;
+		h ^= k; h *= m;
+	}
+	if (len) {
+		uint64_t k = 0;
+		memcpy(&k, p, len);
+		h ^= k; h *= m;
+	}
+	h ^= h >> r; h *= m; h ^= h >> r;
+	return h;
+}
+
+IndexFilter::IndexFilter() {
+	m_blocks = NULL;
+	m_numBlocks = 0;
+	m_numProbes = 0;
+	m_numKeys = 0;
+	m_mmapBase = NULL;
+	m_mmapSize = 0;
+}
+
+IndexFilter::~IndexFilter() {
+	if (m_mmapBase) {
+		mmap_close(m_mmapBase, m_mmapSize);
+	}
+}
+
+void IndexFilter::init(size_t numKeys, size_t bitsPerKey) {
+	assert(NULL == m_mmapBase);
+	assert(bitsPerKey > 0);
+	// size_t(...) makes a temporary, std::max binds a reference and
+	// BitsPerBlock has no out-of-line definition
+	size_t bits = std::max<size_t>(numKeys * bitsPerKey, size_t(BitsPerBlock));
+	m_numBlocks = std::min<size_t>((bits + BitsPerBlock - 1) / BitsPerBlock, UINT32_MAX);
+	// k = ln2 * bitsPerKey is optimal for standard bloom filter
+	m_numProbes = uint32_t(std::min<size_t>(std::max<size_t>(bitsPerKey * 69 / 100, 1), 16));
+	m_numKeys = 0;
+	m_data.resize(m_numBlocks * WordsPerBlock, 0);
+	m_blocks = m_data.data();
+}
+
+void IndexFilter::add(uint64_t hash) {
+	assert(m_data.size() == m_numBlocks * WordsPerBlock);
+	uint64_t* block = m_blocks + getBlockIdx(hash) * WordsPerBlock;
+	uint32_t h1 = uint32_t(hash);
+	uint32_t h2 = (h1 >> 17) | (h1 << 15);
+	for (uint32_t i = 0; i < m_numProbes; ++i) {
+		uint32_t bitIdx = h1 & (BitsPerBlock - 1);
+		block[bitIdx / 64] |= uint64_t(1) << (bitIdx % 64);
+		h1 += h2;
+	}
+	m_numKeys++;
+}
+
+void IndexFilter::save(PathRef fpath) const {
+	assert(m_numBlocks > 0);
+	Header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, g_indexFilterMagic, sizeof(h.magic));
+	h.numProbes = m_numProbes;
+	h.numBlocks = m_numBlocks;
+	h.numKeys = m_numKeys;
+	FileStream fp(fpath.string().c_str(), "wb");
+	fp.ensureWrite(&h, sizeof(h));
+	fp.ensureWrite(m_blocks, mem_size());
+}
+
+void IndexFilter::load(PathRef fpath) {
+	assert(NULL == m_mmapBase);
+	std::string strFile = fpath.string();
+	size_t fsize = 0;
+	void* base = mmap_load(strFile, &fsize);
+	auto h = (const Header*)base;
+	if (fsize < sizeof(Header)
+		|| memcmp(h->magic, g_indexFilterMagic, sizeof(h->magic)) != 0
+		|| h->numBlocks == 0 || h->numBlocks > UINT32_MAX
+		|| h->numProbes == 0 || h->numProbes > 16
+		|| sizeof(Header) + h->numBlocks * WordsPerBlock * 8 != fsize) {
+		mmap_close(base, fsize);
+		THROW_STD(invalid_argument, "bad index filter file: %s", strFile.c_str());
+	}
+	m_mmapBase = base;
+	m_mmapSize = fsize;
+	m_numBlocks = size_t(h->numBlocks);
+	m_numProbes = h->numProbes;
+	m_numKeys = size_t(h->numKeys);
+	m_blocks = (uint64_t*)(h + 1);
+	m_data.clear();
+}
+
+} } // namespace terark::terichdb
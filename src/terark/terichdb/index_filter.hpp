@@ -0,0 +1,68 @@
+#ifndef __terichdb_index_filter_hpp__
+#define __terichdb_index_filter_hpp__
+
+#include "db_store.hpp"
+
+namespace terark { namespace terichdb {
+
+// Cache line blocked bloom filter for index keys of a ReadonlySegment,
+// a probe touches just one 64 bytes block.
+// It is built after the index is built and saved as "index-$name.bloom"
+// in the segment dir, old segments without this file are always probed.
+class TERICHDB_DLL IndexFilter : public RefCounter {
+	TERICHDB_NON_COPYABLE_CLASS(IndexFilter);
+public:
+	static uint64_t hashKey(fstring key);
+
+	IndexFilter();
+	~IndexFilter();
+
+	void init(size_t numKeys, size_t bitsPerKey);
+	void add(uint64_t hash);
+	bool mayContain(uint64_t hash) const {
+		const uint64_t* block = m_blocks + getBlockIdx(hash) * WordsPerBlock;
+		uint32_t h1 = uint32_t(hash);
+		uint32_t h2 = (h1 >> 17) | (h1 << 15);
+		for (uint32_t i = 0; i < m_numProbes; ++i) {
+			uint32_t bitIdx = h1 & (BitsPerBlock - 1);
+			if (!(block[bitIdx / 64] & (uint64_t(1) << (bitIdx % 64))))
+				return false;
+			h1 += h2;
+		}
+		return true;
+	}
+	void prefetch(uint64_t hash) const {
+		const uint64_t* block = m_blocks + getBlockIdx(hash) * WordsPerBlock;
+#if defined(__GNUC__)
+		__builtin_prefetch(block);
+#else
+		(void)block;
+#endif
+	}
+
+	void save(PathRef fpath) const;
+	void load(PathRef fpath);
+	size_t mem_size() const { return m_numBlocks * WordsPerBlock * 8; }
+
+	static const size_t WordsPerBlock = 8;
+	static const size_t BitsPerBlock = 64 * WordsPerBlock;
+
+private:
+	size_t getBlockIdx(uint64_t hash) const {
+		// fast range reduction, m_numBlocks < 2^32
+		return size_t(((hash >> 32) * m_numBlocks) >> 32);
+	}
+	struct Header;
+	uint64_t* m_blocks;
+	size_t    m_numBlocks;
+	uint32_t  m_numProbes;
+	size_t    m_numKeys;
+	valvec<uint64_t> m_data; // when built in memory
+	void*     m_mmapBase;
+	size_t    m_mmapSize;
+};
+typedef boost::intrusive_ptr<IndexFilter> IndexFilterPtr;
+
+} } // namespace terark::terichdb
+
+#endif // __terichdb_index_filter_hpp__
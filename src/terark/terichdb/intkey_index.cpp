@@ -1,4 +1,6 @@
 #include "intkey_index.hpp"
+#include "fixed_len_ext_sort.hpp"
+#include "eytzinger_layout.hpp"
 #include <terark/util/sortable_strvec.hpp>
 #include <terark/io/FileStream.hpp>
 #include <terark/io/DataIO.hpp>
@@ -14,11 +16,14 @@ ZipIntKeyIndex::ZipIntKeyIndex(const Schema& schema) : m_schema(schema) {
 	m_isOrdered = true;
 	m_mmapBase = nullptr;
 	m_mmapSize = 0;
+	m_eytzShift = -1;
+	m_eytzLevels = 0;
 }
 ZipIntKeyIndex::~ZipIntKeyIndex() {
 	if (m_mmapBase) {
 		m_keys.risk_release_ownership();
 		m_index.risk_release_ownership();
+		m_eytz.risk_release_ownership();
 		mmap_close(m_mmapBase, m_mmapSize);
 	}
 }
@@ -33,7 +38,27 @@ ReadableStore* ZipIntKeyIndex::getReadableStore() {
 
 ///@{ ordered and unordered index
 llong ZipIntKeyIndex::indexStorageSize() const {
-	return m_keys.mem_size() + m_index.mem_size();
+	return m_keys.mem_size() + m_index.mem_size() + m_eytz.used_mem_size();
+}
+
+void ZipIntKeyIndex::narrowLowerBound(ullong key, size_t* lo, size_t* hi) const {
+	if (m_eytz.empty())
+		return;
+	const uint64_t* a = m_eytz.data();
+	size_t r = EytzingerLayout::rank(a, sizeof(uint64_t), m_eytzLevels,
+		[a,key](size_t k) { return a[k] < key; });
+	EytzingerLayout::narrowLo(r, m_eytzShift, m_index.size(), lo);
+	EytzingerLayout::narrowHi(r, m_eytzShift, m_index.size(), hi);
+}
+
+void ZipIntKeyIndex::narrowUpperBound(ullong key, size_t* lo, size_t* hi) const {
+	if (m_eytz.empty())
+		return;
+	const uint64_t* a = m_eytz.data();
+	size_t r = EytzingerLayout::rank(a, sizeof(uint64_t), m_eytzLevels,
+		[a,key](size_t k) { return a[k] <= key; });
+	EytzingerLayout::narrowLo(r, m_eytzShift, m_index.size(), lo);
+	EytzingerLayout::narrowHi(r, m_eytzShift, m_index.size(), hi);
 }
 
 template<class Int>
@@ -51,6 +76,7 @@ size_t ZipIntKeyIndex::IntVecLowerBound(fstring binkey) const {
 	auto keysMask = m_keys.uintmask();
 	ullong key = ullong(rawkey - Int(m_minKey));
 	size_t i = 0, j = m_index.size();
+	narrowLowerBound(key, &i, &j);
 	while (i < j) {
 		size_t mid = (i + j) / 2;
 		size_t hitPos = UintVecMin0::fast_get(indexData, indexBits, indexMask, mid);
@@ -70,6 +96,17 @@ void ZipIntKeyIndex::searchExactAppend(fstring key, valvec<llong>* recIdvec, DbC
 	}
 }
 
+llong ZipIntKeyIndex::searchLowerBoundRank(fstring key) const {
+	size_t keyLen = m_schema.getColumnMeta(0).fixedLen;
+	if (0 == keyLen) {
+		keyLen = 8; // VarSint, VarUint are searched as 64 bit
+	}
+	if (key.size() != keyLen) {
+		return -1;
+	}
+	return llong(searchLowerBound(key));
+}
+
 size_t ZipIntKeyIndex::searchLowerBound(fstring key) const {
 	switch (m_keyType) {
 	default:
@@ -104,6 +141,7 @@ size_t ZipIntKeyIndex::IntVecUpperBound(fstring binkey) const {
 	auto keysMask = m_keys.uintmask();
 	size_t key = size_t(rawkey - Int(m_minKey));
 	size_t i = 0, j = m_index.size();
+	narrowUpperBound(key, &i, &j);
 	while (i < j) {
 		size_t mid = (i + j) / 2;
 		size_t hitPos = UintVecMin0::fast_get(indexData, indexBits, indexMask, mid);
@@ -152,6 +190,11 @@ ZipIntKeyIndex::IntVecEqualRange(fstring binkey) const {
 	size_t key = size_t(rawkey - Int(m_minKey));
 	size_t i = 0, j = m_index.size();
 	size_t mid = 0;
+	if (!m_eytz.empty()) {
+		size_t lbHi = j, ubLo = i;
+		narrowLowerBound(key, &i, &lbHi); // i <= lower_bound
+		narrowUpperBound(key, &ubLo, &j); // j >= upper_bound
+	}
 	while (i < j) {
 		mid = (i + j) / 2;
 		size_t hitPos = UintVecMin0::fast_get(indexData, indexBits, indexMask, mid);
@@ -291,7 +334,7 @@ void ZipIntKeyIndex::zipKeys(const void* data, size_t size) {
 #endif
 }
 
-void ZipIntKeyIndex::build(ColumnType keyType, SortableStrVec& strVec) {
+void ZipIntKeyIndex::zipStrVec(ColumnType keyType, SortableStrVec& strVec) {
 	assert(strVec.m_index.size() == 0);
 	m_keyType = keyType;
 	void*  data = strVec.m_strpool.data();
@@ -332,6 +375,10 @@ void ZipIntKeyIndex::build(ColumnType keyType, SortableStrVec& strVec) {
 		zipKeys<uint64_t>(tmp.data(), tmp.used_mem_size());
 		break; }
 	}
+}
+
+void ZipIntKeyIndex::build(ColumnType keyType, SortableStrVec& strVec) {
+	zipStrVec(keyType, strVec);
 	valvec<uint32_t> index(m_keys.size(), valvec_no_init());
 	for (size_t i = 0; i < index.size(); ++i) index[i] = uint32_t(i);
 	std::sort(index.begin(), index.end(), [&](size_t x, size_t y) {
@@ -353,6 +400,89 @@ void ZipIntKeyIndex::build(ColumnType keyType, SortableStrVec& strVec) {
 		assert(xk <= yk);
 	}
 #endif
+	buildEytzinger();
+}
+
+void ZipIntKeyIndex::buildSorted(ColumnType keyType, SortableStrVec& strVec,
+								 const valvec<uint32_t>& sortedIds) {
+	zipStrVec(keyType, strVec);
+	assert(sortedIds.size() == m_keys.size());
+	auto minIdx = m_index.build_from(sortedIds);
+	(void)minIdx;
+#if !defined(NDEBUG)
+	assert(0 == minIdx);
+	for(size_t i = 1; i < m_index.size(); ++i) {
+		size_t xi = m_index.get(i-1);
+		size_t yi = m_index.get(i-0);
+		size_t xk = m_keys.get(xi);
+		size_t yk = m_keys.get(yi);
+		assert(xk < yk || (xk == yk && xi < yi));
+	}
+#endif
+	buildEytzinger();
+}
+
+void ZipIntKeyIndex::build(ColumnType keyType, const byte* keys, size_t rows,
+						   size_t maxMem, PathRef tmpDir) {
+	m_keyType = keyType;
+	switch (keyType) {
+	default:
+		THROW_STD(invalid_argument, "Bad keyType=%s", Schema::columnTypeStr(keyType));
+	case ColumnType::Sint08: zipKeys< int8_t >(keys, rows * 1); break;
+	case ColumnType::Uint08: zipKeys<uint8_t >(keys, rows * 1); break;
+	case ColumnType::Sint16: zipKeys< int16_t>(keys, rows * 2); break;
+	case ColumnType::Uint16: zipKeys<uint16_t>(keys, rows * 2); break;
+	case ColumnType::Sint32: zipKeys< int32_t>(keys, rows * 4); break;
+	case ColumnType::Uint32: zipKeys<uint32_t>(keys, rows * 4); break;
+	case ColumnType::Sint64: zipKeys< int64_t>(keys, rows * 8); break;
+	case ColumnType::Uint64: zipKeys<uint64_t>(keys, rows * 8); break;
+	}
+	// record is big endian (zipped key, recId), memcmp order is the same
+	// as the order of in memory build
+	FixedLenExtSorter sorter(12, maxMem, tmpDir, "index-" + m_schema.m_name);
+	byte rec[12];
+	for (size_t i = 0; i < rows; ++i) {
+		uint64_t key = m_keys.get(i);
+		for (int k = 0; k < 8; ++k) rec[k] = byte(key >> (56 - 8*k));
+		for (int k = 0; k < 4; ++k) rec[8+k] = byte(i >> (24 - 8*k));
+		sorter.add(rec);
+	}
+	sorter.complete();
+	m_index.resize_with_wire_max_val(rows, size_t(rows ? rows - 1 : 0));
+	for (size_t i = 0; i < rows; ++i) {
+		const byte* r = sorter.next();
+		assert(NULL != r);
+		size_t recId = size_t(r[8]) << 24 | size_t(r[9]) << 16 | size_t(r[10]) << 8 | r[11];
+		m_index.set_wire(i, recId);
+	}
+	assert(NULL == sorter.next());
+#if !defined(NDEBUG)
+	for(size_t i = 1; i < m_index.size(); ++i) {
+		size_t xi = m_index.get(i-1);
+		size_t yi = m_index.get(i-0);
+		size_t xk = m_keys.get(xi);
+		size_t yk = m_keys.get(yi);
+		assert(xk <= yk);
+	}
+#endif
+	buildEytzinger();
+}
+
+void ZipIntKeyIndex::buildEytzinger() {
+	size_t rows = m_index.size();
+	m_eytz.clear();
+	m_eytzLevels = 0;
+	m_eytzShift = EytzingerLayout::sampleShift(rows);
+	if (m_eytzShift < 0) {
+		return;
+	}
+	m_eytzLevels = EytzingerLayout::levels(rows, m_eytzShift);
+	m_eytz.resize_no_init(EytzingerLayout::slots(m_eytzLevels));
+	uint64_t* a = m_eytz.data();
+	a[0] = 0; // unused
+	EytzingerLayout::build(rows, m_eytzShift, m_eytzLevels,
+		[&](size_t k, size_t pos) { a[k] = m_keys.get(m_index.get(pos)); },
+		[a](size_t k) { a[k] = UINT64_MAX; });
 }
 
 namespace {
@@ -361,7 +491,7 @@ namespace {
 		uint8_t  keyBits;
 		uint8_t  keyType;
 		uint8_t  isUnique;
-		uint8_t  padding;
+		uint8_t  eytzShift; // EytzingerLayout sample shift + 1, 0 for none
 		 int64_t minKey;
 	};
 	BOOST_STATIC_ASSERT(sizeof(Header) == 16);
@@ -378,6 +508,13 @@ void ZipIntKeyIndex::load(PathRef path) {
 	size_t indexBits = h->rows <= 1 ? 0 : terark_bsr_u64(h->rows - 1) + 1;
 	m_keys .risk_set_data((byte*)(h+1)                    , h->rows, h->keyBits);
 	m_index.risk_set_data((byte*)(h+1) + m_keys.mem_size(), h->rows,  indexBits);
+	if (h->eytzShift) {
+		byte* eytz = (byte*)(h+1) + m_keys.mem_size() + m_index.mem_size();
+		m_eytzShift  = h->eytzShift - 1;
+		m_eytzLevels = EytzingerLayout::levels(h->rows, m_eytzShift);
+		m_eytz.risk_set_data((uint64_t*)eytz, EytzingerLayout::slots(m_eytzLevels));
+		assert(eytz + m_eytz.used_mem_size() <= m_mmapBase + m_mmapSize);
+	}
 }
 
 void ZipIntKeyIndex::save(PathRef path) const {
@@ -389,11 +526,12 @@ void ZipIntKeyIndex::save(PathRef path) const {
 	h.keyBits  = m_keys.uintbits();
 	h.keyType  = uint8_t(m_keyType);
 	h.isUnique = m_isUnique;
-	h.padding  = 0;
+	h.eytzShift= uint8_t(m_eytz.empty() ? 0 : m_eytzShift + 1);
 	h.minKey   = m_minKey;
 	dio.ensureWrite(&h, sizeof(h));
 	dio.ensureWrite(m_keys .data(), m_keys .mem_size());
 	dio.ensureWrite(m_index.data(), m_index.mem_size());
+	dio.ensureWrite(m_eytz .data(), m_eytz .used_mem_size());
 }
 
 class ZipIntKeyIndex::MyIndexIterForward : public IndexIterator {
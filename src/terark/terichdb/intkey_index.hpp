@@ -20,6 +20,7 @@ public:
 
 	IndexIterator* createIndexIterForward(DbContext*) const override;
 	IndexIterator* createIndexIterBackward(DbContext*) const override;
+	llong searchLowerBoundRank(fstring key) const override;
 
 	ReadableIndex* getReadableIndex() override;
 	ReadableStore* getReadableStore() override;
@@ -32,6 +33,14 @@ public:
 	StoreIterator* createStoreIterBackward(DbContext*) const override;
 
 	void build(ColumnType keyType, SortableStrVec& strVec);
+	///@param keys fixed len keys in recId order, such as mmap of a temp file
+	/// the index is sorted by FixedLenExtSorter with at most maxMem memory
+	void build(ColumnType keyType, const byte* keys, size_t rows,
+			   size_t maxMem, PathRef tmpDir);
+	///@param sortedIds recIds in (key, recId) order, such as merged from
+	/// sorted indices, keys are not sorted again
+	void buildSorted(ColumnType keyType, SortableStrVec& strVec,
+					 const valvec<uint32_t>& sortedIds);
 	void load(PathRef path) override;
 	void save(PathRef path) const override;
 
@@ -42,8 +51,15 @@ protected:
 	size_t      m_mmapSize;
 	llong       m_minKey; // may be unsigned
 	ColumnType  m_keyType;
+	int         m_eytzShift;  // -1 if no Eytzinger layer
+	size_t      m_eytzLevels;
+	valvec<uint64_t> m_eytz;  // sampled zipped keys, see EytzingerLayout
 	const Schema& m_schema;
 
+	void buildEytzinger();
+	void narrowLowerBound(ullong key, size_t* lo, size_t* hi) const;
+	void narrowUpperBound(ullong key, size_t* lo, size_t* hi) const;
+
 	template<class Int>
 	size_t IntVecLowerBound(fstring binkey) const;
 	size_t searchLowerBound(fstring binkey) const;
@@ -61,6 +77,7 @@ protected:
 
 	template<class Int>
 	void zipKeys(const void* data, size_t size);
+	void zipStrVec(ColumnType keyType, SortableStrVec& strVec);
 
 	class MyIndexIterForward;  friend class MyIndexIterForward;
 	class MyIndexIterBackward; friend class MyIndexIterBackward;
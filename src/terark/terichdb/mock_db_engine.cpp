@@ -344,6 +344,19 @@ MockReadonlyIndex::build(SortableStrVec& keys) {
 	m_fixedLen = fixlen;
 }
 
+// keys are fixed length and in recId order
+void
+MockReadonlyIndex::buildSorted(SortableStrVec& keys,
+							   const valvec<uint32_t>& sortedIds) {
+	size_t fixlen = m_schema->getFixedRowLen();
+	assert(fixlen > 0);
+	assert(keys.m_index.size() == 0);
+	assert(keys.str_size() == fixlen * sortedIds.size());
+	m_keys.strpool.swap((valvec<char>&)keys.m_strpool);
+	m_ids = sortedIds;
+	m_fixedLen = fixlen;
+}
+
 void MockReadonlyIndex::save(PathRef fpath) const {
 	FileStream fp(fpath.string().c_str(), "wb");
 	fp.disbuf();
@@ -594,14 +607,18 @@ llong MockWritableStore::append(fstring row, DbContext*) {
 	return id;
 }
 
+// id may be greater than m_rows.size(), in concurrent insertions, or
+// in DbTable::insertRows, which inserts rows in key order
 void MockWritableStore::update(llong id, fstring row, DbContext* ctx) {
 	assert(id >= 0);
-	assert(id <= llong(m_rows.size()));
 	if (llong(m_rows.size()) == id) {
 		append(row, ctx);
 		return;
 	}
 	SpinRwLock lock(m_rwMutex, true);
+	if (llong(m_rows.size()) < id) {
+		m_rows.resize(size_t(id + 1));
+	}
 	size_t oldsize = m_rows[id].size();
 	m_rows[id].assign(row);
 	m_dataSize -= oldsize;
@@ -874,6 +891,25 @@ const {
 	return index.release();
 }
 
+ReadableIndex*
+MockReadonlySegment::buildIndexByExtSort(const Schema&, ReadableStore*, PathRef)
+const {
+	return NULL; // always use MockReadonlyIndex
+}
+
+ReadableIndex*
+MockReadonlySegment::buildIndexSorted(const Schema& schema, SortableStrVec& keys,
+									  const valvec<uint32_t>& sortedIds)
+const {
+	std::unique_ptr<MockReadonlyIndex> index(new MockReadonlyIndex(schema));
+	index->buildSorted(keys, sortedIds);
+	return index.release();
+}
+
+bool MockReadonlySegment::canBuildIndexSorted(const Schema& schema) const {
+	return schema.getFixedRowLen() != 0; // as ReadonlySegment
+}
+
 ReadableStore*
 MockReadonlySegment::buildStore(const Schema& schema, SortableStrVec& storeData)
 const {
@@ -44,6 +44,7 @@ public:
 	~MockReadonlyIndex();
 
 	void build(SortableStrVec& indexData);
+	void buildSorted(SortableStrVec& keys, const valvec<uint32_t>& sortedIds);
 
 	void save(PathRef) const override;
 	void load(PathRef) override;
@@ -131,6 +132,9 @@ protected:
 	ReadableIndex* openIndex(const Schema&, PathRef path) const override;
 
 	ReadableIndex* buildIndex(const Schema&, SortableStrVec& indexData) const override;
+	ReadableIndex* buildIndexByExtSort(const Schema&, ReadableStore* keyStore, PathRef tmpDir) const override;
+	ReadableIndex* buildIndexSorted(const Schema&, SortableStrVec& keys, const valvec<uint32_t>& sortedIds) const override;
+	bool canBuildIndexSorted(const Schema&) const override;
 	ReadableStore* buildStore(const Schema&, SortableStrVec& storeData) const override;
 	ReadableStore* buildDictZipStore(const Schema&, PathRef, StoreIterator& iter,
 					  const bm_uint_t* isDel, const febitvec* isPurged) const override;
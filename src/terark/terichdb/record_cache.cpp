@@ -0,0 +1,172 @@
+#include "record_cache.hpp"
+#include <terark/fstring.hpp>
+#include <unordered_map>
+#include <memory>
+#include <string.h>
+
+namespace terark { namespace terichdb {
+
+struct RecordCacheKey {
+	ullong segId;
+	size_t physicId;
+	size_t cgId;
+	bool operator==(const RecordCacheKey& y) const {
+		return segId == y.segId && physicId == y.physicId && cgId == y.cgId;
+	}
+};
+
+struct RecordCache::Entry {
+	Entry* prev;
+	Entry* next;
+	RecordCacheKey key;
+	valvec<byte> data;
+	size_t charge() const { return sizeof(Entry) + data.size(); }
+};
+
+struct RecordCache::Shard {
+	struct KeyHash {
+		size_t operator()(const RecordCacheKey& k) const {
+			return size_t(RecordCache::hashKey(k.segId, k.cgId, k.physicId));
+		}
+	};
+	std::mutex mutex;
+	std::unordered_map<RecordCacheKey, Entry*, KeyHash> map;
+	Entry  lru; // sentinel, lru.next is the most recently used
+	size_t usedBytes = 0;
+	ullong hits = 0, misses = 0, inserts = 0, evicts = 0;
+
+	Shard() { lru.prev = lru.next = &lru; }
+	~Shard() {
+		for (auto& kv : map) delete kv.second;
+	}
+	void unlink(Entry* e) {
+		e->prev->next = e->next;
+		e->next->prev = e->prev;
+	}
+	void pushFront(Entry* e) {
+		e->next = lru.next;
+		e->prev = &lru;
+		lru.next->prev = e;
+		lru.next = e;
+	}
+	void erase(Entry* e) {
+		unlink(e);
+		map.erase(e->key);
+		usedBytes -= e->charge();
+		delete e;
+	}
+};
+
+RecordCache& RecordCache::instance() {
+	static RecordCache cache(size_t(getEnvLong("TerichDB_RecordCacheBytes", 64L << 20)));
+	return cache;
+}
+
+ullong RecordCache::newSegmentId() {
+	static std::atomic<ullong> g_segId(0);
+	return ++g_segId; // 0 is reserved for not cached
+}
+
+ullong RecordCache::hashKey(ullong segId, size_t cgId, size_t physicId) {
+	ullong h = segId * 0x9E3779B97F4A7C15ULL;
+	h ^= (ullong(physicId) << 8 | cgId) + 0xc6a4a7935bd1e995ULL + (h << 6) + (h >> 2);
+	h ^= h >> 29; h *= 0xbf58476d1ce4e5b9ULL; h ^= h >> 32;
+	return h;
+}
+
+RecordCache::Shard* RecordCache::getShard(ullong hash) const {
+	return m_shards + hash % ShardNum;
+}
+
+RecordCache::RecordCache(size_t capacityBytes) {
+	m_shards = new Shard[ShardNum];
+	m_shardCapacity = capacityBytes / ShardNum;
+}
+
+RecordCache::~RecordCache() {
+	delete[] m_shards;
+}
+
+bool
+RecordCache::getAppend(ullong segId, size_t cgId, size_t physicId, valvec<byte>* val) {
+	RecordCacheKey key = { segId, physicId, cgId };
+	Shard& shard = *getShard(hashKey(segId, cgId, physicId));
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	auto iter = shard.map.find(key);
+	if (shard.map.end() == iter) {
+		shard.misses++;
+		return false;
+	}
+	Entry* e = iter->second;
+	shard.unlink(e);
+	shard.pushFront(e);
+	shard.hits++;
+	val->append(e->data.data(), e->data.size());
+	return true;
+}
+
+void RecordCache::put(ullong segId, size_t cgId, size_t physicId, fstring val) {
+	size_t capacity = m_shardCapacity.load(std::memory_order_relaxed);
+	if (sizeof(Entry) + val.size() > capacity / 8) {
+		return; // too large for the shard, don't flush others
+	}
+	ullong hash = hashKey(segId, cgId, physicId);
+	std::unique_ptr<Entry> e(new Entry());
+	e->key = RecordCacheKey{ segId, physicId, cgId };
+	e->data.assign(val.udata(), val.size());
+	Shard& shard = *getShard(hash);
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	auto ib = shard.map.emplace(e->key, e.get());
+	if (!ib.second) {
+		return; // inserted by another thread
+	}
+	shard.pushFront(e.get());
+	shard.usedBytes += e->charge();
+	shard.inserts++;
+	e.release();
+	evictNoLock(shard, capacity);
+}
+
+void RecordCache::evictNoLock(Shard& shard, size_t capacity) {
+	while (shard.usedBytes > capacity && shard.lru.prev != &shard.lru) {
+		shard.erase(shard.lru.prev);
+		shard.evicts++;
+	}
+}
+
+void RecordCache::setCapacity(size_t capacityBytes) {
+	size_t capacity = capacityBytes / ShardNum;
+	m_shardCapacity = capacity;
+	for (size_t i = 0; i < ShardNum; ++i) {
+		Shard& shard = m_shards[i];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		evictNoLock(shard, capacity);
+	}
+}
+
+bool RecordCache::growCapacity(size_t capacityBytes) {
+	size_t capacity = capacityBytes / ShardNum;
+	size_t old = m_shardCapacity.load();
+	while (old < capacity) {
+		if (m_shardCapacity.compare_exchange_weak(old, capacity))
+			return true;
+	}
+	return false;
+}
+
+void RecordCache::getStat(Stat* st) const {
+	memset(st, 0, sizeof(*st));
+	for (size_t i = 0; i < ShardNum; ++i) {
+		Shard& shard = m_shards[i];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		st->hits += shard.hits;
+		st->misses += shard.misses;
+		st->inserts += shard.inserts;
+		st->evicts += shard.evicts;
+		st->usedBytes += shard.usedBytes;
+		st->entries += shard.map.size();
+	}
+	st->capacityBytes = capacity();
+}
+
+} } // namespace terark::terichdb
@@ -0,0 +1,63 @@
+#ifndef __terichdb_record_cache_hpp__
+#define __terichdb_record_cache_hpp__
+
+#include "db_store.hpp"
+#include <atomic>
+#include <mutex>
+
+namespace terark { namespace terichdb {
+
+// Process wide cache of decompressed colgroup records of ReadonlySegment,
+// keyed by (segment, physicId, colgroup). Each segment object gets a unique
+// segId which is never reused, so merged or purged segments never hit
+// records of old segments, records of closed segments just age out.
+// Scans don't fill the cache, see DbContext::noRecordCacheFill.
+// Sharded LRU, each shard has its own mutex and 1/ShardNum of the budget.
+// The budget is set by env TerichDB_RecordCacheBytes, 0 to disable.
+class TERICHDB_DLL RecordCache {
+	TERICHDB_NON_COPYABLE_CLASS(RecordCache);
+public:
+	struct Stat {
+		ullong hits;
+		ullong misses;
+		ullong inserts;
+		ullong evicts;
+		size_t usedBytes;
+		size_t capacityBytes;
+		size_t entries;
+	};
+	static RecordCache& instance();
+	static ullong newSegmentId();
+
+	explicit RecordCache(size_t capacityBytes);
+	~RecordCache();
+
+	bool enabled() const { return m_shardCapacity != 0; }
+
+	///@returns true and val is appended on hit
+	bool getAppend(ullong segId, size_t cgId, size_t physicId, valvec<byte>* val);
+	void put(ullong segId, size_t cgId, size_t physicId, fstring val);
+
+	void setCapacity(size_t capacityBytes);
+	///@returns true if capacity was grown, never shrinks or evicts, for
+	///         users sharing the process wide instance, such as each DB::Open
+	bool growCapacity(size_t capacityBytes);
+	size_t capacity() const { return m_shardCapacity * ShardNum; }
+	void getStat(Stat*) const;
+
+	static const size_t ShardNum = 64;
+
+private:
+	struct Entry;
+	struct Shard;
+	Shard* getShard(ullong hash) const;
+	static ullong hashKey(ullong segId, size_t cgId, size_t physicId);
+	void evictNoLock(Shard&, size_t capacity);
+
+	Shard* m_shards;
+	std::atomic_size_t m_shardCapacity;
+};
+
+} } // namespace terark::terichdb
+
+#endif // __terichdb_record_cache_hpp__
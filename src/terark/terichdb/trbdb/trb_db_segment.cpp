@@ -13,11 +13,21 @@
 #include <boost/thread/mutex.hpp>
 #include <boost/optional.hpp>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
 #include <tbb/queuing_mutex.h>
 #include <terark/io/MemStream.hpp>
 #include <terark/util/mmap.hpp>
 #include <algorithm>
 
+#if defined(_MSC_VER)
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
 #undef min
 #undef max
 
@@ -141,16 +151,147 @@ private:
         m_logSize += size;
         m_totalLogSize += size;
 
+        if(m_groupCommit)
+        {
+            groupCommit(ctx->syncOnCommit, buffer.buf(), size);
+            return;
+        }
         lock_t l(m_mutex);
         m_fp.write(buffer.buf(), size);
         if(ctx->syncOnCommit)
         {
+            // flush only, no fsync: weaker than group commit, which fsyncs
+            // each batch, see TrbLogStat in trb_db_segment.hpp
             m_fp.flush();
         }
     }
 
     typedef tbb::queuing_mutex mutex_t;
     typedef mutex_t::scoped_lock lock_t;
+    typedef std::chrono::steady_clock gc_clock_t;
+
+    /**
+     * group commit: writers append records into m_gcBuf, one of them becomes
+     * the leader, writes the whole batch and syncs it if any record in the
+     * batch requires sync, followers just wait for the leader.
+     * a failed write is sticky: every record of the failed batch and all
+     * later records fail with the same error, since the log has a gap
+     */
+    void groupCommit(bool sync, byte const *data, size_t size)
+    {
+        auto start = gc_clock_t::now();
+        std::unique_lock<std::mutex> l(m_gcMutex);
+        if(m_gcError)
+        {
+            std::rethrow_exception(m_gcError);
+        }
+        m_gcBuf.append(data, size);
+        uint64_t ticket = ++m_gcAppendSeq;
+        if(!sync)
+        {
+            // async record will be written by current leader or by me
+            if(!m_gcLeaderActive)
+            {
+                gcLead(l);
+            }
+            return;
+        }
+        m_gcNeedSync = true;
+        gcWaitFor(l, ticket);
+        uint64_t latency = std::chrono::duration_cast<std::chrono::microseconds>(
+            gc_clock_t::now() - start).count();
+        m_stat.syncCommitNum++;
+        m_stat.totalCommitLatencyUsec += latency;
+        m_stat.maxCommitLatencyUsec = std::max(m_stat.maxCommitLatencyUsec, latency);
+    }
+    void gcWaitFor(std::unique_lock<std::mutex> &l, uint64_t ticket)
+    {
+        ++m_gcWaiters;
+        while(m_gcDoneSeq < ticket)
+        {
+            if(!m_gcLeaderActive)
+            {
+                --m_gcWaiters;
+                gcLead(l);
+                ++m_gcWaiters;
+            }
+            else
+            {
+                m_gcCond.wait(l);
+            }
+        }
+        --m_gcWaiters;
+        if(m_gcError && ticket > m_gcDurableSeq)
+        {
+            std::rethrow_exception(m_gcError);
+        }
+    }
+    // m_gcMutex is locked on enter and on leave
+    void gcLead(std::unique_lock<std::mutex> &l)
+    {
+        assert(!m_gcLeaderActive);
+        m_gcLeaderActive = true;
+        if(m_gcNeedSync && m_gcMaxDelay.count() > 0)
+        {
+            // give other writers a chance to join this batch
+            auto deadline = gc_clock_t::now() + m_gcMaxDelay;
+            while(gc_clock_t::now() < deadline)
+            {
+                m_gcCond.wait_until(l, deadline);
+            }
+        }
+        valvec<byte> batch;
+        do
+        {
+            batch.swap(m_gcBuf);
+            uint64_t batchEnd = m_gcAppendSeq;
+            uint64_t records = batchEnd - m_gcDoneSeq;
+            bool needSync = m_gcNeedSync;
+            m_gcNeedSync = false;
+            l.unlock();
+            try
+            {
+                lock_t fl(m_mutex);
+                m_fp.write(batch.data(), batch.size());
+                if(needSync)
+                {
+                    syncFile();
+                }
+            }
+            catch(...)
+            {
+                l.lock();
+                // fail this batch and the records appended meanwhile
+                m_gcError = std::current_exception();
+                m_gcDoneSeq = m_gcAppendSeq;
+                m_gcBuf.erase_all();
+                m_gcLeaderActive = false;
+                m_gcCond.notify_all();
+                throw;
+            }
+            l.lock();
+            m_gcDoneSeq = batchEnd;
+            m_gcDurableSeq = batchEnd;
+            m_stat.batchNum++;
+            m_stat.batchRecords += records;
+            m_stat.maxBatchRecords = std::max(m_stat.maxBatchRecords, records);
+            batch.erase_all();
+            m_gcCond.notify_all();
+            // async records appended meanwhile may have no waiter which
+            // would lead, so write until the buffer is empty
+        } while(!m_gcBuf.empty());
+        m_gcLeaderActive = false;
+        m_gcCond.notify_all();
+    }
+    void syncFile()
+    {
+        m_fp.flush();
+#if defined(_MSC_VER)
+        _commit(_fileno(m_fp.fp()));
+#else
+        fsync(fileno(m_fp.fp()));
+#endif
+    }
 
 public:
     struct Param
@@ -172,15 +313,47 @@ private:
     size_t m_logCount;  // we don't care add check point later
     std::atomic<uint64_t> m_totalLogSize;   //togal log size
 
+    // group commit
+    bool m_groupCommit;
+    bool m_gcLeaderActive;
+    bool m_gcNeedSync;
+    size_t m_gcWaiters;
+    uint64_t m_gcAppendSeq;
+    uint64_t m_gcDoneSeq;    // written or failed
+    uint64_t m_gcDurableSeq; // written successfully
+    std::exception_ptr m_gcError;
+    valvec<byte> m_gcBuf;
+    std::mutex m_gcMutex;
+    std::condition_variable m_gcCond;
+    std::chrono::microseconds m_gcMaxDelay;
+    TrbLogStat m_stat; // protected by m_gcMutex
+
 public:
     TrbLogger() : m_seed(), m_logSize(), m_logCount(), m_totalLogSize{0}
     {
+        m_groupCommit = getEnvBool("TerichDB_TrbLogGroupCommit", false);
+        m_gcMaxDelay = std::chrono::microseconds(
+            std::max(0L, getEnvLong("TerichDB_TrbLogGroupCommitDelayUsec", 0)));
+        m_gcLeaderActive = false;
+        m_gcNeedSync = false;
+        m_gcWaiters = 0;
+        m_gcAppendSeq = 0;
+        m_gcDoneSeq = 0;
+        m_gcDurableSeq = 0;
+        memset(&m_stat, 0, sizeof m_stat);
     }
     ~TrbLogger()
     {
         if(m_fp.isOpen())
         {
-            m_fp.flush();
+            try
+            {
+                flush();
+            }
+            catch(const std::exception &ex)
+            {
+                fprintf(stderr, "ERROR: TrbLogger flush on close: %s\n", ex.what());
+            }
             m_fp.close();
         }
     }
@@ -189,6 +362,11 @@ public:
     {
         return m_totalLogSize;
     }
+    void getStat(TrbLogStat *stat)
+    {
+        std::lock_guard<std::mutex> l(m_gcMutex);
+        *stat = m_stat;
+    }
 
     void initCallback(Param p)
     {
@@ -205,6 +383,11 @@ public:
     void flush()
     {
         assert(m_fp.isOpen());
+        if(m_groupCommit)
+        {
+            std::unique_lock<std::mutex> l(m_gcMutex);
+            gcWaitFor(l, m_gcAppendSeq);
+        }
         lock_t l(m_mutex);
         m_fp.flush();
     }
@@ -956,6 +1139,11 @@ void TrbColgroupSegment::loadRecordStore(PathRef segDir)
     }
 }
 
+void TrbColgroupSegment::getLogStat(TrbLogStat *stat) const
+{
+    m_logger->getStat(stat);
+}
+
 llong TrbColgroupSegment::dataStorageSize() const
 {
     return m_logger->logSize();
@@ -27,6 +27,25 @@ struct TrbMemoryFullException
 {
 };
 
+// counters of TrbLogger group commit
+// enable group commit by env TerichDB_TrbLogGroupCommit=1
+// max batch delay is env TerichDB_TrbLogGroupCommitDelayUsec
+// the env also changes what DbContext::syncOnCommit guarantees:
+//   - group commit off (default): the record is flushed to the OS by
+//     fflush, it survives a process crash but not an OS crash or power loss
+//   - group commit on: the batch holding the record is fsync'ed before the
+//     write returns, it survives an OS crash and power loss, the cost of
+//     fsync is shared by the records of the batch
+struct TrbLogStat
+{
+    uint64_t batchNum;              // num of batches written by leaders
+    uint64_t batchRecords;          // num of records in all batches
+    uint64_t maxBatchRecords;
+    uint64_t syncCommitNum;         // num of records waited for sync
+    uint64_t totalCommitLatencyUsec;
+    uint64_t maxCommitLatencyUsec;
+};
+
 struct TrbRWRowMutex : boost::noncopyable
 {
 private:
@@ -127,6 +146,8 @@ public:
 
     llong dataStorageSize() const override;
     llong totalStorageSize() const override;
+
+    void getLogStat(TrbLogStat *) const;
 };
 
 }}} // namespace terark::terichdb::wt
@@ -37,6 +37,9 @@
 	assert(recordId < m_rowNumVec.back());
 	size_t upp = upper_bound_a(m_rowNumVec, recordId);
 	assert(upp < m_rowNumVec.size());
+	if (terark_unlikely(0 == upp)) { // dropped by dropOldSegments
+		throw ReadDeletedRecordException(m_dir.string(), 0, recordId);
+	}
 	llong baseId = m_rowNumVec[upp-1];
 	llong subId = recordId - baseId;
 	auto seg = m_segments[upp-1].get();
@@ -89,6 +89,116 @@ void ZipIntStore::getValueAppend(llong id, valvec<byte>* val, DbContext*) const
 	}
 }
 
+// map an int value of m_intType to ullong with the same order,
+// the difference of keys is the same as the difference of values
+ullong ZipIntStore::intKeyOf(fstring val) const {
+	const ullong signBit = ullong(1) << 63;
+	auto checkSize = [&](size_t size) {
+		if (val.size() != size) {
+			THROW_STD(invalid_argument, "val.size = %zd, intType = %s"
+				, val.size(), Schema::columnTypeStr(m_intType));
+		}
+	};
+	switch (m_intType) {
+	default:
+		THROW_STD(invalid_argument, "Bad m_intType=%s", Schema::columnTypeStr(m_intType));
+	case ColumnType::Sint08: checkSize(1); return ullong(llong(unaligned_load< int8_t >(val.udata()))) ^ signBit;
+	case ColumnType::Uint08: checkSize(1); return ullong(unaligned_load<uint8_t >(val.udata()));
+	case ColumnType::Sint16: checkSize(2); return ullong(llong(unaligned_load< int16_t>(val.udata()))) ^ signBit;
+	case ColumnType::Uint16: checkSize(2); return ullong(unaligned_load<uint16_t>(val.udata()));
+	case ColumnType::Sint32: checkSize(4); return ullong(llong(unaligned_load< int32_t>(val.udata()))) ^ signBit;
+	case ColumnType::Uint32: checkSize(4); return ullong(unaligned_load<uint32_t>(val.udata()));
+	case ColumnType::Sint64: checkSize(8); return ullong(unaligned_load< int64_t>(val.udata())) ^ signBit;
+	case ColumnType::Uint64: checkSize(8); return ullong(unaligned_load<uint64_t>(val.udata()));
+	case ColumnType::VarSint: {
+		const byte* end = NULL;
+		llong x = load_var_int64(val.udata(), &end);
+		if (end != val.udata() + val.size()) {
+			THROW_STD(invalid_argument, "bad VarSint, val.size = %zd", val.size());
+		}
+		return ullong(x) ^ signBit; }
+	case ColumnType::VarUint: {
+		const byte* end = NULL;
+		ullong x = load_var_uint64(val.udata(), &end);
+		if (end != val.udata() + val.size()) {
+			THROW_STD(invalid_argument, "bad VarUint, val.size = %zd", val.size());
+		}
+		return x; }
+	}
+}
+
+// set bits for values in [lo, hi] of the bit packed vector, unpacking
+// WordBits values per bitmap word, the range check is branch free
+static void
+filterPackedUint(const UintVecMin0& vec, ullong lo, ullong hi, bm_uint_t* bits) {
+	const byte*  data = vec.data();
+	const size_t uintbits = vec.uintbits();
+	const size_t mask = vec.uintmask();
+	const size_t rows = vec.size();
+	const ullong width = hi - lo;
+	size_t i = 0;
+	for (; i + WordBits <= rows; i += WordBits) {
+		bm_uint_t w = 0;
+		for (size_t j = 0; j < WordBits; ++j) {
+			ullong x = UintVecMin0::fast_get(data, uintbits, mask, i + j);
+			w |= bm_uint_t(x - lo <= width) << j;
+		}
+		bits[i / WordBits] = w;
+	}
+	if (i < rows) {
+		bm_uint_t w = 0;
+		for (size_t j = 0; i + j < rows; ++j) {
+			ullong x = UintVecMin0::fast_get(data, uintbits, mask, i + j);
+			w |= bm_uint_t(x - lo <= width) << j;
+		}
+		bits[i / WordBits] = w;
+	}
+}
+
+bool ZipIntStore::filterRange(const fstring* lo, const fstring* hi,
+							  febitvec* bitmap) const {
+	const ullong signBit = ullong(1) << 63;
+	const bool isSigned =
+		ColumnType::Sint08 == m_intType || ColumnType::Sint16 == m_intType ||
+		ColumnType::Sint32 == m_intType || ColumnType::Sint64 == m_intType ||
+		ColumnType::VarSint == m_intType;
+	ullong minKey = isSigned ? ullong(m_minValue) ^ signBit : ullong(m_minValue);
+	ullong loKey = lo ? intKeyOf(*lo) : 0;
+	ullong hiKey = hi ? intKeyOf(*hi) : ullong(-1);
+	size_t rows = size_t(numDataRows());
+	bitmap->erase_all();
+	bitmap->resize(rows, false);
+	if (0 == rows || loKey > hiKey || hiKey < minKey) {
+		return true;
+	}
+	// values are stored as offsets from m_minValue
+	ullong loOff = loKey > minKey ? loKey - minKey : 0;
+	ullong hiOff = hiKey - minKey;
+	if (m_index.size()) {
+		// m_dedup is sorted, filter on the dedup index
+		size_t lower = 0, upper = m_dedup.size();
+		while (lower < upper) {
+			size_t mid = (lower + upper) / 2;
+			if (m_dedup.get(mid) < loOff) lower = mid + 1;
+			else upper = mid;
+		}
+		size_t loIdx = lower;
+		upper = m_dedup.size();
+		while (lower < upper) {
+			size_t mid = (lower + upper) / 2;
+			if (m_dedup.get(mid) <= hiOff) lower = mid + 1;
+			else upper = mid;
+		}
+		if (loIdx < lower) {
+			filterPackedUint(m_index, loIdx, lower - 1, bitmap->bldata());
+		}
+	}
+	else {
+		filterPackedUint(m_dedup, loOff, hiOff, bitmap->bldata());
+	}
+	return true;
+}
+
 StoreIterator* ZipIntStore::createStoreIterForward(DbContext*) const {
 	return nullptr; // not needed
 }
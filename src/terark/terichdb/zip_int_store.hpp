@@ -16,6 +16,7 @@ public:
 	llong dataInflateSize() const override;
 	llong numDataRows() const override;
 	void getValueAppend(llong id, valvec<byte>* val, DbContext*) const override;
+	bool filterRange(const fstring* lo, const fstring* hi, febitvec*) const override;
 	StoreIterator* createStoreIterForward(DbContext*) const override;
 	StoreIterator* createStoreIterBackward(DbContext*) const override;
 
@@ -35,6 +36,8 @@ protected:
 	template<class Int>
 	void valueAppend(size_t recIdx, valvec<byte>* res) const;
 
+	ullong intKeyOf(fstring val) const;
+
 	template<class Int>
 	void zipValues(const void* data, size_t size);
 };
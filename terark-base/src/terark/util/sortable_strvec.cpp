@@ -6,6 +6,9 @@
 #include <parallel/algorithm>
 #define parallel_sort __gnu_parallel::sort
 #endif
+#include <atomic>
+#include <thread>
+#include <vector>
 
 // memcpy on gcc-4.9+ linux fails on some corner case
 //
@@ -21,6 +24,258 @@
 
 namespace terark {
 
+#ifdef _MSC_VER
+    #define QSortCtx qsort_s
+#else
+    #define QSortCtx qsort_r
+#endif
+
+#ifdef _MSC_VER
+static int CmpFixLenStr(void* ctx, const void* x, const void* y)
+#else
+static int CmpFixLenStr(const void* x, const void* y, void* ctx)
+#endif
+{
+    size_t fixlen = (size_t)(ctx);
+    return memcmp(x, y, fixlen);
+}
+
+namespace {
+
+struct RadixSortJob {
+	size_t beg, end, depth;
+	size_t size() const { return end - beg; }
+};
+
+// returns 1 if n is too small for parallel sort
+static size_t RadixSortThreads(size_t n) {
+	static const size_t minNum = (size_t)getEnvLong("SortableStrVec_parallelSortMinNum", 1L<<20);
+	static const size_t threads = (size_t)getEnvLong("SortableStrVec_sortThreads", 8);
+	if (n < minNum) {
+		return 1;
+	}
+	size_t cpus = std::thread::hardware_concurrency();
+	return std::max<size_t>(1, std::min(threads, cpus ? cpus : 1));
+}
+
+// Sorter::split(job, &jobs) distributes job by one byte and pushes sub jobs,
+// Sorter::sortRange(job) sorts job to the end.
+// Buckets of different top level jobs are disjoint, so they are sorted by
+// threads without any lock.
+template<class Sorter>
+static void ParallelRadixSort(Sorter& sorter, size_t n, size_t threads) {
+	if (threads <= 1) {
+		sorter.sortRange(RadixSortJob{0, n, 0});
+		return;
+	}
+	auto bySizeDesc = [](const RadixSortJob& x, const RadixSortJob& y) {
+		return x.size() > y.size();
+	};
+	valvec<RadixSortJob> jobs, sub;
+	sorter.split(RadixSortJob{0, n, 0}, &jobs);
+	// split large buckets again for load balance
+	for (size_t loop = 0; loop < 64 && jobs.size(); ++loop) {
+		std::sort(jobs.begin(), jobs.end(), bySizeDesc);
+		if (jobs[0].size() * 2 * threads <= n ||
+			jobs[0].size() < Sorter::SmallBucket) {
+			break;
+		}
+		RadixSortJob big = jobs[0];
+		jobs.erase_i(0, 1);
+		sub.erase_all();
+		sorter.split(big, &sub);
+		jobs.append(sub.begin(), sub.end());
+	}
+	std::sort(jobs.begin(), jobs.end(), bySizeDesc);
+	std::atomic_size_t next(0);
+	auto worker = [&]() {
+		for (size_t j; (j = next++) < jobs.size(); ) {
+			sorter.sortRange(jobs[j]);
+		}
+	};
+	threads = std::min(threads, jobs.size());
+	std::vector<std::thread> thr;
+	for (size_t i = 1; i < threads; ++i) {
+		thr.emplace_back(worker);
+	}
+	worker();
+	for (auto& t : thr) {
+		t.join();
+	}
+}
+
+// Distributes [beg, end) to buckets in place (American flag sort),
+// key[i] is the bucket of elem i, swap(i, j) swaps elem i and elem j.
+// pos[c] is the start of bucket c on enter, and is the end on return.
+template<size_t Buckets, class Key, class Swap>
+static void RadixPermute(Key* key, size_t* pos, const size_t* cnt, Swap swap) {
+	size_t lim[Buckets];
+	for (size_t c = 0; c < Buckets; ++c) {
+		lim[c] = pos[c] + cnt[c];
+	}
+	for (size_t c = 0; c < Buckets; ++c) {
+		while (pos[c] < lim[c]) {
+			// the elem at pos[c] is moved along a cycle until an elem
+			// of bucket c is swapped to pos[c]
+			size_t i = pos[c];
+			while (key[i] != c) {
+				size_t j = pos[key[i]]++;
+				swap(i, j);
+				std::swap(key[i], key[j]);
+			}
+			pos[c]++;
+		}
+	}
+}
+
+// MSD radix sort of SortableStrVec::m_index, entries are permuted in place.
+// All strings of a job share a common prefix of job.depth bytes, which is
+// skipped: split reads just the byte at job.depth and smallSort compares
+// from job.depth. If all strings of a job have the same byte at job.depth,
+// the depth is increased without moving entries. m_cache holds the bytes
+// of current split, no LCP of strings is computed or kept.
+class StrVecRadixSorter {
+	typedef SortableStrVec::SEntry SEntry;
+	const byte_t* m_pool;
+	SEntry*       m_index;
+	uint16_t*     m_cache; // 0 for end of string, else byte + 1
+public:
+	static const size_t SmallBucket = 64;
+	StrVecRadixSorter(const byte_t* pool, SEntry* index, uint16_t* cache)
+		: m_pool(pool), m_index(index), m_cache(cache) {}
+
+	void smallSort(const RadixSortJob& job) {
+		const byte_t* pool = m_pool;
+		const size_t depth = job.depth;
+		std::sort(m_index + job.beg, m_index + job.end,
+		[pool,depth](const SEntry& x, const SEntry& y) {
+			fstring sx(pool + x.offset + depth, x.length - depth);
+			fstring sy(pool + y.offset + depth, y.length - depth);
+			return sx < sy;
+		});
+	}
+	void split(RadixSortJob job, valvec<RadixSortJob>* jobs) {
+		const byte_t* pool = m_pool;
+		const size_t  beg = job.beg, end = job.end, n = end - beg;
+		size_t cnt[257];
+		for (;;) {
+			const size_t depth = job.depth;
+			memset(cnt, 0, sizeof(cnt));
+			for (size_t i = beg; i < end; ++i) {
+				const SEntry& e = m_index[i];
+				uint16_t c = e.length > depth ? 1 + pool[e.offset + depth] : 0;
+				m_cache[i] = c;
+				cnt[c]++;
+			}
+			size_t c0 = m_cache[beg];
+			if (cnt[c0] != n) {
+				break;
+			}
+			if (0 == c0) {
+				return; // all strings are equal
+			}
+			job.depth++; // all have the same byte, no need to distribute
+		}
+		size_t pos[257];
+		pos[0] = beg;
+		for (size_t c = 1; c < 257; ++c) {
+			pos[c] = pos[c-1] + cnt[c-1];
+		}
+		SEntry* index = m_index;
+		RadixPermute<257>(m_cache, pos, cnt, [index](size_t i, size_t j) {
+			std::swap(index[i], index[j]);
+		});
+		size_t start = beg + cnt[0]; // ended strings are in final position
+		for (size_t c = 1; c < 257; ++c) {
+			if (cnt[c] > 1) {
+				jobs->push_back(RadixSortJob{start, start + cnt[c], job.depth + 1});
+			}
+			start += cnt[c];
+		}
+	}
+	void sortRange(RadixSortJob job) {
+		valvec<RadixSortJob> stack;
+		stack.push_back(job);
+		while (!stack.empty()) {
+			job = stack.pop_val();
+			if (job.size() < SmallBucket)
+				smallSort(job);
+			else
+				split(job, &stack);
+		}
+	}
+};
+
+// MSD radix sort of FixedLenStrVec rows, rows are swapped in place,
+// leading bytes which are same for all rows of a job are skipped
+class FixedLenMsdRadixSorter {
+	byte_t*   m_pool;
+	byte_t*   m_cache;
+	size_t    m_fixlen;
+public:
+	static const size_t SmallBucket = 64;
+	FixedLenMsdRadixSorter(byte_t* pool, byte_t* cache, size_t fixlen)
+		: m_pool(pool), m_cache(cache), m_fixlen(fixlen) {}
+
+	void smallSort(const RadixSortJob& job) {
+		QSortCtx(m_pool + m_fixlen * job.beg, job.size(), m_fixlen,
+				 CmpFixLenStr, (void*)(m_fixlen));
+	}
+	void split(RadixSortJob job, valvec<RadixSortJob>* jobs) {
+		const size_t fixlen = m_fixlen;
+		const size_t beg = job.beg, end = job.end, n = end - beg;
+		size_t cnt[256];
+		for (;;) {
+			if (job.depth == fixlen) {
+				return; // all rows are equal
+			}
+			const byte_t* col = m_pool + job.depth;
+			memset(cnt, 0, sizeof(cnt));
+			for (size_t i = beg; i < end; ++i) {
+				byte_t c = col[fixlen * i];
+				m_cache[i] = c;
+				cnt[c]++;
+			}
+			if (cnt[m_cache[beg]] != n) {
+				break;
+			}
+			job.depth++;
+		}
+		size_t pos[256];
+		pos[0] = beg;
+		for (size_t c = 1; c < 256; ++c) {
+			pos[c] = pos[c-1] + cnt[c-1];
+		}
+		byte_t* pool = m_pool;
+		RadixPermute<256>(m_cache, pos, cnt, [pool,fixlen](size_t i, size_t j) {
+			std::swap_ranges(pool + fixlen * i, pool + fixlen * (i + 1), pool + fixlen * j);
+		});
+		if (job.depth + 1 == fixlen) {
+			return;
+		}
+		size_t start = beg;
+		for (size_t c = 0; c < 256; ++c) {
+			if (cnt[c] > 1) {
+				jobs->push_back(RadixSortJob{start, start + cnt[c], job.depth + 1});
+			}
+			start += cnt[c];
+		}
+	}
+	void sortRange(RadixSortJob job) {
+		valvec<RadixSortJob> stack;
+		stack.push_back(job);
+		while (!stack.empty()) {
+			job = stack.pop_val();
+			if (job.size() < SmallBucket)
+				smallSort(job);
+			else
+				split(job, &stack);
+		}
+	}
+};
+
+} // namespace
+
 void SortableStrVec::reserve(size_t strNum, size_t maxStrPool) {
     m_index.reserve(strNum);
     m_strpool.reserve(maxStrPool);
@@ -107,11 +362,20 @@ void SortableStrVec::reverse_keys() {
 void SortableStrVec::sort() {
 	const byte* pool = m_strpool.data();
 	double avgLen = double(m_strpool.size()+1) / double(m_index.size() + 1);
-	double minRadixSortStrLen = UINT32_MAX; // disable radix sort by default
+	double minRadixSortStrLen = UINT32_MAX; // disable radix_sort_tpl by default
 	if (const char* env = getenv("SortableStrVec_minRadixSortStrLen")) {
 		minRadixSortStrLen = atof(env);
 	}
-	if (avgLen < minRadixSortStrLen) {
+	static const size_t minMsdNum = (size_t)getEnvLong("SortableStrVec_radixSortMinNum", 4096);
+	static const bool useMsd = getEnvBool("SortableStrVec_useRadixSort", true) &&
+							  !getEnvBool("SortableStrVec_useMergeSort", false);
+	if (avgLen < minRadixSortStrLen && m_index.size() >= minMsdNum && useMsd) {
+		size_t n = m_index.size();
+		valvec<uint16_t> cache(n, valvec_no_init());
+		StrVecRadixSorter sorter(pool, m_index.data(), cache.data());
+		ParallelRadixSort(sorter, n, RadixSortThreads(n));
+	}
+	else if (avgLen < minRadixSortStrLen) {
 		auto cmp = [pool](const SEntry& x, const SEntry& y) {
 			fstring sx(pool + x.offset, x.length);
 			fstring sy(pool + y.offset, y.length);
@@ -697,25 +961,18 @@ void FixedLenStrVec::reverse_keys() {
     }
 }
 
-#ifdef _MSC_VER
-static int CmpFixLenStr(void* ctx, const void* x, const void* y)
-#else
-static int CmpFixLenStr(const void* x, const void* y, void* ctx)
-#endif
-{
-    size_t fixlen = (size_t)(ctx);
-    return memcmp(x, y, fixlen);
-}
-
 void FixedLenStrVec::sort() {
     assert(m_fixlen * m_size == m_strpool.size());
-#ifdef _MSC_VER
-    #define QSortCtx qsort_s
-#else
-    #define QSortCtx qsort_r
-#endif
     auto d = m_strpool.data();
-    QSortCtx(d, m_size, m_fixlen, CmpFixLenStr, (void*)(m_fixlen));
+    static const size_t minNum = (size_t)getEnvLong("SortableStrVec_radixSortMinNum", 4096);
+    static const bool useMsd = getEnvBool("SortableStrVec_useRadixSort", true);
+    if (m_size < minNum || !useMsd) {
+        QSortCtx(d, m_size, m_fixlen, CmpFixLenStr, (void*)(m_fixlen));
+        return;
+    }
+    valvec<byte_t> cache(m_size, valvec_no_init());
+    FixedLenMsdRadixSorter sorter(d, cache.data(), m_fixlen);
+    ParallelRadixSort(sorter, m_size, RadixSortThreads(m_size));
 }
 
 void FixedLenStrVec::clear() {
@@ -0,0 +1,105 @@
+// SchemaPlanBench.cpp : time of parseRow, compareData and byteLexEncode/Decode
+// by the execution plan built by Schema::compile vs the interpreter
+//
+
+#include "stdafx.h"
+#include <terark/terichdb/db_conf.hpp>
+#include <terark/util/profiling.hpp>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace terark;
+using namespace terark::terichdb;
+
+static SchemaPtr makeSchema(const std::vector<ColumnType>& types, bool withPlan) {
+	SchemaPtr schema(new Schema());
+	for (size_t i = 0; i < types.size(); ++i) {
+		std::string name = "c" + std::to_string(i);
+		schema->m_columnsMeta.insert_i(name, ColumnMeta(types[i]));
+	}
+	schema->compile();
+	if (!withPlan)
+		schema->clearPlan();
+	return schema;
+}
+
+// numbers are random in [0, 4), rows share prefixes as index keys do
+static std::string makeRow(const Schema& schema, std::mt19937_64& rnd) {
+	std::string buf;
+	ColumnVec cols;
+	valvec<ColumnVec::Elem> elems;
+	for (size_t i = 0; i < schema.columnNum(); ++i) {
+		const ColumnMeta& colmeta = schema.getColumnMeta(i);
+		size_t len = colmeta.fixedLen ? colmeta.fixedLen : 8 + rnd() % 8;
+		size_t pos = buf.size();
+		buf.append(len, '\0');
+		if (colmeta.fixedLen)
+			buf[pos] = char(rnd() % 4);
+		else
+			for (size_t j = 0; j < len; ++j) buf[pos + j] = char('a' + rnd() % 4);
+		elems.push_back(ColumnVec::Elem(uint32_t(pos), uint32_t(len)));
+	}
+	cols.m_base = (const byte*)buf.data();
+	for (auto e : elems)
+		cols.push_back(e);
+	valvec<byte> row;
+	schema.combineRow(cols, &row);
+	return std::string((const char*)row.data(), row.size());
+}
+
+static void bench(const char* name, const std::vector<ColumnType>& types) {
+	const size_t rowNum = 100000;
+	const size_t loop = TERARK_IF_DEBUG(1, 20);
+	std::mt19937_64 rnd(1);
+	SchemaPtr schemas[2] = { makeSchema(types, false), makeSchema(types, true) };
+	std::vector<std::string> rows;
+	for (size_t i = 0; i < rowNum; ++i)
+		rows.push_back(makeRow(*schemas[0], rnd));
+	profiling pf;
+	printf("%s: rows = %zd, loop = %zd, avg time in ns\n", name, rowNum, loop);
+	for (int p = 0; p < 2; ++p) {
+		const Schema& schema = *schemas[p];
+		ColumnVec cols;
+		size_t sum = 0;
+		long long t0 = pf.now();
+		for (size_t l = 0; l < loop; ++l)
+			for (const std::string& row : rows) {
+				schema.parseRow(row, &cols);
+				sum += cols.size();
+			}
+		long long t1 = pf.now();
+		for (size_t l = 0; l < loop; ++l)
+			for (size_t i = 0; i + 1 < rowNum; ++i)
+				sum += schema.compareData(rows[i], rows[i+1]) < 0;
+		long long t2 = pf.now();
+		valvec<byte> buf;
+		if (schema.m_canEncodeToLexByteComparable) {
+			for (size_t l = 0; l < loop; ++l)
+				for (const std::string& row : rows) {
+					buf.assign((const byte*)row.data(), row.size());
+					schema.byteLexEncode(buf);
+					schema.byteLexDecode(buf);
+					sum += buf[0];
+				}
+		}
+		long long t3 = pf.now();
+		size_t num = loop * rowNum;
+		printf("  %-9s parseRow %7.2f, compareData %7.2f, lexEncodeDecode %7.2f (sum = %zd)\n",
+			p ? "plan" : "interpret", pf.nf(t0,t1)/num, pf.nf(t1,t2)/num, pf.nf(t2,t3)/num, sum);
+	}
+}
+
+int main(int argc, char* argv[]) {
+	bench("Sint32,Uint64,Float64", {
+		ColumnType::Sint32, ColumnType::Uint64, ColumnType::Float64,
+	});
+	bench("Uint64,Sint64,StrZero,Binary", {
+		ColumnType::Uint64, ColumnType::Sint64, ColumnType::StrZero, ColumnType::Binary,
+	});
+	bench("Uint08,Uuid", { ColumnType::Uint08, ColumnType::Uuid });
+	bench("Binary", { ColumnType::Binary });
+	return 0;
+}
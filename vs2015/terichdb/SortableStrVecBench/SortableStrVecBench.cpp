@@ -0,0 +1,82 @@
+// SortableStrVecBench.cpp : time of SortableStrVec::sort and
+// FixedLenStrVec::sort vs std::sort on the same strings
+//
+// usage: SortableStrVecBench [num]
+
+#include "stdafx.h"
+#include <terark/util/sortable_strvec.hpp>
+#include <terark/util/profiling.hpp>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace terark;
+
+static std::string makeStr(std::mt19937_64& rnd, int kind, size_t fixlen) {
+	std::string s;
+	switch (kind) {
+	default: // random
+		s.resize(fixlen ? fixlen : 8 + rnd() % 24);
+		for (char& c : s) c = char(rnd());
+		break;
+	case 1: // duplicate heavy
+		s = std::to_string(rnd() % 1000);
+		s.resize(fixlen ? fixlen : s.size() + 8, 'd');
+		break;
+	case 2: // shared prefix, like urls or composite keys
+		s = "http://www.example.com/path/";
+		s += std::to_string(rnd() % 100000);
+		if (fixlen) s.resize(fixlen, '_');
+		break;
+	}
+	return s;
+}
+
+static void bench(const char* name, int kind, size_t n, size_t fixlen) {
+	std::mt19937_64 rnd(kind);
+	std::vector<std::string> v;
+	for (size_t i = 0; i < n; ++i)
+		v.push_back(makeStr(rnd, kind, fixlen));
+	profiling pf;
+	long long t0, t1, t2;
+	if (fixlen) {
+		FixedLenStrVec fv(fixlen);
+		for (const std::string& s : v) fv.push_back(s);
+		t0 = pf.now();
+		fv.sort();
+		t1 = pf.now();
+		// the same rows as std::string, the cost of building them is excluded
+		std::sort(v.begin(), v.end());
+		t2 = pf.now();
+	}
+	else {
+		SortableStrVec sv;
+		for (const std::string& s : v) sv.push_back(s);
+		SortableStrVec sv2;
+		for (const std::string& s : v) sv2.push_back(s);
+		const byte_t* pool = sv2.m_strpool.data();
+		t0 = pf.now();
+		sv.sort();
+		t1 = pf.now();
+		std::sort(sv2.m_index.begin(), sv2.m_index.end(),
+			[pool](const SortableStrVec::SEntry& x, const SortableStrVec::SEntry& y) {
+				return fstring(pool + x.offset, x.length) < fstring(pool + y.offset, y.length);
+			});
+		t2 = pf.now();
+	}
+	printf("%-13s fixlen = %2zd, n = %zd: radix %8.3f ms, std::sort %8.3f ms\n",
+		name, fixlen, n, pf.mf(t0,t1), pf.mf(t1,t2));
+}
+
+int main(int argc, char* argv[]) {
+	size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	const char* names[] = { "Random", "DupHeavy", "SharedPrefix" };
+	for (int kind = 0; kind < 3; ++kind) {
+		for (size_t fixlen : { 0, 4, 8, 32 })
+			bench(names[kind], kind, n, fixlen);
+	}
+	return 0;
+}
@@ -0,0 +1,1526 @@
+// TestDbTable.cpp : behavior tests of DbTable on mock segments, tables are
+// created in the dir given by argv[1].
+//
+
+#include "stdafx.h"
+#include <terark/terichdb/db_table.hpp>
+#include <terark/terichdb/db_segment.hpp>
+#include <terark/terichdb/appendonly.hpp>
+#include <terark/terichdb/fixed_len_store.hpp>
+#include <terark/terichdb/index_filter.hpp>
+#include <terark/terichdb/mock_db_engine.hpp>
+#include <terark/terichdb/record_cache.hpp>
+#include <terark/terichdb/trbdb/trb_db_segment.hpp>
+#include <terark/terichdb/zip_int_store.hpp>
+#include <terark/io/DataIO.hpp>
+#include <terark/io/MemStream.hpp>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#if !defined(_MSC_VER)
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+using namespace terark;
+using namespace terark::terichdb;
+using terark::terichdb::trbdb::TrbColgroupSegment;
+using terark::terichdb::trbdb::TrbLogStat;
+namespace fs = boost::filesystem;
+
+static int g_failed = 0;
+
+#define CHECK(cond, ...) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		fprintf(stderr, __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		if (++g_failed > 20) exit(1); \
+	} } while (0)
+
+// rows are (id uint64, str strzero), id is a non-unique index by default,
+// mock writable segments have no unique check across segments,
+// extraMeta is inserted into dbmeta.json as is, strIndex adds index str
+static DbTablePtr createTable(PathRef dir, const char* extraMeta,
+							  const char* wrSegClass = "MockWritable",
+							  bool uniqueId = false, bool strIndex = false) {
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	FILE* fp = fopen((dir / "dbmeta.json").string().c_str(), "w");
+	fprintf(fp, R"({
+  "WritableSegmentClass": "%s",
+  "ReadonlySegmentClass": "MockReadonly",
+  %s
+  "RowSchema": {
+    "columns": {
+      "id" : { "type": "uint64" },
+      "str": { "type": "strzero" }
+    }
+  },
+  "TableIndex": [ { "fields": "id", "ordered": true, "unique": %s }%s ]
+})", wrSegClass, extraMeta, uniqueId ? "true" : "false",
+	strIndex ? R"(, { "fields": "str", "ordered": true })" : "");
+	fclose(fp);
+	return DbTable::open(dir);
+}
+
+static std::string makeStr(ullong id) {
+	return "str-" + std::to_string(id) + "-" + std::string(id % 7 * 5, 'x');
+}
+
+// ids are permuted by idMul, to make key ranges of segments overlap
+static llong insertRows(DbContext* ctx, ullong idBeg, ullong idEnd,
+						ullong idMul = 1) {
+	NativeDataOutput<AutoGrownMemIO> rb;
+	llong lastRecId = -1;
+	for (ullong i = idBeg; i < idEnd; ++i) {
+		ullong id = i * idMul % idEnd;
+		std::string str = makeStr(id);
+		rb.rewind();
+		rb << id;
+		rb.write(str.c_str(), str.size() + 1);
+		lastRecId = ctx->insertRow(fstring(rb.begin(), rb.tell()));
+		CHECK(lastRecId >= 0, "id = %llu, err = %s", id, ctx->errMsg.c_str());
+	}
+	return lastRecId;
+}
+
+static bool checkRowData(fstring row, ullong id) {
+	NativeDataInput<MemIO> dio; dio.set((void*)row.data(), row.size());
+	ullong id2 = 0;
+	dio >> id2;
+	// the last strzero column may be stored without the ending zero
+	fstring str((const char*)dio.current(), row.end());
+	if (!str.empty() && str.end()[-1] == '\0')
+		str.n--;
+	return id2 == id && str == makeStr(id);
+}
+
+static bool checkRow(DbTable* tab, DbContext* ctx, llong recId, ullong id) {
+	valvec<byte> row;
+	tab->getValue(recId, &row, ctx);
+	return checkRowData(row, id);
+}
+
+// background conversions are async, wait until the writable segments
+// except the last one have been converted to readonly segments
+static void waitConverted(DbTable* tab) {
+	for (int retry = 0; retry < 600; ++retry) {
+		size_t segNum = tab->getSegNum();
+		size_t i = 0;
+		while (i + 1 < segNum && tab->getSegmentPtr(i)->getReadonlySegment())
+			i++;
+		if (i + 1 >= segNum)
+			return;
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	CHECK(false, "timeout waiting conversion, segNum = %zd", tab->getSegNum());
+}
+
+// the small MaxWrSegSize makes many segments, as the capped dbmeta does
+static const char* kSmallSegMeta =
+	R"("MaxWrSegSize": 4096,
+  "WriteStallSoftPendingBytes": "1G",
+  "WriteStallHardPendingBytes": "2G",)";
+
+static void testDropOldSegments(PathRef dir) {
+	const ullong rows = 3000;
+	DbTablePtr tab = createTable(dir, kSmallSegMeta);
+	DbContextPtr ctx = tab->createDbContext();
+	insertRows(ctx.get(), 0, rows);
+	waitConverted(tab.get());
+	// background merges may combine the first segments, drop them when
+	// they are stable
+	size_t segNum0 = 0;
+	std::string segDir0;
+	llong endId = 0, dropped = 0;
+	for (int retry = 0; retry < 100 && 0 == dropped; ++retry) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		segNum0 = tab->getSegNum();
+		ReadableSegmentPtr seg0 = tab->getSegmentPtr(0);
+		segDir0 = seg0->m_segDir.string();
+		endId = seg0->m_isDel.size();
+		dropped = tab->dropOldSegments(endId);
+	}
+	CHECK(segNum0 >= 2, "segNum = %zd", segNum0);
+	CHECK(dropped == endId, "dropped = %lld, endId = %lld", dropped, endId);
+	// removal may be deferred to autoConvMergePurge by a running merge
+	for (int retry = 0; retry < 600 && tab->oldestRowId() == 0; ++retry) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	const llong oldest = tab->oldestRowId();
+	CHECK(oldest == endId, "oldest = %lld, endId = %lld", oldest, endId);
+	CHECK(tab->getSegNum() < segNum0, "segNum = %zd, old = %zd", tab->getSegNum(), segNum0);
+	CHECK(tab->numDataRows() == llong(rows), "rows = %lld", tab->numDataRows());
+	for (llong recId = 0; recId < oldest; ++recId) {
+		CHECK(!tab->exists(recId), "recId = %lld", recId);
+	}
+	for (llong recId = oldest; recId < llong(rows); ++recId) {
+		CHECK(tab->exists(recId), "recId = %lld", recId);
+		CHECK(checkRow(tab.get(), ctx.get(), recId, recId), "recId = %lld", recId);
+	}
+	{
+		StoreIteratorPtr iter = tab->createStoreIterForward(ctx.get());
+		llong recId = -1, expected = oldest;
+		valvec<byte> val;
+		while (iter->increment(&recId, &val)) {
+			CHECK(recId == expected, "recId = %lld, expected = %lld", recId, expected);
+			expected = recId + 1;
+		}
+		CHECK(expected == llong(rows), "expected = %lld", expected);
+		CHECK(!iter->seekExact(oldest - 1, &val), "oldest = %lld", oldest);
+		CHECK(iter->seekExact(oldest, &val), "oldest = %lld", oldest);
+	}
+	// dirs are deleted when the last reference is released, ctx refers
+	// the old segments until it is synced
+	ctx = nullptr;
+	CHECK(!fs::exists(segDir0), "segDir0 = %s", segDir0.c_str());
+
+	// recIds are kept after reopen
+	tab = nullptr;
+	tab = DbTable::open(dir);
+	ctx = tab->createDbContext();
+	CHECK(tab->oldestRowId() == oldest, "oldest = %lld, loaded = %lld", oldest, tab->oldestRowId());
+	CHECK(tab->numDataRows() == llong(rows), "rows = %lld", tab->numDataRows());
+	CHECK(!tab->exists(oldest - 1), "oldest = %lld", oldest);
+	CHECK(checkRow(tab.get(), ctx.get(), oldest, oldest), "oldest = %lld", oldest);
+	CHECK(checkRow(tab.get(), ctx.get(), rows - 1, rows - 1), "rows = %llu", rows);
+	llong recId = insertRows(ctx.get(), rows, rows + 1);
+	CHECK(recId == llong(rows), "recId = %lld", recId);
+	tab = nullptr;
+	ctx = nullptr;
+}
+
+// the way TerichDbRecordStoreCapped keeps a cap: drop the oldest rows after
+// each batch, the number of segments must not grow with the inserted rows
+static void testCappedSegNum(PathRef dir) {
+	const ullong capRows = 500, batch = 100, total = 20000;
+	DbTablePtr tab = createTable(dir, kSmallSegMeta);
+	DbContextPtr ctx = tab->createDbContext();
+	size_t maxSegNum = 0;
+	for (ullong id = 0; id < total; id += batch) {
+		insertRows(ctx.get(), id, id + batch);
+		if (id + batch > capRows)
+			tab->dropOldSegments(id + batch - capRows);
+		maxSegNum = std::max(maxSegNum, tab->getSegNum());
+	}
+	waitConverted(tab.get());
+	tab->dropOldSegments(total - capRows);
+	CHECK(tab->oldestRowId() >= llong(total / 2), "oldest = %lld", tab->oldestRowId());
+	CHECK(tab->getSegNum() < 40, "segNum = %zd", tab->getSegNum());
+	fprintf(stderr, "INFO: testCappedSegNum: max segNum = %zd, final = %zd\n",
+		maxSegNum, tab->getSegNum());
+	tab = nullptr;
+	ctx = nullptr;
+}
+
+// ids are inserted in order, so each readonly segment has its own id
+// range, compactRange must merge just the segments overlapping [lo, hi]
+static void testCompactRange(PathRef dir) {
+	const ullong rows = 500, lo = 150, hi = 349;
+	// less than MinMergeSegNum segments, auto merge will not run
+	DbTablePtr tab = createTable(dir, R"("MinMergeSegNum": 9,
+  "SuggestWritableSegNum": 1000,
+  "MaxWrSegSize": 4096,)");
+	DbContextPtr ctx = tab->createDbContext();
+	insertRows(ctx.get(), 0, rows);
+	waitConverted(tab.get());
+	auto segRange = [&](size_t i) {
+		ReadableSegmentPtr seg = tab->getSegmentPtr(i);
+		llong base = 0;
+		for (size_t j = 0; j < i; ++j)
+			base += tab->getSegmentPtr(j)->m_isDel.size();
+		return std::make_pair(base, base + llong(seg->m_isDel.size()) - 1);
+	};
+	const size_t segNum0 = tab->getSegNum();
+	size_t overlapNum = 0;
+	for (size_t i = 0; i + 1 < segNum0; ++i) {
+		auto r = segRange(i);
+		overlapNum += r.first <= llong(hi) && r.second >= llong(lo);
+	}
+	CHECK(overlapNum >= 3, "overlapNum = %zd, segNum = %zd", overlapNum, segNum0);
+	std::string firstDir = tab->getSegmentPtr(0)->m_segDir.string();
+
+	auto keyOf = [](const ullong& id) { return fstring((const char*)&id, 8); };
+	llong sizeAll = tab->approxRangeSize(0, keyOf(0), keyOf(rows));
+	llong sizeHalf = tab->approxRangeSize(0, keyOf(0), keyOf(rows / 2));
+	CHECK(sizeAll > 0, "sizeAll = %lld", sizeAll);
+	CHECK(sizeHalf <= sizeAll, "sizeHalf = %lld, sizeAll = %lld", sizeHalf, sizeAll);
+	CHECK(tab->approxRangeSize(0, keyOf(rows), keyOf(0)) == 0, "reversed range");
+
+	fstring loKey = keyOf(lo), hiKey = keyOf(hi);
+	tab->compactRange(0, &loKey, &hiKey);
+	const size_t segNum1 = tab->getSegNum();
+	CHECK(segNum1 == segNum0 - overlapNum + 1, "segNum = %zd, old = %zd, overlap = %zd",
+		segNum1, segNum0, overlapNum);
+	// segments out of the range are not touched
+	if (segRange(0).second < llong(lo)) {
+		CHECK(tab->getSegmentPtr(0)->m_segDir.string() == firstDir, "first = %s",
+			tab->getSegmentPtr(0)->m_segDir.string().c_str());
+	}
+	size_t mergedNum = 0;
+	for (size_t i = 0; i + 1 < segNum1; ++i) {
+		auto r = segRange(i);
+		if (r.first <= llong(lo) && r.second >= llong(hi))
+			mergedNum++;
+	}
+	CHECK(mergedNum == 1, "mergedNum = %zd", mergedNum);
+	for (llong recId = 0; recId < llong(rows); ++recId) {
+		CHECK(checkRow(tab.get(), ctx.get(), recId, recId), "recId = %lld", recId);
+	}
+	tab = nullptr;
+	ctx = nullptr;
+}
+
+// the deletion time of a segment decides visibility to the scan snapshot,
+// rows deleted or inserted during the scan must not break the scan
+static void testParallelScanSnapshot(PathRef dir) {
+	const ullong rows = 500;
+	DbTablePtr tab = createTable(dir, R"("MinMergeSegNum": 9,
+  "SuggestWritableSegNum": 1000,
+  "MaxWrSegSize": 4096,)");
+	DbContextPtr ctx = tab->createDbContext();
+	insertRows(ctx.get(), 0, rows);
+	waitConverted(tab.get());
+	CHECK(tab->getSegNum() >= 3, "segNum = %zd", tab->getSegNum());
+
+	// snapshot version of the scan is rowNum - 1, rows of segment 0 deleted
+	// after it are visible, rows deleted at it are not, no m_isDel is set
+	const llong snapshotVersion = tab->numDataRows() - 1;
+	ReadableSegmentPtr seg0 = tab->getSegmentPtr(0);
+	const llong seg0Rows = seg0->m_isDel.size();
+	SchemaPtr deltimeSchema(new Schema());
+	deltimeSchema->m_columnsMeta.insert_i("deltime", ColumnMeta(ColumnType::Uint64));
+	deltimeSchema->compile();
+	{
+		SortableStrVec strVec;
+		for (llong subId = 0; subId < seg0Rows; ++subId) {
+			llong t = subId % 3 == 0 ? snapshotVersion + 1
+					: subId % 3 == 1 ? snapshotVersion : LLONG_MAX;
+			strVec.m_strpool.append((const byte*)&t, sizeof(t));
+		}
+		FixedLenStorePtr deltime(new FixedLenStore(dir, *deltimeSchema));
+		deltime->build(strVec);
+		seg0->m_deletionTime = deltime;
+	}
+	DbTable::ParallelScanOptions opt;
+	opt.threadNum = 4;
+	opt.partitionRows = 16;
+	{
+		std::mutex mtx;
+		std::vector<int> seen(rows);
+		bool rowOk = true;
+		tab->parallelScan(opt, [&](llong recId, fstring row) {
+			std::lock_guard<std::mutex> lock(mtx);
+			if (recId >= 0 && recId < llong(rows))
+				seen[recId]++;
+			rowOk = rowOk && checkRowData(row, recId);
+			return true;
+		}, ctx.get());
+		CHECK(rowOk, "row data");
+		for (llong recId = 0; recId < llong(rows); ++recId) {
+			int expected = recId < seg0Rows && recId % 3 == 1 ? 0 : 1;
+			CHECK(seen[recId] == expected, "recId = %lld, seen = %d", recId, seen[recId]);
+		}
+	}
+	seg0->m_deletionTime = nullptr;
+
+	// an ordered scan inserts and deletes rows from onRow, while workers
+	// are reading later partitions, inserted rows are not reused slots of
+	// deleted rows
+	DbContextPtr wctx = tab->createDbContext();
+	const llong delBeg = seg0Rows + 10;
+	llong prevId = -1, rowNum = 0;
+	bool rowOk = true;
+	opt.ordered = true;
+	rowNum = tab->parallelScan(opt, [&](llong recId, fstring row) {
+		if (recId == 0) {
+			insertRows(wctx.get(), rows, rows + 20);
+			for (llong id = delBeg; id < llong(rows); id += 2)
+				wctx->removeRow(id);
+		}
+		rowOk = rowOk && recId > prevId && checkRowData(row, recId);
+		// deleted rows may be read before they are deleted
+		if (recId > prevId + 1) {
+			for (llong id = prevId + 1; id < recId; ++id)
+				rowOk = rowOk && id >= delBeg && (id - delBeg) % 2 == 0;
+		}
+		prevId = recId;
+		return true;
+	}, ctx.get());
+	CHECK(rowOk, "prevId = %lld", prevId);
+	CHECK(prevId < llong(rows), "rows inserted after the snapshot are scanned, last = %lld", prevId);
+	CHECK(rowNum >= llong(rows) - (llong(rows) - delBeg + 1) / 2, "rowNum = %lld", rowNum);
+	// a new scan does not see the deleted rows
+	opt.ordered = false;
+	rowNum = tab->parallelScan(opt, [&](llong, fstring) { return true; }, ctx.get());
+	CHECK(rowNum == llong(rows + 20) - (llong(rows) - delBeg + 1) / 2, "rowNum = %lld", rowNum);
+	wctx = nullptr;
+	tab = nullptr;
+	ctx = nullptr;
+}
+
+// segments with overlapping keys and purged rows are merged, the fixed
+// length index by the k-way merge of sorted indices, the var length index
+// by resort, each merged index must be the same as the one built by
+// sorting its keys
+static void testMergeSortedIndex(PathRef dir) {
+	const ullong rows = 500;
+	DbTablePtr tab = createTable(dir, R"("MinMergeSegNum": 9,
+  "SuggestWritableSegNum": 1000,
+  "MaxWrSegSize": 4096,)", "MockWritable", false, true);
+	DbContextPtr ctx = tab->createDbContext();
+	insertRows(ctx.get(), 0, rows, 7919);
+	waitConverted(tab.get());
+	const size_t segNum0 = tab->getSegNum();
+	CHECK(segNum0 >= 3, "segNum = %zd", segNum0);
+	for (llong recId = 0; recId < llong(rows); recId += 5)
+		ctx->removeRow(recId);
+	tab->compactRange(0, NULL, NULL);
+	CHECK(tab->getSegNum() == 2, "segNum = %zd, old = %zd", tab->getSegNum(), segNum0);
+	ReadableSegmentPtr seg = tab->getSegmentPtr(0);
+	CHECK(seg->getReadonlySegment() != NULL, "segment 0 is not readonly");
+	CHECK(!seg->m_isPurged.empty(), "deleted rows are not purged");
+	const size_t physicRows = seg->getPhysicRows();
+	CHECK(physicRows == seg->m_isDel.size() - seg->m_delcnt, "physicRows = %zd, delcnt = %zd",
+		physicRows, seg->m_delcnt);
+	for (size_t indexId = 0; indexId < 2; ++indexId) {
+		const Schema& schema = seg->m_schema->getIndexSchema(indexId);
+		ReadableIndex* merged = seg->m_indices[indexId].get();
+		SortableStrVec keys;
+		valvec<byte> key;
+		for (size_t physicId = 0; physicId < physicRows; ++physicId) {
+			merged->getReadableStore()->getValue(physicId, &key, ctx.get());
+			if (schema.getFixedRowLen())
+				keys.m_strpool.append(key);
+			else
+				keys.push_back(key);
+			if (0 == indexId) {
+				size_t logicId = seg->getLogicId(physicId);
+				ullong id = 0;
+				memcpy(&id, key.data(), std::min(key.size(), sizeof(id)));
+				CHECK(checkRow(tab.get(), ctx.get(), logicId, id), "logicId = %zd", logicId);
+			}
+		}
+		MockReadonlyIndexPtr rebuilt(new MockReadonlyIndex(schema));
+		rebuilt->build(keys);
+		IndexIteratorPtr iter1 = merged->createIndexIterForward(ctx.get());
+		IndexIteratorPtr iter2 = rebuilt->createIndexIterForward(ctx.get());
+		llong id1, id2;
+		valvec<byte> key1, key2;
+		size_t num = 0;
+		for (;;) {
+			bool has1 = iter1->increment(&id1, &key1);
+			bool has2 = iter2->increment(&id2, &key2);
+			CHECK(has1 == has2, "index %zd: num = %zd", indexId, num);
+			if (!has1 || !has2)
+				break;
+			CHECK(id1 == id2 && fstring(key1) == fstring(key2), "index %zd: num = %zd, id = %lld %lld",
+				indexId, num, id1, id2);
+			num++;
+		}
+		CHECK(num == physicRows, "index %zd: num = %zd", indexId, num);
+	}
+	tab = nullptr;
+	ctx = nullptr;
+}
+
+// run.lock of the open table is not copied
+static void copyDir(const fs::path& src, const fs::path& dst) {
+	fs::create_directories(dst);
+	for (fs::directory_iterator it(src), end; it != end; ++it) {
+		if (it->path().filename() == "run.lock")
+			continue;
+		if (fs::is_directory(it->status()))
+			copyDir(it->path(), dst / it->path().filename());
+		else
+			fs::copy_file(it->path(), dst / it->path().filename());
+	}
+}
+
+static SchemaPtr makeOneColumnSchema(const char* name, ColumnType type) {
+	SchemaPtr schema(new Schema());
+	schema->m_name = name;
+	schema->m_columnsMeta.insert_i(name, ColumnMeta(type));
+	schema->compile();
+	return schema;
+}
+
+// the estimate of a concurrent build must be the memory of the data
+// collected for the build, then a segment is built with 2 threads
+static void testBuildMemEstimate(PathRef dir) {
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	SchemaPtr idSchema = makeOneColumnSchema("id", ColumnType::Uint64);
+	SchemaPtr strSchema = makeOneColumnSchema("str", ColumnType::StrZero);
+	FixedLenStorePtr idStore(new FixedLenStore(dir, *idSchema));
+	ReadableStorePtr strStore(new SeqReadAppendonlyStore(dir, *strSchema));
+	SortableStrVec idVec, strVec;
+	const ullong rows = 1000;
+	for (ullong id = 0; id < rows; ++id) {
+		fstring idKey((const char*)&id, sizeof(id));
+		std::string str = makeStr(id);
+		idStore->append(idKey, NULL);
+		strStore->getAppendableStore()->append(str, NULL);
+		idVec.m_strpool.append(idKey);
+		strVec.push_back(str);
+	}
+	idStore->shrinkToFit();
+	strStore->getAppendableStore()->shrinkToFit();
+	const size_t bigMem = size_t(1) << 30, smallMem = 1000;
+	size_t idMem = ReadonlySegment::estimateBuildMemSize(*idSchema, true, *idStore, bigMem);
+	size_t strMem = ReadonlySegment::estimateBuildMemSize(*strSchema, true, *strStore, bigMem);
+	CHECK(idMem == idVec.mem_size(), "%zd %zd", idMem, idVec.mem_size());
+	CHECK(strMem == strVec.mem_size(), "%zd %zd", strMem, strVec.mem_size());
+	// index keys are fully loaded, except fixed len keys of ext sort
+	strMem = ReadonlySegment::estimateBuildMemSize(*strSchema, true, *strStore, smallMem);
+	CHECK(strMem == strVec.mem_size(), "%zd %zd", strMem, strVec.mem_size());
+	idMem = ReadonlySegment::estimateBuildMemSize(*idSchema, true, *idStore, smallMem);
+	CHECK(idMem == smallMem, "%zd", idMem);
+	// a colgroup is built by parts of maxMem, FixedLenStore is not built
+	strMem = ReadonlySegment::estimateBuildMemSize(*strSchema, false, *strStore, smallMem);
+	CHECK(strMem == smallMem, "%zd", strMem);
+	idMem = ReadonlySegment::estimateBuildMemSize(*idSchema, false, *idStore, bigMem);
+	CHECK(idMem == idVec.mem_size(), "%zd", idMem); // built as ZipIntStore
+	idSchema->m_isInplaceUpdatable = true;
+	idMem = ReadonlySegment::estimateBuildMemSize(*idSchema, false, *idStore, bigMem);
+	CHECK(idMem == 0, "%zd", idMem);
+	idStore = nullptr;
+	strStore = nullptr;
+
+	DbTablePtr tab = createTable(dir / "tab",
+		R"("MaxWrSegSize": 4096, "CompressingParallelism": 2,
+  "MinMergeSegNum": 9, "SuggestWritableSegNum": 1000,)",
+		"MockWritable", false, true);
+	DbContextPtr ctx = tab->createDbContext();
+	const ullong tabRows = 500; // less than MinMergeSegNum segments
+	insertRows(ctx.get(), 0, tabRows);
+	waitConverted(tab.get());
+	CHECK(tab->getSegNum() > 2, "segNum = %zd", tab->getSegNum());
+	for (size_t i = 0; i + 1 < tab->getSegNum(); ++i) {
+		ReadableSegment* seg = tab->getSegmentPtr(i);
+		for (size_t indexId = 0; indexId < 2; ++indexId) {
+			IndexIteratorPtr iter(seg->m_indices[indexId]->createIndexIterForward(ctx.get()));
+			llong id;
+			valvec<byte> key;
+			size_t num = 0;
+			while (iter->increment(&id, &key))
+				num++;
+			CHECK(num == seg->m_isDel.size(), "seg = %zd, index = %zd, num = %zd, rows = %zd",
+				i, indexId, num, seg->m_isDel.size());
+		}
+	}
+	for (ullong id = 0; id < tabRows; ++id) {
+		CHECK(checkRow(tab.get(), ctx.get(), llong(id), id), "id = %llu", id);
+	}
+	tab = nullptr;
+	ctx = nullptr;
+}
+
+// the projection iterators yield the same as selectColumns of each live
+// row, in recId order forward and backward, deleted rows are skipped
+static void testProjectIter(PathRef dir) {
+	DbTablePtr tab = createTable(dir, R"("MinMergeSegNum": 9,
+  "SuggestWritableSegNum": 1000,
+  "MaxWrSegSize": 4096,)");
+	DbContextPtr ctx = tab->createDbContext();
+	const llong rows = 300;
+	insertRows(ctx.get(), 0, rows);
+	waitConverted(tab.get());
+	CHECK(tab->getSegNum() > 2, "segNum = %zd", tab->getSegNum());
+	for (llong recId = 0; recId < rows; recId += 7)
+		tab->removeRow(recId, ctx.get());
+	const valvec<size_t> colsVec[] = {
+		valvec<size_t>{1}, valvec<size_t>{1, 0}, valvec<size_t>{0},
+	};
+	for (const valvec<size_t>& cols : colsVec) {
+		for (int backward = 0; backward < 2; ++backward) {
+			StoreIteratorPtr iter = backward
+				? tab->createProjectIterBackward(cols, ctx.get())
+				: tab->createProjectIterForward(cols, ctx.get());
+			llong expected = backward ? rows - 1 : 0;
+			llong recId;
+			valvec<byte> val, colsData;
+			size_t num = 0;
+			while (iter->increment(&recId, &val)) {
+				while (expected % 7 == 0)
+					expected += backward ? -1 : 1;
+				CHECK(recId == expected, "cols = %zd, backward = %d, recId = %lld, expected = %lld",
+					cols.size(), backward, recId, expected);
+				tab->selectColumns(recId, cols, &colsData, ctx.get());
+				CHECK(val == colsData, "cols = %zd, backward = %d, recId = %lld", cols.size(), backward, recId);
+				expected += backward ? -1 : 1;
+				num++;
+			}
+			CHECK(num == size_t(rows - (rows + 6) / 7), "cols = %zd, backward = %d, num = %zd",
+				cols.size(), backward, num);
+			CHECK(iter->seekExact(rows / 2, &val), "seekExact");
+			tab->selectColumns(rows / 2, cols, &colsData, ctx.get());
+			CHECK(val == colsData, "cols = %zd, seekExact", cols.size());
+		}
+	}
+	tab = nullptr;
+	ctx = nullptr;
+}
+
+// readers sync the published segment array without m_rwMutex while rows
+// are inserted, flushed, converted and merged, an old version is kept
+// alive by its holder, and is released by the table after a new publish
+static void testSegArrayVersion(PathRef dir) {
+	DbTablePtr tab = createTable(dir, kSmallSegMeta);
+	DbContextPtr ctx = tab->createDbContext();
+	insertRows(ctx.get(), 0, 10);
+	SegArrayVersionPtr ver0 = tab->getSegArrayVersion();
+	const size_t seq0 = ver0->m_updateSeq;
+	CHECK(tab->getSegArrayUpdateSeq() == seq0, "seq = %zd, ver = %zd", tab->getSegArrayUpdateSeq(), seq0);
+	std::atomic<llong> inserted(10);
+	std::atomic<bool> done(false);
+	std::atomic<size_t> readNum(0);
+	std::vector<std::thread> readers;
+	for (int t = 0; t < 3; ++t) {
+		readers.emplace_back([&,t]() {
+			DbContextPtr rctx = tab->createDbContext();
+			std::mt19937_64 rnd(t);
+			size_t lastSeq = 0;
+			while (!done) {
+				llong n = inserted.load(std::memory_order_acquire);
+				llong recId = llong(rnd() % ullong(n));
+				CHECK(checkRow(tab.get(), rctx.get(), recId, recId), "recId = %lld", recId);
+				CHECK(rctx->segArrayUpdateSeq >= lastSeq, "seq = %zd, last = %zd",
+					rctx->segArrayUpdateSeq, lastSeq);
+				lastSeq = rctx->segArrayUpdateSeq;
+				readNum++;
+			}
+		});
+	}
+	const ullong rows = 1500;
+	for (ullong id = 10; id < rows; ++id) {
+		llong recId = insertRows(ctx.get(), id, id + 1);
+		CHECK(recId == llong(id), "recId = %lld, id = %llu", recId, id);
+		inserted.store(id + 1, std::memory_order_release);
+	}
+	waitConverted(tab.get());
+	done = true;
+	for (auto& th : readers)
+		th.join();
+	CHECK(readNum > 0, "no reads");
+	CHECK(tab->getSegArrayUpdateSeq() > seq0, "seq = %zd, seq0 = %zd", tab->getSegArrayUpdateSeq(), seq0);
+	// the table has released ver0, it is freed by the last holder
+	CHECK(ver0->get_refcount() == 1, "refcount = %ld", ver0->get_refcount());
+	SegArrayVersionPtr ver1 = tab->getSegArrayVersion();
+	CHECK(ver1->m_updateSeq == tab->getSegArrayUpdateSeq(), "seq = %zd, ver = %zd",
+		tab->getSegArrayUpdateSeq(), ver1->m_updateSeq);
+	CHECK(ver1->m_segs.size() == tab->getSegNum(), "%zd %zd", ver1->m_segs.size(), tab->getSegNum());
+	ver0 = nullptr;
+	ver1 = nullptr;
+	tab = nullptr;
+	ctx = nullptr;
+}
+
+// the table index iterator merges segments in (key, recId) order forward,
+// and in the reversed order backward, keys are duplicated across segments,
+// str keys share long prefixes, so the prefix cache has many ties
+static void testTableIndexIter(PathRef dir) {
+	DbTablePtr tab = createTable(dir, R"("MinMergeSegNum": 9,
+  "SuggestWritableSegNum": 1000,
+  "MaxWrSegSize": 4096,)", "MockWritable", false, true);
+	DbContextPtr ctx = tab->createDbContext();
+	const ullong rows = 300;
+	insertRows(ctx.get(), 0, rows, 7);
+	insertRows(ctx.get(), 0, rows / 3, 11);
+	waitConverted(tab.get());
+	CHECK(tab->getSegNum() > 3, "segNum = %zd", tab->getSegNum());
+	typedef std::pair<std::string, llong> KeyId;
+	std::vector<KeyId> expected[2];
+	for (llong recId = 0; recId < tab->numDataRows(); ++recId) {
+		valvec<byte> row;
+		tab->getValue(recId, &row, ctx.get());
+		std::string str((const char*)row.data() + 8, row.size() - 8);
+		if (!str.empty() && str.back() == '\0')
+			str.pop_back();
+		ullong id = unaligned_load<ullong>(row.data());
+		// big endian id, string compare is the key order
+		std::string idKey(8, '\0');
+		for (int i = 0; i < 8; ++i)
+			idKey[i] = char(id >> (56 - 8*i));
+		expected[0].push_back(KeyId(idKey, recId));
+		expected[1].push_back(KeyId(str, recId));
+	}
+	auto getKey = [](size_t indexId, const valvec<byte>& key) {
+		if (1 == indexId)
+			return std::string((const char*)key.data(), key.size());
+		ullong id = unaligned_load<ullong>(key.data());
+		std::string idKey(8, '\0');
+		for (int i = 0; i < 8; ++i)
+			idKey[i] = char(id >> (56 - 8*i));
+		return idKey;
+	};
+	for (size_t indexId = 0; indexId < 2; ++indexId) {
+		std::vector<KeyId>& exp = expected[indexId];
+		std::sort(exp.begin(), exp.end());
+		for (int backward = 0; backward < 2; ++backward) {
+			IndexIteratorPtr iter = backward
+				? tab->createIndexIterBackward(indexId, ctx.get())
+				: tab->createIndexIterForward(indexId, ctx.get());
+			llong recId;
+			valvec<byte> key;
+			size_t num = 0;
+			while (iter->increment(&recId, &key)) {
+				if (num < exp.size()) {
+					const KeyId& e = backward ? exp[exp.size() - 1 - num] : exp[num];
+					CHECK(getKey(indexId, key) == e.first && recId == e.second,
+						"index = %zd, backward = %d, num = %zd, recId = %lld, expected = %lld",
+						indexId, backward, num, recId, e.second);
+				}
+				num++;
+			}
+			CHECK(num == exp.size(), "index = %zd, backward = %d, num = %zd, rows = %zd",
+				indexId, backward, num, exp.size());
+		}
+		// seek to existing and absent keys
+		IndexIteratorPtr iter = tab->createIndexIterForward(indexId, ctx.get());
+		for (ullong id = 0; id < rows + 10; id += 7) {
+			std::string seekKey = 0 == indexId ? std::string((const char*)&id, 8) : makeStr(id) + "!";
+			llong recId;
+			valvec<byte> key;
+			int cmp = iter->seekLowerBound(seekKey, &recId, &key);
+			std::string seekOrdered = 0 == indexId
+				? getKey(0, valvec<byte>((const byte*)seekKey.data(), 8)) : seekKey;
+			auto lo = std::lower_bound(exp.begin(), exp.end(), KeyId(seekOrdered, -1));
+			if (lo == exp.end()) {
+				CHECK(cmp < 0, "index = %zd, id = %llu, cmp = %d", indexId, id, cmp);
+				continue;
+			}
+			CHECK(cmp >= 0 && getKey(indexId, key) == lo->first && recId == lo->second,
+				"index = %zd, id = %llu, cmp = %d, recId = %lld, expected = %lld",
+				indexId, id, cmp, recId, lo->second);
+		}
+	}
+	tab = nullptr;
+	ctx = nullptr;
+}
+
+// a bloom filter has no false negatives, also after save and load
+static void testIndexFilter(PathRef dir) {
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	const size_t keyNum = 20000;
+	IndexFilterPtr filter(new IndexFilter());
+	filter->init(keyNum, 10);
+	for (size_t i = 0; i < keyNum; ++i)
+		filter->add(IndexFilter::hashKey("key-" + std::to_string(i)));
+	filter->save(dir / "index.bloom");
+	IndexFilterPtr loaded(new IndexFilter());
+	loaded->load(dir / "index.bloom");
+	CHECK(loaded->mem_size() == filter->mem_size(), "%zd %zd", loaded->mem_size(), filter->mem_size());
+	size_t falsePositive = 0;
+	for (size_t i = 0; i < keyNum; ++i) {
+		uint64_t h = IndexFilter::hashKey("key-" + std::to_string(i));
+		CHECK(filter->mayContain(h), "key-%zd", i);
+		CHECK(loaded->mayContain(h), "loaded key-%zd", i);
+		falsePositive += filter->mayContain(IndexFilter::hashKey("absent-" + std::to_string(i)));
+	}
+	// about 1% for 10 bits per key
+	CHECK(falsePositive < keyNum / 20, "falsePositive = %zd", falsePositive);
+}
+
+// indexSearchExactMulti must return the same as indexSearchExact of each
+// key, ids are duplicated across segments, and some keys are absent
+static void testIndexSearchExactMulti(PathRef dir) {
+	DbTablePtr tab = createTable(dir, R"("MinMergeSegNum": 9,
+  "SuggestWritableSegNum": 1000,
+  "MaxWrSegSize": 4096,)", "MockWritable", false, true);
+	DbContextPtr ctx = tab->createDbContext();
+	const ullong rows = 300;
+	insertRows(ctx.get(), 0, rows, 7);
+	insertRows(ctx.get(), 0, rows / 2, 11);
+	waitConverted(tab.get());
+	// a mock writable segment can not be searched by the table, it is
+	// skipped when all its rows are deleted
+	const size_t segNum = tab->getSegNum();
+	llong wrBaseId = 0;
+	for (size_t i = 0; i + 1 < segNum; ++i)
+		wrBaseId += tab->getSegmentPtr(i)->m_isDel.size();
+	for (llong recId = wrBaseId; recId < tab->numDataRows(); ++recId)
+		tab->removeRow(recId, ctx.get());
+	size_t rdsegNum = 0;
+	for (size_t i = 0; i < tab->getSegNum(); ++i) {
+		ReadonlySegment* seg = tab->getSegmentPtr(i)->getReadonlySegment();
+		if (!seg)
+			continue;
+		rdsegNum++;
+		// keys of the built filter have no false negatives
+		for (size_t indexId = 0; indexId < 2; ++indexId) {
+			const IndexFilter* filter = seg->getIndexFilter(indexId);
+			CHECK(filter != NULL, "seg = %zd, index = %zd", i, indexId);
+			if (!filter)
+				continue;
+			IndexIteratorPtr iter(seg->m_indices[indexId]->createIndexIterForward(ctx.get()));
+			llong id;
+			valvec<byte> key;
+			while (iter->increment(&id, &key))
+				CHECK(filter->mayContain(IndexFilter::hashKey(key)), "seg = %zd, index = %zd, id = %lld",
+					i, indexId, id);
+		}
+	}
+	CHECK(rdsegNum >= 2 && rdsegNum + 1 == segNum && tab->getSegNum() == segNum,
+		"rdsegNum = %zd, segNum = %zd", rdsegNum, tab->getSegNum());
+	for (size_t indexId = 0; indexId < 2; ++indexId) {
+		std::vector<std::string> keys;
+		for (ullong id = 0; id < rows + 50; ++id) {
+			if (0 == indexId)
+				keys.push_back(std::string((const char*)&id, 8));
+			else
+				keys.push_back(makeStr(id));
+		}
+		for (size_t i = 0; i < keys.size(); ++i) // not in key order
+			std::swap(keys[i], keys[i * 13 % keys.size()]);
+		std::vector<fstring> fkeys(keys.begin(), keys.end());
+		std::vector<valvec<llong> > multi(keys.size());
+		tab->indexSearchExactMulti(indexId, fkeys.data(), fkeys.size(), multi.data(), ctx.get());
+		size_t foundNum = 0;
+		valvec<llong> single;
+		for (size_t i = 0; i < keys.size(); ++i) {
+			tab->indexSearchExact(indexId, fkeys[i], &single, ctx.get());
+			CHECK(single == multi[i], "index = %zd, i = %zd, single = %zd, multi = %zd",
+				indexId, i, single.size(), multi[i].size());
+			foundNum += !single.empty();
+		}
+		CHECK(foundNum > rows / 2 && foundNum <= rows, "index = %zd, found = %zd", indexId, foundNum);
+	}
+	tab = nullptr;
+	ctx = nullptr;
+}
+
+// the bitmap of filterRange is the same as comparing each value by the
+// schema, on every kernel: fixed len numbers, general fixed len rows,
+// packed and dedup indexed ZipIntStore, NULL lo/hi are unbounded
+static void checkFilterRange(const ReadableStore& store, const Schema& schema,
+							 const std::vector<std::string>& bounds,
+							 const char* name) {
+	const size_t rows = size_t(store.numDataRows());
+	std::vector<const fstring*> loVec, hiVec;
+	std::vector<fstring> fbounds(bounds.begin(), bounds.end());
+	loVec.push_back(NULL);
+	hiVec.push_back(NULL);
+	for (const fstring& b : fbounds) {
+		loVec.push_back(&b);
+		hiVec.push_back(&b);
+	}
+	febitvec bitmap;
+	valvec<byte> val;
+	for (const fstring* lo : loVec) {
+		for (const fstring* hi : hiVec) {
+			bool ok = store.filterRange(lo, hi, &bitmap);
+			CHECK(ok, "%s", name);
+			CHECK(bitmap.size() == rows, "%s: bitmap = %zd, rows = %zd", name, bitmap.size(), rows);
+			if (!ok || bitmap.size() != rows)
+				continue;
+			for (size_t id = 0; id < rows; ++id) {
+				store.getValue(id, &val, NULL);
+				bool expected = (!lo || schema.compareData(*lo, val) <= 0)
+							 && (!hi || schema.compareData(val, *hi) <= 0);
+				CHECK(bitmap[id] == expected, "%s: id = %zd, lo = %d, hi = %d",
+					name, id, lo ? int(lo - fbounds.data()) : -1, hi ? int(hi - fbounds.data()) : -1);
+			}
+		}
+	}
+}
+
+template<class Int>
+static std::string intStr(Int x) {
+	return std::string((const char*)&x, sizeof(x));
+}
+
+static void testFilterRange(PathRef dir) {
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	std::mt19937_64 rnd(17);
+	const size_t rows = 1000; // not a multiple of WordBits
+	SchemaPtr intSchema = makeOneColumnSchema("val", ColumnType::Sint32);
+	std::vector<std::string> bounds;
+	for (int32_t b : { INT32_MIN, -600, -500, -123, -1, 0, 77, 499, 500, INT32_MAX })
+		bounds.push_back(intStr(b));
+	{
+		FixedLenStorePtr store(new FixedLenStore(dir, *intSchema));
+		for (size_t i = 0; i < rows; ++i)
+			store->append(intStr(int32_t(rnd() % 1001) - 500), NULL);
+		checkFilterRange(*store, *intSchema, bounds, "FixedLenStore Sint32");
+	}
+	{
+		// random values, stored as a packed vector, and few values, stored
+		// as a dedup vector and its index
+		for (int few = 0; few < 2; ++few) {
+			SortableStrVec strVec;
+			for (size_t i = 0; i < rows; ++i) {
+				int32_t x = few ? int32_t(rnd() % 11) * 97 - 500 : int32_t(rnd() % 1001) - 500;
+				strVec.m_strpool.append(intStr(x));
+			}
+			ReadableStorePtr store(new ZipIntStore(*intSchema));
+			static_cast<ZipIntStore&>(*store).build(ColumnType::Sint32, strVec);
+			checkFilterRange(*store, *intSchema, bounds, few ? "ZipIntStore dedup" : "ZipIntStore");
+		}
+	}
+	{
+		SchemaPtr schema(new Schema());
+		schema->m_name = "u16s16";
+		schema->m_columnsMeta.insert_i("a", ColumnMeta(ColumnType::Uint16));
+		schema->m_columnsMeta.insert_i("b", ColumnMeta(ColumnType::Sint16));
+		schema->compile();
+		FixedLenStorePtr store(new FixedLenStore(dir, *schema));
+		auto row = [](uint16_t a, int16_t b) { return intStr(a) + intStr(b); };
+		for (size_t i = 0; i < rows; ++i)
+			store->append(row(uint16_t(rnd() % 8), int16_t(rnd() % 201) - 100), NULL);
+		bounds.clear();
+		for (uint16_t a : { 0, 3, 7 })
+			for (int16_t b : { -101, -50, 0, 100 })
+				bounds.push_back(row(a, b));
+		checkFilterRange(*store, *schema, bounds, "FixedLenStore u16s16");
+	}
+
+	// the table filters row by row on stores without filterRange, deleted
+	// rows are excluded, recIds are ascending
+	DbTablePtr tab = createTable(dir / "tab", R"("MinMergeSegNum": 9,
+  "SuggestWritableSegNum": 1000,
+  "MaxWrSegSize": 4096,)");
+	DbContextPtr ctx = tab->createDbContext();
+	const ullong tabRows = 300;
+	insertRows(ctx.get(), 0, tabRows, 7);
+	waitConverted(tab.get());
+	CHECK(tab->getSegNum() > 2, "segNum = %zd", tab->getSegNum());
+	for (llong recId = 0; recId < llong(tabRows); recId += 5)
+		tab->removeRow(recId, ctx.get());
+	const Schema& idSchema = tab->getColgroupSchema(0);
+	std::vector<std::string> tabBounds;
+	for (ullong b : { 0, 10, 150, 151, 299, 1000 })
+		tabBounds.push_back(intStr(b));
+	std::vector<fstring> fbounds(tabBounds.begin(), tabBounds.end());
+	valvec<llong> recIdvec;
+	valvec<byte> cgData;
+	for (size_t i = 0; i <= fbounds.size(); ++i) {
+		for (size_t j = 0; j <= fbounds.size(); ++j) {
+			const fstring* lo = i < fbounds.size() ? &fbounds[i] : NULL;
+			const fstring* hi = j < fbounds.size() ? &fbounds[j] : NULL;
+			tab->filterColgroupRange(0, lo, hi, &recIdvec, ctx.get());
+			size_t k = 0;
+			for (llong recId = 0; recId < tab->numDataRows(); ++recId) {
+				if (!tab->exists(recId))
+					continue;
+				tab->selectOneColgroup(recId, 0, &cgData, ctx.get());
+				if (lo && idSchema.compareData(*lo, cgData) > 0)
+					continue;
+				if (hi && idSchema.compareData(cgData, *hi) > 0)
+					continue;
+				CHECK(k < recIdvec.size() && recIdvec[k] == recId, "lo = %zd, hi = %zd, k = %zd, recId = %lld",
+					i, j, k, recId);
+				k++;
+			}
+			CHECK(k == recIdvec.size(), "lo = %zd, hi = %zd, k = %zd, found = %zd", i, j, k, recIdvec.size());
+		}
+	}
+	tab = nullptr;
+	ctx = nullptr;
+}
+
+static DbTable::WriteStallStat getWriteStallStat(DbTable* tab) {
+	DbTable::WriteStallStat st;
+	tab->getWriteStallStat(&st);
+	return st;
+}
+
+// writes are delayed above the soft segment num, the delay is reported
+// by the stat, at the hard limit writes throw if throwOnThrottle, else
+// they wait until the backlog is under the limit
+static void testWriteStall(PathRef dir) {
+	DbTablePtr tab = createTable(dir, R"("MinMergeSegNum": 9,
+  "SuggestWritableSegNum": 1000,
+  "MaxWrSegSize": 4096,
+  "WriteStallSoftPendingBytes": "1G",
+  "WriteStallHardPendingBytes": "2G",
+  "WriteStallSoftSegNum": 3,
+  "WriteStallHardSegNum": 100,
+  "WriteStallMaxDelayUsec": 1000,)");
+	DbContextPtr ctx = tab->createDbContext();
+	SchemaConfig& sconf = tab->getSchemaConfig();
+	DbTable::WriteStallStat st = getWriteStallStat(tab.get());
+	CHECK(st.reason == DbTable::WriteStallNone && st.delayedWrites == 0 && st.totalStallUsec == 0,
+		"reason = %s, delayed = %llu", DbTable::writeStallReasonStr(st.reason), st.delayedWrites);
+	ullong rows = 0;
+	while (tab->getSegNum() <= 4 && rows < 3000) {
+		insertRows(ctx.get(), rows, rows + 10);
+		rows += 10;
+	}
+	CHECK(tab->getSegNum() > 4, "segNum = %zd", tab->getSegNum());
+	st = getWriteStallStat(tab.get());
+	ullong delayed = st.delayedWrites;
+	CHECK(delayed > 0, "rows = %llu", rows);
+	insertRows(ctx.get(), rows, rows + 10);
+	rows += 10;
+	st = getWriteStallStat(tab.get());
+	CHECK(st.reason == DbTable::WriteStallDelaySegNum, "reason = %s", DbTable::writeStallReasonStr(st.reason));
+	CHECK(st.delayedWrites == delayed + 10, "delayed = %llu, old = %llu", st.delayedWrites, delayed);
+	CHECK(st.delayUsec >= 1 && st.delayUsec <= 1001, "delayUsec = %llu", st.delayUsec);
+	CHECK(st.totalStallUsec >= st.delayedWrites, "total = %llu", st.totalStallUsec);
+	CHECK(st.stoppedWrites == 0 && st.segNum > 4, "stopped = %llu, segNum = %zd", st.stoppedWrites, st.segNum);
+
+	// stop at the hard limit, merges are disabled, segNum won't shrink
+	waitConverted(tab.get());
+	sconf.m_writeStallHardSegNum = tab->getSegNum();
+	tab->setThrowOnThrottle(true);
+	NativeDataOutput<AutoGrownMemIO> rb;
+	std::string str = makeStr(rows);
+	rb << rows;
+	rb.write(str.c_str(), str.size() + 1);
+	const fstring row(rb.begin(), rb.tell());
+	const llong dataRows = tab->numDataRows();
+	bool thrown = false;
+	try { ctx->insertRow(row); }
+	catch (const WriteThrottleException&) { thrown = true; }
+	CHECK(thrown, "segNum = %zd", tab->getSegNum());
+	CHECK(tab->numDataRows() == dataRows, "%lld %lld", tab->numDataRows(), dataRows);
+	st = getWriteStallStat(tab.get());
+	CHECK(st.reason == DbTable::WriteStallStopSegNum, "reason = %s", DbTable::writeStallReasonStr(st.reason));
+
+	// a stopped writer resumes when the backlog is under the limit,
+	// simulated by disabling the limits
+	tab->setThrowOnThrottle(false);
+	std::thread relax([&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(300));
+		sconf.m_writeStallSoftSegNum = 0;
+		sconf.m_writeStallHardSegNum = 0;
+	});
+	auto t0 = std::chrono::steady_clock::now();
+	llong recId = ctx->insertRow(row);
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - t0).count();
+	relax.join();
+	CHECK(recId >= 0, "err = %s", ctx->errMsg.c_str());
+	CHECK(ms >= 250, "ms = %lld", llong(ms));
+	st = getWriteStallStat(tab.get());
+	CHECK(st.stoppedWrites == 1, "stopped = %llu", st.stoppedWrites);
+	CHECK(st.totalStallUsec >= 250000, "total = %llu", st.totalStallUsec);
+	insertRows(ctx.get(), rows + 1, rows + 2);
+	st = getWriteStallStat(tab.get());
+	CHECK(st.reason == DbTable::WriteStallNone && st.delayUsec == 0,
+		"reason = %s, delayUsec = %llu", DbTable::writeStallReasonStr(st.reason), st.delayUsec);
+	// all frozen writable segments have been converted
+	CHECK(st.pendingConvertBytes == 0, "pending = %lld", st.pendingConvertBytes);
+	tab = nullptr;
+	ctx = nullptr;
+}
+
+static RecordCache::Stat getRecordCacheStat(const RecordCache& cache) {
+	RecordCache::Stat st;
+	cache.getStat(&st);
+	return st;
+}
+
+// the LRU of RecordCache: hits and misses are counted, keys of different
+// segments don't collide, the least recently used are evicted first, and
+// values too large for a shard are not cached
+static void testRecordCacheLru() {
+	const size_t shardCap = 4096;
+	RecordCache cache(shardCap * RecordCache::ShardNum);
+	CHECK(cache.enabled() && cache.capacity() == shardCap * RecordCache::ShardNum,
+		"capacity = %zd", cache.capacity());
+	valvec<byte> val;
+	CHECK(!cache.getAppend(1, 0, 0, &val) && val.empty(), "empty cache");
+	for (size_t id = 0; id < 100; ++id) {
+		cache.put(1, 1, id, makeStr(id));
+		cache.put(2, 1, id, makeStr(id + 1000));
+	}
+	RecordCache::Stat st = getRecordCacheStat(cache);
+	CHECK(st.inserts == 200 && st.entries == 200 && st.evicts == 0 && st.misses == 1,
+		"inserts = %llu, entries = %zd, evicts = %llu", st.inserts, st.entries, st.evicts);
+	for (size_t id = 0; id < 100; ++id) {
+		val.assign("prefix", 6);
+		CHECK(cache.getAppend(1, 1, id, &val) && fstring(val) == "prefix" + makeStr(id), "id = %zd", id);
+		val.erase_all();
+		CHECK(cache.getAppend(2, 1, id, &val) && fstring(val) == makeStr(id + 1000), "id = %zd", id);
+		CHECK(!cache.getAppend(3, 1, id, &val) && !cache.getAppend(1, 0, id, &val), "id = %zd", id);
+	}
+	st = getRecordCacheStat(cache);
+	CHECK(st.hits == 200 && st.misses == 201, "hits = %llu, misses = %llu", st.hits, st.misses);
+	cache.put(1, 1, 1000, std::string(shardCap / 8, 'L'));
+	CHECK(!cache.getAppend(1, 1, 1000, &val), "too large");
+
+	// keep touching a hot key while filling cold keys far over capacity
+	const size_t coldNum = 20 * RecordCache::ShardNum * shardCap / 100;
+	for (size_t id = 0; id < coldNum; ++id) {
+		CHECK(cache.getAppend(1, 1, 7, &val), "hot key evicted, id = %zd", id);
+		cache.put(9, 1, id, std::string(40, 'c'));
+	}
+	st = getRecordCacheStat(cache);
+	CHECK(st.evicts > 0 && st.usedBytes <= cache.capacity(), "evicts = %llu, used = %zd",
+		st.evicts, st.usedBytes);
+	CHECK(!cache.getAppend(9, 1, 0, &val), "the oldest cold key is evicted");
+	// growCapacity never shrinks and never evicts
+	size_t entries = st.entries;
+	CHECK(!cache.growCapacity(shardCap), "capacity = %zd", cache.capacity());
+	CHECK(cache.capacity() == shardCap * RecordCache::ShardNum, "capacity = %zd", cache.capacity());
+	CHECK(getRecordCacheStat(cache).entries == entries, "entries = %zd", getRecordCacheStat(cache).entries);
+	CHECK(cache.growCapacity(2 * shardCap * RecordCache::ShardNum), "grow");
+	CHECK(cache.capacity() == 2 * shardCap * RecordCache::ShardNum, "capacity = %zd", cache.capacity());
+	CHECK(cache.getAppend(1, 1, 7, &val), "hot key is kept by grow");
+	cache.setCapacity(0);
+	st = getRecordCacheStat(cache);
+	CHECK(!cache.enabled() && st.entries == 0 && st.usedBytes == 0, "entries = %zd", st.entries);
+}
+
+// readonly segments cache records of compressed colgroups: the first read
+// misses, the second read hits, scans don't fill the cache, and the new
+// segment of a merge never hits records of the old segments
+static void testRecordCache(PathRef dir) {
+	testRecordCacheLru();
+	DbTablePtr tab = createTable(dir, R"("MinMergeSegNum": 9,
+  "SuggestWritableSegNum": 1000,
+  "MaxWrSegSize": 4096,)");
+	DbContextPtr ctx = tab->createDbContext();
+	const ullong rows = 400;
+	insertRows(ctx.get(), 0, rows);
+	waitConverted(tab.get());
+	CHECK(tab->getSegNum() > 2, "segNum = %zd", tab->getSegNum());
+	RecordCache& cache = RecordCache::instance();
+	CHECK(cache.enabled(), "capacity = %zd", cache.capacity());
+	auto readonlyRows = [&]() {
+		llong num = 0;
+		for (size_t i = 0; i + 1 < tab->getSegNum(); ++i)
+			num += tab->getSegmentPtr(i)->m_isDel.size();
+		return num;
+	};
+	llong rdRows = readonlyRows();
+	CHECK(rdRows > 0, "rdRows = %lld", rdRows);
+
+	// a scan reads through the cache without filling it
+	RecordCache::Stat st0 = getRecordCacheStat(cache);
+	StoreIteratorPtr iter(tab->createStoreIterForward(ctx.get()));
+	llong recId;
+	valvec<byte> row;
+	size_t scanned = 0;
+	while (iter->increment(&recId, &row)) {
+		CHECK(checkRowData(row, recId), "recId = %lld", recId);
+		scanned++;
+	}
+	iter = nullptr;
+	CHECK(scanned == rows, "scanned = %zd", scanned);
+	RecordCache::Stat st1 = getRecordCacheStat(cache);
+	CHECK(st1.inserts == st0.inserts, "inserts = %llu, old = %llu", st1.inserts, st0.inserts);
+	CHECK(st1.misses - st0.misses >= ullong(rdRows), "misses = %llu", st1.misses - st0.misses);
+	CHECK(ctx->noRecordCacheFill == 0, "noRecordCacheFill = %d", ctx->noRecordCacheFill);
+
+	// point reads fill the cache, then hit it
+	for (int pass = 0; pass < 2; ++pass) {
+		for (llong id = 0; id < rdRows; ++id)
+			CHECK(checkRow(tab.get(), ctx.get(), id, id), "pass = %d, recId = %lld", pass, id);
+	}
+	RecordCache::Stat st2 = getRecordCacheStat(cache);
+	CHECK(st2.inserts - st1.inserts == ullong(rdRows), "inserts = %llu, rdRows = %lld",
+		st2.inserts - st1.inserts, rdRows);
+	CHECK(st2.misses - st1.misses == ullong(rdRows), "misses = %llu", st2.misses - st1.misses);
+	CHECK(st2.hits - st1.hits == ullong(rdRows), "hits = %llu", st2.hits - st1.hits);
+
+	// merged segments have new segment ids, the first reads miss
+	for (llong id = 0; id < rdRows; id += 3)
+		tab->removeRow(id, ctx.get());
+	const ullong lo = 0, hi = rows;
+	fstring loKey((const char*)&lo, 8), hiKey((const char*)&hi, 8);
+	tab->compactRange(0, &loKey, &hiKey);
+	rdRows = readonlyRows();
+	size_t liveNum = 0;
+	for (llong id = 0; id < rdRows; ++id)
+		liveNum += tab->exists(id);
+	RecordCache::Stat st3 = getRecordCacheStat(cache);
+	for (int pass = 0; pass < 2; ++pass) {
+		for (llong id = 0; id < rdRows; ++id) {
+			if (tab->exists(id))
+				CHECK(checkRow(tab.get(), ctx.get(), id, id), "pass = %d, recId = %lld", pass, id);
+		}
+	}
+	RecordCache::Stat st4 = getRecordCacheStat(cache);
+	CHECK(liveNum > 0 && st4.misses - st3.misses == liveNum, "misses = %llu, live = %zd",
+		st4.misses - st3.misses, liveNum);
+	CHECK(st4.hits - st3.hits == liveNum, "hits = %llu, live = %zd", st4.hits - st3.hits, liveNum);
+	tab = nullptr;
+	ctx = nullptr;
+}
+
+// dup keys of a unique index fail only their own rows of a batch, with
+// an existing row, or with an earlier row in the same batch
+static void testInsertRowsPartialFailure(PathRef dir) {
+	DbTablePtr tab = createTable(dir, "", "MockWritable", true);
+	DbContextPtr ctx = tab->createDbContext();
+	insertRows(ctx.get(), 1000, 1001); // id 1000 exists
+	// ids are in reversed order, the batch is sorted by id in chunks
+	const size_t rowNum = 600;
+	std::vector<ullong> ids;
+	for (size_t i = 0; i < rowNum; ++i) {
+		ullong id = rowNum - i;
+		if (i % 100 == 50)
+			id = 1000;         // dup with the existing row
+		else if (i % 100 == 70)
+			id = ids[i - 1];   // dup with the previous row
+		ids.push_back(id);
+	}
+	std::vector<std::string> rowData;
+	NativeDataOutput<AutoGrownMemIO> rb;
+	for (ullong id : ids) {
+		std::string str = makeStr(id);
+		rb.rewind();
+		rb << id;
+		rb.write(str.c_str(), str.size() + 1);
+		rowData.push_back(std::string((const char*)rb.begin(), rb.tell()));
+	}
+	std::vector<fstring> rows(rowData.begin(), rowData.end());
+	std::vector<llong> recIdvec(rowNum);
+	size_t okNum = tab->insertRows(rows.data(), rowNum, recIdvec.data(), ctx.get());
+	size_t dupNum = 0;
+	std::set<llong> recIdset;
+	for (size_t i = 0; i < rowNum; ++i) {
+		bool isDup = i % 100 == 50 || i % 100 == 70;
+		dupNum += isDup;
+		if (isDup) {
+			CHECK(recIdvec[i] == -1, "i = %zd, recId = %lld", i, recIdvec[i]);
+			continue;
+		}
+		CHECK(recIdset.insert(recIdvec[i]).second, "i = %zd, recId = %lld", i, recIdvec[i]);
+		CHECK(checkRow(tab.get(), ctx.get(), recIdvec[i], ids[i]), "i = %zd", i);
+	}
+	CHECK(okNum == rowNum - dupNum, "okNum = %zd, dupNum = %zd", okNum, dupNum);
+	CHECK(!ctx->errMsg.empty(), "errMsg of the last dup is empty");
+	CHECK(tab->existingRows(ctx.get()) == llong(1 + okNum), "rows = %lld",
+		tab->existingRows(ctx.get()));
+	// each id is in the unique index once
+	std::map<ullong, size_t> idCount;
+	ReadableSegmentPtr seg = tab->getSegmentPtr(tab->getSegNum() - 1);
+	IndexIteratorPtr iter(seg->m_indices[0]->createIndexIterForward(ctx.get()));
+	llong subId;
+	valvec<byte> key;
+	while (iter->increment(&subId, &key))
+		idCount[unaligned_load<ullong>(key.data())]++;
+	CHECK(idCount.size() == 1 + okNum, "keys = %zd", idCount.size());
+	for (auto& kv : idCount)
+		CHECK(kv.second == 1, "id = %llu, count = %zd", kv.first, kv.second);
+	iter = nullptr;
+	seg = nullptr;
+	tab = nullptr;
+	ctx = nullptr;
+}
+
+// insertRows writes the rows of a chunk in key order, ids are allocated in
+// input order, so the stores of a trbdb writable segment get ids out of
+// order: FixedLenStore of an inplaceUpdatable colgroup, MemoryFixedLenStore
+// and TrbWritableStore. dfadb has only a readonly segment class, its
+// tables use such a writable segment too. Rows must be intact, also after
+// reopen, which replays the trbdb log
+static void testInsertRowsOutOfOrder(PathRef dir) {
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	FILE* fp = fopen((dir / "dbmeta.json").string().c_str(), "w");
+	fprintf(fp, R"({
+  "WritableSegmentClass": "trbdb",
+  "ReadonlySegmentClass": "MockReadonly",
+  "RowSchema": {
+    "columns": {
+      "id" : { "type": "uint64" },
+      "cnt": { "type": "uint32" },
+      "fix": { "type": "uint32" },
+      "str": { "type": "strzero" }
+    }
+  },
+  "ColumnGroups": {
+    "cg_cnt": { "columns": "cnt", "inplaceUpdatable": true },
+    "cg_fix": { "columns": "fix" }
+  },
+  "TableIndex": [ { "fields": "id", "ordered": true, "unique": true } ]
+})");
+	fclose(fp);
+	DbTablePtr tab = DbTable::open(dir);
+	DbContextPtr ctx = tab->createDbContext();
+	const size_t rowNum = 600;
+	std::vector<std::string> rowData;
+	NativeDataOutput<AutoGrownMemIO> rb;
+	for (size_t i = 0; i < rowNum; ++i) {
+		ullong id = rowNum - i; // reversed, key order is not input order
+		std::string str = makeStr(id);
+		rb.rewind();
+		rb << id << uint32_t(id * 3) << uint32_t(id * 7);
+		rb.write(str.c_str(), str.size()); // the last strzero has no zero
+		rowData.push_back(std::string((const char*)rb.begin(), rb.tell()));
+	}
+	auto rowEq = [](const valvec<byte>& row, const std::string& expected) {
+		fstring r(row);
+		if (!r.empty() && r.end()[-1] == '\0')
+			r.n--;
+		return r == fstring(expected);
+	};
+	std::vector<fstring> rows(rowData.begin(), rowData.end());
+	std::vector<llong> recIdvec(rowNum);
+	size_t okNum = tab->insertRows(rows.data(), rowNum, recIdvec.data(), ctx.get());
+	CHECK(okNum == rowNum, "okNum = %zd, err = %s", okNum, ctx->errMsg.c_str());
+	valvec<byte> row;
+	for (size_t i = 0; i < rowNum; ++i) {
+		CHECK(recIdvec[i] >= 0, "i = %zd", i);
+		tab->getValue(recIdvec[i], &row, ctx.get());
+		CHECK(rowEq(row, rowData[i]), "i = %zd, recId = %lld", i, recIdvec[i]);
+	}
+	ctx = nullptr;
+	tab = nullptr;
+	tab = DbTable::open(dir);
+	ctx = tab->createDbContext();
+	CHECK(tab->numDataRows() == llong(rowNum), "rows = %lld", tab->numDataRows());
+	valvec<llong> recIds;
+	for (size_t i = 0; i < rowNum; ++i) {
+		fstring key(rowData[i].data(), 8);
+		tab->indexSearchExact(0, key, &recIds, ctx.get());
+		CHECK(recIds.size() == 1, "i = %zd, found = %zd", i, recIds.size());
+		if (recIds.size() != 1)
+			continue;
+		tab->getValue(recIds[0], &row, ctx.get());
+		CHECK(rowEq(row, rowData[i]), "i = %zd, recId = %lld", i, recIds[0]);
+	}
+	ctx = nullptr;
+	tab = nullptr;
+}
+
+// index files are warmed up first, then the colgroup with "warmUpHot",
+// then other colgroups, bytes are counted when they are read or cached
+static void testWarmUp(PathRef dir) {
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	FILE* fp = fopen((dir / "dbmeta.json").string().c_str(), "w");
+	fprintf(fp, R"({
+  "WritableSegmentClass": "MockWritable",
+  "ReadonlySegmentClass": "MockReadonly",
+  "MaxWrSegSize": 4096,
+  "MinMergeSegNum": 9,
+  "SuggestWritableSegNum": 1000,
+  "RowSchema": {
+    "columns": {
+      "id"  : { "type": "uint64" },
+      "cold": { "type": "strzero" },
+      "hot" : { "type": "strzero" }
+    }
+  },
+  "ColumnGroups": {
+    "cg_cold": { "columns": "cold" },
+    "cg_hot" : { "columns": "hot", "warmUpHot": true }
+  },
+  "TableIndex": [ { "fields": "id", "ordered": true } ]
+})");
+	fclose(fp);
+	DbTablePtr tab = DbTable::open(dir);
+	DbContextPtr ctx = tab->createDbContext();
+	const ullong rows = 300;
+	NativeDataOutput<AutoGrownMemIO> rb;
+	for (ullong id = 0; id < rows; ++id) {
+		std::string str = makeStr(id);
+		rb.rewind();
+		rb << id;
+		rb.write(str.c_str(), str.size() + 1);
+		rb.write(str.c_str(), str.size() + 1);
+		llong recId = ctx->insertRow(fstring(rb.begin(), rb.tell()));
+		CHECK(recId >= 0, "id = %llu, err = %s", id, ctx->errMsg.c_str());
+	}
+	waitConverted(tab.get());
+	CHECK(tab->getSegNum() > 2, "segNum = %zd", tab->getSegNum());
+
+	valvec<std::string> fpaths;
+	tab->getWarmUpFiles(&fpaths);
+	size_t kindNum[3] = { 0, 0, 0 };
+	int lastKind = 0;
+	for (const std::string& fpath : fpaths) {
+		fstring fname = fstring(fpath).substr(fpath.rfind('/') + 1);
+		int kind = fname.startsWith("index-") ? 0
+				 : fname.startsWith("colgroup-cg_hot") ? 1 : 2;
+		CHECK(kind >= lastKind, "%s after kind %d", fpath.c_str(), lastKind);
+		lastKind = kind;
+		kindNum[kind]++;
+	}
+	CHECK(kindNum[0] > 0 && kindNum[1] > 0 && kindNum[2] > 0,
+		"index = %zd, hot = %zd, cold = %zd", kindNum[0], kindNum[1], kindNum[2]);
+
+#if defined(POSIX_FADV_DONTNEED)
+	// drop the files from page cache, then they are really read
+	for (const std::string& fpath : fpaths) {
+		int fd = open(fpath.c_str(), O_RDONLY);
+		if (fd >= 0) {
+			fdatasync(fd);
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			close(fd);
+		}
+	}
+#endif
+	DbTable::WarmUpProgress p;
+	tab->startWarmUp();
+	for (int retry = 0; retry < 600; ++retry) {
+		tab->getWarmUpProgress(&p);
+		if (!p.running)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	CHECK(!p.running, "warm up is not completed");
+	CHECK(p.totalFiles == fpaths.size(), "files = %zd, expected = %zd", p.totalFiles, fpaths.size());
+	CHECK(p.doneFiles == p.totalFiles, "done = %zd, total = %zd", p.doneFiles, p.totalFiles);
+	CHECK(p.doneBytes == p.totalBytes && p.totalBytes > 0, "done = %lld, total = %lld",
+		p.doneBytes, p.totalBytes);
+	CHECK(p.cachedBytes <= p.doneBytes, "cached = %lld, done = %lld", p.cachedBytes, p.doneBytes);
+
+	// stop does not wait for the I/O budget of 1 byte per second
+	auto t0 = std::chrono::steady_clock::now();
+	tab->startWarmUp(1);
+	valvec<byte> row;
+	tab->getValue(0, &row, ctx.get());
+	CHECK(row.size() > 8 && 0 == *(const ullong*)row.data(), "read while warming up");
+	tab->stopWarmUp();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - t0;
+	CHECK(elapsed.count() < 5, "stop time = %f sec", elapsed.count());
+	tab->getWarmUpProgress(&p);
+	CHECK(!p.running && p.totalFiles == 0, "progress is not cleared by stop");
+	tab = nullptr;
+	ctx = nullptr;
+}
+
+static DbTable::BgTaskStat getBgTaskStat() {
+	DbTable::BgTaskStat st;
+	DbTable::getBgTaskStat(&st);
+	return st;
+}
+
+// compression workers are paused, so merges stay in the queue, flushes of
+// new segments must still be run, then convert tasks must do conversions
+static void testBgTaskPriority(PathRef dir) {
+	const size_t workerNum = DbTable::getBgThreadNum();
+	DbTable::setBgThreadNum(0);
+	CHECK(DbTable::getBgThreadNum() == 0, "workerNum = %zd", DbTable::getBgThreadNum());
+	// a paused worker exits after its running task, or its 100ms wait
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	const DbTable::BgTaskPriority Flush = DbTable::BgTaskFlush;
+	const DbTable::BgTaskPriority Convert = DbTable::BgTaskConvert;
+	const DbTable::BgTaskPriority Merge = DbTable::BgTaskMerge;
+	DbTablePtr tab = createTable(dir, kSmallSegMeta);
+	DbContextPtr ctx = tab->createDbContext();
+	const size_t mergeNum = 3;
+	for (size_t i = 0; i < mergeNum; ++i)
+		tab->putAutoTask(Merge);
+	DbTable::BgTaskStat st0 = getBgTaskStat();
+	CHECK(st0.queueDepth[Merge] >= mergeNum, "merge queue = %zd", st0.queueDepth[Merge]);
+	insertRows(ctx.get(), 0, 1000);
+	CHECK(tab->getSegNum() > 2, "segNum = %zd", tab->getSegNum());
+	DbTable::BgTaskStat st1 = getBgTaskStat();
+	for (int retry = 0; retry < 100 && st1.queueDepth[Flush]; ++retry) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		st1 = getBgTaskStat();
+	}
+	CHECK(st1.queueDepth[Flush] == 0, "flush queue = %zd", st1.queueDepth[Flush]);
+	CHECK(st1.executedNum[Flush] >= st0.executedNum[Flush] + tab->getSegNum() - 1,
+		"flushed = %llu, segNum = %zd",
+		st1.executedNum[Flush] - st0.executedNum[Flush], tab->getSegNum());
+	CHECK(st1.executedNum[Merge] == st0.executedNum[Merge],
+		"merged = %llu", st1.executedNum[Merge] - st0.executedNum[Merge]);
+	CHECK(st1.queueDepth[Merge] >= mergeNum, "merge queue = %zd", st1.queueDepth[Merge]);
+	CHECK(st1.queueDepth[Convert] > 0, "convert queue = %zd", st1.queueDepth[Convert]);
+	DbTable::setBgThreadNum(workerNum);
+	waitConverted(tab.get());
+	DbTable::BgTaskStat st2 = getBgTaskStat();
+	CHECK(st2.executedNum[Convert] > st1.executedNum[Convert], "no convert task is run");
+	CHECK(st2.workerNum == workerNum, "workerNum = %zd", st2.workerNum);
+	tab = nullptr;
+	ctx = nullptr;
+}
+
+// concurrent syncOnCommit writers in group commit mode, every record must
+// be in the log when its insertRow returns, checked by loading a copy of
+// the table dir while the table is still open
+static void testTrbGroupCommit(PathRef dir) {
+	setenv("TerichDB_TrbLogGroupCommit", "1", 1);
+	setenv("TerichDB_TrbLogGroupCommitDelayUsec", "200", 1);
+	const ullong threads = 8, rowsPerThread = 500;
+	fs::remove_all(dir);
+	DbTablePtr tab = createTable(dir / "tab", "", "trbdb", true);
+	unsetenv("TerichDB_TrbLogGroupCommit");
+	unsetenv("TerichDB_TrbLogGroupCommitDelayUsec");
+	std::vector<std::thread> writers;
+	for (ullong t = 0; t < threads; ++t) {
+		writers.emplace_back([&,t]() {
+			DbContextPtr ctx = tab->createDbContext();
+			ctx->syncOnCommit = true;
+			insertRows(ctx.get(), t * rowsPerThread, (t + 1) * rowsPerThread);
+		});
+	}
+	for (auto& th : writers)
+		th.join();
+	const llong rows = threads * rowsPerThread;
+	CHECK(tab->numDataRows() == rows, "rows = %lld", tab->numDataRows());
+	{
+		auto seg = dynamic_cast<TrbColgroupSegment*>(
+			tab->getSegmentPtr(tab->getSegNum() - 1)->getWritableSegment());
+		CHECK(seg != NULL, "not a TrbColgroupSegment");
+		if (seg) {
+			TrbLogStat stat;
+			seg->getLogStat(&stat);
+			CHECK(stat.syncCommitNum >= ullong(rows), "syncCommitNum = %llu", ullong(stat.syncCommitNum));
+			CHECK(stat.batchNum > 0 && stat.batchNum <= stat.batchRecords,
+				"batchNum = %llu, batchRecords = %llu",
+				ullong(stat.batchNum), ullong(stat.batchRecords));
+			fprintf(stderr, "INFO: testTrbGroupCommit: batches = %llu, maxBatchRecords = %llu\n",
+				ullong(stat.batchNum), ullong(stat.maxBatchRecords));
+		}
+	}
+	copyDir(dir / "tab", dir / "copy");
+	DbTablePtr tab2 = DbTable::open(dir / "copy");
+	DbContextPtr ctx2 = tab2->createDbContext();
+	CHECK(tab2->numDataRows() == rows, "loaded rows = %lld", tab2->numDataRows());
+	std::vector<bool> seen(rows);
+	valvec<llong> recIds;
+	for (llong id = 0; id < rows; ++id) {
+		NativeDataOutput<AutoGrownMemIO> key;
+		key << ullong(id);
+		tab2->indexSearchExact(0, fstring(key.begin(), key.tell()), &recIds, ctx2.get());
+		CHECK(recIds.size() == 1, "id = %lld, found = %zd", id, recIds.size());
+		if (recIds.size() == 1)
+			CHECK(checkRow(tab2.get(), ctx2.get(), recIds[0], id), "id = %lld", id);
+	}
+	tab2 = nullptr;
+	ctx2 = nullptr;
+	tab = nullptr;
+}
+
+int main(int argc, char* argv[]) {
+	fs::path dir = argc > 1 ? argv[1] : "TestDbTable.tmp";
+	testDropOldSegments(dir / "DropOldSegments");
+	testCappedSegNum(dir / "CappedSegNum");
+	testTrbGroupCommit(dir / "TrbGroupCommit");
+	testCompactRange(dir / "CompactRange");
+	testParallelScanSnapshot(dir / "ParallelScanSnapshot");
+	testMergeSortedIndex(dir / "MergeSortedIndex");
+	testBgTaskPriority(dir / "BgTaskPriority");
+	testBuildMemEstimate(dir / "BuildMemEstimate");
+	testWarmUp(dir / "WarmUp");
+	testInsertRowsPartialFailure(dir / "InsertRowsPartialFailure");
+	testInsertRowsOutOfOrder(dir / "InsertRowsOutOfOrder");
+	testIndexFilter(dir / "IndexFilter");
+	testTableIndexIter(dir / "TableIndexIter");
+	testSegArrayVersion(dir / "SegArrayVersion");
+	testProjectIter(dir / "ProjectIter");
+	testIndexSearchExactMulti(dir / "IndexSearchExactMulti");
+	testFilterRange(dir / "FilterRange");
+	testWriteStall(dir / "WriteStall");
+	testRecordCache(dir / "RecordCache");
+	DbTable::safeStopAndWaitForFlush();
+	fs::remove_all(dir);
+	if (g_failed) {
+		fprintf(stderr, "%d checks failed\n", g_failed);
+		return 1;
+	}
+	printf("passed\n");
+	return 0;
+}
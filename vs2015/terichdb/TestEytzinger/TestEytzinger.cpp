@@ -0,0 +1,304 @@
+// TestEytzinger.cpp : checks EytzingerLayout narrowing, and the Eytzinger
+// layer of ZipIntKeyIndex and FixedLenKeyIndex through save and load,
+// including index files saved before the layer existed (eytzShift == 0),
+// and FixedLenKeyIndex built by the external sort into a mmap must be the
+// same as the one built in memory.
+//
+
+#include "stdafx.h"
+#include <terark/terichdb/eytzinger_layout.hpp>
+#include <terark/terichdb/intkey_index.hpp>
+#include <terark/terichdb/fixed_len_key_index.hpp>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace terark;
+using namespace terark::terichdb;
+namespace fs = boost::filesystem;
+
+static int g_failed = 0;
+
+#define CHECK(cond, ...) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		fprintf(stderr, __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		if (++g_failed > 20) exit(1); \
+	} } while (0)
+
+// keys are sorted, less(x, y) is the key order, pad is the max key
+template<class Key, class Less>
+void checkLayout(const std::vector<Key>& keys, const std::vector<Key>& queries,
+				 int shift, const Key& pad, Less less, const char* name) {
+	size_t rows = keys.size();
+	size_t levels = EytzingerLayout::levels(rows, shift);
+	std::vector<Key> a(EytzingerLayout::slots(levels));
+	EytzingerLayout::build(rows, shift, levels,
+		[&](size_t k, size_t pos) { a[k] = keys[pos]; },
+		[&](size_t k) { a[k] = pad; });
+	for (const Key& q : queries) {
+		for (int upper = 0; upper < 2; ++upper) {
+			size_t r = EytzingerLayout::rank(a.data(), sizeof(Key), levels,
+				[&](size_t k) { return upper ? !less(q, a[k]) : less(a[k], q); });
+			size_t lo = 0, hi = rows;
+			EytzingerLayout::narrowLo(r, shift, rows, &lo);
+			EytzingerLayout::narrowHi(r, shift, rows, &hi);
+			size_t expected = upper
+				? std::upper_bound(keys.begin(), keys.end(), q, less) - keys.begin()
+				: std::lower_bound(keys.begin(), keys.end(), q, less) - keys.begin();
+			CHECK(lo <= expected && expected <= hi && hi - lo <= (size_t(1) << shift),
+				"%s: rows=%zd shift=%d upper=%d lo=%zd hi=%zd expected=%zd",
+				name, rows, shift, upper, lo, hi, expected);
+		}
+	}
+}
+
+typedef std::array<byte, 6> FixKey;
+
+void testLayout() {
+	std::mt19937_64 rng(1);
+	for (int t = 0; t < 200; ++t) {
+		size_t rows = 1 + rng() % 20000;
+		int shift = int(rng() % 6);
+		// small range for many duplicates
+		ullong range = 1 + rng() % (rows * 2);
+		std::vector<ullong> keys(rows);
+		for (auto& x : keys) x = rng() % range;
+		if (t % 3 == 0) keys.back() = UINT64_MAX;
+		if (t % 5 == 0) std::fill(keys.end() - std::min<size_t>(rows, 100), keys.end(), UINT64_MAX);
+		std::sort(keys.begin(), keys.end());
+		std::vector<ullong> queries = { 0, UINT64_MAX, UINT64_MAX - 1 };
+		for (int q = 0; q < 1000; ++q)
+			queries.push_back(rng() % (range + 2));
+		checkLayout(keys, queries, shift, ullong(UINT64_MAX), std::less<ullong>(), "uint64");
+	}
+	auto fixLess = [](const FixKey& x, const FixKey& y) {
+		return memcmp(x.data(), y.data(), x.size()) < 0;
+	};
+	const byte alphabet[] = { 0x00, 0x7F, 0xFF };
+	FixKey allFF;
+	allFF.fill(0xFF);
+	for (int t = 0; t < 50; ++t) {
+		size_t rows = 1 + rng() % 5000;
+		int shift = int(rng() % 6);
+		std::vector<FixKey> keys(rows);
+		for (auto& k : keys)
+			for (auto& b : k) b = alphabet[rng() % 3];
+		// the pad is all 0xFF, same as real max keys
+		std::fill(keys.end() - std::min<size_t>(rows, 1 + t), keys.end(), allFF);
+		std::sort(keys.begin(), keys.end(), fixLess);
+		std::vector<FixKey> queries = { allFF };
+		for (int q = 0; q < 500; ++q) {
+			FixKey k;
+			for (auto& b : k) b = alphabet[rng() % 3];
+			queries.push_back(k);
+		}
+		checkLayout(keys, queries, shift, allFF, fixLess, "fixlen");
+	}
+}
+
+// an index file of the format before the Eytzinger layer: eytzShift is 0
+// and the file ends after m_index
+void makeOldFormat(const std::string& fname, size_t shiftOffset, size_t shiftSize,
+				   size_t slotLen) {
+	FILE* fp = fopen(fname.c_str(), "rb+");
+	CHECK(NULL != fp, "fopen(%s) = %s", fname.c_str(), strerror(errno));
+	if (!fp) return;
+	uint32_t rows = 0, shift = 0;
+	CHECK(fread(&rows, 4, 1, fp) == 1, "read rows");
+	fseek(fp, long(shiftOffset), SEEK_SET);
+	CHECK(fread(&shift, shiftSize, 1, fp) == 1, "read eytzShift");
+	CHECK(shift != 0, "%s has no Eytzinger layer, rows = %u", fname.c_str(), rows);
+	uint32_t zero = 0;
+	fseek(fp, long(shiftOffset), SEEK_SET);
+	fwrite(&zero, shiftSize, 1, fp);
+	fclose(fp);
+	if (shift) {
+		size_t levels = EytzingerLayout::levels(rows, int(shift - 1));
+		size_t layerSize = slotLen * EytzingerLayout::slots(levels);
+		fs::resize_file(fname, fs::file_size(fname) - layerSize);
+	}
+}
+
+template<class Index>
+void checkIntIndex(const Index& index, const std::vector<ullong>& sorted,
+				   const std::vector<ullong>& queries, const char* name) {
+	for (ullong q : queries) {
+		fstring key((const char*)&q, 8);
+		size_t expected = std::lower_bound(sorted.begin(), sorted.end(), q) - sorted.begin();
+		size_t count = std::upper_bound(sorted.begin(), sorted.end(), q) - sorted.begin() - expected;
+		llong rank = index.searchLowerBoundRank(key);
+		CHECK(rank == llong(expected), "%s: key=%llu rank=%lld expected=%zd", name, q, rank, expected);
+		valvec<llong> recIdvec;
+		index.searchExactAppend(key, &recIdvec, NULL);
+		CHECK(recIdvec.size() == count, "%s: key=%llu found=%zd expected=%zd", name, q, recIdvec.size(), count);
+	}
+}
+
+void testZipIntKeyIndex(const fs::path& dir) {
+	SchemaPtr schema(new Schema());
+	schema->m_columnsMeta.insert_i("key", ColumnMeta(ColumnType::Uint64));
+	schema->compile();
+	std::mt19937_64 rng(2);
+	const size_t rows = 20000;
+	// keys are zipped to at most 58 bits, so UINT64_MAX keys are tested
+	// near the top, max keys are the same as the pad of the layer
+	const ullong range = 5000; // duplicate keys
+	const ullong base = UINT64_MAX - range;
+	std::vector<ullong> keys(rows);
+	for (auto& x : keys) x = base + rng() % range;
+	for (size_t i = 0; i < 50; ++i) keys[rng() % rows] = UINT64_MAX;
+	SortableStrVec strVec;
+	for (ullong x : keys) strVec.m_strpool.append((const byte*)&x, 8);
+	std::vector<ullong> sorted(keys);
+	std::sort(sorted.begin(), sorted.end());
+	std::vector<ullong> queries = { 0, base - 1, base, UINT64_MAX, UINT64_MAX - 1 };
+	for (int q = 0; q < 3000; ++q) queries.push_back(base + rng() % (range + 1));
+
+	fs::path path = dir / "zint";
+	{
+		std::unique_ptr<ZipIntKeyIndex> index(new ZipIntKeyIndex(*schema));
+		index->build(ColumnType::Uint64, strVec);
+		checkIntIndex(*index, sorted, queries, "ZipIntKeyIndex built");
+		index->save(path);
+	}
+	{
+		std::unique_ptr<ZipIntKeyIndex> index(new ZipIntKeyIndex(*schema));
+		index->load(path);
+		checkIntIndex(*index, sorted, queries, "ZipIntKeyIndex loaded");
+	}
+	// Header { uint32 rows; uint8 keyBits, keyType, isUnique, eytzShift; ... }
+	makeOldFormat(path.string() + ".zint", 7, 1, sizeof(uint64_t));
+	{
+		std::unique_ptr<ZipIntKeyIndex> index(new ZipIntKeyIndex(*schema));
+		index->load(path);
+		checkIntIndex(*index, sorted, queries, "ZipIntKeyIndex old format");
+	}
+}
+
+void checkFixIndex(const FixedLenKeyIndex& index, const std::vector<FixKey>& sorted,
+				   const std::vector<FixKey>& queries, const char* name) {
+	auto fixLess = [](const FixKey& x, const FixKey& y) {
+		return memcmp(x.data(), y.data(), x.size()) < 0;
+	};
+	for (const FixKey& q : queries) {
+		fstring key((const char*)q.data(), q.size());
+		size_t expected = std::lower_bound(sorted.begin(), sorted.end(), q, fixLess) - sorted.begin();
+		size_t count = std::upper_bound(sorted.begin(), sorted.end(), q, fixLess) - sorted.begin() - expected;
+		llong rank = index.searchLowerBoundRank(key);
+		CHECK(rank == llong(expected), "%s: rank=%lld expected=%zd", name, rank, expected);
+		valvec<llong> recIdvec;
+		index.searchExactAppend(key, &recIdvec, NULL);
+		CHECK(recIdvec.size() == count, "%s: found=%zd expected=%zd", name, recIdvec.size(), count);
+	}
+}
+
+// (id, key) in the order of forward iteration must be the same
+void checkSameIndex(const FixedLenKeyIndex& x, const FixedLenKeyIndex& y, const char* name) {
+	std::unique_ptr<IndexIterator> ix(x.createIndexIterForward(NULL));
+	std::unique_ptr<IndexIterator> iy(y.createIndexIterForward(NULL));
+	llong idx = -1, idy = -1;
+	valvec<byte> kx, ky;
+	size_t num = 0;
+	for (;;) {
+		bool hasx = ix->increment(&idx, &kx);
+		bool hasy = iy->increment(&idy, &ky);
+		CHECK(hasx == hasy, "%s: num=%zd", name, num);
+		if (!hasx || !hasy)
+			break;
+		CHECK(idx == idy && kx == ky, "%s: num=%zd id=%lld expected=%lld", name, num, idx, idy);
+		num++;
+	}
+	CHECK(llong(num) == x.numDataRows(), "%s: num=%zd rows=%lld", name, num, x.numDataRows());
+	CHECK(x.isUnique() == y.isUnique(), "%s", name);
+}
+
+void testFixedLenKeyIndex(const fs::path& dir) {
+	SchemaPtr schema(new Schema());
+	ColumnMeta colmeta(ColumnType::Fixed);
+	colmeta.fixedLen = sizeof(FixKey);
+	schema->m_columnsMeta.insert_i("key", colmeta);
+	schema->compile();
+	std::mt19937_64 rng(3);
+	const byte alphabet[] = { 0x00, 0x7F, 0xFF };
+	const size_t rows = 20000;
+	FixKey allFF;
+	allFF.fill(0xFF);
+	std::vector<FixKey> keys(rows);
+	for (auto& k : keys)
+		for (auto& b : k) b = alphabet[rng() % 3];
+	for (size_t i = 0; i < 50; ++i) keys[rng() % rows] = allFF;
+	SortableStrVec strVec;
+	for (auto& k : keys) strVec.m_strpool.append(k.data(), k.size());
+	std::vector<FixKey> sorted(keys);
+	std::sort(sorted.begin(), sorted.end(), [](const FixKey& x, const FixKey& y) {
+		return memcmp(x.data(), y.data(), x.size()) < 0;
+	});
+	std::vector<FixKey> queries = { allFF };
+	for (int q = 0; q < 3000; ++q) {
+		FixKey k;
+		for (auto& b : k) b = alphabet[rng() % 3];
+		queries.push_back(k);
+	}
+
+	// build(strVec) encodes keys in place, the ext sort build reads a copy
+	valvec<byte> rawKeys(strVec.m_strpool.data(), strVec.m_strpool.size());
+
+	fs::path path = dir / "fixlen";
+	std::unique_ptr<FixedLenKeyIndex> memIndex(new FixedLenKeyIndex(*schema));
+	memIndex->build(*schema, strVec);
+	checkFixIndex(*memIndex, sorted, queries, "FixedLenKeyIndex built");
+	memIndex->save(path);
+	{
+		// 1024 records of each run is the min of the sorter, about 20 runs
+		std::unique_ptr<FixedLenKeyIndex> index(new FixedLenKeyIndex(*schema));
+		index->build(*schema, rawKeys.data(), rows, 1, dir);
+		checkFixIndex(*index, sorted, queries, "FixedLenKeyIndex ext sorted");
+		checkSameIndex(*index, *memIndex, "FixedLenKeyIndex ext sorted");
+		index->save(dir / "fixlen-ext");
+		index.reset(new FixedLenKeyIndex(*schema));
+		CHECK(!fs::exists(dir / "index-key.fixlen"), "tmp file of ext sort is not removed");
+		index->load(dir / "fixlen-ext");
+		checkSameIndex(*index, *memIndex, "FixedLenKeyIndex ext sorted loaded");
+	}
+	{
+		std::unique_ptr<FixedLenKeyIndex> index(new FixedLenKeyIndex(*schema));
+		index->load(path);
+		checkFixIndex(*index, sorted, queries, "FixedLenKeyIndex loaded");
+	}
+	// Header { uint32 rows, uniqKeys, fixlen, eytzShift; }
+	makeOldFormat(path.string() + ".fixlen", 12, 4, sizeof(FixKey));
+	{
+		std::unique_ptr<FixedLenKeyIndex> index(new FixedLenKeyIndex(*schema));
+		index->load(path);
+		checkFixIndex(*index, sorted, queries, "FixedLenKeyIndex old format");
+	}
+}
+
+int main(int argc, char* argv[]) {
+	// the index tests need the layer, keep the default sample shift
+	if (getenv("TerichDB_eytzingerSampleShift")) {
+		fprintf(stderr, "unset TerichDB_eytzingerSampleShift to run this test\n");
+		return 1;
+	}
+	fs::path dir = argc > 1 ? argv[1] : "TestEytzinger.tmp";
+	fs::create_directories(dir);
+	testLayout();
+	testZipIntKeyIndex(dir);
+	testFixedLenKeyIndex(dir);
+	fs::remove_all(dir);
+	if (g_failed) {
+		fprintf(stderr, "%d checks failed\n", g_failed);
+		return 1;
+	}
+	printf("passed\n");
+	return 0;
+}
@@ -0,0 +1,195 @@
+// TestSchemaPlan.cpp : the execution plan built by Schema::compile must
+// give the same results as the interpreter, for parseRow, compareData and
+// byteLexEncode/byteLexDecode
+//
+
+#include "stdafx.h"
+#include <terark/terichdb/db_conf.hpp>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace terark;
+using namespace terark::terichdb;
+
+static int g_failed = 0;
+
+#define CHECK(cond, ...) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		fprintf(stderr, __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		if (++g_failed > 20) exit(1); \
+	} } while (0)
+
+struct ColumnDef {
+	ColumnType type;
+	uint32_t   fixedLen; // for ColumnType::Fixed
+};
+
+static SchemaPtr makeSchema(const std::vector<ColumnDef>& defs, bool withPlan) {
+	SchemaPtr schema(new Schema());
+	for (size_t i = 0; i < defs.size(); ++i) {
+		ColumnMeta colmeta(defs[i].type);
+		if (ColumnType::Fixed == defs[i].type)
+			colmeta.fixedLen = defs[i].fixedLen;
+		std::string name = "c" + std::to_string(i);
+		schema->m_columnsMeta.insert_i(name, colmeta);
+	}
+	schema->compile();
+	if (!withPlan)
+		schema->clearPlan();
+	return schema;
+}
+
+// values are from small ranges, so rows often have equal leading columns
+// and compareData reaches the later columns
+template<class Int>
+static void appendInt(std::string& col, std::mt19937_64& rnd) {
+	Int x = Int(llong(rnd() % 7) - 3);
+	col.append((const char*)&x, sizeof(x));
+}
+template<class Float>
+static void appendFloat(std::string& col, std::mt19937_64& rnd) {
+	Float x = Float(llong(rnd() % 7) - 3) / 2;
+	col.append((const char*)&x, sizeof(x));
+}
+
+static std::string makeColumn(const ColumnMeta& colmeta, std::mt19937_64& rnd) {
+	std::string col;
+	switch (colmeta.type) {
+	default: abort();
+	case ColumnType::Uint08:  appendInt<uint8_t >(col, rnd); break;
+	case ColumnType::Sint08:  appendInt< int8_t >(col, rnd); break;
+	case ColumnType::Uint16:  appendInt<uint16_t>(col, rnd); break;
+	case ColumnType::Sint16:  appendInt< int16_t>(col, rnd); break;
+	case ColumnType::Uint32:  appendInt<uint32_t>(col, rnd); break;
+	case ColumnType::Sint32:  appendInt< int32_t>(col, rnd); break;
+	case ColumnType::Uint64:  appendInt<uint64_t>(col, rnd); break;
+	case ColumnType::Sint64:  appendInt< int64_t>(col, rnd); break;
+	case ColumnType::Float32: appendFloat<float >(col, rnd); break;
+	case ColumnType::Float64: appendFloat<double>(col, rnd); break;
+	case ColumnType::Uuid:
+	case ColumnType::Fixed:
+		for (size_t i = 0; i < colmeta.fixedLen; ++i)
+			col.push_back(char('a' + rnd() % 2));
+		break;
+	case ColumnType::StrZero:
+	case ColumnType::Binary:
+		for (size_t i = 0, n = rnd() % 5; i < n; ++i)
+			col.push_back(char('a' + rnd() % 2));
+		break;
+	}
+	return col;
+}
+
+static std::string makeRow(const Schema& schema, std::mt19937_64& rnd) {
+	std::string buf;
+	std::vector<ColumnVec::Elem> elems;
+	for (size_t i = 0; i < schema.columnNum(); ++i) {
+		std::string col = makeColumn(schema.getColumnMeta(i), rnd);
+		elems.push_back(ColumnVec::Elem(uint32_t(buf.size()), uint32_t(col.size())));
+		buf += col;
+	}
+	ColumnVec cols;
+	cols.m_base = (const byte*)buf.data();
+	for (auto e : elems)
+		cols.push_back(e);
+	valvec<byte> row;
+	schema.combineRow(cols, &row);
+	return std::string((const char*)row.data(), row.size());
+}
+
+static int sign(int x) { return x < 0 ? -1 : x > 0 ? 1 : 0; }
+
+static void testSchema(const char* name, const std::vector<ColumnDef>& defs) {
+	SchemaPtr plan = makeSchema(defs, true);
+	SchemaPtr interp = makeSchema(defs, false);
+	std::mt19937_64 rnd(12345);
+	std::vector<std::string> rows;
+	for (size_t i = 0; i < 2000; ++i) {
+		if (i % 8 == 7)
+			rows.push_back(rows[rnd() % i]); // duplicate rows
+		else
+			rows.push_back(makeRow(*plan, rnd));
+	}
+	ColumnVec cols1, cols2;
+	for (const std::string& row : rows) {
+		plan->parseRow(row, &cols1);
+		interp->parseRow(row, &cols2);
+		CHECK(cols1.size() == cols2.size(), "%s: %zd %zd", name, cols1.size(), cols2.size());
+		for (size_t j = 0; j < cols1.size() && j < cols2.size(); ++j) {
+			CHECK(cols1[j] == cols2[j], "%s: column %zd", name, j);
+		}
+	}
+	// random pairs, then neighbors in sorted order which share prefixes,
+	// so the compare reaches the later columns
+	std::vector<std::string> sorted = rows;
+	std::sort(sorted.begin(), sorted.end(),
+		[&](const std::string& x, const std::string& y) {
+			return interp->compareData(x, y) < 0;
+		});
+	size_t equalNum = 0;
+	for (size_t i = 0; i + 1 < rows.size(); ++i) {
+		for (size_t j : { i, i + 1, rows.size() - 1 - i }) {
+			int c1 = plan->compareData(rows[i], rows[j]);
+			int c2 = interp->compareData(rows[i], rows[j]);
+			CHECK(sign(c1) == sign(c2), "%s: rows %zd %zd: %d %d", name, i, j, c1, c2);
+		}
+		int c1 = plan->compareData(sorted[i], sorted[i+1]);
+		int c2 = interp->compareData(sorted[i], sorted[i+1]);
+		CHECK(sign(c1) == sign(c2), "%s: sorted rows %zd: %d %d", name, i, c1, c2);
+		CHECK(c1 <= 0, "%s: sorted rows %zd: %d", name, i, c1);
+		equalNum += 0 == c2;
+	}
+	if (plan->m_canEncodeToLexByteComparable) {
+		for (size_t i = 0; i + 1 < rows.size(); ++i) {
+			valvec<byte> x1(rows[i].data(), rows[i].size()), x2 = x1;
+			valvec<byte> y1(rows[i+1].data(), rows[i+1].size());
+			plan->byteLexEncode(x1);
+			interp->byteLexEncode(x2);
+			CHECK(x1 == x2, "%s: encode row %zd", name, i);
+			plan->byteLexEncode(y1);
+			// encoded fixed length rows are compared by bytes in the same order
+			size_t n = std::min(x1.size(), y1.size());
+			int c1 = sign(memcmp(x1.data(), y1.data(), n));
+			if (0 == c1)
+				c1 = sign(int(x1.size()) - int(y1.size()));
+			int c2 = sign(interp->compareData(rows[i], rows[i+1]));
+			if (plan->getFixedRowLen()) {
+				CHECK(c1 == c2, "%s: encoded order of rows %zd: %d %d", name, i, c1, c2);
+			}
+			plan->byteLexDecode(x1);
+			interp->byteLexDecode(x2);
+			CHECK(x1 == x2, "%s: decode row %zd", name, i);
+			CHECK(fstring(x1.data(), x1.size()) == rows[i], "%s: decode row %zd", name, i);
+		}
+	}
+	CHECK(equalNum > 0, "%s: no equal rows", name);
+}
+
+int main(int argc, char* argv[]) {
+	testSchema("AllFixed", {
+		{ ColumnType::Sint08, 0 }, { ColumnType::Uint16, 0 }, { ColumnType::Sint16, 0 },
+		{ ColumnType::Uint32, 0 }, { ColumnType::Sint32, 0 }, { ColumnType::Float32, 0 },
+		{ ColumnType::Uint64, 0 }, { ColumnType::Sint64, 0 }, { ColumnType::Float64, 0 },
+		{ ColumnType::Fixed, 3 },
+	});
+	testSchema("FixedMemcmp", {
+		{ ColumnType::Uint08, 0 }, { ColumnType::Fixed, 2 }, { ColumnType::Uuid, 0 },
+	});
+	testSchema("FixedPrefix", {
+		{ ColumnType::Sint32, 0 }, { ColumnType::Uint64, 0 }, { ColumnType::Float64, 0 },
+		{ ColumnType::StrZero, 0 }, { ColumnType::Sint16, 0 }, { ColumnType::Binary, 0 },
+	});
+	testSchema("OneBinary", { { ColumnType::Binary, 0 } });
+	if (g_failed) {
+		fprintf(stderr, "%d checks failed\n", g_failed);
+		return 1;
+	}
+	printf("passed\n");
+	return 0;
+}
@@ -0,0 +1,13 @@
+// stdafx.h : include file for standard system include files,
+// or project specific include files that are used frequently, but
+// are changed infrequently
+//
+
+#pragma once
+
+#ifdef _MSC_VER
+#include "targetver.h"
+#include <tchar.h>
+#endif
+
+#include <stdio.h>
@@ -0,0 +1,124 @@
+// TestSortableStrVec.cpp : radix sort of SortableStrVec and FixedLenStrVec
+// must give the same order as std::sort
+//
+
+#include "stdafx.h"
+#include <terark/util/sortable_strvec.hpp>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace terark;
+
+static int g_failed = 0;
+
+#define CHECK(cond, ...) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "FAIL: %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		fprintf(stderr, __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		if (++g_failed > 20) exit(1); \
+	} } while (0)
+
+static std::string randomStr(std::mt19937_64& rnd, size_t len, int alphabet) {
+	std::string s(len, '\0');
+	for (size_t i = 0; i < len; ++i)
+		s[i] = char(rnd() % alphabet);
+	return s;
+}
+
+// all bytes and lengths, including empty strings
+static std::vector<std::string> genRandom(size_t n, size_t fixlen, std::mt19937_64& rnd) {
+	std::vector<std::string> v;
+	for (size_t i = 0; i < n; ++i)
+		v.push_back(randomStr(rnd, fixlen ? fixlen : rnd() % 20, 256));
+	return v;
+}
+
+// few distinct strings, most buckets are all equal strings
+static std::vector<std::string> genDupHeavy(size_t n, size_t fixlen, std::mt19937_64& rnd) {
+	std::vector<std::string> dict = genRandom(50, fixlen, rnd);
+	dict.push_back(std::string(fixlen, '\0'));
+	std::vector<std::string> v;
+	for (size_t i = 0; i < n; ++i)
+		v.push_back(dict[rnd() % dict.size()]);
+	return v;
+}
+
+// long shared prefixes with a small alphabet, strings may be prefixes of
+// other strings
+static std::vector<std::string> genSharedPrefix(size_t n, size_t fixlen, std::mt19937_64& rnd) {
+	std::string prefix(fixlen ? fixlen / 2 : 100, 'p');
+	std::vector<std::string> v;
+	for (size_t i = 0; i < n; ++i) {
+		size_t plen = rnd() % 3 == 0 ? prefix.size() / 2 : prefix.size();
+		std::string s = prefix.substr(0, plen);
+		s += randomStr(rnd, fixlen ? fixlen - plen : rnd() % 6, 3);
+		v.push_back(s);
+	}
+	return v;
+}
+
+typedef std::vector<std::string> (*Generator)(size_t, size_t, std::mt19937_64&);
+
+static void testSortableStrVec(const char* name, Generator gen, size_t n) {
+	std::mt19937_64 rnd(n);
+	std::vector<std::string> v = gen(n, 0, rnd);
+	SortableStrVec strVec;
+	for (const std::string& s : v)
+		strVec.push_back(s);
+	strVec.sort();
+	std::vector<std::string> expected = v;
+	std::sort(expected.begin(), expected.end());
+	CHECK(strVec.size() == n, "%s: n = %zd, size = %zd", name, n, strVec.size());
+	std::vector<bool> seen(n);
+	for (size_t i = 0; i < n && i < strVec.size(); ++i) {
+		fstring s = strVec[i];
+		CHECK(s == expected[i], "%s: n = %zd, i = %zd", name, n, i);
+		size_t seq = strVec.m_index[i].seq_id;
+		CHECK(seq < n && !seen[seq] && s == v[seq], "%s: n = %zd, i = %zd, seq_id = %zd", name, n, i, seq);
+		if (seq < n)
+			seen[seq] = true;
+	}
+}
+
+static void testFixedLenStrVec(const char* name, Generator gen, size_t n, size_t fixlen) {
+	std::mt19937_64 rnd(n + fixlen);
+	std::vector<std::string> v = gen(n, fixlen, rnd);
+	FixedLenStrVec strVec(fixlen);
+	for (const std::string& s : v)
+		strVec.push_back(s);
+	strVec.sort();
+	std::sort(v.begin(), v.end());
+	CHECK(strVec.size() == n, "%s: n = %zd, size = %zd", name, n, strVec.size());
+	for (size_t i = 0; i < n && i < strVec.size(); ++i) {
+		CHECK(strVec[i] == v[i], "%s: n = %zd, fixlen = %zd, i = %zd", name, n, fixlen, i);
+	}
+}
+
+int main(int argc, char* argv[]) {
+	// env values are read once by the sort, lower the parallel threshold
+	// before the first sort, so sizes below and above it are tested
+	setenv("SortableStrVec_parallelSortMinNum", "100000", 1);
+	struct { const char* name; Generator gen; } gens[] = {
+		{ "Random", &genRandom },
+		{ "DupHeavy", &genDupHeavy },
+		{ "SharedPrefix", &genSharedPrefix },
+	};
+	for (auto& g : gens) {
+		for (size_t n : { 1000, 20000, 300000 }) {
+			testSortableStrVec(g.name, g.gen, n);
+			for (size_t fixlen : { 1, 4, 16 })
+				testFixedLenStrVec(g.name, g.gen, n, fixlen);
+		}
+	}
+	if (g_failed) {
+		fprintf(stderr, "%d checks failed\n", g_failed);
+		return 1;
+	}
+	printf("passed\n");
+	return 0;
+}